@@ -0,0 +1,328 @@
+/*
+ * Copyright (C) 2017 Glimp IP Ltd
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <dirent.h>
+#include <libgen.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+
+#include <vector>
+#include <atomic>
+
+#include "batch_convert.h"
+
+
+#define xsnprintf(dest, fmt, ...) do { \
+        if (snprintf(dest, sizeof(dest), fmt,  __VA_ARGS__) >= (int)sizeof(dest)) \
+            exit(1); \
+    } while(0)
+
+struct batch
+{
+    const char *in_dir;
+    const char *out_dir;
+    const char *in_ext;
+    const char *out_ext;
+    bool (*convert)(const char *in_filename, const char *out_filename);
+
+    /* Paths of the files to convert, relative to in_dir and without their
+     * extension
+     */
+    std::vector<char *> files;
+    std::atomic<unsigned> next_file;
+    std::atomic<unsigned> n_failed;
+};
+
+static pthread_mutex_t budget_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t budget_cond = PTHREAD_COND_INITIALIZER;
+static size_t budget_max = 256 * 1024 * 1024;
+static size_t budget_used;
+
+void
+batch_set_budget(size_t bytes)
+{
+    pthread_mutex_lock(&budget_lock);
+    budget_max = bytes;
+    pthread_cond_broadcast(&budget_cond);
+    pthread_mutex_unlock(&budget_lock);
+}
+
+size_t
+batch_get_budget(void)
+{
+    pthread_mutex_lock(&budget_lock);
+    size_t bytes = budget_max;
+    pthread_mutex_unlock(&budget_lock);
+
+    return bytes;
+}
+
+void
+batch_budget_reserve(size_t bytes)
+{
+    pthread_mutex_lock(&budget_lock);
+    while (budget_used && budget_used + bytes > budget_max)
+        pthread_cond_wait(&budget_cond, &budget_lock);
+    budget_used += bytes;
+    pthread_mutex_unlock(&budget_lock);
+}
+
+void
+batch_budget_charge(size_t bytes)
+{
+    pthread_mutex_lock(&budget_lock);
+    budget_used += bytes;
+    pthread_mutex_unlock(&budget_lock);
+}
+
+void
+batch_budget_release(size_t bytes)
+{
+    pthread_mutex_lock(&budget_lock);
+    budget_used -= bytes;
+    pthread_cond_broadcast(&budget_cond);
+    pthread_mutex_unlock(&budget_lock);
+}
+
+static uint64_t
+get_time(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ((uint64_t)ts.tv_sec) * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+/* Returns the position of @ext at the end of @name, or NULL if @name doesn't
+ * end with @ext
+ */
+static char *
+find_extension(char *name, const char *ext)
+{
+    size_t name_len = strlen(name);
+    size_t ext_len = strlen(ext);
+
+    if (name_len < ext_len || strcmp(name + name_len - ext_len, ext) != 0)
+        return NULL;
+
+    return name + name_len - ext_len;
+}
+
+static void
+ensure_directory(const char *path)
+{
+    struct stat st;
+    int ret;
+
+    char *dirname_copy = strdup(path);
+    char *parent = dirname(dirname_copy);
+
+    if (strcmp(parent, ".") != 0 &&
+        strcmp(parent, "..") != 0 &&
+        strcmp(parent, "/") != 0)
+    {
+        ensure_directory(parent);
+    }
+
+    free(dirname_copy);
+
+    ret = stat(path, &st);
+    if (ret == -1) {
+        int ret = mkdir(path, 0777);
+        if (ret < 0 && errno != EEXIST) {
+            fprintf(stderr, "Failed to create destination directory %s: %m\n", path);
+            exit(1);
+        }
+    }
+}
+
+static void
+directory_recurse(struct batch *batch, const char *rel_path)
+{
+    char src_path[1024];
+    DIR *dir;
+    struct dirent *entry;
+
+    xsnprintf(src_path, "%s/%s", batch->in_dir, rel_path);
+
+    dir = opendir(src_path);
+    if (!dir) {
+        fprintf(stderr, "Failed to open directory %s: %m\n", src_path);
+        exit(1);
+    }
+
+    while ((entry = readdir(dir)) != NULL) {
+        char next_rel_path[1024];
+        char next_src_path[1024];
+        struct stat st;
+
+        if (strcmp(entry->d_name, ".") == 0 ||
+            strcmp(entry->d_name, "..") == 0)
+            continue;
+
+        xsnprintf(next_rel_path, "%s/%s", rel_path, entry->d_name);
+        xsnprintf(next_src_path, "%s/%s", batch->in_dir, next_rel_path);
+
+        if (stat(next_src_path, &st) < 0)
+            continue;
+
+        if (S_ISDIR(st.st_mode)) {
+            directory_recurse(batch, next_rel_path);
+        } else if (find_extension(entry->d_name, batch->in_ext)) {
+            /* NB: only the file name is checked, so that e.g. the files
+             * under a directory named foo.exr.d/ aren't mistaken for it
+             */
+            *find_extension(next_rel_path, batch->in_ext) = '\0';
+            batch->files.push_back(strdup(next_rel_path));
+        }
+    }
+
+    closedir(dir);
+}
+
+/* Reads a training data index, where each line is the path of a frame
+ * relative to the top directory, without an extension
+ */
+static void
+load_index(struct batch *batch, const char *index_filename)
+{
+    FILE *fp = fopen(index_filename, "r");
+    if (!fp) {
+        fprintf(stderr, "Failed to open index %s: %m\n", index_filename);
+        exit(1);
+    }
+
+    char *line = NULL;
+    size_t line_buf_len = 0;
+    ssize_t line_len;
+    while ((line_len = getline(&line, &line_buf_len, fp)) != -1) {
+        if (line_len && line[line_len - 1] == '\n')
+            line[--line_len] = '\0';
+        if (line_len == 0)
+            continue;
+
+        char *ext = find_extension(line, batch->in_ext);
+        if (ext)
+            *ext = '\0';
+
+        batch->files.push_back(strdup(line));
+    }
+
+    free(line);
+    fclose(fp);
+}
+
+static void *
+worker_thread_cb(void *data)
+{
+    struct batch *batch = (struct batch *)data;
+    unsigned i;
+
+    while ((i = batch->next_file++) < batch->files.size()) {
+        char in_filename[1024];
+        char out_filename[1024];
+
+        xsnprintf(in_filename, "%s/%s%s",
+                  batch->in_dir, batch->files[i], batch->in_ext);
+        xsnprintf(out_filename, "%s/%s%s",
+                  batch->out_dir, batch->files[i], batch->out_ext);
+
+        char *dirname_copy = strdup(out_filename);
+        ensure_directory(dirname(dirname_copy));
+        free(dirname_copy);
+
+        if (!batch->convert(in_filename, out_filename))
+            batch->n_failed++;
+    }
+
+    return NULL;
+}
+
+unsigned
+batch_convert(const char *in_dir,
+              const char *out_dir,
+              const char *index_filename,
+              const char *in_ext,
+              const char *out_ext,
+              int n_threads,
+              bool (*convert)(const char *in_filename,
+                              const char *out_filename))
+{
+    struct batch batch;
+
+    batch.in_dir = in_dir;
+    batch.out_dir = out_dir;
+    batch.in_ext = in_ext;
+    batch.out_ext = out_ext;
+    batch.convert = convert;
+    batch.next_file = 0;
+    batch.n_failed = 0;
+
+    if (index_filename)
+        load_index(&batch, index_filename);
+    else
+        directory_recurse(&batch, "");
+
+    if (n_threads < 1)
+        n_threads = 1;
+    if ((unsigned)n_threads > batch.files.size())
+        n_threads = batch.files.size();
+
+    printf("Converting %u files with %d threads\n",
+           (unsigned)batch.files.size(), n_threads);
+
+    uint64_t start = get_time();
+
+    std::vector<pthread_t> threads(n_threads);
+    for (int i = 0; i < n_threads; i++) {
+        if (pthread_create(&threads[i], NULL, worker_thread_cb, &batch) != 0) {
+            fprintf(stderr, "Failed to create worker thread\n");
+            exit(1);
+        }
+    }
+    for (int i = 0; i < n_threads; i++)
+        pthread_join(threads[i], NULL);
+
+    uint64_t duration_ns = get_time() - start;
+
+    unsigned n_failed = batch.n_failed;
+    printf("Converted %u files (%u failed) in %.3fs\n",
+           (unsigned)batch.files.size() - n_failed, n_failed,
+           duration_ns / 1e9);
+
+    for (unsigned i = 0; i < batch.files.size(); i++)
+        free(batch.files[i]);
+
+    return n_failed;
+}
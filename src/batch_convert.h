@@ -0,0 +1,67 @@
+/*
+ * Copyright (C) 2017 Glimp IP Ltd
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#pragma once
+
+#include <stddef.h>
+#include <stdbool.h>
+
+/* Shared by the exr-to-pfm and pfm-to-exr tools to convert whole training
+ * data directories with a pool of worker threads
+ */
+
+/* Limit on the memory used by files that are in the middle of being
+ * converted, in bytes. A file isn't read while over budget unless nothing
+ * else is in flight, so the total can exceed the budget by at most one file
+ * per thread.
+ */
+void batch_set_budget(size_t bytes);
+size_t batch_get_budget(void);
+
+/* Blocks until @bytes can be accounted for within the budget */
+void batch_budget_reserve(size_t bytes);
+
+/* Accounts for @bytes without blocking, e.g. for a decoded image whose
+ * encoded size was already reserved
+ */
+void batch_budget_charge(size_t bytes);
+
+void batch_budget_release(size_t bytes);
+
+/* Calls @convert for every file with the extension @in_ext under @in_dir
+ * (or only those listed in @index_filename, if not NULL) to write a file
+ * with the same relative path under @out_dir but with the extension
+ * @out_ext. Extensions include the leading '.'
+ *
+ * Returns the number of files that failed to convert.
+ */
+unsigned batch_convert(const char *in_dir,
+                       const char *out_dir,
+                       const char *index_filename,
+                       const char *in_ext,
+                       const char *out_ext,
+                       int n_threads,
+                       bool (*convert)(const char *in_filename,
+                                       const char *out_filename));
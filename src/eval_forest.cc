@@ -0,0 +1,724 @@
+/*
+ * Copyright (C) 2017 Glimp IP Ltd
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+/* Evaluates the quality and speed of a decision forest over a set of test
+ * images, so that changes that affect numerics (e.g. quantization, strides
+ * or early exits) can be checked against a consistent baseline.
+ */
+
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <getopt.h>
+#include <pthread.h>
+
+#include <thread>
+#include <atomic>
+#include <algorithm>
+
+#include "half.hpp"
+
+#include "xalloc.h"
+#include "utils.h"
+#include "train_utils.h"
+#include "image_utils.h"
+#include "loader.h"
+#include "infer.h"
+#include "parson.h"
+#ifdef USE_SNAPPY
+#include "pack.h"
+#endif
+
+using half_float::half;
+
+enum {
+  STAGE_LABELS,
+  STAGE_WEIGHTS,
+  STAGE_JOINTS,
+  N_STAGES
+};
+
+static const char* stage_names[] = {
+  "infer_labels",
+  "calc_pixel_weights",
+  "infer_joints",
+};
+
+typedef struct {
+  unsigned n_trees;       // Number of decision trees
+  RDTree** forest;        // Decision trees
+  uint8_t  n_labels;      // Number of labels inferred by the forest
+  uint32_t stride;        // Label inference stride
+  bool     fast_joints;   // Use infer_joints_fast() instead of infer_joints()
+
+  uint32_t n_images;      // Number of test images
+  int32_t  width;         // Width of test images
+  int32_t  height;        // Height of test images
+  uint8_t* label_images;  // Label images (row-major)
+  half*    depth_images;  // Depth images (row-major)
+
+  uint8_t  n_joints;      // Number of joints
+  JSON_Value* joint_map;  // Map between joints and labels
+  JIParams* joint_params; // Joint inference parameters
+  float*   joints;        // Ground truth joint positions for each image
+
+  uint32_t n_threads;     // Number of threads to use for work
+  std::atomic<uint32_t> next_image; // Next image to be evaluated
+} EvalContext;
+
+/* Each thread accumulates its own results, merged once all threads finish */
+typedef struct {
+  EvalContext* ctx;
+  pthread_t    thread;
+
+  uint64_t*    confusion;       // [actual label][inferred label] pixel counts
+  uint64_t     invalid_labels;  // Pixels with out-of-range ground truth
+  double*      joint_error;     // Accumulated distance per joint (meters)
+  uint32_t*    joint_found;     // Number of images each joint was found in
+  double       stage_time[N_STAGES]; // Accumulated time per stage (ms)
+} EvalThreadData;
+
+static double
+time_ms(struct timespec* begin, struct timespec* end)
+{
+  return (end->tv_sec - begin->tv_sec) * 1000.0 +
+    (end->tv_nsec - begin->tv_nsec) / 1000000.0;
+}
+
+static void*
+eval_thread(void* userdata)
+{
+  EvalThreadData* data = (EvalThreadData*)userdata;
+  EvalContext* ctx = data->ctx;
+  uint8_t n_labels = ctx->n_labels;
+  uint32_t n_pixels = ctx->width * ctx->height;
+
+  float* pr_table = (float*)xmalloc(n_pixels * n_labels * sizeof(float));
+  float* weights = ctx->joint_map ?
+    (float*)xmalloc(n_pixels * ctx->n_joints * sizeof(float)) : NULL;
+
+  uint32_t i;
+  while ((i = ctx->next_image++) < ctx->n_images)
+    {
+      half* depth_image = &ctx->depth_images[i * n_pixels];
+      uint8_t* label_image = &ctx->label_images[i * n_pixels];
+      struct timespec begin, end;
+
+      clock_gettime(CLOCK_MONOTONIC, &begin);
+      infer_labels<half>(ctx->forest, ctx->n_trees, depth_image,
+                         ctx->width, ctx->height, pr_table, ctx->stride);
+      clock_gettime(CLOCK_MONOTONIC, &end);
+      data->stage_time[STAGE_LABELS] += time_ms(&begin, &end);
+
+      for (uint32_t p = 0; p < n_pixels; p++)
+        {
+          uint8_t actual_label = label_image[p];
+          if (actual_label >= n_labels)
+            {
+              data->invalid_labels++;
+              continue;
+            }
+
+          float* pixel_pr = &pr_table[p * n_labels];
+          float best_pr = 0.f;
+          uint8_t inferred_label = 0;
+          for (uint8_t l = 0; l < n_labels; l++)
+            {
+              if (pixel_pr[l] > best_pr)
+                {
+                  best_pr = pixel_pr[l];
+                  inferred_label = l;
+                }
+            }
+
+          data->confusion[actual_label * n_labels + inferred_label]++;
+        }
+
+      if (!ctx->joint_map)
+        {
+          continue;
+        }
+
+      clock_gettime(CLOCK_MONOTONIC, &begin);
+      calc_pixel_weights<half>(depth_image, pr_table, ctx->width, ctx->height,
+                               n_labels, ctx->joint_map, weights);
+      clock_gettime(CLOCK_MONOTONIC, &end);
+      data->stage_time[STAGE_WEIGHTS] += time_ms(&begin, &end);
+
+      begin = end;
+      InferredJoints* result = ctx->fast_joints ?
+        infer_joints_fast<half>(depth_image, pr_table, weights,
+                                ctx->width, ctx->height, n_labels,
+                                ctx->joint_map, ctx->forest[0]->header.fov,
+                                ctx->joint_params->joint_params) :
+        infer_joints<half>(depth_image, pr_table, weights,
+                           ctx->width, ctx->height, n_labels,
+                           ctx->joint_map, ctx->forest[0]->header.fov,
+                           ctx->joint_params->joint_params);
+      clock_gettime(CLOCK_MONOTONIC, &end);
+      data->stage_time[STAGE_JOINTS] += time_ms(&begin, &end);
+
+      for (uint8_t j = 0; j < ctx->n_joints; j++)
+        {
+          if (!result->joints[j])
+            {
+              continue;
+            }
+
+          Joint* inferred_joint = (Joint*)result->joints[j]->data;
+          float* actual_joint = &ctx->joints[((i * ctx->n_joints) + j) * 3];
+
+          // XXX: Current joint z positions are negated
+          data->joint_error[j] +=
+            sqrtf(powf(inferred_joint->x - actual_joint[0], 2.f) +
+                  powf(inferred_joint->y - actual_joint[1], 2.f) +
+                  powf(inferred_joint->z + actual_joint[2], 2.f));
+          data->joint_found[j]++;
+        }
+
+      free_joints(result);
+    }
+
+  xfree(weights);
+  xfree(pr_table);
+
+  return NULL;
+}
+
+#ifdef USE_SNAPPY
+/* Loads the labels and depth of each frame of a pack written by
+ * pack-training-data. Packs don't include joint positions.
+ */
+static bool
+load_pack(const char* filename, uint32_t limit, uint32_t skip,
+          EvalContext* ctx)
+{
+  char* err = NULL;
+  struct pack_file* pack = pack_open(filename, &err);
+  if (!pack)
+    {
+      fprintf(stderr, "Failed to open pack %s: %s\n", filename, err);
+      return false;
+    }
+
+  ctx->width = pack_get_i64(pack, "width", &err);
+  if (!err)
+    {
+      ctx->height = pack_get_i64(pack, "height", &err);
+    }
+  if (err)
+    {
+      fprintf(stderr, "Failed to read pack dimensions: %s\n", err);
+      pack_close(pack);
+      return false;
+    }
+
+  uint32_t n_pixels = ctx->width * ctx->height;
+  uint32_t n_allocated = 0;
+  ctx->n_images = 0;
+
+  for (uint32_t f = skip; ctx->n_images < limit; f++)
+    {
+      struct pack_frame* frame = pack_read_frame(pack, f, &err);
+      if (!frame)
+        {
+          // Reached the end of the pack
+          xfree(err);
+          err = NULL;
+          break;
+        }
+
+      if (ctx->n_images == n_allocated)
+        {
+          n_allocated = std::max(64u, n_allocated * 2);
+          ctx->label_images = (uint8_t*)
+            xrealloc(ctx->label_images, n_allocated * n_pixels);
+          ctx->depth_images = (half*)
+            xrealloc(ctx->depth_images, n_allocated * n_pixels * sizeof(half));
+        }
+
+      uint32_t len;
+      uint8_t* labels_png = pack_frame_get_section(frame, "labels", &len, &err);
+      IUImageSpec label_spec = { ctx->width, ctx->height, IU_FORMAT_U8 };
+      uint8_t* label_image = &ctx->label_images[ctx->n_images * n_pixels];
+      if (!labels_png ||
+          iu_read_png_from_memory(labels_png, len, &label_spec, &label_image,
+                                  NULL, NULL) != SUCCESS)
+        {
+          fprintf(stderr, "Failed to decode labels of pack frame %u\n", f);
+          pack_frame_free(frame);
+          pack_close(pack);
+          return false;
+        }
+
+      uint8_t* depth_exr = pack_frame_get_section(frame, "depth", &len, &err);
+      IUImageSpec depth_spec = { ctx->width, ctx->height, IU_FORMAT_HALF };
+      void* depth_image = &ctx->depth_images[ctx->n_images * n_pixels];
+      if (!depth_exr ||
+          iu_read_exr_from_memory(depth_exr, len, &depth_spec,
+                                  &depth_image) != SUCCESS)
+        {
+          fprintf(stderr, "Failed to decode depth of pack frame %u\n", f);
+          pack_frame_free(frame);
+          pack_close(pack);
+          return false;
+        }
+
+      pack_frame_free(frame);
+      ctx->n_images++;
+    }
+
+  pack_close(pack);
+
+  printf("Loaded %u images from %s\n", ctx->n_images, filename);
+
+  return true;
+}
+#endif
+
+static void
+print_usage(FILE* stream)
+{
+  fprintf(stream,
+"Usage: eval_forest [OPTIONS] <data dir> <index name> <tree1> [tree2] ...\n"
+#ifdef USE_SNAPPY
+"       eval_forest [OPTIONS] --pack=FILE <tree1> [tree2] ...\n"
+#endif
+"Evaluate label accuracy, joint error and inference time of a forest over a\n"
+"set of test images.\n"
+"\n"
+#ifdef USE_SNAPPY
+"  -P, --pack=FILE             Evaluate the images of a training data pack\n"
+"                              instead of an index\n"
+#endif
+"  -l, --limit=NUMBER[,NUMBER] Limit evaluation to this many images.\n"
+"                              Optionally, skip the first N images.\n"
+"  -j, --joint-map=JSON        Joint map for evaluating joint inference\n"
+"                              (requires --jip and an index)\n"
+"  -p, --jip=JIP               Joint inference parameters\n"
+"  -f, --fast                  Use fast joint inference\n"
+"  -s, --stride=NUMBER         Label inference stride (default: 1)\n"
+"  -m, --threads=NUMBER        Number of threads to use (default: autodetect)\n"
+"  -o, --output=JSON           Write the full report, including the confusion\n"
+"                              matrix, to a JSON file\n"
+"  -h, --help                  Display this message\n");
+}
+
+int
+main(int argc, char **argv)
+{
+  EvalContext ctx = {};
+  ctx.stride = 1;
+  ctx.n_threads = std::max(1u, std::thread::hardware_concurrency());
+
+  uint32_t limit = UINT32_MAX;
+  uint32_t skip = 0;
+  const char* pack_file = NULL;
+  const char* joint_map_file = NULL;
+  const char* jip_file = NULL;
+  const char* output_file = NULL;
+  int opt;
+
+  const char *short_options="+hP:l:j:p:fs:m:o:";
+  const struct option long_options[] = {
+      {"help",            no_argument,        0, 'h'},
+      {"pack",            required_argument,  0, 'P'},
+      {"limit",           required_argument,  0, 'l'},
+      {"joint-map",       required_argument,  0, 'j'},
+      {"jip",             required_argument,  0, 'p'},
+      {"fast",            no_argument,        0, 'f'},
+      {"stride",          required_argument,  0, 's'},
+      {"threads",         required_argument,  0, 'm'},
+      {"output",          required_argument,  0, 'o'},
+      {0, 0, 0, 0}
+  };
+
+  while ((opt = getopt_long(argc, argv, short_options, long_options, NULL))
+         != -1)
+    {
+      char* end;
+
+      switch (opt) {
+          case 'h':
+              print_usage(stdout);
+              return 0;
+          case 'P':
+              pack_file = optarg;
+              break;
+          case 'l':
+              limit = (uint32_t)strtol(optarg, &end, 10);
+              if (end[0] == ',')
+                {
+                  skip = (uint32_t)strtol(end + 1, NULL, 10);
+                }
+              break;
+          case 'j':
+              joint_map_file = optarg;
+              break;
+          case 'p':
+              jip_file = optarg;
+              break;
+          case 'f':
+              ctx.fast_joints = true;
+              break;
+          case 's':
+              ctx.stride = std::max(1, atoi(optarg));
+              break;
+          case 'm':
+              ctx.n_threads = std::max(1, atoi(optarg));
+              break;
+          case 'o':
+              output_file = optarg;
+              break;
+         default:
+              print_usage(stderr);
+              return 1;
+      }
+  }
+
+#ifndef USE_SNAPPY
+  if (pack_file)
+    {
+      fprintf(stderr, "Pack support requires building with snappy\n");
+      return 1;
+    }
+#endif
+
+  int n_data_args = pack_file ? 0 : 2;
+  if ((argc - optind) < n_data_args + 1)
+    {
+      print_usage(stderr);
+      return 1;
+    }
+
+  if (!!joint_map_file != !!jip_file)
+    {
+      fprintf(stderr, "--joint-map and --jip must be given together\n");
+      return 1;
+    }
+  if (joint_map_file && pack_file)
+    {
+      fprintf(stderr, "Packs don't include joint positions to evaluate\n");
+      return 1;
+    }
+
+  ctx.n_trees = argc - optind - n_data_args;
+  const char** tree_files = (const char**)&argv[optind + n_data_args];
+  const char* ext = strrchr(tree_files[0], '.');
+  ctx.forest = (ext && strcmp(ext, ".json") == 0) ?
+    read_json_forest(tree_files, ctx.n_trees) :
+    read_forest(tree_files, ctx.n_trees);
+  if (!ctx.forest)
+    {
+      return 1;
+    }
+  ctx.n_labels = ctx.forest[0]->header.n_labels;
+
+  if (joint_map_file)
+    {
+      ctx.joint_map = json_parse_file(joint_map_file);
+      if (!ctx.joint_map)
+        {
+          fprintf(stderr, "Failed to parse joint map %s\n", joint_map_file);
+          return 1;
+        }
+      ctx.joint_params = read_jip(jip_file);
+      if (!ctx.joint_params)
+        {
+          return 1;
+        }
+    }
+
+#ifdef USE_SNAPPY
+  if (pack_file)
+    {
+      if (!load_pack(pack_file, limit, skip, &ctx))
+        {
+          return 1;
+        }
+    }
+  else
+#endif
+    {
+      uint8_t data_n_labels;
+      float fov;
+      gather_train_data(argv[optind], argv[optind + 1], joint_map_file,
+                        limit, skip, false,
+                        &ctx.n_images, &ctx.n_joints, &ctx.width, &ctx.height,
+                        &ctx.depth_images, &ctx.label_images,
+                        joint_map_file ? &ctx.joints : NULL,
+                        &data_n_labels, &fov);
+      if (data_n_labels != ctx.n_labels)
+        {
+          fprintf(stderr, "Test data has %u labels but the forest has %u\n",
+                  (unsigned)data_n_labels, (unsigned)ctx.n_labels);
+          return 1;
+        }
+      if (ctx.joint_params &&
+          ctx.joint_params->header.n_joints != ctx.n_joints)
+        {
+          fprintf(stderr, "Joint parameters are for %u joints, not %u\n",
+                  (unsigned)ctx.joint_params->header.n_joints,
+                  (unsigned)ctx.n_joints);
+          return 1;
+        }
+    }
+
+  if (ctx.n_images == 0)
+    {
+      fprintf(stderr, "No images to evaluate\n");
+      return 1;
+    }
+
+  ctx.n_threads = std::min(ctx.n_threads, ctx.n_images);
+  printf("Evaluating %u images on %u threads...\n",
+         ctx.n_images, ctx.n_threads);
+
+  uint8_t n_labels = ctx.n_labels;
+  EvalThreadData* threads = (EvalThreadData*)
+    xcalloc(ctx.n_threads, sizeof(EvalThreadData));
+
+  struct timespec begin, end;
+  clock_gettime(CLOCK_MONOTONIC, &begin);
+
+  for (uint32_t t = 0; t < ctx.n_threads; t++)
+    {
+      EvalThreadData* data = &threads[t];
+      data->ctx = &ctx;
+      data->confusion = (uint64_t*)
+        xcalloc(n_labels * n_labels, sizeof(uint64_t));
+      data->joint_error = (double*)
+        xcalloc(std::max(ctx.n_joints, (uint8_t)1), sizeof(double));
+      data->joint_found = (uint32_t*)
+        xcalloc(std::max(ctx.n_joints, (uint8_t)1), sizeof(uint32_t));
+
+      if (pthread_create(&data->thread, NULL, eval_thread, data) != 0)
+        {
+          fprintf(stderr, "Error creating thread\n");
+          return 1;
+        }
+    }
+
+  // Merge the per-thread results
+  uint64_t* confusion = (uint64_t*)
+    xcalloc(n_labels * n_labels, sizeof(uint64_t));
+  uint64_t invalid_labels = 0;
+  double joint_error[256] = { 0 };
+  uint32_t joint_found[256] = { 0 };
+  double stage_time[N_STAGES] = { 0 };
+
+  for (uint32_t t = 0; t < ctx.n_threads; t++)
+    {
+      EvalThreadData* data = &threads[t];
+      if (pthread_join(data->thread, NULL) != 0)
+        {
+          fprintf(stderr, "Error joining thread\n");
+          return 1;
+        }
+
+      for (int i = 0; i < n_labels * n_labels; i++)
+        {
+          confusion[i] += data->confusion[i];
+        }
+      invalid_labels += data->invalid_labels;
+      for (int j = 0; j < ctx.n_joints; j++)
+        {
+          joint_error[j] += data->joint_error[j];
+          joint_found[j] += data->joint_found[j];
+        }
+      for (int s = 0; s < N_STAGES; s++)
+        {
+          stage_time[s] += data->stage_time[s];
+        }
+
+      xfree(data->confusion);
+      xfree(data->joint_error);
+      xfree(data->joint_found);
+    }
+
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  double wall_ms = time_ms(&begin, &end);
+
+  xfree(threads);
+
+  /*
+   * Report
+   */
+  JSON_Value* report_val = json_value_init_object();
+  JSON_Object* report = json_object(report_val);
+  json_object_set_number(report, "n_images", ctx.n_images);
+  json_object_set_number(report, "width", ctx.width);
+  json_object_set_number(report, "height", ctx.height);
+  json_object_set_number(report, "n_trees", ctx.n_trees);
+  json_object_set_number(report, "stride", ctx.stride);
+  json_object_set_number(report, "n_threads", ctx.n_threads);
+
+  printf("\nLabel   Pixels       Accuracy  Precision\n");
+  JSON_Value* labels_val = json_value_init_array();
+  uint64_t total_pixels = 0;
+  uint64_t total_correct = 0;
+  float mean_accuracy = 0.f;
+  int n_present_labels = 0;
+  for (int l = 0; l < n_labels; l++)
+    {
+      uint64_t actual = 0;
+      uint64_t inferred = 0;
+      for (int o = 0; o < n_labels; o++)
+        {
+          actual += confusion[l * n_labels + o];
+          inferred += confusion[o * n_labels + l];
+        }
+      uint64_t correct = confusion[l * n_labels + l];
+      total_pixels += actual;
+      total_correct += correct;
+
+      float accuracy = actual ? correct / (double)actual : 0.f;
+      float precision = inferred ? correct / (double)inferred : 0.f;
+      if (actual)
+        {
+          mean_accuracy += accuracy;
+          n_present_labels++;
+        }
+
+      printf("%5d   %-12" PRIu64 " %7.2f%%   %7.2f%%\n", l, actual,
+             accuracy * 100.f, precision * 100.f);
+
+      JSON_Value* label_val = json_value_init_object();
+      JSON_Value* row_val = json_value_init_array();
+      for (int o = 0; o < n_labels; o++)
+        {
+          json_array_append_number(json_array(row_val),
+                                   (double)confusion[l * n_labels + o]);
+        }
+      json_object_set_number(json_object(label_val), "pixels", actual);
+      json_object_set_number(json_object(label_val), "accuracy", accuracy);
+      json_object_set_number(json_object(label_val), "precision", precision);
+      json_object_set_value(json_object(label_val), "confusion", row_val);
+      json_array_append_value(json_array(labels_val), label_val);
+    }
+  json_object_set_value(report, "labels", labels_val);
+  mean_accuracy = n_present_labels ? mean_accuracy / n_present_labels : 0.f;
+
+  float pixel_accuracy = total_pixels ?
+    total_correct / (double)total_pixels : 0.f;
+  printf("\nPixel accuracy: %.2f%%\n", pixel_accuracy * 100.f);
+  printf("Mean label accuracy: %.2f%%\n", mean_accuracy * 100.f);
+  if (invalid_labels)
+    {
+      printf("Ignored %" PRIu64 " pixels with out of range labels\n",
+             invalid_labels);
+    }
+  json_object_set_number(report, "pixel_accuracy", pixel_accuracy);
+  json_object_set_number(report, "mean_label_accuracy", mean_accuracy);
+
+  if (ctx.joint_map)
+    {
+      printf("\nJoint   Found   Mean error (m)\n");
+      JSON_Value* joints_val = json_value_init_array();
+      double total_error = 0;
+      uint32_t total_found = 0;
+      for (int j = 0; j < ctx.n_joints; j++)
+        {
+          double error = joint_found[j] ? joint_error[j] / joint_found[j] : 0;
+          total_error += joint_error[j];
+          total_found += joint_found[j];
+
+          JSON_Object* entry =
+            json_array_get_object(json_array(ctx.joint_map), j);
+          const char* name = json_object_get_string(entry, "joint");
+
+          printf("%-16s %5.1f%%  %.4f\n", name ? name : "?",
+                 joint_found[j] * 100.f / ctx.n_images, error);
+
+          JSON_Value* joint_val = json_value_init_object();
+          json_object_set_string(json_object(joint_val), "joint",
+                                 name ? name : "");
+          json_object_set_number(json_object(joint_val), "found",
+                                 joint_found[j] / (double)ctx.n_images);
+          json_object_set_number(json_object(joint_val), "mean_error", error);
+          json_array_append_value(json_array(joints_val), joint_val);
+        }
+      double mean_error = total_found ? total_error / total_found : 0;
+      printf("\nMean joint error: %.4fm\n", mean_error);
+      json_object_set_value(report, "joints", joints_val);
+      json_object_set_number(report, "mean_joint_error", mean_error);
+    }
+
+  /* NB: Stage times are summed across threads, so per-image times and
+   * pixels/s per thread are independent of the number of threads
+   */
+  uint64_t n_pixels = (uint64_t)ctx.width * ctx.height * ctx.n_images;
+  printf("\nStage                Per image (ms)\n");
+  JSON_Value* stages_val = json_value_init_object();
+  for (int s = 0; s < N_STAGES; s++)
+    {
+      if (s != STAGE_LABELS && !ctx.joint_map)
+        {
+          continue;
+        }
+      double per_image = stage_time[s] / ctx.n_images;
+      printf("%-20s %8.3f\n", stage_names[s], per_image);
+      json_object_set_number(json_object(stages_val), stage_names[s],
+                             per_image);
+    }
+  json_object_set_value(report, "stage_ms_per_image", stages_val);
+
+  double thread_pixels_per_sec = n_pixels / (stage_time[STAGE_LABELS] / 1000.0);
+  double pixels_per_sec = n_pixels / (wall_ms / 1000.0);
+  printf("\nLabel inference: %.0f pixels/s per thread\n", thread_pixels_per_sec);
+  printf("Overall: %.0f pixels/s, %.1f images/s (%.2fs)\n", pixels_per_sec,
+         ctx.n_images / (wall_ms / 1000.0), wall_ms / 1000.0);
+  json_object_set_number(report, "label_pixels_per_sec_per_thread",
+                         thread_pixels_per_sec);
+  json_object_set_number(report, "pixels_per_sec", pixels_per_sec);
+  json_object_set_number(report, "wall_time_ms", wall_ms);
+
+  if (output_file)
+    {
+      if (json_serialize_to_file_pretty(report_val, output_file) != JSONSuccess)
+        {
+          fprintf(stderr, "Failed to write report to %s\n", output_file);
+          return 1;
+        }
+    }
+
+  json_value_free(report_val);
+  xfree(confusion);
+  if (ctx.joint_map)
+    {
+      json_value_free(ctx.joint_map);
+      free_jip(ctx.joint_params);
+      xfree(ctx.joints);
+    }
+  xfree(ctx.depth_images);
+  xfree(ctx.label_images);
+  free_forest(ctx.forest, ctx.n_trees);
+
+  return 0;
+}
@@ -36,10 +36,12 @@
 #include <stdint.h>
 #include <libgen.h>
 #include <fcntl.h>
+#include <errno.h>
+#include <getopt.h>
 
-#include "tinyexr.h"
-
-#include "half.hpp"
+#include "image_utils.h"
+#include "batch_convert.h"
+#include "xalloc.h"
 
 
 #ifdef DEBUG
@@ -49,39 +51,6 @@
 #define debug(ARGS...) do {} while(0)
 #endif
 
-#define ARRAY_LEN(X) (sizeof(X)/sizeof(X[0]))
-
-using half_float::half;
-
-enum image_format {
-    IMAGE_FORMAT_X8,
-    IMAGE_FORMAT_XFLOAT,
-    IMAGE_FORMAT_XHALF,
-};
-
-struct image
-{
-    enum image_format format;
-    int width;
-    int height;
-    int stride;
-
-    union {
-        uint8_t *data_u8;
-        float *data_float;
-        half *data_half;
-    };
-};
-
-static void *
-xmalloc(size_t size)
-{
-    void *ret = malloc(size);
-    if (ret == NULL)
-        exit(1);
-    return ret;
-}
-
 static char *
 read_file(const char *filename, int *len)
 {
@@ -113,6 +82,7 @@ read_file(const char *filename, int *len)
                 continue;
             else {
                 free(buf);
+                close(fd);
                 return NULL;
             }
         } else if (ret == 0)
@@ -128,132 +98,8 @@ read_file(const char *filename, int *len)
     return buf;
 }
 
-static struct image *
-xalloc_image(enum image_format format,
-             int width,
-             int height)
-{
-    struct image *img = (struct image *)xmalloc(sizeof(struct image));
-    img->format = format;
-    img->width = width;
-    img->height = height;
-
-    switch (format) {
-    case IMAGE_FORMAT_X8:
-        img->stride = width;
-        break;
-    case IMAGE_FORMAT_XFLOAT:
-        img->stride = width * sizeof(float);
-        break;
-    case IMAGE_FORMAT_XHALF:
-        img->stride = width * sizeof(half);
-        break;
-    }
-    img->data_u8 = (uint8_t *)xmalloc(img->stride * img->height);
-
-    return img;
-}
-
-static struct image *
-decode_exr(uint8_t *buf, int len, enum image_format fmt)
-{
-    EXRVersion version;
-    EXRHeader header;
-    const char *err = NULL;
-    int ret;
-    int channel;
-    int pixel_type;
-
-    if (fmt != IMAGE_FORMAT_XHALF && fmt != IMAGE_FORMAT_XFLOAT) {
-        fprintf(stderr, "Can only decode EXR into full or half float image\n");
-        abort();
-    }
-
-    ParseEXRVersionFromMemory(&version, (unsigned char *)buf, len);
-
-    if (version.multipart || version.non_image) {
-        fprintf(stderr, "Can't load multipart or DeepImage EXR image\n");
-        return NULL;
-    }
-
-    ret = ParseEXRHeaderFromMemory(&header, &version, (unsigned char *)buf, len, &err);
-    if (ret != 0) {
-        fprintf(stderr, "Failed to parse EXR header: %s\n", err);
-        return NULL;
-    }
-
-    channel = -1;
-    for (int i = 0; i < header.num_channels; i++) {
-        const char *names[] = { "Y", "R", "G", "B" };
-        for (unsigned j = 0; j < ARRAY_LEN(names); j++) {
-            if (strcmp(names[j], header.channels[i].name) == 0) {
-                channel = i;
-                break;
-            }
-        }
-        if (channel > 0)
-            break;
-    }
-    if (channel == -1) {
-        fprintf(stderr, "Failed to find R, G, B or Y channel in EXR file\n");
-        return NULL;
-    }
-
-    pixel_type = header.channels[channel].pixel_type;
-    if (pixel_type != TINYEXR_PIXELTYPE_HALF && pixel_type != TINYEXR_PIXELTYPE_FLOAT) {
-        fprintf(stderr, "Can only decode EXR images with FLOAT or HALF data\n");
-        return NULL;
-    }
-
-    EXRImage exr_image;
-    InitEXRImage(&exr_image);
-
-    ret = LoadEXRImageFromMemory(&exr_image, &header, (const unsigned char *)buf, len, &err);
-    if (ret != 0) {
-        fprintf(stderr, "Failed to load EXR file: %s\n", err);
-    }
-
-    struct image *img = xalloc_image(fmt, exr_image.width, exr_image.height);
-
-    enum image_format exr_fmt = (pixel_type == TINYEXR_PIXELTYPE_HALF ?
-                                 IMAGE_FORMAT_XHALF :
-                                 IMAGE_FORMAT_XFLOAT);
-    if (exr_fmt == fmt) {
-        memcpy(img->data_u8, &exr_image.images[channel][0],
-               img->stride * img->height);
-    } else {
-        /* Need to handle format conversion... */
-
-        if (exr_fmt == IMAGE_FORMAT_XHALF) {
-            const half *half_pixels = (half *)(exr_image.images[channel]);
-
-            for (int y = 0; y < exr_image.height; y++) {
-                const half *exr_row = half_pixels + y * exr_image.width;
-                float *out_row = img->data_float + y * exr_image.width;
-
-                for (int x = 0; x < exr_image.width; x++)
-                    out_row[x] = exr_row[x];
-            }
-        } else {
-            const float *float_pixels = (float *)(exr_image.images[channel]);
-
-            for (int y = 0; y < exr_image.height; y++) {
-                const float *exr_row = float_pixels + y * exr_image.width;
-                half *out_row = img->data_half + y * exr_image.width;
-
-                for (int x = 0; x < exr_image.width; x++)
-                    out_row[x] = exr_row[x];
-            }
-        }
-    }
-
-    FreeEXRImage(&exr_image);
-
-    return img;
-}
-
 static bool
-write_pfm_file(struct image *image, const char *filename)
+write_pfm_file(IUImageSpec *spec, float *data, const char *filename)
 {
     int fd;
     char header[128];
@@ -268,14 +114,14 @@ write_pfm_file(struct image *image, const char *filename)
     }
 
     header_len = snprintf(header, sizeof(header), "Pf\n%u %u\n%f\n",
-                          image->width, image->height, -1.0);
+                          spec->width, spec->height, -1.0);
     if (header_len >= sizeof(header)) {
         fprintf(stderr, "Failed to describe PFN header for %s\n", filename);
         close(fd);
         return false;
     }
 
-    file_len = header_len + sizeof(float) * image->width * image->height;
+    file_len = header_len + sizeof(float) * spec->width * spec->height;
 
     if (ftruncate(fd, file_len) < 0) {
         fprintf(stderr, "Failed to set file (%s) size: %m\n", filename);
@@ -294,8 +140,8 @@ write_pfm_file(struct image *image, const char *filename)
 
     memcpy(buf, header, header_len);
     memcpy(buf + header_len,
-           image->data_float,
-           sizeof(float) * image->width * image->height);
+           data,
+           sizeof(float) * spec->width * spec->height);
 
     munmap(buf, file_len);
     close(fd);
@@ -305,34 +151,130 @@ write_pfm_file(struct image *image, const char *filename)
     return true;
 }
 
-int
-main(int argc, char **argv)
+static bool
+convert_file(const char *in_filename, const char *out_filename)
 {
-    if (argc != 3) {
-        fprintf(stderr, "Usage: %s <in_file> <out_file>\n", argv[0]);
-        exit(1);
+    struct stat st;
+    if (stat(in_filename, &st) < 0) {
+        fprintf(stderr, "Failed to stat %s: %m\n", in_filename);
+        return false;
     }
+    batch_budget_reserve(st.st_size);
 
     int len;
-    char *file = read_file(argv[1], &len);
+    char *file = read_file(in_filename, &len);
     if (!file) {
-        fprintf(stderr, "Failed to read file %s: %m\n", argv[1]);
-        exit(1);
+        fprintf(stderr, "Failed to read file %s: %m\n", in_filename);
+        batch_budget_release(st.st_size);
+        return false;
     }
-    debug("read %s OK\n", argv[1]);
-
-    struct image *img = decode_exr((uint8_t *)file, len, IMAGE_FORMAT_XFLOAT);
-    if (!img)
-        exit(1);
-
-    debug("decoded %s OK (%dx%d)\n", argv[1], img->width, img->height);
+    debug("read %s OK\n", in_filename);
 
+    IUImageSpec spec = { 0, 0, IU_FORMAT_FLOAT };
+    float *img = NULL;
+    IUReturnCode ret = iu_read_exr_from_memory((uint8_t *)file, len, &spec,
+                                               (void **)&img);
     free(file);
     file = NULL;
 
-    write_pfm_file(img, argv[2]);
+    if (ret != SUCCESS) {
+        fprintf(stderr, "Failed to decode %s: %s\n", in_filename,
+                iu_code_to_string(ret));
+        batch_budget_release(st.st_size);
+        return false;
+    }
+
+    size_t img_size = sizeof(float) * spec.width * spec.height;
+    batch_budget_charge(img_size);
+    batch_budget_release(st.st_size);
+
+    debug("decoded %s OK (%dx%d)\n", in_filename, spec.width, spec.height);
+
+    bool success = write_pfm_file(&spec, img, out_filename);
+
+    xfree(img);
+    batch_budget_release(img_size);
+
+    return success;
+}
+
+static void
+usage(void)
+{
+    printf(
+"Usage exr-to-pfm [options] <in.exr> <out.pfm>\n"
+"      exr-to-pfm [options] --batch <in_dir> <out_dir>\n"
+"\n"
+"    -b,--batch                 Convert all .exr files under <in_dir> to .pfm\n"
+"                               files with the same relative paths under\n"
+"                               <out_dir>\n"
+"    -i,--index=<file>          Only convert the files listed in a training\n"
+"                               data index (implies --batch)\n"
+"    -j,--threads=<n>           Number of worker threads (default: number of\n"
+"                               CPUs)\n"
+"    -m,--max-memory=<MB>       Limit on the memory used by files being\n"
+"                               converted (default: %zuMB)\n"
+"\n"
+"    -h,--help                  Display this help\n\n"
+"\n",
+    batch_get_budget() / (1024 * 1024));
+}
+
+int
+main(int argc, char **argv)
+{
+    int opt;
+    bool batch = false;
+    const char *index_filename = NULL;
+    int n_threads = sysconf(_SC_NPROCESSORS_ONLN);
+
+    const char *short_options="+hbi:j:m:";
+    const struct option long_options[] = {
+        {"help",            no_argument,        0, 'h'},
+        {"batch",           no_argument,        0, 'b'},
+        {"index",           required_argument,  0, 'i'},
+        {"threads",         required_argument,  0, 'j'},
+        {"max-memory",      required_argument,  0, 'm'},
+        {0, 0, 0, 0}
+    };
+
+    while ((opt = getopt_long(argc, argv, short_options, long_options, NULL))
+           != -1)
+    {
+        switch (opt) {
+            case 'h':
+                usage();
+                return 0;
+            case 'b':
+                batch = true;
+                break;
+            case 'i':
+                index_filename = optarg;
+                batch = true;
+                break;
+            case 'j':
+                n_threads = atoi(optarg);
+                break;
+            case 'm':
+                batch_set_budget((size_t)strtoul(optarg, NULL, 10) * 1024 * 1024);
+                break;
+            default:
+                usage();
+                return 1;
+        }
+    }
+
+    if (argc - optind != 2) {
+        usage();
+        return 1;
+    }
+
+    if (!batch)
+        return convert_file(argv[optind], argv[optind + 1]) ? 0 : 1;
 
-    free(img);
+    unsigned n_failed = batch_convert(argv[optind], argv[optind + 1],
+                                      index_filename, ".exr", ".pfm",
+                                      n_threads, convert_file);
 
-    return 0;
+    return n_failed ? 1 : 0;
 }
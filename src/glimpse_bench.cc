@@ -0,0 +1,978 @@
+/*
+ * Copyright (C) 2017 Glimp IP Ltd
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+/* Reproducible micro-benchmarks for the inference and data loading hot
+ * paths.
+ *
+ * By default everything runs against deterministically generated trees,
+ * depth images and packs so results are comparable between machines and
+ * over time without needing any assets. Real models, depth images and
+ * packs can be given to benchmark those too.
+ *
+ * Results are written as JSON.
+ *
+ * Not covered: train_rdt's histogramming and copy_and_rotate_depth_buffer()
+ * are static to train_rdt and the tracking context, and replaying
+ * recordings needs the device and context machinery from libglimpse, none
+ * of which is linked here. Packs are the only recorded data benchmarked.
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <getopt.h>
+
+#include <vector>
+#include <algorithm>
+
+#include "half.hpp"
+
+#include "image_utils.h"
+#include "xalloc.h"
+#include "utils.h"
+#include "loader.h"
+#include "infer.h"
+#include "parson.h"
+#ifdef USE_SNAPPY
+#include "pack.h"
+#endif
+
+using half_float::half;
+
+#define SYNTHETIC_SEED 0x9e3779b9
+
+typedef struct {
+  uint32_t state;
+} BenchRNG;
+
+/* xorshift32, so synthetic data doesn't depend on the C++ library's
+ * random number implementation
+ */
+static uint32_t
+rng_next(BenchRNG* rng)
+{
+  uint32_t x = rng->state;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  rng->state = x;
+  return x;
+}
+
+static float
+rng_uniform(BenchRNG* rng, float min, float max)
+{
+  return min + (max - min) * ((rng_next(rng) >> 8) / (float)(1 << 24));
+}
+
+typedef struct {
+  const char* filter;     // Only run benchmarks whose name contains this
+  float       min_time;   // Minimum time to spend per benchmark (seconds)
+  int         min_iterations;
+
+  int         width;
+  int         height;
+  float       vfov;       // Vertical field of view (degrees)
+
+  int         n_trees;
+  int         tree_depth;
+  int         n_labels;
+  int         n_joints;
+  int         n_pack_frames;
+
+  JSON_Value* results;
+} BenchContext;
+
+static uint64_t
+get_time(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return ((uint64_t)ts.tv_sec) * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static bool
+should_run(BenchContext* ctx, const char* name)
+{
+  return !ctx->filter || strstr(name, ctx->filter);
+}
+
+/* Runs func repeatedly for at least ctx->min_time seconds and
+ * ctx->min_iterations iterations and appends the timing statistics to the
+ * results.
+ */
+template<typename Func>
+static void
+run_benchmark(BenchContext* ctx, const char* name, Func func)
+{
+  if (!should_run(ctx, name))
+    {
+      return;
+    }
+
+  // Warm up caches and any lazy allocations first
+  func();
+
+  std::vector<double> times;
+  uint64_t min_duration = (uint64_t)(ctx->min_time * 1e9);
+  uint64_t start = get_time();
+  uint64_t now = start;
+  while (now - start < min_duration ||
+         (int)times.size() < ctx->min_iterations)
+    {
+      uint64_t iter_start = now;
+      func();
+      now = get_time();
+      times.push_back((now - iter_start) / 1e6);
+    }
+
+  std::sort(times.begin(), times.end());
+
+  double sum = 0;
+  for (double t : times)
+    {
+      sum += t;
+    }
+  double mean = sum / times.size();
+
+  double var = 0;
+  for (double t : times)
+    {
+      var += (t - mean) * (t - mean);
+    }
+  double stddev = sqrt(var / times.size());
+
+  size_t n = times.size();
+  double median = (n % 2) ? times[n / 2] :
+    (times[n / 2 - 1] + times[n / 2]) / 2.0;
+
+  JSON_Value* result_val = json_value_init_object();
+  JSON_Object* result = json_object(result_val);
+  json_object_set_string(result, "name", name);
+  json_object_set_number(result, "iterations", n);
+  json_object_set_number(result, "mean_ms", mean);
+  json_object_set_number(result, "median_ms", median);
+  json_object_set_number(result, "min_ms", times[0]);
+  json_object_set_number(result, "max_ms", times[n - 1]);
+  json_object_set_number(result, "stddev_ms", stddev);
+  json_array_append_value(
+    json_object_get_array(json_object(ctx->results), "benchmarks"),
+    result_val);
+
+  fprintf(stderr, "%-40s %8.3fms (median %8.3fms, %zu iterations)\n",
+          name, mean, median, n);
+}
+
+/* Generates a complete tree with random uv offsets and thresholds in the
+ * same ranges that train_rdt uses by default, and random leaf label
+ * distributions.
+ */
+static RDTree*
+create_synthetic_tree(BenchContext* ctx, BenchRNG* rng)
+{
+  RDTree* tree = (RDTree*)xcalloc(1, sizeof(RDTree));
+  memcpy(tree->header.tag, "RDT", 3);
+  tree->header.version = RDT_VERSION;
+  tree->header.depth = ctx->tree_depth;
+  tree->header.n_labels = ctx->n_labels;
+  tree->header.bg_label = 0;
+  tree->header.fov = ctx->vfov;
+
+  float ppm = (ctx->height / 2.f) / tanf(ctx->vfov * M_PI / 360.f);
+  float uv_range = 1.29f * ppm;
+  float t_range = 1.29f;
+
+  uint32_t n_nodes = (1 << ctx->tree_depth) - 1;
+  uint32_t n_leaves = 1 << (ctx->tree_depth - 1);
+  uint32_t first_leaf = n_nodes - n_leaves;
+
+  tree->nodes = (Node*)xcalloc(n_nodes, sizeof(Node));
+  for (uint32_t i = 0; i < first_leaf; i++)
+    {
+      Node* node = &tree->nodes[i];
+      for (int c = 0; c < 4; c++)
+        {
+          node->uv[c] = rng_uniform(rng, -uv_range / 2.f, uv_range / 2.f);
+        }
+      node->t = rng_uniform(rng, -t_range / 2.f, t_range / 2.f);
+      node->label_pr_idx = 0;
+    }
+
+  tree->n_pr_tables = n_leaves;
+  tree->label_pr_tables =
+    (float*)xmalloc(n_leaves * ctx->n_labels * sizeof(float));
+  for (uint32_t i = 0; i < n_leaves; i++)
+    {
+      tree->nodes[first_leaf + i].label_pr_idx = i + 1;
+
+      float* pr_table = &tree->label_pr_tables[i * ctx->n_labels];
+      float total = 0.f;
+      for (int l = 0; l < ctx->n_labels; l++)
+        {
+          pr_table[l] = rng_uniform(rng, 0.f, 1.f);
+          pr_table[l] *= pr_table[l] * pr_table[l];
+          total += pr_table[l];
+        }
+      for (int l = 0; l < ctx->n_labels; l++)
+        {
+          pr_table[l] /= total;
+        }
+    }
+
+  return tree;
+}
+
+/* A rough human-sized silhouette (a torso, head and two arms) about 2.5m
+ * away with a little noise, on an empty background.
+ */
+template<typename FloatT>
+static FloatT*
+create_synthetic_depth(BenchContext* ctx, BenchRNG* rng)
+{
+  int width = ctx->width;
+  int height = ctx->height;
+  FloatT* depth = (FloatT*)xmalloc(width * height * sizeof(FloatT));
+
+  struct {
+    float cx, cy, rx, ry;
+  } parts[] = {
+    { 0.50f, 0.55f, 0.18f, 0.30f }, // torso
+    { 0.50f, 0.17f, 0.08f, 0.08f }, // head
+    { 0.25f, 0.50f, 0.05f, 0.28f }, // left arm
+    { 0.75f, 0.50f, 0.05f, 0.28f }, // right arm
+  };
+
+  for (int y = 0; y < height; y++)
+    {
+      for (int x = 0; x < width; x++)
+        {
+          float value = HUGE_DEPTH;
+          for (unsigned p = 0; p < sizeof(parts) / sizeof(parts[0]); p++)
+            {
+              float dx = (x / (float)width - parts[p].cx) / parts[p].rx;
+              float dy = (y / (float)height - parts[p].cy) / parts[p].ry;
+              float r2 = dx * dx + dy * dy;
+              if (r2 < 1.f)
+                {
+                  float d = 2.5f - 0.15f * sqrtf(1.f - r2) +
+                    rng_uniform(rng, -0.005f, 0.005f);
+                  value = std::min(value, d);
+                }
+            }
+          depth[y * width + x] = (FloatT)value;
+        }
+    }
+
+  return depth;
+}
+
+static JSON_Value*
+create_synthetic_joint_map(BenchContext* ctx)
+{
+  JSON_Value* map_val = json_value_init_array();
+  for (int j = 0; j < ctx->n_joints; j++)
+    {
+      JSON_Value* joint_val = json_value_init_object();
+      JSON_Value* labels_val = json_value_init_array();
+
+      // Spread the joints over the non-background labels, with every
+      // other joint mapped to two labels
+      int label = 1 + (j * 2) % (ctx->n_labels - 1);
+      json_array_append_number(json_array(labels_val), label);
+      if (j % 2)
+        {
+          json_array_append_number(json_array(labels_val),
+                                   1 + label % (ctx->n_labels - 1));
+        }
+
+      char name[16];
+      snprintf(name, sizeof(name), "joint%d", j);
+      json_object_set_string(json_object(joint_val), "joint", name);
+      json_object_set_value(json_object(joint_val), "labels", labels_val);
+      json_array_append_value(json_array(map_val), joint_val);
+    }
+
+  return map_val;
+}
+
+template<typename FloatT>
+static void
+bench_inference(BenchContext* ctx, const char* suffix,
+                RDTree** forest, int n_trees, FloatT* depth,
+                int width, int height,
+                JSON_Value* joint_map, JIParam* joint_params)
+{
+  uint8_t n_labels = forest[0]->header.n_labels;
+  const char* type = sizeof(FloatT) == sizeof(half) ? "half" : "float";
+  char name[128];
+
+  float* pr_table = (float*)
+    xmalloc(width * height * n_labels * sizeof(float));
+
+  snprintf(name, sizeof(name), "infer_labels/%s/%s", type, suffix);
+  run_benchmark(ctx, name, [&]() {
+    infer_labels(forest, n_trees, depth, width, height, pr_table);
+  });
+
+  snprintf(name, sizeof(name), "infer_labels/%s/stride2/%s", type, suffix);
+  run_benchmark(ctx, name, [&]() {
+    infer_labels(forest, n_trees, depth, width, height, pr_table, 2);
+  });
+
+  if (!joint_map || !joint_params)
+    {
+      xfree(pr_table);
+      return;
+    }
+
+  // The joint benchmarks all use the same label inference results
+  infer_labels(forest, n_trees, depth, width, height, pr_table);
+
+  int n_joints = json_array_get_count(json_array(joint_map));
+  float* weights = (float*)xmalloc(width * height * n_joints * sizeof(float));
+
+  snprintf(name, sizeof(name), "calc_pixel_weights/%s/%s", type, suffix);
+  run_benchmark(ctx, name, [&]() {
+    calc_pixel_weights(depth, pr_table, width, height, n_labels, joint_map,
+                       weights);
+  });
+
+  snprintf(name, sizeof(name), "infer_joints/%s/%s", type, suffix);
+  run_benchmark(ctx, name, [&]() {
+    InferredJoints* joints =
+      infer_joints(depth, pr_table, weights, width, height, n_labels,
+                   joint_map, ctx->vfov, joint_params);
+    free_joints(joints);
+  });
+
+  snprintf(name, sizeof(name), "infer_joints_fast/%s/%s", type, suffix);
+  run_benchmark(ctx, name, [&]() {
+    InferredJoints* joints =
+      infer_joints_fast(depth, pr_table, weights, width, height, n_labels,
+                        joint_map, ctx->vfov, joint_params);
+    free_joints(joints);
+  });
+
+  xfree(weights);
+  xfree(pr_table);
+}
+
+#ifdef USE_SNAPPY
+static void
+bench_pack_reads(BenchContext* ctx, const char* suffix, const char* filename)
+{
+  char* err = NULL;
+  struct pack_file* pack = pack_open(filename, &err);
+  if (!pack)
+    {
+      fprintf(stderr, "Failed to open pack %s: %s\n", filename, err);
+      xfree(err);
+      return;
+    }
+
+  // Packs don't record their length so count (a bounded number of) frames
+  int n_frames = 0;
+  while (n_frames < 256)
+    {
+      struct pack_frame* frame = pack_read_frame(pack, n_frames, &err);
+      if (!frame)
+        {
+          xfree(err);
+          err = NULL;
+          break;
+        }
+      pack_frame_free(frame);
+      n_frames++;
+    }
+  if (n_frames == 0)
+    {
+      fprintf(stderr, "No frames found in pack %s\n", filename);
+      pack_close(pack);
+      return;
+    }
+
+  char name[128];
+  snprintf(name, sizeof(name), "pack_read_frame/%s", suffix);
+
+  // NB: Sections are only decompressed on demand, so include that too
+  int frame_no = 0;
+  run_benchmark(ctx, name, [&]() {
+    struct pack_frame* frame = pack_read_frame(pack, frame_no, &err);
+    if (!frame)
+      {
+        fprintf(stderr, "Failed to read pack frame %d: %s\n", frame_no, err);
+        exit(1);
+      }
+    for (int i = 0; i < pack->n_sections; i++)
+      {
+        uint32_t len;
+        if (!pack_frame_get_section(frame, pack->section_names[i], &len,
+                                    &err))
+          {
+            fprintf(stderr, "Failed to decompress pack section %s: %s\n",
+                    pack->section_names[i], err);
+            exit(1);
+          }
+      }
+    pack_frame_free(frame);
+    frame_no = (frame_no + 1) % n_frames;
+  });
+
+  // Decoding the labels and depth images as the training tools do
+  char* width_err = NULL;
+  char* height_err = NULL;
+  int width = pack_get_i64(pack, "width", &width_err);
+  int height = pack_get_i64(pack, "height", &height_err);
+  if (width_err || height_err)
+    {
+      xfree(width_err);
+      xfree(height_err);
+      pack_close(pack);
+      return;
+    }
+
+  uint8_t* labels = (uint8_t*)xmalloc(width * height);
+  half* depth = (half*)xmalloc(width * height * sizeof(half));
+
+  snprintf(name, sizeof(name), "pack_decode_frame/%s", suffix);
+  frame_no = 0;
+  run_benchmark(ctx, name, [&]() {
+    struct pack_frame* frame = pack_read_frame(pack, frame_no, &err);
+    if (!frame)
+      {
+        fprintf(stderr, "Failed to read pack frame %d: %s\n", frame_no, err);
+        exit(1);
+      }
+
+    uint32_t len;
+    uint8_t* labels_png = pack_frame_get_section(frame, "labels", &len, &err);
+    IUImageSpec labels_spec = { width, height, IU_FORMAT_U8 };
+    if (!labels_png ||
+        iu_read_png_from_memory(labels_png, len, &labels_spec, &labels,
+                                NULL, NULL) != SUCCESS)
+      {
+        fprintf(stderr, "Failed to decode labels of pack frame %d\n",
+                frame_no);
+        exit(1);
+      }
+
+    uint8_t* depth_exr = pack_frame_get_section(frame, "depth", &len, &err);
+    IUImageSpec depth_spec = { width, height, IU_FORMAT_HALF };
+    void* depth_image = depth;
+    if (!depth_exr ||
+        iu_read_exr_from_memory(depth_exr, len, &depth_spec,
+                                &depth_image) != SUCCESS)
+      {
+        fprintf(stderr, "Failed to decode depth of pack frame %d\n",
+                frame_no);
+        exit(1);
+      }
+
+    pack_frame_free(frame);
+    frame_no = (frame_no + 1) % n_frames;
+  });
+
+  xfree(depth);
+  xfree(labels);
+  pack_close(pack);
+}
+
+static uint8_t*
+read_file(const char* filename, uint32_t* len)
+{
+  FILE* fp = fopen(filename, "rb");
+  if (!fp)
+    {
+      return NULL;
+    }
+
+  uint8_t* buf = NULL;
+  struct stat sb;
+  if (fstat(fileno(fp), &sb) == 0)
+    {
+      buf = (uint8_t*)xmalloc(sb.st_size);
+      if (fread(buf, sb.st_size, 1, fp) == 1 || sb.st_size == 0)
+        {
+          *len = sb.st_size;
+        }
+      else
+        {
+          xfree(buf);
+          buf = NULL;
+        }
+    }
+  fclose(fp);
+
+  return buf;
+}
+
+/* Writes a pack with the same sections as pack-training-data's: the labels
+ * as a PNG, the depth as a half float EXR and the frame's meta JSON, so
+ * reading it back involves the same decode work as a real pack. The images
+ * are encoded via temporary files in tmp_dir.
+ */
+static bool
+create_synthetic_pack(BenchContext* ctx, BenchRNG* rng, const char* tmp_dir,
+                      const char* filename)
+{
+  char* err = NULL;
+  struct pack_file* pack = pack_open(filename, &err);
+  if (!pack)
+    {
+      fprintf(stderr, "Failed to create pack %s: %s\n", filename, err);
+      xfree(err);
+      return false;
+    }
+
+  pack_declare_frame_section(pack, "labels");
+  pack_declare_frame_section(pack, "depth");
+  pack_declare_frame_section(pack, "meta");
+  pack_set_i64(pack, "width", ctx->width);
+  pack_set_i64(pack, "height", ctx->height);
+
+  char labels_name[64];
+  char depth_name[64];
+  snprintf(labels_name, sizeof(labels_name), "%s/labels.png", tmp_dir);
+  snprintf(depth_name, sizeof(depth_name), "%s/depth.exr", tmp_dir);
+
+  JSON_Value* meta_val = json_value_init_object();
+  JSON_Value* camera_val = json_value_init_object();
+  json_object_set_number(json_object(camera_val), "vertical_fov", ctx->vfov);
+  json_object_set_number(json_object(camera_val), "width", ctx->width);
+  json_object_set_number(json_object(camera_val), "height", ctx->height);
+  json_object_set_value(json_object(meta_val), "camera", camera_val);
+  char* meta = json_serialize_to_string(meta_val);
+  json_value_free(meta_val);
+
+  int n_pixels = ctx->width * ctx->height;
+  uint8_t* labels = (uint8_t*)xmalloc(n_pixels);
+  IUImageSpec labels_spec = { ctx->width, ctx->height, IU_FORMAT_U8 };
+  IUImageSpec depth_spec = { ctx->width, ctx->height, IU_FORMAT_HALF };
+  bool ret = true;
+
+  for (int i = 0; i < ctx->n_pack_frames && ret; i++)
+    {
+      half* depth = create_synthetic_depth<half>(ctx, rng);
+      for (int p = 0; p < n_pixels; p++)
+        {
+          labels[p] = (float)depth[p] >= HUGE_DEPTH ? 0 :
+            1 + (p / ctx->width * ctx->n_labels / ctx->height) %
+            (ctx->n_labels - 1);
+        }
+
+      uint32_t labels_len = 0, depth_len = 0;
+      uint8_t* labels_png = NULL;
+      uint8_t* depth_exr = NULL;
+      if (iu_write_png_to_file(labels_name, &labels_spec, labels,
+                               NULL, 0) == SUCCESS)
+        {
+          labels_png = read_file(labels_name, &labels_len);
+        }
+      if (iu_write_exr_to_file(depth_name, &depth_spec, depth,
+                               IU_FORMAT_HALF) == SUCCESS)
+        {
+          depth_exr = read_file(depth_name, &depth_len);
+        }
+      xfree(depth);
+
+      if (!labels_png || !depth_exr)
+        {
+          fprintf(stderr, "Failed to encode synthetic pack frame\n");
+          ret = false;
+        }
+      else
+        {
+          struct pack_frame* frame = pack_frame_new(pack);
+          pack_frame_set_section(frame, "labels", labels_png, labels_len);
+          pack_frame_set_section(frame, "depth", depth_exr, depth_len);
+          pack_frame_set_section(frame, "meta", (uint8_t*)meta,
+                                 strlen(meta));
+          pack_frame_set_i64(frame, "frame", i);
+          if (pack_frame_compress(frame, &err))
+            {
+              pack_append_frame(pack, frame);
+            }
+          else
+            {
+              fprintf(stderr, "Failed to compress pack frame: %s\n", err);
+              xfree(err);
+              err = NULL;
+              ret = false;
+            }
+          pack_frame_free(frame);
+        }
+
+      if (labels_png)
+        {
+          xfree(labels_png);
+        }
+      if (depth_exr)
+        {
+          xfree(depth_exr);
+        }
+    }
+
+  unlink(labels_name);
+  unlink(depth_name);
+  json_free_serialized_string(meta);
+  xfree(labels);
+
+  if (ret)
+    {
+      ret = pack_write_header(pack, &err);
+      if (!ret)
+        {
+          fprintf(stderr, "Failed to write pack header: %s\n", err);
+          xfree(err);
+        }
+    }
+  pack_close(pack);
+
+  return ret;
+}
+#endif
+
+static void
+print_usage(FILE* stream)
+{
+  fprintf(stream,
+"Usage: glimpse_bench [OPTIONS] [tree1.rdt|tree1.json] [tree2] ...\n"
+"Benchmark inference and data loading on synthetic data, and optionally on\n"
+"real trees, depth images and packs, writing the results as JSON.\n"
+"\n"
+"  -o, --output=FILE        Write JSON results to FILE (default = stdout)\n"
+"  -f, --filter=STRING      Only run benchmarks whose name contains STRING\n"
+"  -t, --time=SECONDS       Minimum time per benchmark (default = 1)\n"
+"  -i, --iterations=N       Minimum iterations per benchmark (default = 5)\n"
+"\n"
+"  -W, --width=N            Synthetic image width (default = 172)\n"
+"  -H, --height=N           Synthetic image height (default = 224)\n"
+"  -T, --trees=N            Number of synthetic trees (default = 3)\n"
+"  -D, --tree-depth=N       Depth of synthetic trees (default = 20)\n"
+"\n"
+"  -d, --depth=EXR          Depth image to run the given trees against\n"
+"                           (default = synthetic)\n"
+"  -j, --joint-map=JSON     Joint map for benchmarking joint inference with\n"
+"                           the given trees (requires --jip)\n"
+"  -p, --jip=JIP            Joint inference parameters for the given trees\n"
+#ifdef USE_SNAPPY
+"  -P, --pack=FILE          Training data pack to benchmark reading\n"
+#endif
+"\n"
+"  -h, --help               Display this help\n\n");
+}
+
+int
+main(int argc, char **argv)
+{
+  BenchContext ctx = {};
+  ctx.min_time = 1.f;
+  ctx.min_iterations = 5;
+  ctx.width = 172;
+  ctx.height = 224;
+  ctx.vfov = 54.5f;
+  ctx.n_trees = 3;
+  ctx.tree_depth = 20;
+  ctx.n_labels = 34;
+  ctx.n_joints = 20;
+  ctx.n_pack_frames = 32;
+
+  const char* output = NULL;
+  const char* depth_file = NULL;
+  const char* joint_map_file = NULL;
+  const char* jip_file = NULL;
+  const char* pack_file = NULL;
+  int opt;
+
+  const char *short_options="+ho:f:t:i:W:H:T:D:d:j:p:P:";
+  const struct option long_options[] = {
+      {"help",            no_argument,        0, 'h'},
+      {"output",          required_argument,  0, 'o'},
+      {"filter",          required_argument,  0, 'f'},
+      {"time",            required_argument,  0, 't'},
+      {"iterations",      required_argument,  0, 'i'},
+      {"width",           required_argument,  0, 'W'},
+      {"height",          required_argument,  0, 'H'},
+      {"trees",           required_argument,  0, 'T'},
+      {"tree-depth",      required_argument,  0, 'D'},
+      {"depth",           required_argument,  0, 'd'},
+      {"joint-map",       required_argument,  0, 'j'},
+      {"jip",             required_argument,  0, 'p'},
+      {"pack",            required_argument,  0, 'P'},
+      {0, 0, 0, 0}
+  };
+
+  while ((opt = getopt_long(argc, argv, short_options, long_options, NULL))
+         != -1)
+    {
+      switch (opt) {
+          case 'h':
+              print_usage(stdout);
+              return 0;
+          case 'o':
+              output = optarg;
+              break;
+          case 'f':
+              ctx.filter = optarg;
+              break;
+          case 't':
+              ctx.min_time = strtof(optarg, NULL);
+              break;
+          case 'i':
+              ctx.min_iterations = atoi(optarg);
+              break;
+          case 'W':
+              ctx.width = atoi(optarg);
+              break;
+          case 'H':
+              ctx.height = atoi(optarg);
+              break;
+          case 'T':
+              ctx.n_trees = atoi(optarg);
+              break;
+          case 'D':
+              ctx.tree_depth = atoi(optarg);
+              break;
+          case 'd':
+              depth_file = optarg;
+              break;
+          case 'j':
+              joint_map_file = optarg;
+              break;
+          case 'p':
+              jip_file = optarg;
+              break;
+          case 'P':
+              pack_file = optarg;
+              break;
+         default:
+              print_usage(stderr);
+              return 1;
+      }
+  }
+
+  if (ctx.width < 1 || ctx.height < 1 || ctx.n_trees < 1 ||
+      ctx.n_trees > 255 || ctx.tree_depth < 2 || ctx.tree_depth > 24)
+    {
+      fprintf(stderr, "Invalid synthetic data configuration\n");
+      return 1;
+    }
+
+  if (!!joint_map_file != !!jip_file)
+    {
+      fprintf(stderr, "--joint-map and --jip must be given together\n");
+      return 1;
+    }
+
+  ctx.results = json_value_init_object();
+  JSON_Object* root = json_object(ctx.results);
+
+  JSON_Value* config_val = json_value_init_object();
+  JSON_Object* config = json_object(config_val);
+  json_object_set_number(config, "seed", SYNTHETIC_SEED);
+  json_object_set_number(config, "width", ctx.width);
+  json_object_set_number(config, "height", ctx.height);
+  json_object_set_number(config, "n_trees", ctx.n_trees);
+  json_object_set_number(config, "tree_depth", ctx.tree_depth);
+  json_object_set_number(config, "n_labels", ctx.n_labels);
+  json_object_set_number(config, "n_joints", ctx.n_joints);
+  json_object_set_number(config, "min_time", ctx.min_time);
+  json_object_set_number(config, "min_iterations", ctx.min_iterations);
+  json_object_set_value(root, "config", config_val);
+  json_object_set_number(root, "timestamp", (double)time(NULL));
+  json_object_set_value(root, "benchmarks", json_value_init_array());
+
+  /*
+   * Synthetic workloads
+   */
+  BenchRNG rng = { SYNTHETIC_SEED };
+
+  RDTree** forest = (RDTree**)xcalloc(ctx.n_trees, sizeof(RDTree*));
+  for (int i = 0; i < ctx.n_trees; i++)
+    {
+      forest[i] = create_synthetic_tree(&ctx, &rng);
+    }
+
+  half* depth_half = create_synthetic_depth<half>(&ctx, &rng);
+  float* depth_float = (float*)xmalloc(ctx.width * ctx.height * sizeof(float));
+  for (int i = 0; i < ctx.width * ctx.height; i++)
+    {
+      depth_float[i] = depth_half[i];
+    }
+
+  JSON_Value* joint_map = create_synthetic_joint_map(&ctx);
+  JIParam* joint_params = (JIParam*)xmalloc(ctx.n_joints * sizeof(JIParam));
+  for (int j = 0; j < ctx.n_joints; j++)
+    {
+      joint_params[j].bandwidth = 0.1f;
+      joint_params[j].threshold = 0.3f;
+      joint_params[j].offset = 0.05f;
+    }
+
+  bench_inference(&ctx, "synthetic", forest, ctx.n_trees, depth_half,
+                  ctx.width, ctx.height, joint_map, joint_params);
+  bench_inference(&ctx, "synthetic", forest, ctx.n_trees, depth_float,
+                  ctx.width, ctx.height, joint_map, joint_params);
+
+  xfree(joint_params);
+  json_value_free(joint_map);
+  xfree(depth_float);
+  free_forest(forest, ctx.n_trees);
+
+#ifdef USE_SNAPPY
+  if (should_run(&ctx, "pack_read_frame/synthetic") ||
+      should_run(&ctx, "pack_decode_frame/synthetic"))
+    {
+      char pack_dir[] = "/tmp/glimpse-bench-XXXXXX";
+      if (mkdtemp(pack_dir))
+        {
+          char pack_name[64];
+          snprintf(pack_name, sizeof(pack_name), "%s/synthetic.pack",
+                   pack_dir);
+          if (create_synthetic_pack(&ctx, &rng, pack_dir, pack_name))
+            {
+              bench_pack_reads(&ctx, "synthetic", pack_name);
+            }
+          unlink(pack_name);
+          rmdir(pack_dir);
+        }
+      else
+        {
+          fprintf(stderr, "Failed to create temporary directory\n");
+        }
+    }
+#endif
+
+  /*
+   * Optional real workloads
+   */
+  int n_trees = argc - optind;
+  if (n_trees > 0)
+    {
+      const char** tree_files = (const char**)&argv[optind];
+      const char* ext = strrchr(tree_files[0], '.');
+      RDTree** model = (ext && strcmp(ext, ".json") == 0) ?
+        read_json_forest(tree_files, n_trees) :
+        read_forest(tree_files, n_trees);
+      if (!model)
+        {
+          return 1;
+        }
+
+      int width = ctx.width;
+      int height = ctx.height;
+      half* depth = depth_half;
+      if (depth_file)
+        {
+          IUImageSpec spec = { 0, 0, IU_FORMAT_HALF };
+          depth = NULL;
+          if (iu_read_exr_from_file(depth_file, &spec, (void**)&depth) !=
+              SUCCESS)
+            {
+              fprintf(stderr, "Error loading depth image %s\n", depth_file);
+              return 1;
+            }
+          width = spec.width;
+          height = spec.height;
+        }
+
+      JSON_Value* model_joint_map = NULL;
+      JIParams* model_jip = NULL;
+      if (joint_map_file)
+        {
+          model_joint_map = json_parse_file(joint_map_file);
+          model_jip = read_jip(jip_file);
+          if (!model_joint_map || !model_jip)
+            {
+              fprintf(stderr, "Error loading joint map or parameters\n");
+              return 1;
+            }
+        }
+
+      bench_inference(&ctx, "model", model, n_trees, depth, width, height,
+                      model_joint_map,
+                      model_jip ? model_jip->joint_params : NULL);
+
+      if (model_jip)
+        {
+          free_jip(model_jip);
+        }
+      if (model_joint_map)
+        {
+          json_value_free(model_joint_map);
+        }
+      if (depth != depth_half)
+        {
+          xfree(depth);
+        }
+      free_forest(model, n_trees);
+    }
+  else if (depth_file || joint_map_file)
+    {
+      fprintf(stderr, "No trees given to benchmark with real data\n");
+      return 1;
+    }
+
+#ifdef USE_SNAPPY
+  if (pack_file)
+    {
+      bench_pack_reads(&ctx, "pack", pack_file);
+    }
+#else
+  if (pack_file)
+    {
+      fprintf(stderr, "Pack support requires building with snappy\n");
+      return 1;
+    }
+#endif
+
+  xfree(depth_half);
+
+  if (output)
+    {
+      if (json_serialize_to_file_pretty(ctx.results, output) != JSONSuccess)
+        {
+          fprintf(stderr, "Failed to write results to %s\n", output);
+          return 1;
+        }
+    }
+  else
+    {
+      char* json = json_serialize_to_string_pretty(ctx.results);
+      printf("%s\n", json);
+      json_free_serialized_string(json);
+    }
+
+  json_value_free(ctx.results);
+
+  return 0;
+}
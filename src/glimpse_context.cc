@@ -34,6 +34,7 @@
 #include <string.h>
 #include <cmath>
 #include <list>
+#include <algorithm>
 #include <forward_list>
 
 #include <pthread.h>
@@ -79,9 +80,12 @@
 #include "loader.h"
 #include "image_utils.h"
 
+#include <profiler.h>
+
 #include "glimpse_log.h"
 #include "glimpse_mem_pool.h"
 #include "glimpse_assets.h"
+#include "glimpse_host.h"
 #include "glimpse_context.h"
 
 #undef GM_LOG_CONTEXT
@@ -155,6 +159,71 @@
 using half_float::half;
 using namespace pcl::common;
 
+/* Enough for the tracking in progress, the latest tracking and one held by
+ * the application
+ */
+#define CONTEXT_PREALLOC_TRACKING 3
+
+/* Timed stages of gm_context_track_skeleton(), used by the adaptive quality
+ * controller
+ */
+enum tracking_stage {
+    TRACKING_STAGE_PROJECTION,
+    TRACKING_STAGE_NORMALS,
+    TRACKING_STAGE_PLANES,
+    TRACKING_STAGE_CLUSTERING,
+    TRACKING_STAGE_DETECTION,
+    TRACKING_STAGE_REPROJECTION,
+    TRACKING_STAGE_LABELS,
+    TRACKING_STAGE_WEIGHTS,
+    TRACKING_STAGE_JOINTS,
+    TRACKING_STAGE_PROCESSING,
+    N_TRACKING_STAGES
+};
+
+static const char *tracking_stage_names[] = {
+    "projection",
+    "normals",
+    "planes",
+    "clustering",
+    "detection",
+    "reprojection",
+    "labels",
+    "weights",
+    "joints",
+    "processing",
+};
+
+/* The adaptive quality controller steps through these levels, from best
+ * quality to fastest, to try and keep tracking within a frame budget. Each
+ * level is applied relative to the user configured properties.
+ */
+struct quality_level {
+    int drop_trees;     // Number of decision trees to skip (leaving >= 1)
+    int label_stride;   // Pixel stride for label inference
+    int seg_res_add;    // Added to the seg_res divider (capped at 4)
+    int cloud_res_add;  // Added to the cloud_res divider (capped at 4)
+    int max_candidates; // Max person clusters to infer joints for (0 = all)
+};
+
+static const struct quality_level quality_levels[] = {
+    { 0, 1, 0, 0, 0 },
+    { 0, 1, 0, 0, 2 },
+    { 1, 1, 0, 0, 2 },
+    { 1, 1, 0, 0, 1 },
+    { 1, 2, 0, 0, 1 },
+    { 2, 2, 1, 0, 1 },
+    { 2, 2, 1, 1, 1 },
+    { 2, 3, 2, 1, 1 },
+};
+
+/* Consecutive frames over budget before degrading quality, and with
+ * headroom before restoring quality
+ */
+#define QUALITY_DEGRADE_FRAMES 3
+#define QUALITY_RESTORE_FRAMES 30
+#define QUALITY_HEADROOM 0.7f
+
 
 #define DOWNSAMPLE_1_2
 //#define DOWNSAMPLE_1_4
@@ -234,6 +303,7 @@ struct gm_prediction_impl
     struct gm_prediction base;
     struct gm_prediction_vtable vtable;
     struct gm_mem_pool *pool;
+    struct gm_mem_pool_link pool_link;
 
     struct gm_context *ctx;
 
@@ -255,6 +325,7 @@ struct gm_tracking_impl
     struct gm_tracking_vtable vtable;
 
     struct gm_mem_pool *pool;
+    struct gm_mem_pool_link pool_link;
 
     struct gm_context *ctx;
 
@@ -269,22 +340,30 @@ struct gm_tracking_impl
 
     struct gm_frame *frame;
 
-    // Depth data, in meters
+    // Depth data, in meters. Either points to depth_storage or is borrowed
+    // from the frame's depth buffer (see copy_and_rotate_depth_buffer())
     float *depth;
+    float *depth_storage;
 
-    // Label inference data
+    // Most probable label for each pixel of the label inference
     uint8_t *label_map;
 
-    // Label probability tables
-    float *label_probs;
+    // Label probability tables, only retained if a debug consumer asked for
+    // them via gm_context_set_debug_retention(). NULL otherwise.
+    enum gm_label_probs_format label_probs_format;
+    void *label_probs;
+    size_t label_probs_size;
 
     // Estimated normals for the depth buffer
+    // (released after tracking unless GM_TRACKING_RETAIN_NORMALS)
     pcl::PointCloud<pcl::Normal>::Ptr normals;
 
     // Labels based on similar normals
+    // (released after tracking unless GM_TRACKING_RETAIN_CLUSTERS)
     pcl::PointCloud<pcl::Label>::Ptr normal_labels;
 
     // Labels based on clustering after plane removal
+    // (released after tracking unless GM_TRACKING_RETAIN_CLUSTERS)
     pcl::PointCloud<pcl::Label>::Ptr cluster_labels;
 
     // Whether any person clouds were tracked in this frame
@@ -300,6 +379,10 @@ struct gm_tracking_impl
     size_t face_detect_buf_width;
     size_t face_detect_buf_height;
 
+    // Copied from the latest face detection results when published
+    std::vector<float> faces;
+    uint64_t faces_timestamp;
+
     /* Lets us debug when we've failed to release frame resources when
      * we come to destroy our resource pools
      */
@@ -329,6 +412,18 @@ struct gm_context
     bool basis_extrinsics_set;
 
     pthread_t detect_thread;
+
+    /* If a host has been associated via gm_context_set_host() then tracking
+     * runs on the host's shared workers instead of detect_thread.
+     *
+     * host_camera is protected by frame_ready_mutex
+     */
+    struct gm_host *host;
+    struct gm_host_camera *host_camera;
+    char *host_camera_name;
+    uint64_t host_deadline_ns;
+
+    bool face_detection_initialized;
     dlib::frontal_face_detector detector;
 
     dlib::shape_predictor face_feature_detector;
@@ -381,6 +476,25 @@ struct gm_context
 
     std::vector<dlib::rectangle> last_faces;
 
+    /* Face detection runs as a separate stage on face_detect_thread so that
+     * it can't delay skeletal tracking. After tracking, a reference to the
+     * tracking is handed over via face_detect_pending (replacing any that
+     * hasn't been picked up yet) at most once every face_detect_interval_ms
+     * and the results are copied into subsequently published tracking.
+     *
+     * face_detect_mutex protects face_detect_pending, faces and
+     * faces_timestamp
+     */
+    bool face_detection;
+    float face_detect_interval_ms;
+    uint64_t last_face_detect_queue_time;
+    pthread_t face_detect_thread;
+    pthread_mutex_t face_detect_mutex;
+    pthread_cond_t face_detect_cond;
+    struct gm_tracking_impl *face_detect_pending;
+    std::vector<float> faces;
+    uint64_t faces_timestamp;
+
 #if 0
     int current_copy_buf;
     int current_detect_buf;
@@ -405,6 +519,25 @@ struct gm_context
      */
     int debug_label;
 
+    /* GM_TRACKING_RETAIN_* flags for the debug state that should be kept
+     * with each tracking object after tracking completes, and the precision
+     * label probabilities are kept with.
+     */
+    uint64_t debug_retention;
+    int label_probs_format;
+
+    /* Adaptive quality control state: the per-stage timings of the last
+     * tracking iteration and a running average of the total tracking time
+     * that's compared against frame_budget_ms to choose a quality_level.
+     */
+    bool adaptive_quality;
+    float frame_budget_ms;
+    int quality_level;
+    float avg_tracking_ms;
+    int n_over_budget;
+    int n_under_budget;
+    uint64_t stage_ns[N_TRACKING_STAGES];
+
     pthread_mutex_t skel_track_cond_mutex;
     pthread_cond_t skel_track_cond;
 
@@ -473,6 +606,7 @@ struct gm_context
     struct color_stop *heat_color_stops;
 
     std::vector<struct gm_ui_enumerant> label_enumerants;
+    std::vector<struct gm_ui_enumerant> label_probs_format_enumerants;
     struct gm_ui_properties properties_state;
     std::vector<struct gm_ui_property> properties;
 
@@ -848,6 +982,23 @@ gm_context_detect_faces(struct gm_context *ctx, struct gm_tracking_impl *trackin
 
     ctx->last_faces = face_rects;
 
+    std::vector<float> faces(face_rects.size() * 4);
+    for (unsigned i = 0; i < face_rects.size(); i++) {
+        faces[i * 4] = face_rects[i].left() /
+            (float)tracking->face_detect_buf_width;
+        faces[i * 4 + 1] = face_rects[i].top() /
+            (float)tracking->face_detect_buf_height;
+        faces[i * 4 + 2] = face_rects[i].width() /
+            (float)tracking->face_detect_buf_width;
+        faces[i * 4 + 3] = face_rects[i].height() /
+            (float)tracking->face_detect_buf_height;
+    }
+
+    pthread_mutex_lock(&ctx->face_detect_mutex);
+    ctx->faces.swap(faces);
+    ctx->faces_timestamp = tracking->frame->timestamp;
+    pthread_mutex_unlock(&ctx->face_detect_mutex);
+
 
     std::vector<struct pt> landmarks(0);
 
@@ -1468,6 +1619,106 @@ class DepthComparator: public pcl::Comparator<PointT>
     float depth_threshold_;
 };
 
+/* Reduces the full float label probabilities to an argmax label map, and
+ * only keeps a copy of the probabilities (at the configured precision) if a
+ * debug consumer asked for them since they are otherwise the single largest
+ * part of the tracking state.
+ */
+static void
+tracking_store_label_probs(struct gm_context *ctx,
+                           struct gm_tracking_impl *tracking,
+                           const float *probs)
+{
+    int width = tracking->training_camera_intrinsics.width;
+    int height = tracking->training_camera_intrinsics.height;
+    int n_labels = ctx->n_labels;
+
+    foreach_xy_off(width, height) {
+        const float *pr_table = &probs[off * n_labels];
+        uint8_t label = 0;
+        float pr = -1.0;
+        for (int l = 0; l < n_labels; l++) {
+            if (pr_table[l] > pr) {
+                label = l;
+                pr = pr_table[l];
+            }
+        }
+        tracking->label_map[off] = label;
+    }
+
+    if (!(ctx->debug_retention & GM_TRACKING_RETAIN_LABEL_PROBS)) {
+        free(tracking->label_probs);
+        tracking->label_probs = NULL;
+        tracking->label_probs_size = 0;
+        return;
+    }
+
+    enum gm_label_probs_format format =
+        (enum gm_label_probs_format)ctx->label_probs_format;
+    size_t n_probs = (size_t)width * height * n_labels;
+    size_t size;
+    switch (format) {
+    case GM_LABEL_PROBS_U8:
+        size = n_probs;
+        break;
+    case GM_LABEL_PROBS_HALF:
+        size = n_probs * sizeof(half);
+        break;
+    case GM_LABEL_PROBS_FLOAT:
+    default:
+        format = GM_LABEL_PROBS_FLOAT;
+        size = n_probs * sizeof(float);
+        break;
+    }
+
+    if (tracking->label_probs_size != size) {
+        free(tracking->label_probs);
+        tracking->label_probs = xmalloc(size);
+        tracking->label_probs_size = size;
+    }
+    tracking->label_probs_format = format;
+
+    switch (format) {
+    case GM_LABEL_PROBS_U8: {
+        uint8_t *out = (uint8_t *)tracking->label_probs;
+        for (size_t i = 0; i < n_probs; i++)
+            out[i] = (uint8_t)(std::min(std::max(probs[i], 0.f), 1.f) * 255.f + 0.5f);
+        break;
+    }
+    case GM_LABEL_PROBS_HALF: {
+        half *out = (half *)tracking->label_probs;
+        for (size_t i = 0; i < n_probs; i++)
+            out[i] = half(probs[i]);
+        break;
+    }
+    case GM_LABEL_PROBS_FLOAT:
+        memcpy(tracking->label_probs, probs, size);
+        break;
+    }
+}
+
+static float
+tracking_get_label_prob(struct gm_tracking_impl *tracking,
+                        int off, int label)
+{
+    struct gm_context *ctx = tracking->ctx;
+
+    if (!tracking->label_probs)
+        return tracking->label_map[off] == label ? 1.f : 0.f;
+
+    size_t i = (size_t)off * ctx->n_labels + label;
+    switch (tracking->label_probs_format) {
+    case GM_LABEL_PROBS_U8:
+        return ((uint8_t *)tracking->label_probs)[i] / 255.f;
+    case GM_LABEL_PROBS_HALF:
+        return ((half *)tracking->label_probs)[i];
+    case GM_LABEL_PROBS_FLOAT:
+        return ((float *)tracking->label_probs)[i];
+    }
+
+    return 0;
+}
+
 static bool
 gm_context_track_skeleton(struct gm_context *ctx,
                           struct gm_tracking_impl *tracking)
@@ -1477,17 +1728,29 @@ gm_context_track_skeleton(struct gm_context *ctx,
     float nan = std::numeric_limits<float>::quiet_NaN();
     pcl::PointXYZ invalid_pt(nan, nan, nan);
 
+    memset(ctx->stage_ns, 0, sizeof(ctx->stage_ns));
+
+    /* Apply any reductions in quality chosen by the adaptive quality
+     * controller on top of the configured properties...
+     */
+    const struct quality_level *quality =
+        &quality_levels[ctx->adaptive_quality ? ctx->quality_level : 0];
+    int cloud_res = std::min(ctx->cloud_res + quality->cloud_res_add, 4);
+    int seg_res = std::min(ctx->seg_res + quality->seg_res_add, 4);
+    int n_trees = std::max(ctx->n_decision_trees - quality->drop_trees, 1);
+
     // X increases to the right
     // Y increases downwards
     // Z increases outwards
 
     // Project depth buffer into cloud and filter out points that are too
     // near/far.
+    ProfilePushSection(Projection);
     start = get_time();
     pcl::PointCloud<pcl::PointXYZ>::Ptr hires_cloud(
         new pcl::PointCloud<pcl::PointXYZ>);
-    hires_cloud->width = tracking->depth_camera_intrinsics.width / ctx->cloud_res;
-    hires_cloud->height = tracking->depth_camera_intrinsics.height / ctx->cloud_res;
+    hires_cloud->width = tracking->depth_camera_intrinsics.width / cloud_res;
+    hires_cloud->height = tracking->depth_camera_intrinsics.height / cloud_res;
     hires_cloud->points.resize(hires_cloud->width * hires_cloud->height);
     hires_cloud->is_dense = false;
 
@@ -1499,14 +1762,14 @@ gm_context_track_skeleton(struct gm_context *ctx,
     float cy = tracking->depth_camera_intrinsics.cy;
 
     foreach_xy_off(hires_cloud->width, hires_cloud->height) {
-        int doff = (y * ctx->cloud_res) * tracking->depth_camera_intrinsics.width +
-                   (x * ctx->cloud_res);
+        int doff = (y * cloud_res) * tracking->depth_camera_intrinsics.width +
+                   (x * cloud_res);
         float depth = tracking->depth[doff];
         if (std::isnormal(depth) &&
             depth >= ctx->min_depth &&
             depth < ctx->max_depth) {
-            float dx = ((x * ctx->cloud_res) - cx) * depth * inv_fx;
-            float dy = -((y * ctx->cloud_res) - cy) * depth * inv_fy;
+            float dx = ((x * cloud_res) - cx) * depth * inv_fx;
+            float dy = -((y * cloud_res) - cy) * depth * inv_fy;
             hires_cloud->points[off].x = dx;
             hires_cloud->points[off].y = dy;
             hires_cloud->points[off].z = depth;
@@ -1522,17 +1785,17 @@ gm_context_track_skeleton(struct gm_context *ctx,
     // doing so and give us less useful data structures.
     int n_lores_points;
     pcl::PointCloud<pcl::PointXYZ>::Ptr lores_cloud;
-    if (ctx->seg_res > 1) {
+    if (seg_res > 1) {
         lores_cloud = boost::shared_ptr<pcl::PointCloud<pcl::PointXYZ>>(
               new pcl::PointCloud<pcl::PointXYZ>);
-        lores_cloud->width = hires_cloud->width / ctx->seg_res;
-        lores_cloud->height = hires_cloud->height / ctx->seg_res;
+        lores_cloud->width = hires_cloud->width / seg_res;
+        lores_cloud->height = hires_cloud->height / seg_res;
         lores_cloud->points.resize(lores_cloud->width * lores_cloud->height);
         lores_cloud->is_dense = false;
 
         n_lores_points = 0;
         foreach_xy_off(lores_cloud->width, lores_cloud->height) {
-            int hoff = (y * ctx->seg_res) * hires_cloud->width + (x * ctx->seg_res);
+            int hoff = (y * seg_res) * hires_cloud->width + (x * seg_res);
             lores_cloud->points[off] = hires_cloud->points[hoff];
             if (!std::isnan(lores_cloud->points[off].z)) {
                 ++n_lores_points;
@@ -1544,13 +1807,16 @@ gm_context_track_skeleton(struct gm_context *ctx,
     }
 
     end = get_time();
+    ProfilePopSection();
     duration = end - start;
+    ctx->stage_ns[TRACKING_STAGE_PROJECTION] = duration;
     LOGI("Projection (%d points, %d low-res) took (%.3f%s)\n",
          n_points, n_lores_points,
          get_duration_ns_print_scale(duration),
          get_duration_ns_print_scale_suffix(duration));
 
     // Remove dense planes above a certain size
+    ProfilePushSection(Normals);
     start = get_time();
 
     // Estimate normals of depth cloud
@@ -1592,12 +1858,15 @@ gm_context_track_skeleton(struct gm_context *ctx,
 #endif
 
     end = get_time();
+    ProfilePopSection();
     duration = end - start;
+    ctx->stage_ns[TRACKING_STAGE_NORMALS] = duration;
     LOGI("Normal estimation took (%.3f%s)\n",
          get_duration_ns_print_scale(duration),
          get_duration_ns_print_scale_suffix(duration));
 
     // Segment clouds into planes
+    ProfilePushSection(Planes);
     start = get_time();
 
     pcl::OrganizedMultiPlaneSegmentation<pcl::PointXYZ, pcl::Normal, pcl::Label>
@@ -1703,12 +1972,15 @@ gm_context_track_skeleton(struct gm_context *ctx,
 #endif
 
     end = get_time();
+    ProfilePopSection();
     duration = end - start;
+    ctx->stage_ns[TRACKING_STAGE_PLANES] = duration;
     LOGI("Plane removal (%d planes) took %.3f%s\n",
          (int)plane_indices.size(),
          get_duration_ns_print_scale(duration),
          get_duration_ns_print_scale_suffix(duration));
 
+    ProfilePushSection(Clustering);
     start = get_time();
 
     // Use depth clustering to split the cloud into possible human clusters.
@@ -1727,7 +1999,9 @@ gm_context_track_skeleton(struct gm_context *ctx,
     depth_connector.segment(*tracking->cluster_labels, cluster_indices);
 
     end = get_time();
+    ProfilePopSection();
     duration = end - start;
+    ctx->stage_ns[TRACKING_STAGE_CLUSTERING] = duration;
     LOGI("Clustering took (%d clusters) %.3f%s\n",
          (int)cluster_indices.size(),
          get_duration_ns_print_scale(duration),
@@ -1735,6 +2009,7 @@ gm_context_track_skeleton(struct gm_context *ctx,
 
     // Assume the largest cluster that has roughly human dimensions and
     // contains its centroid may be a person.
+    ProfilePushSection(Detection);
     start = get_time();
 
     //const float centroid_tolerance = 0.1f;
@@ -1794,11 +2069,26 @@ gm_context_track_skeleton(struct gm_context *ctx,
     }
 
     end = get_time();
+    ProfilePopSection();
     duration = end - start;
+    ctx->stage_ns[TRACKING_STAGE_DETECTION] = duration;
     LOGI("People detection took %.3f%s\n",
          get_duration_ns_print_scale(duration),
          get_duration_ns_print_scale_suffix(duration));
 
+    /* When limiting the number of candidates we consider the largest
+     * clusters first
+     */
+    if (quality->max_candidates &&
+        (int)persons.size() > quality->max_candidates)
+    {
+        std::sort(persons.begin(), persons.end(),
+                  [](const pcl::PointIndices &a, const pcl::PointIndices &b) {
+                      return a.indices.size() > b.indices.size();
+                  });
+        persons.resize(quality->max_candidates);
+    }
+
     if (persons.size() == 0) {
         // TODO: We should do an interpolation step here.
         LOGE("Skipping detection: Could not find a person cluster\n");
@@ -1812,12 +2102,14 @@ gm_context_track_skeleton(struct gm_context *ctx,
         return false;
     }
 
+    ProfilePushSection(Reprojection);
     start = get_time();
     int width = tracking->training_camera_intrinsics.width;
     int height = tracking->training_camera_intrinsics.height;
 
     if (width == 0 || height == 0) {
         LOGE("Skipping detection: training camera intrinsics uninitialized\n");
+        ProfilePopSection();
         return false;
     }
 
@@ -1850,11 +2142,11 @@ gm_context_track_skeleton(struct gm_context *ctx,
              it != (*p_it).indices.end (); ++it) {
             int lx = (*it) % lores_cloud->width;
             int ly = (*it) / lores_cloud->width;
-            for (int hy = (int)(ly * ctx->seg_res), ey = 0;
-                 hy < (int)hires_cloud->height && ey < ctx->seg_res;
+            for (int hy = (int)(ly * seg_res), ey = 0;
+                 hy < (int)hires_cloud->height && ey < seg_res;
                  ++hy, ++ey) {
-                for (int hx = (int)(lx * ctx->seg_res), ex = 0;
-                     hx < (int)hires_cloud->width && ex < ctx->seg_res;
+                for (int hx = (int)(lx * seg_res), ex = 0;
+                     hx < (int)hires_cloud->width && ex < seg_res;
                      ++hx, ++ex) {
                     int off = hy * hires_cloud->width + hx;
 
@@ -1894,7 +2186,9 @@ gm_context_track_skeleton(struct gm_context *ctx,
 
 
     end = get_time();
+    ProfilePopSection();
     duration = end - start;
+    ctx->stage_ns[TRACKING_STAGE_REPROJECTION] = duration;
     LOGI("Re-projecting %d %dx%d point clouds took %.3f%s\n",
          (int)persons.size(), (int)width, (int)height,
          get_duration_ns_print_scale(duration),
@@ -1906,29 +2200,40 @@ gm_context_track_skeleton(struct gm_context *ctx,
         xmalloc(width * height * ctx->n_joints * sizeof(float));
     float *label_probs = (float*)xmalloc(width * height * ctx->n_labels *
                                          sizeof(float));
+    float *best_label_probs = (float*)xmalloc(width * height * ctx->n_labels *
+                                              sizeof(float));
+    bool have_label_probs = false;
     tracking->skeleton.distance = FLT_MAX;
     for (std::vector<float*>::iterator it = depth_images.begin();
          it != depth_images.end(); ++it) {
+        ProfilePushSection(InferLabels);
         start = get_time();
         float *depth_img = *it;
-        infer_labels<float>(ctx->decision_trees, ctx->n_decision_trees,
-                            depth_img, width, height, label_probs);
+        infer_labels<float>(ctx->decision_trees, n_trees,
+                            depth_img, width, height, label_probs,
+                            quality->label_stride);
         end = get_time();
+        ProfilePopSection();
         duration = end - start;
+        ctx->stage_ns[TRACKING_STAGE_LABELS] += duration;
         LOGI("Label probability (%d trees, %dx%d) inference took %.3f%s\n",
-             (int)ctx->n_decision_trees, (int)width, (int)height,
+             n_trees, (int)width, (int)height,
              get_duration_ns_print_scale(duration),
              get_duration_ns_print_scale_suffix(duration));
 
+        ProfilePushSection(PixelWeights);
         start = get_time();
         calc_pixel_weights<float>(depth_img, label_probs, width, height,
                                   ctx->n_labels, ctx->joint_map, weights);
         end = get_time();
+        ProfilePopSection();
         duration = end - start;
+        ctx->stage_ns[TRACKING_STAGE_WEIGHTS] += duration;
         LOGI("Calculating pixel weights took %.3f%s\n",
              get_duration_ns_print_scale(duration),
              get_duration_ns_print_scale_suffix(duration));
 
+        ProfilePushSection(InferJoints);
         start = get_time();
         InferredJoints *candidate =
             infer_joints_fast<float>(depth_img, label_probs, weights,
@@ -1940,7 +2245,9 @@ gm_context_track_skeleton(struct gm_context *ctx,
         assert(candidate->n_joints == ctx->n_joints);
 
         end = get_time();
+        ProfilePopSection();
         duration = end - start;
+        ctx->stage_ns[TRACKING_STAGE_JOINTS] += duration;
 
         struct gm_skeleton candidate_skeleton(ctx->n_joints);
         build_skeleton(ctx, candidate, candidate_skeleton);
@@ -1956,9 +2263,13 @@ gm_context_track_skeleton(struct gm_context *ctx,
 
         if (compare_skeletons(candidate_skeleton, tracking->skeleton)) {
             std::swap(tracking->skeleton, candidate_skeleton);
-            std::swap(tracking->label_probs, label_probs);
+            std::swap(best_label_probs, label_probs);
+            have_label_probs = true;
         }
     }
+    if (have_label_probs)
+        tracking_store_label_probs(ctx, tracking, best_label_probs);
+    xfree(best_label_probs);
     xfree(label_probs);
     xfree(weights);
 
@@ -1967,6 +2278,7 @@ gm_context_track_skeleton(struct gm_context *ctx,
         return false;
     }
 
+    ProfilePushSection(JointProcessing);
     start = get_time();
 
     // TODO: We just take the most confident skeleton above, but we should
@@ -1974,7 +2286,9 @@ gm_context_track_skeleton(struct gm_context *ctx,
     process_joint_inference(ctx, tracking);
 
     end = get_time();
+    ProfilePopSection();
     duration = end - start;
+    ctx->stage_ns[TRACKING_STAGE_PROCESSING] = duration;
     LOGI("Joint processing took %.3f%s\n",
          get_duration_ns_print_scale(duration),
          get_duration_ns_print_scale_suffix(duration));
@@ -2136,6 +2450,212 @@ update_face_detect_luminance_buffer(struct gm_context *ctx,
 #endif // !DOWNSAMPLE_ON_GPU
 }
 
+/* SIMD helpers for splat_points_to_depth(), using GCC vector extensions so
+ * that the same code maps to NEON on Android and SSE on desktop.
+ */
+typedef float splat_v4sf __attribute__((vector_size(16)));
+typedef int32_t splat_v4si __attribute__((vector_size(16)));
+
+struct depth_splat_params {
+    float fx, fy, cx, cy;
+
+    /* Brown's model with k1, k2, k3 applied as a polynomial in ru^2:
+     *   rd / ru = 1 + k1 * ru^2 + k2 * ru^4 + k3 * ru^6
+     * which is equivalent to rd = ru + k1 * ru^3 + k2 * ru^5 + k3 * ru^7
+     * without needing a sqrtf() to find ru
+     */
+    bool apply_distortion;
+    float k1, k2, k3;
+
+    /* Size of the unrotated image points are projected into */
+    int width;
+    int height;
+
+    /* The output offset for unrotated pixel (x, y) is
+     * base + x * x_stride + y * y_stride, taking into account rotation
+     */
+    int base;
+    int x_stride;
+    int y_stride;
+};
+
+static inline splat_v4sf
+splat_select(splat_v4si mask, splat_v4sf a, splat_v4sf b)
+{
+    return (splat_v4sf)(((splat_v4si)a & mask) | ((splat_v4si)b & ~mask));
+}
+
+/* Projects an XYZC point cloud into a (cleared) depth buffer, keeping the
+ * nearest depth for each pixel.
+ *
+ * Projection is done four points at a time and only the z-tested scatter
+ * into the depth buffer is scalar.
+ */
+static void
+splat_points_to_depth(const float *xyzc, int n_points,
+                      const struct depth_splat_params *p,
+                      float *depth_out)
+{
+    const splat_v4sf zero = { 0, 0, 0, 0 };
+    const splat_v4sf one = { 1, 1, 1, 1 };
+    int n_blocks = n_points / 4;
+    int offsets[4];
+
+    for (int b = 0; b < n_blocks; b++) {
+        const float *pt = xyzc + b * 16;
+        splat_v4sf x = { pt[0], pt[4], pt[8], pt[12] };
+        splat_v4sf y = { pt[1], pt[5], pt[9], pt[13] };
+        splat_v4sf z = { pt[2], pt[6], pt[10], pt[14] };
+
+        /* Substitute z = 1 for invalid points to avoid dividing by zero */
+        splat_v4si valid = z > zero;
+        splat_v4sf inv_z = one / splat_select(valid, z, one);
+        splat_v4sf nx = x * inv_z;
+        splat_v4sf ny = y * inv_z;
+
+        if (p->apply_distortion) {
+            splat_v4sf r2 = nx * nx + ny * ny;
+            splat_v4sf scale = one + r2 * (p->k1 + r2 * (p->k2 + r2 * p->k3));
+            nx *= scale;
+            ny *= scale;
+        }
+
+        splat_v4sf px = nx * p->fx + p->cx;
+        splat_v4sf py = ny * p->fy + p->cy;
+
+        /* Range check before truncating so that, as with an (int) cast,
+         * (-1, 0) maps to pixel 0
+         */
+        valid &= (px > -1.f) & (px < (float)p->width);
+        valid &= (py > -1.f) & (py < (float)p->height);
+        px = splat_select(valid, px, zero);
+        py = splat_select(valid, py, zero);
+
+        splat_v4si ix = __builtin_convertvector(px, splat_v4si);
+        splat_v4si iy = __builtin_convertvector(py, splat_v4si);
+        splat_v4si off = p->base + ix * p->x_stride + iy * p->y_stride;
+        off = (off & valid) | ~valid; // -1 for invalid points
+
+        memcpy(offsets, &off, sizeof(offsets));
+        for (int i = 0; i < 4; i++) {
+            if (offsets[i] < 0)
+                continue;
+            float d = z[i];
+            float *dst = &depth_out[offsets[i]];
+            if (*dst == 0 || d < *dst)
+                *dst = d;
+        }
+    }
+
+    for (int i = n_blocks * 4; i < n_points; i++) {
+        const float *pt = xyzc + i * 4;
+        float z = pt[2];
+        if (!(z > 0))
+            continue;
+
+        float nx = pt[0] / z;
+        float ny = pt[1] / z;
+        if (p->apply_distortion) {
+            float r2 = nx * nx + ny * ny;
+            float scale = 1.f + r2 * (p->k1 + r2 * (p->k2 + r2 * p->k3));
+            nx *= scale;
+            ny *= scale;
+        }
+
+        float px = nx * p->fx + p->cx;
+        float py = ny * p->fy + p->cy;
+        if (!(px > -1.f && px < p->width && py > -1.f && py < p->height))
+            continue;
+
+        float *dst = &depth_out[p->base + (int)px * p->x_stride +
+                                (int)py * p->y_stride];
+        if (*dst == 0 || z < *dst)
+            *dst = z;
+    }
+}
+
+/* Fills small gaps in a depth buffer by interpolating between valid pixels
+ * either side, horizontally or vertically (whichever is closer).
+ *
+ * This is done in a single pass, in place. Filled pixels are temporarily
+ * stored negated so they aren't mistaken for real samples by later pixels,
+ * and are restored once no later pixel can look at them any more.
+ */
+static void
+fill_depth_gaps(float *depth, int width, int height,
+                int gap_dist, float gap_tolerance)
+{
+#define valid_depth(D) ((D) > 0 && std::isnormal(D))
+    for (int y = 0; y <= height + gap_dist; y++) {
+        /* Rows more than gap_dist above the current row are final */
+        int done_y = y - gap_dist - 1;
+        if (done_y >= 0) {
+            float *row = depth + done_y * width;
+            for (int x = 0; x < width; x++) {
+                if (row[x] < 0)
+                    row[x] = -row[x];
+            }
+        }
+        if (y >= height)
+            continue;
+
+        for (int x = 0; x < width; x++) {
+            int off = y * width + x;
+            if (valid_depth(depth[off]) || depth[off] < 0)
+                continue;
+
+            int left = 0, right = 0, up = 0, down = 0;
+            for (int i = 1;
+                 i <= gap_dist && !(left && right) && !(up && down); ++i) {
+                if (!left && (x - i) >= 0 && valid_depth(depth[off - i]))
+                    left = i;
+                if (!right && (x + i) < width && valid_depth(depth[off + i]))
+                    right = i;
+                if (!up && (y - i) >= 0 &&
+                    valid_depth(depth[off - (i * width)]))
+                    up = i;
+                if (!down && (y + i) < height &&
+                    valid_depth(depth[off + (i * width)]))
+                    down = i;
+            }
+
+            bool hvalid = false;
+            if (left && right) {
+                float lval = depth[off - left];
+                float rval = depth[off + right];
+                if (fabsf(rval - lval) < gap_tolerance * (left + right))
+                    hvalid = true;
+            }
+            bool vvalid = false;
+            if (up && down) {
+                float uval = depth[off - (up * width)];
+                float dval = depth[off + (down * width)];
+                if (fabsf(dval - uval) < gap_tolerance * (up + down) &&
+                    (up + down < left + right || !(left && right)))
+                {
+                    vvalid = true;
+                    hvalid = false;
+                }
+            }
+
+            // Note, this interpolation isn't correct because it doesn't
+            // take depth into account. This has a more extreme effect
+            // at oblique angles, but hopefully we won't be filling in
+            // too many pixels so it shouldn't matter too much.
+            if (hvalid) {
+                float lval = depth[off - left];
+                float rval = depth[off + right];
+                depth[off] = -(lval + (rval - lval) * left / (left + right));
+            } else if (vvalid) {
+                float uval = depth[off - (up * width)];
+                float dval = depth[off + (down * width)];
+                depth[off] = -(uval + (dval - uval) * up / (up + down));
+            }
+        }
+    }
+#undef valid_depth
+}
+
 static void
 copy_and_rotate_depth_buffer(struct gm_context *ctx,
                              struct gm_tracking_impl *tracking,
@@ -2148,10 +2668,24 @@ copy_and_rotate_depth_buffer(struct gm_context *ctx,
     int rot_height = tracking->depth_camera_intrinsics.height;
     enum gm_rotation rotation = tracking->frame->camera_rotation;
     void *depth = buffer->data;
-    float *depth_copy = tracking->depth;
+    float *depth_copy = tracking->depth_storage;
 
     int num_points;
 
+    /* If the device's buffer is already in the format we want then we can
+     * use it directly. Device buffers are never written to after being
+     * handed out and the tracking state holds a reference on the frame for
+     * as long as it needs the depth data.
+     */
+    if (format == GM_FORMAT_Z_F32_M &&
+        rotation == GM_ROTATION_0 &&
+        buffer->len >= width * height * sizeof(float))
+    {
+        tracking->depth = (float *)depth;
+        return;
+    }
+    tracking->depth = depth_copy;
+
     // Not ideal how we use `with_rotated_rx_ry_roff` per-pixel, but it lets
     // us easily combine our rotation with our copy...
     //
@@ -2199,179 +2733,88 @@ copy_and_rotate_depth_buffer(struct gm_context *ctx,
         float cx = ctx->basis_depth_camera_intrinsics.cx;
         float cy = ctx->basis_depth_camera_intrinsics.cy;
 
-        float k1, k2, k3;
+        struct depth_splat_params params = {};
+        params.fx = fx;
+        params.fy = fy;
+        params.cx = cx;
+        params.cy = cy;
+        params.width = width;
+        params.height = height;
 
+        switch (rotation) {
+        case GM_ROTATION_0:
+            params.base = 0;
+            params.x_stride = 1;
+            params.y_stride = rot_width;
+            break;
+        case GM_ROTATION_90:
+            params.base = (width - 1) * rot_width;
+            params.x_stride = -rot_width;
+            params.y_stride = 1;
+            break;
+        case GM_ROTATION_180:
+            params.base = (height - 1) * rot_width + (width - 1);
+            params.x_stride = -1;
+            params.y_stride = -rot_width;
+            break;
+        case GM_ROTATION_270:
+            params.base = height - 1;
+            params.x_stride = rot_width;
+            params.y_stride = -1;
+            break;
+        }
+
+        // Google documented their POLY_3 distortion model should
+        // be evaluated as:
+        //   rd = ru + k1 * ru^3 + k2 * ru^5 + k3 * ru^7
+        // they also refer to the same model as Brown's with only
+        // k1, k2 and k3 coefficients, but e.g. referencing Wikipedia
+        // and looking for other interpretations of the Brown-Conrady
+        // model then it looks like there's some inconsistency with
+        // the ru exponents used. Wikipedia uses:
+        //   k1 * ru^2 + k2 * ru^4 + k3 * ru^6
+        //
         /* XXX: we only support applying the brown's model... */
-        bool apply_distortion = ctx->apply_depth_distortion;
-        if (apply_distortion) {
-            switch (ctx->basis_depth_camera_intrinsics.distortion_model) {
+        params.apply_distortion = ctx->apply_depth_distortion;
+        if (params.apply_distortion) {
+            struct gm_intrinsics *intrinsics =
+                &ctx->basis_depth_camera_intrinsics;
+
+            switch (intrinsics->distortion_model) {
             case GM_DISTORTION_NONE:
-                apply_distortion = false;
+                params.apply_distortion = false;
                 break;
             case GM_DISTORTION_FOV_MODEL:
-                apply_distortion = false;
+                params.apply_distortion = false;
                 break;
             case GM_DISTORTION_BROWN_K1_K2:
-                k1 = ctx->basis_depth_camera_intrinsics.distortion[0];
-                k2 = ctx->basis_depth_camera_intrinsics.distortion[1];
-                k3 = 0;
+                params.k1 = intrinsics->distortion[0];
+                params.k2 = intrinsics->distortion[1];
+                params.k3 = 0;
                 break;
             case GM_DISTORTION_BROWN_K1_K2_K3:
-                k1 = ctx->basis_depth_camera_intrinsics.distortion[0];
-                k2 = ctx->basis_depth_camera_intrinsics.distortion[1];
-                k3 = ctx->basis_depth_camera_intrinsics.distortion[2];
+                params.k1 = intrinsics->distortion[0];
+                params.k2 = intrinsics->distortion[1];
+                params.k3 = intrinsics->distortion[2];
                 break;
             case GM_DISTORTION_BROWN_K1_K2_P1_P2_K3:
-                k1 = ctx->basis_depth_camera_intrinsics.distortion[0];
-                k2 = ctx->basis_depth_camera_intrinsics.distortion[1];
-                k3 = ctx->basis_depth_camera_intrinsics.distortion[4];
+                params.k1 = intrinsics->distortion[0];
+                params.k2 = intrinsics->distortion[1];
+                params.k3 = intrinsics->distortion[4];
                 /* Ignoring tangential distortion */
                 break;
             }
         }
 
-        for (int off = 0; off < num_points; off++) {
-            float *xyzc = ((float *)buffer->data) + 4 * off;
-            float ru, ru2, ru3, ru4, ru5, ru6, ru7;
-            float rd;
-
-            // Reproject this point into training camera space
-            glm::vec3 point_t(xyzc[0], xyzc[1], xyzc[2]);
-
-            int x;
-            if (apply_distortion) {
-                ru = sqrtf((point_t.x*point_t.x + point_t.y*point_t.y) /
-                                 (point_t.z*point_t.z));
-                ru2 = ru*ru;
-                ru3 = ru2*ru;
-                ru4 = ru3*ru;
-                ru5 = ru4*ru;
-                ru6 = ru5*ru;
-                ru7 = ru6*ru;
-
-                // Google documented their POLY_3 distortion model should
-                // be evaluated as:
-                //   rd = ru + k1 * ru^3 + k2 * ru^5 + k3 * ru^7
-                // they also refer to the same model as Brown's with only
-                // k1, k2 and k3 coefficients, but e.g. referencing Wikipedia
-                // and looking for other interpretations of the Brown-Conrady
-                // model then it looks like there's some inconsistency with
-                // the ru exponents used. Wikipedia uses:
-                //   k1 * ru^2 + k2 * ru^4 + k3 * ru^6
-                rd = ru + k1 * ru3 + k2 * ru5 + k3 * ru7;
-
-                x = (int)(point_t.x / point_t.z * fx * rd / ru + cx);
-            } else
-                x = (int)((point_t.x * fx / point_t.z) + cx);
-
-            if (x < 0 || x >= width) {
-                continue;
-            }
-
-            int y;
-            if (apply_distortion)
-                y = (int)(point_t.y / point_t.z * fy * rd / ru + cy);
-            else
-                y = (int)((point_t.y * fy / point_t.z) + cy);
-            if (y < 0 || y >= height) {
-                continue;
-            }
-
-            with_rotated_rx_ry_roff(x, y, width, height,
-                                    rotation, rot_width,
-                                    { depth_copy[roff] = point_t.z; });
-        }
+        splat_points_to_depth((float *)buffer->data, num_points,
+                              &params, depth_copy);
 
         if (ctx->depth_gap_fill) {
             // Our code doesn't deal well with gaps in the data, so make some
             // effort to fill in gaps that may have been caused by bad data,
             // distortion transforms, etc.
-            struct blank {
-                int off;
-                float new_depth;
-            };
-            std::vector<struct blank> blanks;
-
-            foreach_xy_off(rot_width, rot_height) {
-                if (std::isnormal(depth_copy[off])) {
-                    continue;
-                }
-
-                // Check to see if gaps can be filled by surrounding pixels on
-                // either the horizontal or vertical axis
-                int left = 0, right = 0, up = 0, down = 0;
-                for (int i = 1;
-                     i <= ctx->gap_dist && !(left && right) && !(up && down); ++i) {
-                    if (!left && (x - i) >= 0 && std::isnormal(depth_copy[off-i])) {
-                        left = i;
-                    }
-                    if (!right && (x + i) < rot_width &&
-                        std::isnormal(depth_copy[off+i])) {
-                        right = i;
-                    }
-                    if (!up && (y - i) >= 0 &&
-                        std::isnormal(depth_copy[off - (i * rot_width)])) {
-                        up = i;
-                    }
-                    if (!down && (y + i) < rot_height &&
-                        std::isnormal(depth_copy[off + (i * rot_width)])) {
-                        down = i;
-                    }
-                }
-
-                bool hvalid = false;
-                if (left && right) {
-                    float lval = depth_copy[off-left];
-                    float rval = depth_copy[off+right];
-                    float distance = fabsf(rval - lval);
-                    if (distance < ctx->gap_tolerance * (left + right)) {
-                        hvalid = true;
-                    }
-                }
-                bool vvalid = false;
-                if (up && down) {
-                    int pix_dist = up + down;
-                    float uval = depth_copy[off-(up * rot_width)];
-                    float dval = depth_copy[off+(down * rot_width)];
-                    float distance = fabsf(dval - uval);
-                    if (distance < ctx->gap_tolerance * pix_dist) {
-                        if (pix_dist < left + right || !(left && right)) {
-                            vvalid = true;
-                            hvalid = false;
-                        }
-                    }
-                }
-
-                if (hvalid || vvalid) {
-                    // Note, this interpolation isn't correct because it doesn't
-                    // take depth into account. This has a more extreme effect
-                    // at oblique angles, but hopefully we won't be filling in
-                    // too many pixels so it shouldn't matter too much.
-                    if (hvalid) {
-                        int pix_dist = left + right;
-                        float lval = depth_copy[off-left];
-                        float rval = depth_copy[off+right];
-                        for (int o = -left + 1, i = 0; o < right; ++o, ++i) {
-                            float new_depth = ((lval * ((pix_dist - 1) - o)) +
-                                               (rval * o)) / (float)(pix_dist - 1);
-                            blanks.push_back({off + o, new_depth});
-                        }
-                    } else {
-                        int pix_dist = up + down;
-                        float uval = depth_copy[off-(up * rot_width)];
-                        float dval = depth_copy[off+(down * rot_width)];
-                        for (int o = -up + 1, i = 0; o < down; ++o, ++i) {
-                            float new_depth = ((uval * ((pix_dist - 1) - o)) +
-                                               (dval * o)) / (float)(pix_dist - 1);
-                            blanks.push_back({off + (o * rot_width), new_depth});
-                        }
-                    }
-                }
-            }
-
-            for (unsigned i = 0; i < blanks.size(); ++i) {
-                depth_copy[blanks[i].off] = blanks[i].new_depth;
-            }
+            fill_depth_gaps(depth_copy, rot_width, rot_height,
+                            ctx->gap_dist, ctx->gap_tolerance);
         }
         break;
     }
@@ -2449,12 +2892,91 @@ gm_context_rotate_intrinsics(struct gm_context *ctx,
     }
 }
 
-static void *
-detector_thread_cb(void *data)
+static void
+log_quality_decision(struct gm_context *ctx, int old_level, const char *reason)
 {
-    struct gm_context *ctx = (struct gm_context *)data;
+    const struct quality_level *quality = &quality_levels[ctx->quality_level];
 
-    gm_debug(ctx->log, "Started Glimpse tracking thread");
+    int slowest = 0;
+    for (int i = 1; i < N_TRACKING_STAGES; i++) {
+        if (ctx->stage_ns[i] > ctx->stage_ns[slowest])
+            slowest = i;
+    }
+
+    gm_info(ctx->log,
+            "Quality level %d -> %d (%s): avg tracking = %.3fms, "
+            "budget = %.3fms, slowest stage = %s (%.3fms); "
+            "trees = %d, label stride = %d, seg_res = %d, cloud_res = %d, "
+            "max candidates = %d",
+            old_level, ctx->quality_level, reason,
+            ctx->avg_tracking_ms, ctx->frame_budget_ms,
+            tracking_stage_names[slowest], ctx->stage_ns[slowest] / 1e6,
+            std::max(ctx->n_decision_trees - quality->drop_trees, 1),
+            quality->label_stride,
+            std::min(ctx->seg_res + quality->seg_res_add, 4),
+            std::min(ctx->cloud_res + quality->cloud_res_add, 4),
+            quality->max_candidates);
+}
+
+/* Steps the quality level down while tracking is consistently slower than
+ * the frame budget and back up once there's consistently some headroom.
+ */
+static void
+update_adaptive_quality(struct gm_context *ctx, uint64_t duration_ns)
+{
+    if (!ctx->adaptive_quality) {
+        if (ctx->quality_level) {
+            int old_level = ctx->quality_level;
+            ctx->quality_level = 0;
+            log_quality_decision(ctx, old_level, "disabled");
+        }
+        return;
+    }
+
+    float duration_ms = duration_ns / 1e6;
+    if (ctx->avg_tracking_ms == 0)
+        ctx->avg_tracking_ms = duration_ms;
+    else
+        ctx->avg_tracking_ms = ctx->avg_tracking_ms * 0.8f + duration_ms * 0.2f;
+
+    if (ctx->avg_tracking_ms > ctx->frame_budget_ms) {
+        ctx->n_over_budget++;
+        ctx->n_under_budget = 0;
+    } else if (ctx->avg_tracking_ms < ctx->frame_budget_ms * QUALITY_HEADROOM) {
+        ctx->n_under_budget++;
+        ctx->n_over_budget = 0;
+    } else {
+        ctx->n_over_budget = 0;
+        ctx->n_under_budget = 0;
+    }
+
+    int max_level = ARRAY_LEN(quality_levels) - 1;
+    int old_level = ctx->quality_level;
+
+    if (ctx->n_over_budget >= QUALITY_DEGRADE_FRAMES &&
+        ctx->quality_level < max_level)
+    {
+        ctx->quality_level++;
+        log_quality_decision(ctx, old_level, "over budget");
+    } else if (ctx->n_under_budget >= QUALITY_RESTORE_FRAMES &&
+               ctx->quality_level > 0)
+    {
+        ctx->quality_level--;
+        log_quality_decision(ctx, old_level, "headroom");
+    } else {
+        return;
+    }
+
+    /* Give the new level a chance to take effect before changing again */
+    ctx->n_over_budget = 0;
+    ctx->n_under_budget = 0;
+}
+
+static void
+context_init_face_detection(struct gm_context *ctx)
+{
+    if (ctx->face_detection_initialized)
+        return;
 
     uint64_t start = get_time();
     ctx->detector = dlib::get_frontal_face_detector();
@@ -2493,157 +3015,296 @@ detector_thread_cb(void *data)
         free(err);
     }
 
-    while (!ctx->stopping) {
-        struct gm_frame *frame = NULL;
+    ctx->face_detection_initialized = true;
+}
 
-        LOGI("Waiting for new frame to start tracking\n");
-        pthread_mutex_lock(&ctx->frame_ready_mutex);
-        while (!ctx->frame_ready && !ctx->stopping) {
-            pthread_cond_wait(&ctx->frame_ready_cond, &ctx->frame_ready_mutex);
-        }
-        frame = ctx->frame_ready;
-        ctx->frame_ready = NULL;
-        pthread_mutex_unlock(&ctx->frame_ready_mutex);
+/* Hands the given tracking over to the face detection thread if it's time
+ * for another face detection pass.
+ */
+static void
+maybe_queue_face_detection(struct gm_context *ctx,
+                           struct gm_tracking_impl *tracking)
+{
+    if (!ctx->face_detection ||
+        !tracking->frame->video ||
+        !tracking->face_detect_buf)
+    {
+        return;
+    }
 
-        if (ctx->stopping) {
-            gm_debug(ctx->log, "Stopping tracking after frame acquire (context being destroyed)");
-            if (frame)
-                gm_frame_unref(frame);
-            break;
-        }
+    uint64_t now = get_time();
+    uint64_t interval_ns = ctx->face_detect_interval_ms * 1000000.0;
+    if (ctx->last_face_detect_queue_time &&
+        now - ctx->last_face_detect_queue_time < interval_ns)
+    {
+        return;
+    }
+    ctx->last_face_detect_queue_time = now;
 
-        start = get_time();
-        gm_debug(ctx->log, "Starting tracking iteration (%" PRIu64 ")\n",
-                 frame->timestamp);
+    struct gm_tracking_impl *stale = NULL;
 
-        struct gm_tracking_impl *tracking =
-            mem_pool_acquire_tracking(ctx->tracking_pool);
+    pthread_mutex_lock(&ctx->face_detect_mutex);
+    stale = ctx->face_detect_pending;
+    ctx->face_detect_pending = (struct gm_tracking_impl *)
+        gm_tracking_ref(&tracking->base);
+    pthread_cond_signal(&ctx->face_detect_cond);
+    pthread_mutex_unlock(&ctx->face_detect_mutex);
 
-        tracking->frame = frame;
+    if (stale) {
+        gm_debug(ctx->log, "Face detection still busy, dropping stale frame");
+        gm_tracking_unref(&stale->base);
+    }
+}
 
-        /* FIXME: rotate the camera extrinsics according to the display rotation */
-        tracking->extrinsics_set = ctx->basis_extrinsics_set;
-        tracking->depth_to_video_extrinsics = ctx->basis_depth_to_video_extrinsics;
+static void *
+face_detect_thread_cb(void *data)
+{
+    struct gm_context *ctx = (struct gm_context *)data;
 
-        gm_context_rotate_intrinsics(ctx,
-                                     &ctx->basis_video_camera_intrinsics,
-                                     &tracking->video_camera_intrinsics,
-                                     tracking->frame->camera_rotation);
-        gm_context_rotate_intrinsics(ctx,
-                                     &ctx->basis_depth_camera_intrinsics,
-                                     &tracking->depth_camera_intrinsics,
-                                     tracking->frame->camera_rotation);
+    gm_debug(ctx->log, "Started Glimpse face detection thread");
 
-        tracking->training_camera_intrinsics = ctx->basis_training_camera_intrinsics;
+    ProfileSetThreadName("Glimpse Faces");
 
-        copy_and_rotate_depth_buffer(ctx,
-                                     tracking,
-                                     frame->depth_format,
-                                     frame->depth);
+    context_init_face_detection(ctx);
 
-        /* FIXME: re-enable support for face detection */
-#if 0
-        /* While downsampling on the CPU we currently do that synchronously
-         * when we are notified of a new frame.
-         */
-#ifdef DOWNSAMPLE_ON_GPU
-        gm_debug(ctx->log, "Waiting for new scaled frame for face detection");
-        pthread_mutex_lock(&ctx->scaled_frame_cond_mutex);
-        ctx->need_new_scaled_frame = true;
-        while (ctx->need_new_scaled_frame && !ctx->stopping) {
-            pthread_cond_wait(&ctx->scaled_frame_available_cond,
-                              &ctx->scaled_frame_cond_mutex);
+    while (true) {
+        pthread_mutex_lock(&ctx->face_detect_mutex);
+        while (!ctx->face_detect_pending && !ctx->stopping) {
+            pthread_cond_wait(&ctx->face_detect_cond, &ctx->face_detect_mutex);
         }
-        pthread_mutex_unlock(&ctx->scaled_frame_cond_mutex);
+        struct gm_tracking_impl *tracking = ctx->face_detect_pending;
+        ctx->face_detect_pending = NULL;
+        pthread_mutex_unlock(&ctx->face_detect_mutex);
 
         if (ctx->stopping) {
-            gm_debug(ctx->log, "Stopping tracking after frame downsample (context being destroyed)");
-            gm_tracking_unref(tracking);
+            gm_debug(ctx->log, "Stopping face detection (context being destroyed)");
+            if (tracking)
+                gm_tracking_unref(&tracking->base);
             break;
         }
-#else
-        update_face_detect_luminance_buffer(ctx,
-                                            tracking,
-                                            frame->video_format,
-                                            (uint8_t *)frame->video->data);
 
-#endif
+        ProfileScopedSection(DetectFaces);
 
-        gm_context_detect_faces(ctx, tracking);
-#endif
+        uint64_t start = get_time();
 
-        bool tracked = gm_context_track_skeleton(ctx, tracking);
+        /* NB: face_detect_buf is only used by the face detection stage so
+         * it's OK to fill it in after the tracking has been published
+         */
+        update_face_detect_luminance_buffer(ctx,
+                                            tracking,
+                                            tracking->frame->video_format,
+                                            (uint8_t *)tracking->frame->video->data);
+        gm_context_detect_faces(ctx, tracking);
 
-        end = get_time();
-        duration = end - start;
-        gm_debug(ctx->log, "Finished skeletal tracking (%.3f%s)",
+        uint64_t duration = get_time() - start;
+        gm_debug(ctx->log, "Finished face detection (%.3f%s)",
                  get_duration_ns_print_scale(duration),
                  get_duration_ns_print_scale_suffix(duration));
 
-        pthread_mutex_lock(&ctx->tracking_swap_mutex);
+        gm_tracking_unref(&tracking->base);
+    }
 
-        if (tracked) {
-            tracking->success = true;
+    ProfileFinishThread();
 
-            // Clear the tracking history if we've gone back in time
-            if (ctx->n_tracking && tracking->frame->timestamp <
-                ctx->tracking_history[0]->frame->timestamp) {
-                gm_warn(ctx->log,
-                        "Tracking has gone back in time, clearing history");
+    return NULL;
+}
 
-                for (int i = 0; i < ctx->n_tracking; ++i) {
-                    gm_tracking_unref(&ctx->tracking_history[i]->base);
-                    ctx->tracking_history[i] = NULL;
-                }
-                ctx->n_tracking = 0;
-            }
+/* Runs a single tracking iteration for the given frame, either on our own
+ * tracking thread or on a worker thread belonging to a gm_host.
+ *
+ * Takes ownership of the frame reference.
+ */
+static void
+context_track_frame(struct gm_context *ctx, struct gm_frame *frame)
+{
+    ProfileScopedSection(TrackFrame);
+
+    uint64_t start = get_time();
+    gm_debug(ctx->log, "Starting tracking iteration (%" PRIu64 ")\n",
+             frame->timestamp);
+
+    struct gm_tracking_impl *tracking =
+        mem_pool_acquire_tracking(ctx->tracking_pool);
+
+    tracking->frame = frame;
+
+    /* FIXME: rotate the camera extrinsics according to the display rotation */
+    tracking->extrinsics_set = ctx->basis_extrinsics_set;
+    tracking->depth_to_video_extrinsics = ctx->basis_depth_to_video_extrinsics;
+
+    gm_context_rotate_intrinsics(ctx,
+                                 &ctx->basis_video_camera_intrinsics,
+                                 &tracking->video_camera_intrinsics,
+                                 tracking->frame->camera_rotation);
+    gm_context_rotate_intrinsics(ctx,
+                                 &ctx->basis_depth_camera_intrinsics,
+                                 &tracking->depth_camera_intrinsics,
+                                 tracking->frame->camera_rotation);
+
+    tracking->training_camera_intrinsics = ctx->basis_training_camera_intrinsics;
+
+    ProfilePushSection(CopyDepth);
+    copy_and_rotate_depth_buffer(ctx,
+                                 tracking,
+                                 frame->depth_format,
+                                 frame->depth);
+    ProfilePopSection();
+
+    bool tracked = gm_context_track_skeleton(ctx, tracking);
+
+    update_adaptive_quality(ctx, get_time() - start);
+
+    /* The intermediate clouds are only needed while tracking so we don't
+     * keep them around in the tracking history unless asked to...
+     */
+    if (!(ctx->debug_retention & GM_TRACKING_RETAIN_NORMALS))
+        tracking->normals.reset();
+    if (!(ctx->debug_retention & GM_TRACKING_RETAIN_CLUSTERS)) {
+        tracking->normal_labels.reset();
+        tracking->cluster_labels.reset();
+    }
+
+    uint64_t end = get_time();
+    uint64_t duration = end - start;
+    gm_debug(ctx->log, "Finished skeletal tracking (%.3f%s)",
+             get_duration_ns_print_scale(duration),
+             get_duration_ns_print_scale_suffix(duration));
+
+    /* Attach whatever face detection results we have so far */
+    if (ctx->face_detection) {
+        pthread_mutex_lock(&ctx->face_detect_mutex);
+        tracking->faces = ctx->faces;
+        tracking->faces_timestamp = ctx->faces_timestamp;
+        pthread_mutex_unlock(&ctx->face_detect_mutex);
+    } else {
+        tracking->faces.clear();
+        tracking->faces_timestamp = 0;
+    }
+
+    pthread_mutex_lock(&ctx->tracking_swap_mutex);
 
-            for (int i = TRACK_FRAMES - 1; i > 0; i--)
-                std::swap(ctx->tracking_history[i], ctx->tracking_history[i - 1]);
-            if (ctx->tracking_history[0]) {
-                gm_debug(ctx->log, "pushing %p out of tracking history fifo (ref = %d)\n",
-                         ctx->tracking_history[0],
-                         ctx->tracking_history[0]->base.ref);
-                gm_tracking_unref(&ctx->tracking_history[0]->base);
+    if (tracked) {
+        tracking->success = true;
+
+        // Clear the tracking history if we've gone back in time
+        if (ctx->n_tracking && tracking->frame->timestamp <
+            ctx->tracking_history[0]->frame->timestamp) {
+            gm_warn(ctx->log,
+                    "Tracking has gone back in time, clearing history");
+
+            for (int i = 0; i < ctx->n_tracking; ++i) {
+                gm_tracking_unref(&ctx->tracking_history[i]->base);
+                ctx->tracking_history[i] = NULL;
             }
-            ctx->tracking_history[0] = (struct gm_tracking_impl *)
-                gm_tracking_ref(&tracking->base);
+            ctx->n_tracking = 0;
+        }
 
-            gm_debug(ctx->log, "adding %p to tracking history fifo (ref = %d)\n",
+        for (int i = TRACK_FRAMES - 1; i > 0; i--)
+            std::swap(ctx->tracking_history[i], ctx->tracking_history[i - 1]);
+        if (ctx->tracking_history[0]) {
+            gm_debug(ctx->log, "pushing %p out of tracking history fifo (ref = %d)\n",
                      ctx->tracking_history[0],
                      ctx->tracking_history[0]->base.ref);
+            gm_tracking_unref(&ctx->tracking_history[0]->base);
+        }
+        ctx->tracking_history[0] = (struct gm_tracking_impl *)
+            gm_tracking_ref(&tracking->base);
 
-            if (ctx->n_tracking < TRACK_FRAMES)
-                ctx->n_tracking++;
+        gm_debug(ctx->log, "adding %p to tracking history fifo (ref = %d)\n",
+                 ctx->tracking_history[0],
+                 ctx->tracking_history[0]->base.ref);
 
-            gm_debug(ctx->log, "tracking history len = %d:", ctx->n_tracking);
-            for (int i = 0; i < ctx->n_tracking; i++) {
-                gm_debug(ctx->log, "%d) %p (ref = %d)", i,
-                         ctx->tracking_history[i],
-                         ctx->tracking_history[i]->base.ref);
-            }
+        if (ctx->n_tracking < TRACK_FRAMES)
+            ctx->n_tracking++;
+
+        gm_debug(ctx->log, "tracking history len = %d:", ctx->n_tracking);
+        for (int i = 0; i < ctx->n_tracking; i++) {
+            gm_debug(ctx->log, "%d) %p (ref = %d)", i,
+                     ctx->tracking_history[i],
+                     ctx->tracking_history[i]->base.ref);
         }
+    }
 
-        /* Hold onto the latest tracking regardless of whether it was
-         * successful so that a user can still access the all the information
-         * related to tracking.
-         */
-        if (ctx->latest_tracking)
-            gm_tracking_unref(&ctx->latest_tracking->base);
-        ctx->latest_tracking = tracking;
+    /* Hold onto the latest tracking regardless of whether it was
+     * successful so that a user can still access the all the information
+     * related to tracking.
+     */
+    if (ctx->latest_tracking)
+        gm_tracking_unref(&ctx->latest_tracking->base);
+    ctx->latest_tracking = tracking;
 
-        pthread_mutex_unlock(&ctx->tracking_swap_mutex);
+    pthread_mutex_unlock(&ctx->tracking_swap_mutex);
+
+    notify_tracking(ctx);
+
+    maybe_queue_face_detection(ctx, tracking);
+
+    gm_debug(ctx->log, "Requesting new frame for skeletal tracking");
+    /* We throttle frame acquisition according to our tracking rate... */
+    request_frame(ctx);
+}
+
+static void *
+detector_thread_cb(void *data)
+{
+    struct gm_context *ctx = (struct gm_context *)data;
+
+    gm_debug(ctx->log, "Started Glimpse tracking thread");
+
+    ProfileSetThreadName("Glimpse Track");
 
-        notify_tracking(ctx);
+    while (!ctx->stopping) {
+        struct gm_frame *frame = NULL;
 
-        gm_debug(ctx->log, "Requesting new frame for skeletal tracking");
-        /* We throttle frame acquisition according to our tracking rate... */
-        request_frame(ctx);
+        LOGI("Waiting for new frame to start tracking\n");
+        pthread_mutex_lock(&ctx->frame_ready_mutex);
+        while (!ctx->frame_ready && !ctx->stopping) {
+            pthread_cond_wait(&ctx->frame_ready_cond, &ctx->frame_ready_mutex);
+        }
+        frame = ctx->frame_ready;
+        ctx->frame_ready = NULL;
+        pthread_mutex_unlock(&ctx->frame_ready_mutex);
+
+        if (ctx->stopping) {
+            gm_debug(ctx->log, "Stopping tracking after frame acquire (context being destroyed)");
+            if (frame)
+                gm_frame_unref(frame);
+            break;
+        }
+
+        context_track_frame(ctx, frame);
     }
 
+    ProfileFinishThread();
+
     return NULL;
 }
 
+static void
+host_run_tracking_cb(struct gm_host_camera *camera,
+                     void *job,
+                     void *user_data)
+{
+    struct gm_context *ctx = (struct gm_context *)user_data;
+    struct gm_frame *frame = (struct gm_frame *)job;
+
+    if (ctx->stopping) {
+        gm_debug(ctx->log, "Dropping host tracking job (context stopping)");
+        gm_frame_unref(frame);
+        return;
+    }
+
+    context_track_frame(ctx, frame);
+}
+
+static void
+host_drop_tracking_cb(struct gm_host_camera *camera,
+                      void *job,
+                      void *user_data)
+{
+    gm_frame_unref((struct gm_frame *)job);
+}
+
 static void
 tracking_state_free(struct gm_mem_pool *pool,
                     void *self,
@@ -2651,10 +3312,11 @@ tracking_state_free(struct gm_mem_pool *pool,
 {
     struct gm_tracking_impl *tracking = (struct gm_tracking_impl *)self;
 
+    free(tracking->label_map);
     free(tracking->label_probs);
     free(tracking->joints_processed);
 
-    free(tracking->depth);
+    free(tracking->depth_storage);
 
     free(tracking->face_detect_buf);
 
@@ -2665,6 +3327,12 @@ tracking_state_free(struct gm_mem_pool *pool,
     delete tracking;
 }
 
+static struct gm_mem_pool_link *
+tracking_state_get_pool_link(void *resource)
+{
+    return &((struct gm_tracking_impl *)resource)->pool_link;
+}
+
 static void
 tracking_state_recycle(struct gm_tracking *self)
 {
@@ -2674,6 +3342,9 @@ tracking_state_recycle(struct gm_tracking *self)
     gm_assert(tracking->ctx->log, tracking->base.ref == 0,
               "Unbalanced tracking unref");
 
+    /* The depth may have been borrowed from the frame */
+    tracking->depth = tracking->depth_storage;
+
     gm_frame_unref(tracking->frame);
     tracking->frame = NULL;
 
@@ -2723,9 +3394,7 @@ tracking_state_alloc(struct gm_mem_pool *pool, void *user_data)
     assert(labels_width);
     assert(labels_height);
 
-    tracking->label_probs = (float *)xcalloc(labels_width *
-                                             labels_height *
-                                             ctx->n_labels, sizeof(float));
+    tracking->label_map = (uint8_t *)xcalloc(labels_width * labels_height, 1);
 
     tracking->skeleton.joints.resize(ctx->n_joints);
     tracking->joints_processed = (float *)
@@ -2737,8 +3406,9 @@ tracking_state_alloc(struct gm_mem_pool *pool, void *user_data)
     assert(depth_width);
     assert(depth_height);
 
-    tracking->depth = (float *)
+    tracking->depth_storage = (float *)
       xcalloc(depth_width * depth_height, sizeof(float));
+    tracking->depth = tracking->depth_storage;
 
     int video_width = ctx->basis_video_camera_intrinsics.width;
     int video_height = ctx->basis_video_camera_intrinsics.height;
@@ -2759,6 +3429,16 @@ tracking_state_alloc(struct gm_mem_pool *pool, void *user_data)
     tracking->face_detect_buf_height = video_height;
 #endif
 
+    /* NB: this doesn't account for any debug state retained via
+     * gm_context_set_debug_retention()
+     */
+    mem_pool_set_resource_size(pool,
+                               sizeof(*tracking) +
+                               labels_width * labels_height +
+                               depth_width * depth_height * sizeof(float) +
+                               video_width * video_height +
+                               ctx->n_joints * 3 * sizeof(float));
+
     return tracking;
 }
 
@@ -2777,6 +3457,12 @@ prediction_free(struct gm_mem_pool *pool,
     delete prediction;
 }
 
+static struct gm_mem_pool_link *
+prediction_get_pool_link(void *resource)
+{
+    return &((struct gm_prediction_impl *)resource)->pool_link;
+}
+
 static void
 prediction_recycle(struct gm_prediction *self)
 {
@@ -2833,6 +3519,8 @@ prediction_alloc(struct gm_mem_pool *pool, void *user_data)
 
     prediction->ctx = ctx;
 
+    mem_pool_set_resource_size(pool, sizeof(*prediction));
+
     return (void *)prediction;
 }
 
@@ -2903,12 +3591,39 @@ gm_context_clear_tracking(struct gm_context *ctx)
 static int
 gm_context_start_tracking(struct gm_context *ctx, char **err)
 {
-    /* XXX: maybe make it an explicit, public api to start running detection
+    /* Face detection runs on its own thread, whether or not tracking runs
+     * on a host's workers
      */
-    int ret = pthread_create(&ctx->detect_thread,
+    int ret = pthread_create(&ctx->face_detect_thread,
                              nullptr, /* default attributes */
-                             detector_thread_cb,
+                             face_detect_thread_cb,
                              ctx);
+    if (ret != 0)
+        return ret;
+    pthread_setname_np(ctx->face_detect_thread, "Glimpse Faces");
+
+    if (ctx->host) {
+        struct gm_host_camera *camera =
+            gm_host_add_camera(ctx->host,
+                               ctx->host_camera_name,
+                               ctx->host_deadline_ns,
+                               host_run_tracking_cb,
+                               host_drop_tracking_cb,
+                               ctx);
+
+        pthread_mutex_lock(&ctx->frame_ready_mutex);
+        ctx->host_camera = camera;
+        pthread_mutex_unlock(&ctx->frame_ready_mutex);
+
+        return 0;
+    }
+
+    /* XXX: maybe make it an explicit, public api to start running detection
+     */
+    ret = pthread_create(&ctx->detect_thread,
+                         nullptr, /* default attributes */
+                         detector_thread_cb,
+                         ctx);
 
     if (ret == 0) {
         pthread_setname_np(ctx->detect_thread, "Glimpse Track");
@@ -2943,8 +3658,16 @@ gm_context_stop_tracking(struct gm_context *ctx)
      */
     pthread_mutex_lock(&ctx->frame_ready_mutex);
     pthread_cond_signal(&ctx->frame_ready_cond);
+    struct gm_host_camera *host_camera = ctx->host_camera;
+    ctx->host_camera = NULL;
     pthread_mutex_unlock(&ctx->frame_ready_mutex);
 
+    /* Drops any pending frame and waits for an in-flight tracking iteration
+     * to finish on the host's workers...
+     */
+    if (host_camera)
+        gm_host_remove_camera(ctx->host, host_camera);
+
     /* It's also possible the tracker thread is waiting for a downsampled
      * frame in pthread_cond_wait...
      */
@@ -2967,6 +3690,30 @@ gm_context_stop_tracking(struct gm_context *ctx)
                      (int)(intptr_t)tracking_retval);
         }
     }
+
+    /* Only once tracking has stopped can we be sure that no more frames
+     * will be queued for face detection...
+     */
+    pthread_mutex_lock(&ctx->face_detect_mutex);
+    pthread_cond_signal(&ctx->face_detect_cond);
+    pthread_mutex_unlock(&ctx->face_detect_mutex);
+
+    if (ctx->face_detect_thread) {
+        int ret = pthread_join(ctx->face_detect_thread, NULL);
+        if (ret < 0) {
+            gm_error(ctx->log, "Failed waiting for face detection thread to complete: %s",
+                     strerror(ret));
+        } else {
+            ctx->face_detect_thread = 0;
+        }
+    }
+
+    pthread_mutex_lock(&ctx->face_detect_mutex);
+    if (ctx->face_detect_pending) {
+        gm_tracking_unref(&ctx->face_detect_pending->base);
+        ctx->face_detect_pending = NULL;
+    }
+    pthread_mutex_unlock(&ctx->face_detect_mutex);
 }
 
 void
@@ -3052,6 +3799,8 @@ gm_context_destroy(struct gm_context *ctx)
     if (ctx->joint_map)
         json_value_free(ctx->joint_map);
 
+    free(ctx->host_camera_name);
+
     if (ctx->joint_stats) {
         for (int i = 0; i < ctx->n_joints; i++) {
             xfree(ctx->joint_stats[i].connections);
@@ -3076,19 +3825,24 @@ gm_context_new(struct gm_logger *logger, char **err)
     pthread_cond_init(&ctx->skel_track_cond, NULL);
     pthread_mutex_init(&ctx->skel_track_cond_mutex, NULL);
 
-    ctx->tracking_pool = mem_pool_alloc(logger,
-                                        "tracking",
-                                        INT_MAX, // max size
-                                        tracking_state_alloc,
-                                        tracking_state_free,
-                                        ctx); // user data
-
-    ctx->prediction_pool = mem_pool_alloc(logger,
-                                          "prediction",
-                                          INT_MAX,
-                                          prediction_alloc,
-                                          prediction_free,
-                                          ctx);
+    pthread_cond_init(&ctx->face_detect_cond, NULL);
+    pthread_mutex_init(&ctx->face_detect_mutex, NULL);
+
+    ctx->tracking_pool = mem_pool_alloc_lockless(logger,
+                                                 "tracking",
+                                                 INT_MAX, // max size
+                                                 tracking_state_alloc,
+                                                 tracking_state_free,
+                                                 tracking_state_get_pool_link,
+                                                 ctx); // user data
+
+    ctx->prediction_pool = mem_pool_alloc_lockless(logger,
+                                                   "prediction",
+                                                   INT_MAX,
+                                                   prediction_alloc,
+                                                   prediction_free,
+                                                   prediction_get_pool_link,
+                                                   ctx);
 
     /* Load the decision trees immediately so we know how many labels we're
      * dealing with asap.
@@ -3655,6 +4409,100 @@ gm_context_new(struct gm_logger *logger, char **err)
     prop.enum_state.enumerants = ctx->label_enumerants.data();
     ctx->properties.push_back(prop);
 
+    ctx->face_detection = false;
+    prop = gm_ui_property();
+    prop.object = ctx;
+    prop.name = "face_detection";
+    prop.desc = "Detect faces (asynchronously, without delaying tracking)";
+    prop.type = GM_PROPERTY_BOOL;
+    prop.bool_state.ptr = &ctx->face_detection;
+    ctx->properties.push_back(prop);
+
+    ctx->face_detect_interval_ms = 200.f;
+    prop = gm_ui_property();
+    prop.object = ctx;
+    prop.name = "face_detect_interval_ms";
+    prop.desc = "Minimum time between face detection passes (ms)";
+    prop.type = GM_PROPERTY_FLOAT;
+    prop.float_state.ptr = &ctx->face_detect_interval_ms;
+    prop.float_state.min = 0.f;
+    prop.float_state.max = 2000.f;
+    ctx->properties.push_back(prop);
+
+    ctx->adaptive_quality = false;
+    prop = gm_ui_property();
+    prop.object = ctx;
+    prop.name = "adaptive_quality";
+    prop.desc = "Automatically reduce tracking quality to stay within the "
+                "frame budget";
+    prop.type = GM_PROPERTY_BOOL;
+    prop.bool_state.ptr = &ctx->adaptive_quality;
+    ctx->properties.push_back(prop);
+
+    ctx->frame_budget_ms = 33.3f;
+    prop = gm_ui_property();
+    prop.object = ctx;
+    prop.name = "frame_budget_ms";
+    prop.desc = "Target tracking time per frame for adaptive quality (ms)";
+    prop.type = GM_PROPERTY_FLOAT;
+    prop.float_state.ptr = &ctx->frame_budget_ms;
+    prop.float_state.min = 5.f;
+    prop.float_state.max = 200.f;
+    ctx->properties.push_back(prop);
+
+    ctx->quality_level = 0;
+    prop = gm_ui_property();
+    prop.object = ctx;
+    prop.name = "quality_level";
+    prop.desc = "Current adaptive quality level (0 = best)";
+    prop.type = GM_PROPERTY_INT;
+    prop.int_state.ptr = &ctx->quality_level;
+    prop.int_state.min = 0;
+    prop.int_state.max = ARRAY_LEN(quality_levels) - 1;
+    prop.read_only = true;
+    ctx->properties.push_back(prop);
+
+    prop = gm_ui_property();
+    prop.object = ctx;
+    prop.name = "avg_tracking_ms";
+    prop.desc = "Running average of the time spent tracking each frame (ms)";
+    prop.type = GM_PROPERTY_FLOAT;
+    prop.float_state.ptr = &ctx->avg_tracking_ms;
+    prop.float_state.min = 0.f;
+    prop.float_state.max = 1000.f;
+    prop.read_only = true;
+    ctx->properties.push_back(prop);
+
+    ctx->label_probs_format = GM_LABEL_PROBS_HALF;
+    prop = gm_ui_property();
+    prop.object = ctx;
+    prop.name = "label_probs_format";
+    prop.desc = "Precision of label probabilities retained for debugging";
+    prop.type = GM_PROPERTY_ENUM;
+    prop.enum_state.ptr = &ctx->label_probs_format;
+
+    enumerant = gm_ui_enumerant();
+    enumerant.name = "u8";
+    enumerant.desc = "8-bit fixed point";
+    enumerant.val = GM_LABEL_PROBS_U8;
+    ctx->label_probs_format_enumerants.push_back(enumerant);
+
+    enumerant = gm_ui_enumerant();
+    enumerant.name = "half";
+    enumerant.desc = "Half-precision float";
+    enumerant.val = GM_LABEL_PROBS_HALF;
+    ctx->label_probs_format_enumerants.push_back(enumerant);
+
+    enumerant = gm_ui_enumerant();
+    enumerant.name = "float";
+    enumerant.desc = "Single-precision float";
+    enumerant.val = GM_LABEL_PROBS_FLOAT;
+    ctx->label_probs_format_enumerants.push_back(enumerant);
+
+    prop.enum_state.n_enumerants = ctx->label_probs_format_enumerants.size();
+    prop.enum_state.enumerants = ctx->label_probs_format_enumerants.data();
+    ctx->properties.push_back(prop);
+
     ctx->properties_state.n_properties = ctx->properties.size();
     pthread_mutex_init(&ctx->properties_state.lock, NULL);
     ctx->properties_state.properties = &ctx->properties[0];
@@ -3662,6 +4510,12 @@ gm_context_new(struct gm_logger *logger, char **err)
     return ctx;
 }
 
+void
+gm_context_set_debug_retention(struct gm_context *ctx, uint64_t flags)
+{
+    ctx->debug_retention = flags;
+}
+
 void
 gm_context_set_depth_camera_intrinsics(struct gm_context *ctx,
                                        struct gm_intrinsics *intrinsics)
@@ -3768,15 +4622,7 @@ gm_tracking_create_rgb_label_map(struct gm_tracking *_tracking,
               ctx->debug_label);
 
     foreach_xy_off(*width, *height) {
-        uint8_t label = 0;
-        float pr = -1.0;
-        float *pr_table = &tracking->label_probs[off * n_labels];
-        for (uint8_t l = 0; l < n_labels; l++) {
-            if (pr_table[l] > pr) {
-                label = l;
-                pr = pr_table[l];
-            }
-        }
+        uint8_t label = tracking->label_map[off];
 
         uint8_t r;
         uint8_t g;
@@ -3790,7 +4636,9 @@ gm_tracking_create_rgb_label_map(struct gm_tracking *_tracking,
             struct color col = stops_color_from_val(ctx->heat_color_stops,
                                                     ctx->n_heat_color_stops,
                                                     1,
-                                                    pr_table[ctx->debug_label]);
+                                                    tracking_get_label_prob(tracking,
+                                                                            off,
+                                                                            ctx->debug_label));
             r = col.r;
             g = col.g;
             b = col.b;
@@ -3912,6 +4760,12 @@ gm_tracking_create_rgb_normals(struct gm_tracking *_tracking,
     struct gm_tracking_impl *tracking = (struct gm_tracking_impl *)_tracking;
     //struct gm_context *ctx = tracking->ctx;
 
+    if (!tracking->normals) {
+        *width = 0;
+        *height = 0;
+        return;
+    }
+
     *width = (int)tracking->normals->width;
     *height = (int)tracking->normals->height;
 
@@ -3944,6 +4798,12 @@ gm_tracking_create_rgb_normal_clusters(struct gm_tracking *_tracking,
     struct gm_tracking_impl *tracking = (struct gm_tracking_impl *)_tracking;
     //struct gm_context *ctx = tracking->ctx;
 
+    if (!tracking->normal_labels) {
+        *width = 0;
+        *height = 0;
+        return;
+    }
+
     *width = (int)tracking->normal_labels->width;
     *height = (int)tracking->normal_labels->height;
 
@@ -3970,6 +4830,12 @@ gm_tracking_create_rgb_candidate_clusters(struct gm_tracking *_tracking,
     struct gm_tracking_impl *tracking = (struct gm_tracking_impl *)_tracking;
     //struct gm_context *ctx = tracking->ctx;
 
+    if (!tracking->cluster_labels) {
+        *width = 0;
+        *height = 0;
+        return;
+    }
+
     *width = (int)tracking->cluster_labels->width;
     *height = (int)tracking->cluster_labels->height;
 
@@ -3988,19 +4854,34 @@ gm_tracking_create_rgb_candidate_clusters(struct gm_tracking *_tracking,
     }
 }
 
-const float *
+const void *
 gm_tracking_get_label_probabilities(struct gm_tracking *_tracking,
                                     int *width,
-                                    int *height)
+                                    int *height,
+                                    enum gm_label_probs_format *format)
 {
     struct gm_tracking_impl *tracking = (struct gm_tracking_impl *)_tracking;
 
     *width = tracking->training_camera_intrinsics.width;
     *height = tracking->training_camera_intrinsics.height;
+    *format = tracking->label_probs_format;
 
     return tracking->label_probs;
 }
 
+const uint8_t *
+gm_tracking_get_label_map(struct gm_tracking *_tracking,
+                          int *width,
+                          int *height)
+{
+    struct gm_tracking_impl *tracking = (struct gm_tracking_impl *)_tracking;
+
+    *width = tracking->training_camera_intrinsics.width;
+    *height = tracking->training_camera_intrinsics.height;
+
+    return tracking->label_map;
+}
+
 uint64_t
 gm_tracking_get_timestamp(struct gm_tracking *_tracking)
 {
@@ -4009,6 +4890,18 @@ gm_tracking_get_timestamp(struct gm_tracking *_tracking)
     return tracking->frame->timestamp;
 }
 
+const float *
+gm_tracking_get_faces(struct gm_tracking *_tracking,
+                      int *n_faces,
+                      uint64_t *faces_timestamp)
+{
+    struct gm_tracking_impl *tracking = (struct gm_tracking_impl *)_tracking;
+
+    if (n_faces) *n_faces = tracking->faces.size() / 4;
+    if (faces_timestamp) *faces_timestamp = tracking->faces_timestamp;
+    return tracking->faces.size() ? tracking->faces.data() : NULL;
+}
+
 int
 gm_skeleton_get_n_joints(const struct gm_skeleton *skeleton)
 {
@@ -4053,10 +4946,18 @@ gm_context_notify_frame(struct gm_context *ctx,
 
     pthread_mutex_lock(&ctx->frame_ready_mutex);
     gm_assert(ctx->log, !ctx->destroying, "Spurious frame notification during destruction");
-    if (ctx->frame_ready)
-        gm_frame_unref(ctx->frame_ready);
-    ctx->frame_ready = gm_frame_ref(frame);
-    pthread_cond_signal(&ctx->frame_ready_cond);
+    if (ctx->host) {
+        /* The host replaces (and unrefs) any frame still pending for this
+         * camera. Frames are simply ignored while tracking is stopped.
+         */
+        if (ctx->host_camera)
+            gm_host_submit_job(ctx->host, ctx->host_camera, gm_frame_ref(frame));
+    } else {
+        if (ctx->frame_ready)
+            gm_frame_unref(ctx->frame_ready);
+        ctx->frame_ready = gm_frame_ref(frame);
+        pthread_cond_signal(&ctx->frame_ready_cond);
+    }
     pthread_mutex_unlock(&ctx->frame_ready_mutex);
 
     pthread_mutex_unlock(&ctx->liveness_lock);
@@ -4088,6 +4989,45 @@ gm_context_flush(struct gm_context *ctx, char **err)
     }
 }
 
+bool
+gm_context_set_host(struct gm_context *ctx,
+                    struct gm_host *host,
+                    const char *name,
+                    uint64_t deadline_ns,
+                    char **err)
+{
+    gm_context_stop_tracking(ctx);
+
+    free(ctx->host_camera_name);
+    ctx->host_camera_name = NULL;
+    if (host) {
+        ctx->host_camera_name = strdup(name ? name : "context");
+        ctx->host_deadline_ns = deadline_ns;
+    }
+
+    /* NB: gm_context_notify_frame() checks ctx->host under this lock */
+    pthread_mutex_lock(&ctx->frame_ready_mutex);
+    if (ctx->frame_ready) {
+        gm_frame_unref(ctx->frame_ready);
+        ctx->frame_ready = NULL;
+    }
+    ctx->host = host;
+    pthread_mutex_unlock(&ctx->frame_ready_mutex);
+
+    ctx->stopping = false;
+    gm_debug(ctx->log, "Restarting tracking %s",
+             host ? "on shared host" : "on dedicated thread");
+
+    int ret = gm_context_start_tracking(ctx, NULL);
+    if (ret != 0) {
+        gm_throw(ctx->log, err,
+                 "Failed to start tracking thread: %s", strerror(ret));
+        return false;
+    }
+
+    return true;
+}
+
 struct gm_tracking *
 gm_context_get_latest_tracking(struct gm_context *ctx)
 {
@@ -4682,6 +5622,15 @@ gm_context_set_event_callback(struct gm_context *ctx,
 void
 gm_context_enable(struct gm_context *ctx)
 {
+    /* Tracking state is sized according to the camera intrinsics so we can
+     * only pre-allocate it once they are known...
+     */
+    if (ctx->basis_depth_camera_intrinsics.width &&
+        ctx->basis_video_camera_intrinsics.width)
+    {
+        mem_pool_prealloc(ctx->tracking_pool, CONTEXT_PREALLOC_TRACKING);
+    }
+
     request_frame(ctx);
 }
 
@@ -53,6 +53,22 @@ enum gm_event_type
 #define GM_REQUEST_FRAME_DEPTH  1ULL<<0
 #define GM_REQUEST_FRAME_VIDEO  1ULL<<1
 
+/* Debug state that can optionally be kept with each tracking object, see
+ * gm_context_set_debug_retention()
+ */
+#define GM_TRACKING_RETAIN_LABEL_PROBS  (1ULL<<0)
+#define GM_TRACKING_RETAIN_NORMALS      (1ULL<<1)
+#define GM_TRACKING_RETAIN_CLUSTERS     (1ULL<<2)
+
+/* How retained label probabilities are stored, as chosen via the context's
+ * "label_probs_format" property
+ */
+enum gm_label_probs_format {
+    GM_LABEL_PROBS_U8,      /* 0-255 for 0-1 */
+    GM_LABEL_PROBS_HALF,    /* half-float */
+    GM_LABEL_PROBS_FLOAT,
+};
+
 struct gm_event
 {
     enum gm_event_type type;
@@ -104,12 +120,16 @@ gm_buffer_add_breadcrumb(struct gm_buffer *buffer, const char *tag)
     buffer->api->add_breadcrumb(buffer, tag);
 }
 
+/* NB: buffers may be shared by several frames at once (e.g. a device
+ * re-emitting the same buffer while playback is paused) with references
+ * being dropped on different threads, so the ref count is atomic.
+ */
 inline struct gm_buffer *
 gm_buffer_ref(struct gm_buffer *buffer)
 {
     assert(buffer->ref >= 0); // implies use after free!
     gm_buffer_add_breadcrumb(buffer, "ref");
-    buffer->ref++;
+    __atomic_add_fetch(&buffer->ref, 1, __ATOMIC_RELAXED);
     return buffer;
 }
 
@@ -117,7 +137,8 @@ inline void
 gm_buffer_unref(struct gm_buffer *buffer)
 {
     gm_buffer_add_breadcrumb(buffer, "unref");
-    if (__builtin_expect(--(buffer->ref) < 1, 0))
+    if (__builtin_expect(__atomic_sub_fetch(&buffer->ref, 1,
+                                            __ATOMIC_ACQ_REL) < 1, 0))
         buffer->api->free(buffer);
 }
 
@@ -261,6 +282,7 @@ struct gm_extrinsics {
 };
 
 struct gm_context;
+struct gm_host;
 
 typedef struct {
     float x;
@@ -312,10 +334,32 @@ struct gm_context *gm_context_new(struct gm_logger *logger, char **err);
 void gm_context_flush(struct gm_context *ctx, char **err);
 void gm_context_destroy(struct gm_context *ctx);
 
+/* Moves tracking off the context's own thread and onto the shared workers
+ * of @host (see glimpse_host.h), registered as a camera with the given
+ * @name and per-frame @deadline_ns. Passing a NULL @host reverts to a
+ * dedicated tracking thread.
+ *
+ * The host must outlive the context (or a subsequent call with a NULL host).
+ */
+bool gm_context_set_host(struct gm_context *ctx,
+                         struct gm_host *host,
+                         const char *name,
+                         uint64_t deadline_ns,
+                         char **err);
+
 
 struct gm_ui_properties *
 gm_context_get_ui_properties(struct gm_context *ctx);
 
+/* By default tracking objects only keep the state needed by the public api
+ * (depth, the most probable label per pixel and the skeleton). A debug
+ * consumer can request that other intermediate state is also retained by
+ * passing a mask of GM_TRACKING_RETAIN_* flags. This only affects tracking
+ * started after the call.
+ */
+void
+gm_context_set_debug_retention(struct gm_context *ctx, uint64_t flags);
+
 void
 gm_context_set_depth_camera_intrinsics(struct gm_context *ctx,
                                        struct gm_intrinsics *intrinsics);
@@ -391,10 +435,21 @@ gm_tracking_get_depth_camera_intrinsics(struct gm_tracking *tracking);
 const gm_intrinsics *
 gm_tracking_get_training_camera_intrinsics(struct gm_tracking *tracking);
 
-const float *
+/* Returns width * height * n_labels probabilities, stored in the given
+ * @format, or NULL unless GM_TRACKING_RETAIN_LABEL_PROBS was requested via
+ * gm_context_set_debug_retention()
+ */
+const void *
 gm_tracking_get_label_probabilities(struct gm_tracking *tracking,
                                     int *width,
-                                    int *height);
+                                    int *height,
+                                    enum gm_label_probs_format *format);
+
+/* The most probable label for each pixel */
+const uint8_t *
+gm_tracking_get_label_map(struct gm_tracking *tracking,
+                          int *width,
+                          int *height);
 
 const float *
 gm_tracking_get_depth(struct gm_tracking *tracking);
@@ -413,6 +468,17 @@ gm_tracking_get_skeleton(struct gm_tracking *tracking);
 uint64_t
 gm_tracking_get_timestamp(struct gm_tracking *tracking);
 
+/* Face bounding boxes as (x, y, width, height) quadruples, normalized to the
+ * video frame. Face detection runs asynchronously, at a lower rate than
+ * skeletal tracking, so these come from the most recent face detection to
+ * have completed when this tracking was published and may lag behind it.
+ * Returns NULL if no faces have been detected.
+ */
+const float *
+gm_tracking_get_faces(struct gm_tracking *tracking,
+                      int *n_faces,
+                      uint64_t *faces_timestamp);
+
 /* Creates an RGB visualisation of the label map. */
 void
 gm_tracking_create_rgb_label_map(struct gm_tracking *tracking,
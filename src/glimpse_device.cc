@@ -28,11 +28,15 @@
 #include <sys/stat.h>
 #include <unistd.h>
 #include <inttypes.h>
+#include <errno.h>
 
 #include <vector>
+#include <string>
+#include <algorithm>
 
 #ifdef USE_FREENECT
 #include <libfreenect.h>
+#include <libfreenect_registration.h>
 #endif
 
 #ifdef __ANDROID__
@@ -48,9 +52,12 @@
 #include "parson.h"
 #include "half.hpp"
 #include "xalloc.h"
+#include "glimpse_rec_pack.h"
 
 #include "image_utils.h"
 
+#include <profiler.h>
+
 #include "glimpse_log.h"
 #include "glimpse_mem_pool.h"
 #include "glimpse_device.h"
@@ -62,6 +69,54 @@
 
 #define ARRAY_LEN(X) (sizeof(X)/sizeof(X[0]))
 
+/* How many frames/buffers to allocate up front once the device is configured.
+ * Enough to cover a frame being captured, one being handed to the tracking
+ * context and one held by the application.
+ */
+#define DEVICE_PREALLOC_FRAMES 3
+
+/* Default number of frames that recording playback tries to keep loaded
+ * ahead of the frame currently being replayed.
+ */
+#define RECORDING_PREFETCH_FRAMES 8
+
+/* How long the prefetch thread backs off for when a buffer budget stops it
+ * from loading another frame
+ */
+#define RECORDING_PREFETCH_THROTTLE_MS 5
+
+/* How many buffers of a budget are left for frames that have been read and
+ * are being delivered or tracked, when limiting the read-ahead ring to fit
+ */
+#define RECORDING_BUDGET_RESERVED_FRAMES 4
+
+/* Limit on the number of breadcrumbs remembered per buffer */
+#define MAX_BUFFER_TRAIL_CRUMBS 64
+
+/* Defaults for synthetic devices */
+#define SYNTHETIC_DEFAULT_MAX_IMAGES 300
+#define SYNTHETIC_MAX_PEOPLE 8
+
+/* How many recent frames a synthetic device remembers ground truth for */
+#define SYNTHETIC_GROUND_TRUTH_FRAMES 32
+
+/* Synthetic people are lined up across the frame, with every other person
+ * pushed further back so that neighbours can partially occlude each other
+ */
+#define SYNTHETIC_PERSON_SPACING_M 0.7f
+#define SYNTHETIC_PERSON_STAGGER_M 0.6f
+
+/* Rendered training images have their background at a huge depth (see
+ * image-pre-processor) which we don't want to composite
+ */
+#define SYNTHETIC_MAX_IMAGE_DEPTH_M 100.f
+
+/* Joints are inside the body so they should be a little behind the surface
+ * seen in the depth image. A larger average difference than this means the
+ * joints are in the wrong coordinate space.
+ */
+#define SYNTHETIC_JOINT_DEPTH_TOLERANCE_M 0.5f
+
 using half_float::half;
 
 struct trail_crumb
@@ -79,6 +134,7 @@ struct gm_device_buffer
 
     struct gm_device *dev;
     struct gm_mem_pool *pool;
+    struct gm_mem_pool_link pool_link;
 
     /* Lets us debug when we've failed to release frame resources when
      * we come to destroy our resource pools
@@ -95,6 +151,7 @@ struct gm_device_frame
 
     struct gm_device *dev;
     struct gm_mem_pool *pool;
+    struct gm_mem_pool_link pool_link;
 
     //TODO
 #if 0
@@ -109,6 +166,80 @@ struct gm_device_frame
     std::vector<struct trail_crumb> trail;
 };
 
+/* Recording frame metadata, decoded up front so that playback doesn't need
+ * to look anything up in the JSON tree.
+ */
+struct recording_frame
+{
+    uint64_t timestamp;
+    enum gm_rotation camera_rotation;
+
+    /* For the directory layout these point into the recording's JSON
+     * metadata (NULL if the frame has no buffer of that type)
+     */
+    const char *depth_file;
+    const char *video_file;
+
+    /* For the pack layout these are offsets into the mapped file */
+    uint64_t depth_offset;
+    uint64_t video_offset;
+
+    size_t depth_len;
+    size_t video_len;
+
+    /* The most recent frame (<= this one) that has a depth buffer, or -1 */
+    int last_depth_frame;
+};
+
+/* A slot in the recording playback read-ahead ring. Frame N is always
+ * loaded into slot N % n_prefetch.
+ *
+ * NB: When a looping recording's length isn't a multiple of n_prefetch then
+ * the window can wrap around onto frames that share a slot (e.g. frames 8
+ * and 0 of a 10 frame recording with 8 slots), in which case only one
+ * of them is prefetched at a time.
+ */
+struct recording_prefetch_slot
+{
+    int frame; // -1 if empty
+    bool loading;
+    struct gm_buffer *depth;
+    struct gm_buffer *video;
+};
+
+#ifdef USE_FREENECT
+/* Raw frames handed from the libfreenect callbacks to the Kinect conversion
+ * thread. libfreenect writes into 'back'; the callback swaps it with
+ * 'pending' (replacing any frame the conversion thread hasn't got to yet)
+ * and the conversion thread swaps 'pending' with 'converting'.
+ */
+struct kinect_raw_buffers
+{
+    void *back;
+    void *pending;
+    void *converting;
+    bool pending_valid;
+    uint64_t pending_time;
+    uint64_t n_dropped;
+};
+
+#define KINECT_WIDTH 640
+#define KINECT_HEIGHT 480
+#define KINECT_MAX_RAW_DEPTH 2048
+#define KINECT_MAX_DEPTH_MM 10000
+
+/* libfreenect registration table x values are in 1/256 pixel units */
+#define KINECT_REG_X_SCALE 256
+#endif
+
+/* Ground truth for one frame emitted by a synthetic device */
+struct synthetic_ground_truth
+{
+    uint64_t timestamp; // 0 if unused
+    int n_people;
+    float *joints; // SYNTHETIC_MAX_PEOPLE * n_joints * 3
+};
+
 struct gm_device
 {
     enum gm_device_type type;
@@ -136,6 +267,16 @@ struct gm_device
             char *path;
             JSON_Value *json;
 
+            /* Set for single-file recordings, otherwise frames are
+             * described by the "frames" array in the json metadata
+             */
+            struct gm_rec_pack *pack;
+
+            enum gm_rec_compression depth_compression;
+
+            struct recording_frame *frames;
+            int n_frames;
+
             /* properties (so careful about changing types) */
             int frame;
             bool loop;
@@ -144,14 +285,70 @@ struct gm_device
             /* Used to break out of pause for skipping frames back and forth */
             bool ignore_loop;
 
+            int playback_mode; // enum gm_recording_playback_mode
+
+            /* Signalled (with request_buffers_mask_lock held) when a frame
+             * is requested or collected, for non-realtime playback
+             */
+            pthread_cond_t consumer_cond;
+
             /* State in case playback is paused: */
             enum gm_rotation last_camera_rotation;
             struct gm_buffer *last_depth_buf;
             struct gm_buffer *last_video_buf;
 
             pthread_t io_thread;
+
+            /* Read-ahead ring filled by the prefetch thread so that the IO
+             * thread doesn't have to block on file IO while pacing playback.
+             *
+             * The prefetch thread tries to keep the n_prefetch frames
+             * following prefetch_cursor loaded (wrapping around if
+             * looping).
+             */
+            int n_prefetch;
+            struct recording_prefetch_slot *prefetch;
+            int prefetch_cursor;
+            pthread_mutex_t prefetch_lock;
+            pthread_cond_t prefetch_cond;
+            pthread_t prefetch_thread;
+            uint64_t n_prefetch_hits;
+            uint64_t n_prefetch_misses;
         } recording;
 
+        struct {
+            /* Training depth images (with their background removed at
+             * composite time) and corresponding joint positions, stored
+             * with +Y down to match the depth camera space
+             */
+            int n_images;
+            half *depth_images;
+            int n_joints;
+            float *joints;
+
+            /* The camera that the training images were rendered with */
+            struct gm_intrinsics image_intrinsics;
+
+            float background_depth;
+
+            /* properties (so careful about changing types) */
+            float fps;
+            int n_people;
+            int frame;
+
+            /* Signalled (with request_buffers_mask_lock held) when a frame
+             * is requested, for unpaced (fps <= 0) synthesis
+             */
+            pthread_cond_t consumer_cond;
+
+            pthread_mutex_t ground_truth_lock;
+            struct synthetic_ground_truth
+                ground_truth[SYNTHETIC_GROUND_TRUTH_FRAMES];
+            int ground_truth_pos;
+
+            pthread_t io_thread;
+        } synthetic;
+
 #ifdef USE_FREENECT
         struct {
             freenect_context *fctx;
@@ -163,6 +360,28 @@ struct gm_device
             float accel[3];
             float mks_accel[3];
             pthread_t io_thread;
+
+            /* The libfreenect callbacks (on the IO thread) only swap raw
+             * buffers so that they never block on buffer pools or
+             * conversion work and USB transfers aren't missed.
+             */
+            pthread_mutex_t raw_lock;
+            pthread_cond_t raw_cond;
+            struct kinect_raw_buffers depth_raw;
+            struct kinect_raw_buffers video_raw;
+            pthread_t convert_thread;
+
+            /* Lookup tables for converting raw 11-bit depth, and for
+             * registering depth to the video camera (from libfreenect's
+             * factory calibration)
+             */
+            uint16_t *raw_to_mm; // [KINECT_MAX_RAW_DEPTH]
+            float *raw_to_m; // [KINECT_MAX_RAW_DEPTH]
+            bool register_depth;
+            int32_t *reg_x; // [w * h], in 1/KINECT_REG_X_SCALE pixels
+            int32_t *reg_y; // [w * h], adjusted for padding lines
+            int32_t *depth_to_rgb_shift; // [KINECT_MAX_DEPTH_MM]
+            uint16_t *registered_mm; // [w * h] scratch, for _Z_F32_M output
         } kinect;
 #endif
 
@@ -218,6 +437,7 @@ struct gm_device
     struct gm_frame *last_frame;
 
     std::vector<struct gm_ui_enumerant> rotation_enumerants;
+    std::vector<struct gm_ui_enumerant> playback_mode_enumerants;
     struct gm_ui_properties properties_state;
     std::vector<struct gm_ui_property> properties;
 
@@ -238,6 +458,12 @@ static const char *rotation_names[] = {
     "270 degrees",
 };
 
+static const char *playback_mode_names[] = {
+    "Realtime",
+    "Max rate",
+    "Lockstep",
+};
+
 #ifdef USE_TANGO
 static pthread_mutex_t jni_lock;
 static jobject early_tango_service_binder;
@@ -301,11 +527,10 @@ mem_pool_acquire_frame(struct gm_mem_pool *pool, const char *bread_crumb)
 }
 
 static struct gm_device_buffer *
-mem_pool_acquire_buffer(struct gm_mem_pool *pool, const char *bread_crumb)
+init_acquired_buffer(struct gm_mem_pool *pool,
+                     struct gm_device_buffer *buffer,
+                     const char *bread_crumb)
 {
-    struct gm_device_buffer *buffer = (struct gm_device_buffer *)
-        mem_pool_acquire_resource(pool);
-
     gm_assert(buffer->dev->log, buffer->base.ref == 0,
               "%s buffer was used after last free", mem_pool_get_name(pool));
 
@@ -316,6 +541,27 @@ mem_pool_acquire_buffer(struct gm_mem_pool *pool, const char *bread_crumb)
     return buffer;
 }
 
+static struct gm_device_buffer *
+mem_pool_acquire_buffer(struct gm_mem_pool *pool, const char *bread_crumb)
+{
+    struct gm_device_buffer *buffer = (struct gm_device_buffer *)
+        mem_pool_acquire_resource(pool);
+
+    return init_acquired_buffer(pool, buffer, bread_crumb);
+}
+
+/* Returns NULL instead of blocking if the pool is at its limit */
+static struct gm_device_buffer *
+mem_pool_try_acquire_buffer(struct gm_mem_pool *pool, const char *bread_crumb)
+{
+    struct gm_device_buffer *buffer = (struct gm_device_buffer *)
+        mem_pool_try_acquire_resource(pool);
+    if (!buffer)
+        return NULL;
+
+    return init_acquired_buffer(pool, buffer, bread_crumb);
+}
+
 static void
 device_frame_recycle(struct gm_frame *self)
 {
@@ -349,6 +595,12 @@ device_frame_free(struct gm_mem_pool *pool, void *resource, void *user_data)
     delete frame;
 }
 
+static struct gm_mem_pool_link *
+device_frame_get_pool_link(void *resource)
+{
+    return &((struct gm_device_frame *)resource)->pool_link;
+}
+
 static void
 device_frame_add_breadcrumb(struct gm_frame *self, const char *tag)
 {
@@ -382,6 +634,8 @@ device_frame_alloc(struct gm_mem_pool *pool, void *user_data)
 
     frame->base.api = &frame->vtable;
 
+    mem_pool_set_resource_size(pool, sizeof(*frame));
+
     return frame;
 }
 
@@ -414,6 +668,13 @@ device_buffer_add_breadcrumb(struct gm_buffer *self, const char *tag)
                                   10);
 
     pthread_mutex_lock(&buffer->trail_lock);
+    /* Buffers can be long lived while re-emitted for paused playback so
+     * only keep the most recent history
+     */
+    if (buffer->trail.size() >= MAX_BUFFER_TRAIL_CRUMBS) {
+        buffer->trail.erase(buffer->trail.begin(),
+                            buffer->trail.begin() + MAX_BUFFER_TRAIL_CRUMBS / 2);
+    }
     buffer->trail.push_back(crumb);
     pthread_mutex_unlock(&buffer->trail_lock);
 }
@@ -445,8 +706,13 @@ device_video_buf_alloc(struct gm_mem_pool *pool, void *user_data)
         /* Allocated large enough for any data format */
         buf->base.len = video_width * video_height * 4;
         break;
+    case GM_DEVICE_SYNTHETIC:
+        /* Allocated large enough for _LUMINANCE_U8 data */
+        buf->base.len = video_width * video_height;
+        break;
     }
     buf->base.data = xmalloc(buf->base.len);
+    mem_pool_set_resource_size(pool, sizeof(*buf) + buf->base.len);
 
     return buf;
 }
@@ -463,6 +729,12 @@ device_buffer_free(struct gm_mem_pool *pool,
     delete buf;
 }
 
+static struct gm_mem_pool_link *
+device_buffer_get_pool_link(void *resource)
+{
+    return &((struct gm_device_buffer *)resource)->pool_link;
+}
+
 static void *
 device_depth_buf_alloc(struct gm_mem_pool *pool, void *user_data)
 {
@@ -489,11 +761,17 @@ device_depth_buf_alloc(struct gm_mem_pool *pool, void *user_data)
         buf->base.len = depth_width * depth_height * 16;
         break;
     case GM_DEVICE_KINECT:
-        /* Allocated large enough for _U16_MM data */
-        buf->base.len = depth_width * depth_height * 2;
+        /* Allocated large enough for _U16_MM or _F32_M data */
+        buf->base.len = depth_width * depth_height *
+            (dev->depth_format == GM_FORMAT_Z_F32_M ? 4 : 2);
+        break;
+    case GM_DEVICE_SYNTHETIC:
+        /* Allocated large enough for _Z_F32_M data */
+        buf->base.len = depth_width * depth_height * 4;
         break;
     }
     buf->base.data = xmalloc(buf->base.len);
+    mem_pool_set_resource_size(pool, sizeof(*buf) + buf->base.len);
 
     return buf;
 }
@@ -529,62 +807,278 @@ maybe_notify_frame_locked(struct gm_device *dev)
 }
 
 #ifdef USE_FREENECT
+/* NB: the libfreenect callbacks are called within freenect_process_events()
+ * on the Kinect IO thread and should do as little as possible.
+ */
+static void
+kinect_enqueue_raw_locked(struct gm_device *dev,
+                          struct kinect_raw_buffers *raw)
+{
+    if (raw->pending_valid)
+        raw->n_dropped++;
+
+    std::swap(raw->back, raw->pending);
+    raw->pending_valid = true;
+    raw->pending_time = get_time();
+
+    pthread_cond_signal(&dev->kinect.raw_cond);
+}
+
 static void
 kinect_depth_frame_cb(freenect_device *fdev, void *depth, uint32_t timestamp)
 {
     struct gm_device *dev = (struct gm_device *)freenect_get_user(fdev);
 
-    if (!(dev->frame_request_buffers_mask & GM_REQUEST_FRAME_DEPTH))
-        return;
+    pthread_mutex_lock(&dev->kinect.raw_lock);
+    kinect_enqueue_raw_locked(dev, &dev->kinect.depth_raw);
+    freenect_set_depth_buffer(fdev, dev->kinect.depth_raw.back);
+    pthread_mutex_unlock(&dev->kinect.raw_lock);
+}
 
-    pthread_mutex_lock(&dev->swap_buffers_lock);
+static void
+kinect_rgb_frame_cb(freenect_device *fdev, void *video, uint32_t timestamp)
+{
+    struct gm_device *dev = (struct gm_device *)freenect_get_user(fdev);
 
-    struct gm_device_buffer *old = dev->depth_buf_ready;
-    dev->depth_buf_ready = dev->depth_buf_back;
-    dev->depth_buf_back = mem_pool_acquire_buffer(dev->depth_buf_pool, "kinect depth");
-    // TODO: Figure out the Kinect timestamp format to translate it into
-    //       nanoseconds
-    //dev->frame_time = (uint64_t)timestamp;
-    dev->frame_time = get_time();
-    dev->frame_ready_buffers_mask |= GM_REQUEST_FRAME_DEPTH;
+    pthread_mutex_lock(&dev->kinect.raw_lock);
+    kinect_enqueue_raw_locked(dev, &dev->kinect.video_raw);
+    freenect_set_video_buffer(fdev, dev->kinect.video_raw.back);
+    pthread_mutex_unlock(&dev->kinect.raw_lock);
+}
 
-    freenect_set_depth_buffer(fdev, dev->depth_buf_back->base.data);
-    if (old)
-        gm_buffer_unref(&old->base);
+/* Converts millimeters to meters, eight pixels at a time using GCC vector
+ * extensions (SSE/NEON)
+ */
+static void
+kinect_mm_to_m(const uint16_t *mm, float *m, int n_pixels)
+{
+    typedef uint16_t v8hu __attribute__((vector_size(16)));
+    typedef float v8sf __attribute__((vector_size(32)));
+
+    int n_blocks = n_pixels / 8;
+    for (int i = 0; i < n_blocks; i++) {
+        v8hu in;
+        memcpy(&in, mm + i * 8, sizeof(in));
+        v8sf out = __builtin_convertvector(in, v8sf) * 0.001f;
+        memcpy(m + i * 8, &out, sizeof(out));
+    }
+    for (int i = n_blocks * 8; i < n_pixels; i++)
+        m[i] = mm[i] * 0.001f;
+}
 
-    pthread_mutex_unlock(&dev->swap_buffers_lock);
+/* Registers raw depth to the video camera, the same way as libfreenect's
+ * FREENECT_DEPTH_REGISTERED mode, keeping the nearest depth where several
+ * depth pixels land on the same video pixel.
+ */
+static void
+kinect_register_depth(struct gm_device *dev,
+                      const uint16_t *raw,
+                      uint16_t *out_mm)
+{
+    const uint16_t *raw_to_mm = dev->kinect.raw_to_mm;
+    const int32_t *reg_x = dev->kinect.reg_x;
+    const int32_t *reg_y = dev->kinect.reg_y;
+    const int32_t *shift = dev->kinect.depth_to_rgb_shift;
+
+    memset(out_mm, 0, KINECT_WIDTH * KINECT_HEIGHT * sizeof(uint16_t));
+
+    for (int off = 0; off < KINECT_WIDTH * KINECT_HEIGHT; off++) {
+        uint16_t mm = raw_to_mm[raw[off] & (KINECT_MAX_RAW_DEPTH - 1)];
+        if (mm == 0 || mm >= KINECT_MAX_DEPTH_MM)
+            continue;
+
+        unsigned nx = (reg_x[off] + shift[mm]) / KINECT_REG_X_SCALE;
+        unsigned ny = reg_y[off];
+        if (nx >= KINECT_WIDTH || ny >= KINECT_HEIGHT)
+            continue;
+
+        uint16_t *dst = &out_mm[ny * KINECT_WIDTH + nx];
+        if (*dst == 0 || mm < *dst)
+            *dst = mm;
+    }
+}
 
-    pthread_mutex_lock(&dev->request_buffers_mask_lock);
-    maybe_notify_frame_locked(dev);
-    pthread_mutex_unlock(&dev->request_buffers_mask_lock);
+static void
+kinect_convert_depth(struct gm_device *dev,
+                     const uint16_t *raw,
+                     struct gm_buffer *out)
+{
+    int n_pixels = KINECT_WIDTH * KINECT_HEIGHT;
+
+    if (dev->kinect.register_depth) {
+        if (dev->depth_format == GM_FORMAT_Z_F32_M) {
+            kinect_register_depth(dev, raw, dev->kinect.registered_mm);
+            kinect_mm_to_m(dev->kinect.registered_mm, (float *)out->data,
+                           n_pixels);
+        } else {
+            kinect_register_depth(dev, raw, (uint16_t *)out->data);
+        }
+    } else if (dev->depth_format == GM_FORMAT_Z_F32_M) {
+        const float *raw_to_m = dev->kinect.raw_to_m;
+        float *m = (float *)out->data;
+        for (int i = 0; i < n_pixels; i++)
+            m[i] = raw_to_m[raw[i] & (KINECT_MAX_RAW_DEPTH - 1)];
+    } else {
+        const uint16_t *raw_to_mm = dev->kinect.raw_to_mm;
+        uint16_t *mm = (uint16_t *)out->data;
+        for (int i = 0; i < n_pixels; i++)
+            mm[i] = raw_to_mm[raw[i] & (KINECT_MAX_RAW_DEPTH - 1)];
+    }
+
+    out->len = n_pixels * (dev->depth_format == GM_FORMAT_Z_F32_M ? 4 : 2);
+}
+
+static void *
+kinect_convert_thread_cb(void *data)
+{
+    struct gm_device *dev = (struct gm_device *)data;
+    struct kinect_raw_buffers *depth_raw = &dev->kinect.depth_raw;
+    struct kinect_raw_buffers *video_raw = &dev->kinect.video_raw;
+
+    ProfileSetThreadName("Kinect Convert");
+
+    while (true) {
+        pthread_mutex_lock(&dev->kinect.raw_lock);
+        while (dev->running &&
+               !depth_raw->pending_valid &&
+               !video_raw->pending_valid)
+        {
+            pthread_cond_wait(&dev->kinect.raw_cond, &dev->kinect.raw_lock);
+        }
+        if (!dev->running) {
+            pthread_mutex_unlock(&dev->kinect.raw_lock);
+            break;
+        }
+
+        bool have_depth = depth_raw->pending_valid;
+        uint64_t depth_time = depth_raw->pending_time;
+        if (have_depth) {
+            std::swap(depth_raw->pending, depth_raw->converting);
+            depth_raw->pending_valid = false;
+        }
+        bool have_video = video_raw->pending_valid;
+        uint64_t video_time = video_raw->pending_time;
+        if (have_video) {
+            std::swap(video_raw->pending, video_raw->converting);
+            video_raw->pending_valid = false;
+        }
+        pthread_mutex_unlock(&dev->kinect.raw_lock);
+
+        uint64_t buffers_mask = dev->frame_request_buffers_mask;
+        struct gm_device_buffer *depth_buf = NULL;
+        struct gm_device_buffer *video_buf = NULL;
+
+        if (have_depth && (buffers_mask & GM_REQUEST_FRAME_DEPTH)) {
+            ProfileScopedSection(ConvertKinectDepth);
+            depth_buf = mem_pool_acquire_buffer(dev->depth_buf_pool,
+                                                "kinect depth");
+            kinect_convert_depth(dev,
+                                 (uint16_t *)depth_raw->converting,
+                                 &depth_buf->base);
+        }
+        if (have_video && (buffers_mask & GM_REQUEST_FRAME_VIDEO)) {
+            video_buf = mem_pool_acquire_buffer(dev->video_buf_pool,
+                                                "kinect rgb");
+            video_buf->base.len = KINECT_WIDTH * KINECT_HEIGHT * 3;
+            memcpy(video_buf->base.data, video_raw->converting,
+                   video_buf->base.len);
+        }
+        if (!depth_buf && !video_buf)
+            continue;
+
+        pthread_mutex_lock(&dev->swap_buffers_lock);
+
+        // TODO: Figure out the Kinect timestamp format to translate it into
+        //       nanoseconds
+        if (depth_buf) {
+            std::swap(dev->depth_buf_ready, depth_buf);
+            dev->frame_time = depth_time;
+            dev->frame_ready_buffers_mask |= GM_REQUEST_FRAME_DEPTH;
+        }
+        if (video_buf) {
+            std::swap(dev->video_buf_ready, video_buf);
+            if (!dev->depth_buf_ready)
+                dev->frame_time = video_time;
+            dev->frame_ready_buffers_mask |= GM_REQUEST_FRAME_VIDEO;
+        }
+
+        pthread_mutex_unlock(&dev->swap_buffers_lock);
+
+        /* Release whatever was replaced */
+        if (depth_buf)
+            gm_buffer_unref(&depth_buf->base);
+        if (video_buf)
+            gm_buffer_unref(&video_buf->base);
+
+        pthread_mutex_lock(&dev->request_buffers_mask_lock);
+        maybe_notify_frame_locked(dev);
+        pthread_mutex_unlock(&dev->request_buffers_mask_lock);
+    }
+
+    ProfileFinishThread();
+
+    return NULL;
 }
 
+/* Sets up the lookup tables for converting raw depth, and registering depth
+ * to the video camera, based on the device's factory calibration.
+ */
 static void
-kinect_rgb_frame_cb(freenect_device *fdev, void *video, uint32_t timestamp)
+kinect_init_depth_tables(struct gm_device *dev, bool register_depth)
 {
-    struct gm_device *dev = (struct gm_device *)freenect_get_user(fdev);
+    freenect_registration reg = freenect_copy_registration(dev->kinect.fdev);
 
-    if (!(dev->frame_request_buffers_mask & GM_REQUEST_FRAME_VIDEO))
-        return;
+    dev->kinect.raw_to_mm = (uint16_t *)
+        xcalloc(KINECT_MAX_RAW_DEPTH, sizeof(uint16_t));
+    dev->kinect.raw_to_m = (float *)
+        xcalloc(KINECT_MAX_RAW_DEPTH, sizeof(float));
 
-    pthread_mutex_lock(&dev->swap_buffers_lock);
+    for (int i = 0; i < KINECT_MAX_RAW_DEPTH - 1; i++) {
+        float mm;
+        if (reg.raw_to_mm_shift) {
+            mm = reg.raw_to_mm_shift[i];
+        } else {
+            /* E.g. with fakenect there's no calibration, so fall back to a
+             * commonly used approximation
+             */
+            mm = 1000.f * 0.1236f * tanf(i / 2842.5f + 1.1863f);
+        }
+        if (mm > 0 && mm < KINECT_MAX_DEPTH_MM) {
+            dev->kinect.raw_to_mm[i] = (uint16_t)mm;
+            dev->kinect.raw_to_m[i] = dev->kinect.raw_to_mm[i] / 1000.f;
+        }
+    }
 
-    struct gm_device_buffer *old = dev->video_buf_ready;
-    dev->video_buf_ready = dev->video_buf_back;
-    dev->video_buf_back = mem_pool_acquire_buffer(dev->video_buf_pool, "kinect rgb");
-    //dev->frame_time = (uint64_t)timestamp;
-    dev->frame_time = get_time();
-    dev->frame_ready_buffers_mask |= GM_REQUEST_FRAME_VIDEO;
+    if (register_depth && !(reg.registration_table && reg.depth_to_rgb_shift)) {
+        gm_warn(dev->log, "No Kinect registration calibration available; "
+                "depth won't be aligned with video");
+        register_depth = false;
+    }
+    dev->kinect.register_depth = register_depth;
 
-    freenect_set_video_buffer(fdev, dev->video_buf_back->base.data);
-    if (old)
-        gm_buffer_unref(&old->base);
+    if (register_depth) {
+        int n_pixels = KINECT_WIDTH * KINECT_HEIGHT;
+        int pad_lines = reg.reg_pad_info.start_lines;
 
-    pthread_mutex_unlock(&dev->swap_buffers_lock);
+        dev->kinect.reg_x = (int32_t *)xmalloc(n_pixels * sizeof(int32_t));
+        dev->kinect.reg_y = (int32_t *)xmalloc(n_pixels * sizeof(int32_t));
+        for (int i = 0; i < n_pixels; i++) {
+            dev->kinect.reg_x[i] = reg.registration_table[i][0];
+            dev->kinect.reg_y[i] = reg.registration_table[i][1] - pad_lines;
+        }
 
-    pthread_mutex_lock(&dev->request_buffers_mask_lock);
-    maybe_notify_frame_locked(dev);
-    pthread_mutex_unlock(&dev->request_buffers_mask_lock);
+        dev->kinect.depth_to_rgb_shift = (int32_t *)
+            xmalloc(KINECT_MAX_DEPTH_MM * sizeof(int32_t));
+        memcpy(dev->kinect.depth_to_rgb_shift, reg.depth_to_rgb_shift,
+               KINECT_MAX_DEPTH_MM * sizeof(int32_t));
+
+        if (dev->depth_format == GM_FORMAT_Z_F32_M) {
+            dev->kinect.registered_mm = (uint16_t *)
+                xmalloc(n_pixels * sizeof(uint16_t));
+        }
+    }
+
+    freenect_destroy_registration(&reg);
 }
 
 static bool
@@ -640,10 +1134,11 @@ kinect_open(struct gm_device *dev, struct gm_device_config *config, char **err)
     dev->depth_camera_intrinsics.fx = 594.21434211923247;
     dev->depth_camera_intrinsics.fy = 591.04053696870778;
     dev->depth_camera_intrinsics.distortion_model = GM_DISTORTION_NONE;
-    dev->depth_format = GM_FORMAT_Z_U16_MM;
+    dev->depth_format = config->kinect.depth_format == GM_FORMAT_Z_F32_M ?
+        GM_FORMAT_Z_F32_M : GM_FORMAT_Z_U16_MM;
 
-    /* We're going to use Freenect's registered depth mode, which transforms
-     * depth to video space, so we don't need video intrinsics/extrinsics.
+    /* We register depth to video space (see kinect_register_depth()), so we
+     * don't need video intrinsics/extrinsics.
      */
     dev->video_format = GM_FORMAT_RGB_U8;
     dev->video_camera_intrinsics = dev->depth_camera_intrinsics;
@@ -701,22 +1196,35 @@ kinect_open(struct gm_device *dev, struct gm_device_config *config, char **err)
 
 #endif
 
+    kinect_init_depth_tables(dev, !config->kinect.unregistered_depth);
+
+    pthread_mutex_init(&dev->kinect.raw_lock, NULL);
+    pthread_cond_init(&dev->kinect.raw_cond, NULL);
+
+    size_t video_raw_size = KINECT_WIDTH * KINECT_HEIGHT * 3;
+    dev->kinect.video_raw.back = xmalloc(video_raw_size);
+    dev->kinect.video_raw.pending = xmalloc(video_raw_size);
+    dev->kinect.video_raw.converting = xmalloc(video_raw_size);
+
     freenect_set_video_callback(dev->kinect.fdev, kinect_rgb_frame_cb);
     freenect_set_video_mode(dev->kinect.fdev,
                             freenect_find_video_mode(FREENECT_RESOLUTION_MEDIUM,
                                                      FREENECT_VIDEO_RGB));
-    dev->video_buf_back = mem_pool_acquire_buffer(dev->video_buf_pool, "kinect rgb");
-    freenect_set_video_buffer(dev->kinect.fdev, dev->video_buf_back->base.data);
+    freenect_set_video_buffer(dev->kinect.fdev, dev->kinect.video_raw.back);
+
+    /* Depth is converted to mm and registered to video on our own
+     * conversion thread instead of within the USB callbacks
+     */
+    size_t depth_raw_size = KINECT_WIDTH * KINECT_HEIGHT * sizeof(uint16_t);
+    dev->kinect.depth_raw.back = xmalloc(depth_raw_size);
+    dev->kinect.depth_raw.pending = xmalloc(depth_raw_size);
+    dev->kinect.depth_raw.converting = xmalloc(depth_raw_size);
 
     freenect_set_depth_callback(dev->kinect.fdev, kinect_depth_frame_cb);
     freenect_set_depth_mode(dev->kinect.fdev,
                             freenect_find_depth_mode(FREENECT_RESOLUTION_MEDIUM,
-                            FREENECT_DEPTH_REGISTERED)); // MM, aligned to RGB
-    /*freenect_set_depth_mode(dev->kinect.fdev,
-                            freenect_find_depth_mode(FREENECT_RESOLUTION_MEDIUM,
-                                                     FREENECT_DEPTH_MM));*/
-    dev->depth_buf_back = mem_pool_acquire_buffer(dev->depth_buf_pool, "kinect depth");
-    freenect_set_depth_buffer(dev->kinect.fdev, dev->depth_buf_back->base.data);
+                                                     FREENECT_DEPTH_11BIT));
+    freenect_set_depth_buffer(dev->kinect.fdev, dev->kinect.depth_raw.back);
 
 
     struct gm_ui_property prop;
@@ -786,6 +1294,42 @@ kinect_close(struct gm_device *dev)
         freenect_close_device(dev->kinect.fdev);
     if (dev->kinect.fctx)
         freenect_shutdown(dev->kinect.fctx);
+
+    struct kinect_raw_buffers *raw_buffers[] = {
+        &dev->kinect.depth_raw,
+        &dev->kinect.video_raw,
+    };
+    for (int i = 0; i < (int)ARRAY_LEN(raw_buffers); i++) {
+        struct kinect_raw_buffers *raw = raw_buffers[i];
+        if (raw->back) {
+            xfree(raw->back);
+            xfree(raw->pending);
+            xfree(raw->converting);
+            raw->back = raw->pending = raw->converting = NULL;
+        }
+    }
+
+    if (dev->kinect.raw_to_mm) {
+        xfree(dev->kinect.raw_to_mm);
+        xfree(dev->kinect.raw_to_m);
+        dev->kinect.raw_to_mm = NULL;
+        dev->kinect.raw_to_m = NULL;
+
+        pthread_cond_destroy(&dev->kinect.raw_cond);
+        pthread_mutex_destroy(&dev->kinect.raw_lock);
+    }
+    if (dev->kinect.reg_x) {
+        xfree(dev->kinect.reg_x);
+        xfree(dev->kinect.reg_y);
+        xfree(dev->kinect.depth_to_rgb_shift);
+        dev->kinect.reg_x = NULL;
+        dev->kinect.reg_y = NULL;
+        dev->kinect.depth_to_rgb_shift = NULL;
+    }
+    if (dev->kinect.registered_mm) {
+        xfree(dev->kinect.registered_mm);
+        dev->kinect.registered_mm = NULL;
+    }
 }
 
 static void *
@@ -850,6 +1394,12 @@ kinect_start(struct gm_device *dev)
                    kinect_io_thread_cb,
                    dev); //data
     pthread_setname_np(dev->kinect.io_thread, "Kinect IO");
+
+    pthread_create(&dev->kinect.convert_thread,
+                   NULL,
+                   kinect_convert_thread_cb,
+                   dev);
+    pthread_setname_np(dev->kinect.convert_thread, "Kinect Convert");
 }
 
 static void
@@ -857,9 +1407,19 @@ kinect_stop(struct gm_device *dev)
 {
     void *retval = NULL;
 
-    /* After setting running = false we expect the thread to exit within a
+    /* After setting running = false we expect the threads to exit within a
      * finite amount of time */
+    pthread_mutex_lock(&dev->kinect.raw_lock);
     dev->running = false;
+    pthread_cond_broadcast(&dev->kinect.raw_cond);
+    pthread_mutex_unlock(&dev->kinect.raw_lock);
+
+    pthread_join(dev->kinect.convert_thread, NULL);
+
+    gm_debug(dev->log, "Kinect frames replaced before conversion: "
+             "%" PRIu64 " depth, %" PRIu64 " video",
+             dev->kinect.depth_raw.n_dropped,
+             dev->kinect.video_raw.n_dropped);
 
     int ret = pthread_join(dev->kinect.io_thread, &retval);
     if (ret < 0) {
@@ -955,6 +1515,117 @@ recording_step_forward(struct gm_ui_property *prop)
     dev->recording.ignore_loop = true;
 }
 
+static bool
+recording_load_frame_table(struct gm_device *dev, char **err)
+{
+    int n_frames = 0;
+    JSON_Array *json_frames = NULL;
+
+    if (dev->recording.pack) {
+        n_frames = rec_pack_get_n_frames(dev->recording.pack);
+    } else {
+        json_frames = json_object_get_array(json_object(dev->recording.json),
+                                            "frames");
+        n_frames = json_array_get_count(json_frames);
+    }
+
+    if (n_frames < 1) {
+        gm_throw(dev->log, err, "Recording has no frames");
+        return false;
+    }
+
+    dev->recording.frames = (struct recording_frame *)
+        xcalloc(n_frames, sizeof(struct recording_frame));
+    dev->recording.n_frames = n_frames;
+
+    int last_depth_frame = -1;
+    for (int i = 0; i < n_frames; i++) {
+        struct recording_frame *frame = &dev->recording.frames[i];
+
+        if (dev->recording.pack) {
+            const struct gm_rec_pack_frame *entry =
+                rec_pack_get_frame(dev->recording.pack, i);
+            frame->timestamp = entry->timestamp;
+            frame->camera_rotation = (enum gm_rotation)entry->camera_rotation;
+            frame->depth_offset = entry->depth_offset;
+            frame->depth_len = entry->depth_len;
+            frame->video_offset = entry->video_offset;
+            frame->video_len = entry->video_len;
+        } else {
+            JSON_Object *json_frame = json_array_get_object(json_frames, i);
+            frame->timestamp = (uint64_t)
+                json_object_get_number(json_frame, "timestamp");
+            frame->camera_rotation = (enum gm_rotation)
+                json_object_get_number(json_frame, "camera_rotation");
+            frame->depth_file = json_object_get_string(json_frame, "depth_file");
+            frame->depth_len = (size_t)
+                json_object_get_number(json_frame, "depth_len");
+            frame->video_file = json_object_get_string(json_frame, "video_file");
+            frame->video_len = (size_t)
+                json_object_get_number(json_frame, "video_len");
+        }
+
+        if (i && frame->timestamp < dev->recording.frames[i - 1].timestamp) {
+            gm_warn(dev->log, "Recorded frame timestamps went backwards at frame %d",
+                    i);
+        }
+
+        bool has_depth = dev->recording.pack ?
+            frame->depth_len > 0 : frame->depth_file != NULL;
+        if (has_depth)
+            last_depth_frame = i;
+        frame->last_depth_frame = last_depth_frame;
+    }
+
+    return true;
+}
+
+/* Finds the first frame in [@first, @end) whose timestamp is at least
+ * @timestamp, or returns @end if there's none
+ */
+static int
+recording_find_frame(struct gm_device *dev,
+                     uint64_t timestamp,
+                     int first,
+                     int end)
+{
+    struct recording_frame *frames = dev->recording.frames;
+    struct recording_frame *found =
+        std::lower_bound(frames + first, frames + end, timestamp,
+                         [](const struct recording_frame &frame, uint64_t ts) {
+                             return frame.timestamp < ts;
+                         });
+    return found - frames;
+}
+
+/* Limits the number of prefetched frames so that they can't take more than
+ * a buffer @budget (0 = unlimited) minus a few frames in flight. @buffer_len
+ * is the capacity of each buffer (see device_depth_buf_alloc() and
+ * device_video_buf_alloc())
+ */
+static int
+recording_prefetch_frames_within_budget(struct gm_device *dev,
+                                        int n_prefetch,
+                                        size_t budget,
+                                        size_t buffer_len)
+{
+    if (!budget || !n_prefetch)
+        return n_prefetch;
+
+    size_t buffer_size = sizeof(struct gm_device_buffer) + buffer_len;
+    int n_fit = budget / buffer_size;
+    int n_limit = std::max(n_fit - RECORDING_BUDGET_RESERVED_FRAMES, 0);
+    if (n_prefetch > n_limit) {
+        gm_warn(dev->log,
+                "Buffer budget of %zu bytes only leaves room to prefetch %d "
+                "recorded frames (instead of %d)",
+                budget, n_limit, n_prefetch);
+        return n_limit;
+    }
+
+    return n_prefetch;
+}
+
 static bool
 recording_open(struct gm_device *dev,
                struct gm_device_config *config, char **err)
@@ -966,8 +1637,28 @@ recording_open(struct gm_device *dev,
     snprintf(json_path, json_path_size, "%s/%s",
              config->recording.path, recording_name);
 
+    pthread_mutex_init(&dev->recording.prefetch_lock, NULL);
+    pthread_cond_init(&dev->recording.prefetch_cond, NULL);
+    pthread_cond_init(&dev->recording.consumer_cond, NULL);
+
     dev->recording.path = strdup(config->recording.path);
-    dev->recording.json = json_parse_file(json_path);
+
+    size_t pack_path_size = strlen(config->recording.path) +
+                                   strlen(GM_REC_PACK_NAME) + 2;
+    char *pack_path = (char *)alloca(pack_path_size);
+    snprintf(pack_path, pack_path_size, "%s/%s",
+             config->recording.path, GM_REC_PACK_NAME);
+
+    struct stat sb;
+    if (stat(pack_path, &sb) == 0) {
+        dev->recording.pack = rec_pack_open(dev->log, pack_path, err);
+        if (!dev->recording.pack)
+            return false;
+        dev->recording.json =
+            json_parse_string(rec_pack_get_metadata(dev->recording.pack));
+    } else {
+        dev->recording.json = json_parse_file(json_path);
+    }
     if (!dev->recording.json) {
         gm_throw(dev->log, err, "Failed to open recording metadata");
         return false;
@@ -1001,11 +1692,57 @@ recording_open(struct gm_device *dev,
     dev->video_format = (enum gm_format)
         round(json_object_get_number(meta, "video_format"));
 
+    const char *compression = json_object_get_string(meta, "depth_compression");
+    if (!rec_compression_from_name(compression,
+                                   &dev->recording.depth_compression))
+    {
+        gm_throw(dev->log, err, "Unknown recording depth compression '%s'",
+                 compression);
+        return false;
+    }
+    if (!rec_compression_supported(dev->recording.depth_compression)) {
+        gm_throw(dev->log, err,
+                 "Recording depth compression '%s' not supported by this build",
+                 compression);
+        return false;
+    }
+
+    if (config->recording.prefetch_frames == 0)
+        dev->recording.n_prefetch = RECORDING_PREFETCH_FRAMES;
+    else
+        dev->recording.n_prefetch = std::max(config->recording.prefetch_frames, 0);
+
+    /* NB: The prefetched buffers count towards any buffer budgets, so the
+     * ring mustn't be able to use up a whole budget, otherwise reading the
+     * frame to be played next would wait forever for a buffer
+     */
+    size_t n_depth_pixels = ((size_t)dev->depth_camera_intrinsics.width *
+                             dev->depth_camera_intrinsics.height);
+    size_t n_video_pixels = ((size_t)dev->video_camera_intrinsics.width *
+                             dev->video_camera_intrinsics.height);
+    dev->recording.n_prefetch =
+        recording_prefetch_frames_within_budget(dev,
+                                                dev->recording.n_prefetch,
+                                                config->depth_buffer_budget,
+                                                n_depth_pixels * 16);
+    dev->recording.n_prefetch =
+        recording_prefetch_frames_within_budget(dev,
+                                                dev->recording.n_prefetch,
+                                                config->video_buffer_budget,
+                                                n_video_pixels * 4);
+    if (dev->recording.n_prefetch) {
+        dev->recording.prefetch = (struct recording_prefetch_slot *)
+            xcalloc(dev->recording.n_prefetch,
+                    sizeof(struct recording_prefetch_slot));
+        for (int i = 0; i < dev->recording.n_prefetch; i++)
+            dev->recording.prefetch[i].frame = -1;
+    }
+
     dev->recording.frame = 0;
 
-    JSON_Array *frames =
-        json_object_get_array(json_object(dev->recording.json), "frames");
-    int n_recorded_frames = json_array_get_count(frames);
+    if (!recording_load_frame_table(dev, err))
+        return false;
+    int n_recorded_frames = dev->recording.n_frames;
 
     struct gm_ui_property prop;
 
@@ -1040,6 +1777,26 @@ recording_open(struct gm_device *dev,
     prop.int_state.max = n_recorded_frames - 1;
     dev->properties.push_back(prop);
 
+    dev->recording.playback_mode = config->recording.playback_mode;
+    prop = gm_ui_property();
+    prop.object = dev;
+    prop.name = "playback mode";
+    prop.desc = "Whether to pace playback in realtime or emit frames as "
+                "fast as they are requested";
+    prop.type = GM_PROPERTY_ENUM;
+    prop.enum_state.ptr = &dev->recording.playback_mode;
+
+    for (int i = 0; i < (int)ARRAY_LEN(playback_mode_names); i++) {
+        struct gm_ui_enumerant enumerant = gm_ui_enumerant();
+        enumerant.name = playback_mode_names[i];
+        enumerant.desc = playback_mode_names[i];
+        enumerant.val = i;
+        dev->playback_mode_enumerants.push_back(enumerant);
+    }
+    prop.enum_state.n_enumerants = dev->playback_mode_enumerants.size();
+    prop.enum_state.enumerants = dev->playback_mode_enumerants.data();
+    dev->properties.push_back(prop);
+
     prop = gm_ui_property();
     prop.object = dev;
     prop.name = "<<";
@@ -1086,17 +1843,192 @@ recording_close(struct gm_device *dev)
         json_value_free(dev->recording.json);
         dev->recording.json = nullptr;
     }
+    if (dev->recording.frames) {
+        xfree(dev->recording.frames);
+        dev->recording.frames = nullptr;
+        dev->recording.n_frames = 0;
+    }
+    if (dev->recording.pack) {
+        rec_pack_close(dev->recording.pack);
+        dev->recording.pack = nullptr;
+    }
+    if (dev->recording.prefetch) {
+        /* Buffers will have been released by recording_stop() */
+        xfree(dev->recording.prefetch);
+        dev->recording.prefetch = nullptr;
+    }
+
+    pthread_cond_destroy(&dev->recording.consumer_cond);
+    pthread_cond_destroy(&dev->recording.prefetch_cond);
+    pthread_mutex_destroy(&dev->recording.prefetch_lock);
 }
 
+/* Checks that an uncompressed recorded buffer is big enough for the
+ * recording's format and resolution but still fits within our buffers (see
+ * device_depth_buf_alloc() and device_video_buf_alloc()), so that a corrupt
+ * recording can't overflow them
+ *
+ * NB: some devices record buffers that are bigger than their format needs
+ * (e.g. Tango luminance video is kept in buffers sized for RGB)
+ */
+static bool
+recording_frame_len_valid(struct gm_device *dev,
+                          size_t len,
+                          uint64_t buffer_type)
+{
+    bool depth = buffer_type == GM_REQUEST_FRAME_DEPTH;
+    struct gm_intrinsics *intrinsics = depth ?
+        &dev->depth_camera_intrinsics : &dev->video_camera_intrinsics;
+    size_t n_pixels = (size_t)intrinsics->width * intrinsics->height;
+    size_t max_len = n_pixels * (depth ? 16 : 4);
+    size_t min_len = 0;
+
+    switch (depth ? dev->depth_format : dev->video_format) {
+    case GM_FORMAT_LUMINANCE_U8:
+        min_len = n_pixels;
+        break;
+    case GM_FORMAT_RGB_U8:
+        min_len = n_pixels * 3;
+        break;
+    case GM_FORMAT_RGBX_U8:
+    case GM_FORMAT_RGBA_U8:
+        min_len = n_pixels * 4;
+        break;
+    case GM_FORMAT_Z_U16_MM:
+    case GM_FORMAT_Z_F16_M:
+        min_len = n_pixels * 2;
+        break;
+    case GM_FORMAT_Z_F32_M:
+        min_len = n_pixels * 4;
+        break;
+    case GM_FORMAT_POINTS_XYZC_F32_M:
+        /* The number of points varies, up to one per pixel */
+        if (len % 16)
+            return false;
+        break;
+    case GM_FORMAT_UNKNOWN:
+        return false;
+    }
+
+    return len >= min_len && len <= max_len;
+}
+
+/* Acquires a buffer to load a recorded frame into. If @throttled is given
+ * then this returns NULL and sets *@throttled instead of blocking when the
+ * pool is at its budget.
+ */
+static struct gm_buffer *
+acquire_frame_buffer(struct gm_mem_pool *buf_pool, bool *throttled)
+{
+    if (!throttled) {
+        return (struct gm_buffer *)
+            mem_pool_acquire_buffer(buf_pool, "recording buffer");
+    }
+
+    struct gm_buffer *buf = (struct gm_buffer *)
+        mem_pool_try_acquire_buffer(buf_pool, "recording buffer");
+    if (!buf)
+        *throttled = true;
+
+    return buf;
+}
+
+/* Copies recorded depth or video data into a new buffer, decompressing it
+ * if necessary
+ */
+static struct gm_buffer *
+load_frame_buffer(struct gm_device *dev,
+                  const void *data,
+                  size_t len,
+                  uint64_t buffer_type,
+                  bool *throttled)
+{
+    bool depth = buffer_type == GM_REQUEST_FRAME_DEPTH;
+    struct gm_mem_pool *buf_pool =
+        depth ? dev->depth_buf_pool : dev->video_buf_pool;
+    bool compressed =
+        depth && dev->recording.depth_compression != GM_REC_COMPRESSION_NONE;
+
+    if (!compressed && !recording_frame_len_valid(dev, len, buffer_type)) {
+        gm_error(dev->log, "Unexpected size (%zu bytes) for recorded %s",
+                 len, depth ? "depth" : "video");
+        return NULL;
+    }
+
+    struct gm_buffer *buf = acquire_frame_buffer(buf_pool, throttled);
+    if (!buf)
+        return NULL;
+
+    if (!compressed) {
+        memcpy(buf->data, data, len);
+        buf->len = len;
+        return buf;
+    }
+
+    /* NB: buf->len is the length of the last data stored in the buffer,
+     * not its capacity (see device_depth_buf_alloc())
+     */
+    size_t max_len = (dev->depth_camera_intrinsics.width *
+                      dev->depth_camera_intrinsics.height * 16);
+    int word_size = (dev->depth_format == GM_FORMAT_Z_U16_MM ||
+                     dev->depth_format == GM_FORMAT_Z_F16_M) ? 2 : 4;
+
+    char *err = NULL;
+    size_t uncompressed_len = 0;
+    if (!rec_depth_decompress(dev->log,
+                              dev->recording.depth_compression,
+                              word_size,
+                              data, len,
+                              buf->data, max_len,
+                              &uncompressed_len,
+                              &err))
+    {
+        gm_error(dev->log, "Failed to load recorded depth: %s", err);
+        free(err);
+        mem_pool_recycle_resource(buf_pool, buf);
+        return NULL;
+    }
+    buf->len = uncompressed_len;
+
+    return buf;
+}
+
+/* Reads the depth or video buffer (according to @buffer_type) for the given
+ * frame, or returns NULL if the frame doesn't have that type of buffer
+ *
+ * See acquire_frame_buffer() for @throttled, which may be NULL
+ */
 static struct gm_buffer *
 read_frame_buffer(struct gm_device *dev,
-                  JSON_Object *frame,
-                  const char *filename_prop,
-                  const char *len_prop,
-                  struct gm_mem_pool *buf_pool)
+                  int frame_no,
+                  uint64_t buffer_type,
+                  bool *throttled)
 {
+    bool depth = buffer_type == GM_REQUEST_FRAME_DEPTH;
+    struct gm_mem_pool *buf_pool =
+        depth ? dev->depth_buf_pool : dev->video_buf_pool;
+
+    struct recording_frame *frame = &dev->recording.frames[frame_no];
+    size_t len = depth ? frame->depth_len : frame->video_len;
+
+    if (dev->recording.pack) {
+        size_t data_len;
+        const void *data = depth ?
+            rec_pack_get_depth(dev->recording.pack, frame_no, &data_len) :
+            rec_pack_get_video(dev->recording.pack, frame_no, &data_len);
+        if (!data)
+            return NULL;
+        if (data_len < len) {
+            gm_error(dev->log, "Recorded %s for frame %d is truncated",
+                     depth ? "depth" : "video", frame_no);
+            return NULL;
+        }
+
+        return load_frame_buffer(dev, data, len, buffer_type, throttled);
+    }
+
     size_t base_path_len = strlen(dev->recording.path);
-    const char *filename = json_object_get_string(frame, filename_prop);
+    const char *filename = depth ? frame->depth_file : frame->video_file;
     if (!filename)
         return NULL;
 
@@ -1105,8 +2037,6 @@ read_frame_buffer(struct gm_device *dev,
     snprintf(abs_filename, abs_filename_size, "%s/%s",
              dev->recording.path, filename);
 
-    size_t len = (size_t)json_object_get_number(frame, len_prop);
-
     FILE *fp = fopen(abs_filename, "r");
     if (!fp) {
         gm_error(dev->log, "Failed to open recording frame '%s'\n",
@@ -1114,8 +2044,39 @@ read_frame_buffer(struct gm_device *dev,
         return NULL;
     }
 
-    struct gm_buffer *buf = (struct gm_buffer *)
-        mem_pool_acquire_buffer(buf_pool, "recording buffer");
+    /* Compressed depth has to be decompressed into the buffer */
+    if (depth &&
+        dev->recording.depth_compression != GM_REC_COMPRESSION_NONE)
+    {
+        void *compressed = xmalloc(len);
+        struct gm_buffer *buf = NULL;
+
+        if (fread(compressed, 1, len, fp) == len) {
+            buf = load_frame_buffer(dev, compressed, len, buffer_type,
+                                    throttled);
+        } else {
+            gm_error(dev->log, "Failed to read recording frame '%s'\n",
+                     abs_filename);
+        }
+
+        xfree(compressed);
+        fclose(fp);
+
+        return buf;
+    }
+
+    if (!recording_frame_len_valid(dev, len, buffer_type)) {
+        gm_error(dev->log, "Unexpected size (%zu bytes) for recording frame '%s'",
+                 len, abs_filename);
+        fclose(fp);
+        return NULL;
+    }
+
+    struct gm_buffer *buf = acquire_frame_buffer(buf_pool, throttled);
+    if (!buf) {
+        fclose(fp);
+        return NULL;
+    }
 
     if (fread(buf->data, 1, len, fp) != len) {
         gm_error(dev->log, "Failed to open recording frame '%s'\n",
@@ -1132,19 +2093,227 @@ read_frame_buffer(struct gm_device *dev,
     return buf;
 }
 
-static struct gm_buffer *
-copy_device_buffer(struct gm_device *dev,
-                   struct gm_device_buffer *buffer)
+/* Maps a position within the read-ahead window to a frame number, or
+ * returns -1 if the window doesn't extend that far (e.g. at the end of a
+ * recording that isn't looping)
+ *
+ * Called with prefetch_lock held
+ */
+static int
+recording_prefetch_window_frame(struct gm_device *dev,
+                                int n_recorded_frames,
+                                int pos)
+{
+    int n_frames = dev->recording.max_frame >= 0 ?
+        std::min(dev->recording.max_frame + 1, n_recorded_frames) :
+        n_recorded_frames;
+    int frame = dev->recording.prefetch_cursor + pos;
+
+    if (frame >= n_frames) {
+        if (!dev->recording.loop)
+            return -1;
+        frame -= n_frames;
+        if (frame >= n_frames)
+            return -1;
+    }
+
+    return frame;
+}
+
+/* Whether the given frame is at some position within the read-ahead window
+ *
+ * Called with prefetch_lock held
+ */
+static bool
+recording_prefetch_window_contains(struct gm_device *dev,
+                                   int n_recorded_frames,
+                                   int frame_no)
+{
+    for (int i = 0; i < dev->recording.n_prefetch; i++) {
+        int frame = recording_prefetch_window_frame(dev, n_recorded_frames, i);
+        if (frame < 0)
+            break;
+        if (frame == frame_no)
+            return true;
+    }
+
+    return false;
+}
+
+static void *
+recording_prefetch_thread_cb(void *userdata)
+{
+    struct gm_device *dev = (struct gm_device *)userdata;
+    int n_prefetch = dev->recording.n_prefetch;
+    int n_recorded_frames = dev->recording.n_frames;
+
+    ProfileSetThreadName("Recording Prefetch");
+
+    pthread_mutex_lock(&dev->recording.prefetch_lock);
+    while (dev->running) {
+        struct recording_prefetch_slot *slot = NULL;
+        int frame_no = -1;
+
+        for (int i = 0; i < n_prefetch; i++) {
+            frame_no = recording_prefetch_window_frame(dev,
+                                                       n_recorded_frames,
+                                                       i);
+            if (frame_no < 0)
+                break;
+
+            struct recording_prefetch_slot *s =
+                &dev->recording.prefetch[frame_no % n_prefetch];
+            if (s->frame == frame_no)
+                continue;
+
+            /* Don't evict another frame in the window that shares this
+             * slot, otherwise the two would keep replacing each other
+             */
+            if (s->frame >= 0 &&
+                recording_prefetch_window_contains(dev, n_recorded_frames,
+                                                   s->frame))
+            {
+                continue;
+            }
+
+            slot = s;
+            break;
+        }
+
+        if (!slot) {
+            pthread_cond_wait(&dev->recording.prefetch_cond,
+                              &dev->recording.prefetch_lock);
+            continue;
+        }
+
+        /* Anything already in this slot is outside of the window */
+        struct gm_buffer *stale_depth = slot->depth;
+        struct gm_buffer *stale_video = slot->video;
+
+        slot->frame = frame_no;
+        slot->loading = true;
+        slot->depth = NULL;
+        slot->video = NULL;
+
+        pthread_mutex_unlock(&dev->recording.prefetch_lock);
+
+        if (stale_depth)
+            gm_buffer_unref(stale_depth);
+        if (stale_video)
+            gm_buffer_unref(stale_video);
+
+        /* NB: we never block waiting for a buffer under a budget, since
+         * nothing would wake us when playback is stopped
+         */
+        bool throttled = false;
+        ProfilePushSection(PrefetchFrame);
+        struct gm_buffer *depth_buffer =
+            read_frame_buffer(dev, frame_no, GM_REQUEST_FRAME_DEPTH,
+                              &throttled);
+        struct gm_buffer *video_buffer = throttled ? NULL :
+            read_frame_buffer(dev, frame_no, GM_REQUEST_FRAME_VIDEO,
+                              &throttled);
+        ProfilePopSection();
+
+        if (throttled) {
+            if (depth_buffer)
+                gm_buffer_unref(depth_buffer);
+            if (video_buffer)
+                gm_buffer_unref(video_buffer);
+
+            pthread_mutex_lock(&dev->recording.prefetch_lock);
+
+            /* Leave the frame to be read synchronously, and retry once
+             * playback has moved on or some buffers may have been released
+             */
+            slot->frame = -1;
+            slot->loading = false;
+            pthread_cond_broadcast(&dev->recording.prefetch_cond);
+
+            if (dev->running) {
+                struct timespec ts;
+                clock_gettime(CLOCK_REALTIME, &ts);
+                ts.tv_nsec += RECORDING_PREFETCH_THROTTLE_MS * 1000000L;
+                if (ts.tv_nsec >= 1000000000L) {
+                    ts.tv_sec++;
+                    ts.tv_nsec -= 1000000000L;
+                }
+                pthread_cond_timedwait(&dev->recording.prefetch_cond,
+                                       &dev->recording.prefetch_lock, &ts);
+            }
+            continue;
+        }
+
+        pthread_mutex_lock(&dev->recording.prefetch_lock);
+
+        /* The slot can't be reassigned while it's marked as loading */
+        slot->depth = depth_buffer;
+        slot->video = video_buffer;
+        slot->loading = false;
+
+        pthread_cond_broadcast(&dev->recording.prefetch_cond);
+    }
+    pthread_mutex_unlock(&dev->recording.prefetch_lock);
+
+    ProfileFinishThread();
+
+    return NULL;
+}
+
+/* Returns the buffers for the given frame, taking them from the read-ahead
+ * ring if they've already been loaded, and moves the read-ahead window to
+ * the following frames.
+ *
+ * The caller owns a reference to the returned buffers.
+ */
+static void
+recording_fetch_frame(struct gm_device *dev,
+                      int frame_no,
+                      struct gm_buffer **depth_buffer,
+                      struct gm_buffer **video_buffer)
 {
-    struct gm_mem_pool *pool = buffer->pool;
+    *depth_buffer = NULL;
+    *video_buffer = NULL;
 
-    struct gm_buffer *copy = (struct gm_buffer *)
-        mem_pool_acquire_buffer(pool, "paused recording buffer");
+    bool hit = false;
+    if (dev->recording.n_prefetch) {
+        pthread_mutex_lock(&dev->recording.prefetch_lock);
 
-    copy->len = buffer->base.len;
-    memcpy(copy->data, buffer->base.data, buffer->base.len);
+        /* Keeping the cursor on this frame while waiting ensures the
+         * prefetch thread won't recycle its slot
+         */
+        dev->recording.prefetch_cursor = frame_no;
 
-    return copy;
+        struct recording_prefetch_slot *slot =
+            &dev->recording.prefetch[frame_no % dev->recording.n_prefetch];
+        while (slot->frame == frame_no && slot->loading && dev->running) {
+            pthread_cond_wait(&dev->recording.prefetch_cond,
+                              &dev->recording.prefetch_lock);
+        }
+
+        if (slot->frame == frame_no && !slot->loading) {
+            *depth_buffer = slot->depth;
+            *video_buffer = slot->video;
+            slot->depth = NULL;
+            slot->video = NULL;
+            slot->frame = -1;
+            dev->recording.n_prefetch_hits++;
+            hit = true;
+        } else
+            dev->recording.n_prefetch_misses++;
+
+        dev->recording.prefetch_cursor = frame_no + 1;
+        pthread_cond_broadcast(&dev->recording.prefetch_cond);
+
+        pthread_mutex_unlock(&dev->recording.prefetch_lock);
+    }
+
+    if (!hit) {
+        *depth_buffer = read_frame_buffer(dev, frame_no, GM_REQUEST_FRAME_DEPTH,
+                                          NULL);
+        *video_buffer = read_frame_buffer(dev, frame_no, GM_REQUEST_FRAME_VIDEO,
+                                          NULL);
+    }
 }
 
 static void
@@ -1161,10 +2330,15 @@ swap_recorded_frame(struct gm_device *dev,
 
         dev->frame_time = timestamp;
 
+        /* NB: while paused the given buffers may be the same as the
+         * last_*_buf or ready buffers, so take new references before
+         * dropping old ones
+         */
         if (depth_buffer) {
-            if (dev->recording.last_depth_buf)
-                gm_buffer_unref(dev->recording.last_depth_buf);
+            struct gm_buffer *old_last = dev->recording.last_depth_buf;
             dev->recording.last_depth_buf = gm_buffer_ref(depth_buffer);
+            if (old_last)
+                gm_buffer_unref(old_last);
 
             if (dev->frame_request_buffers_mask & GM_REQUEST_FRAME_DEPTH) {
                 struct gm_device_buffer *old = dev->depth_buf_ready;
@@ -1176,9 +2350,10 @@ swap_recorded_frame(struct gm_device *dev,
         }
 
         if (video_buffer) {
-            if (dev->recording.last_video_buf)
-                gm_buffer_unref(dev->recording.last_video_buf);
+            struct gm_buffer *old_last = dev->recording.last_video_buf;
             dev->recording.last_video_buf = gm_buffer_ref(video_buffer);
+            if (old_last)
+                gm_buffer_unref(old_last);
 
             if (dev->frame_request_buffers_mask & GM_REQUEST_FRAME_VIDEO) {
                 struct gm_device_buffer *old = dev->video_buf_ready;
@@ -1196,18 +2371,43 @@ swap_recorded_frame(struct gm_device *dev,
         pthread_mutex_unlock(&dev->request_buffers_mask_lock);
 }
 
+/* For non-realtime playback, blocks until the consumer has requested a
+ * frame (and in lockstep mode, collected the last one).
+ *
+ * Returns false if the device is being stopped.
+ */
+static bool
+recording_wait_for_consumer(struct gm_device *dev)
+{
+    pthread_mutex_lock(&dev->request_buffers_mask_lock);
+    while (dev->running) {
+        bool requested = dev->frame_request_buffers_mask != 0;
+        bool collected = dev->frame_ready_buffers_mask == 0;
+        bool lockstep =
+            dev->recording.playback_mode == GM_RECORDING_PLAYBACK_LOCKSTEP;
+
+        if (dev->recording.playback_mode == GM_RECORDING_PLAYBACK_REALTIME ||
+            (requested && (collected || !lockstep)))
+        {
+            break;
+        }
+
+        pthread_cond_wait(&dev->recording.consumer_cond,
+                          &dev->request_buffers_mask_lock);
+    }
+    pthread_mutex_unlock(&dev->request_buffers_mask_lock);
+
+    return dev->running;
+}
+
 static void *
 recording_io_thread_cb(void *userdata)
 {
     struct gm_device *dev = (struct gm_device *)userdata;
 
-    JSON_Array *frames =
-        json_object_get_array(json_object(dev->recording.json), "frames");
-    JSON_Object *frame0 = json_array_get_object(frames, 0);
-    int n_recorded_frames = json_array_get_count(frames);
-
-    uint64_t frame0_timestamp = (uint64_t)
-            json_object_get_number(frame0, "timestamp");
+    struct recording_frame *frames = dev->recording.frames;
+    int n_recorded_frames = dev->recording.n_frames;
+    uint64_t frame0_timestamp = frames[0].timestamp;
 
     /* Even though the recording loops and the playback can be paused
      * we still guarantee a monotonic increasing clock for each frame.
@@ -1216,6 +2416,8 @@ recording_io_thread_cb(void *userdata)
      */
     uint64_t monotonic_clock = get_time();
 
+    ProfileSetThreadName("Recording IO");
+
     /* We want to play back in real-time so at the start of playback
      * we update this reference point for the real wall clock time.
      */
@@ -1231,6 +2433,11 @@ recording_io_thread_cb(void *userdata)
     uint64_t loop_prev_frame_timestamp = frame0_timestamp;
 
     while (dev->running) {
+        bool realtime =
+            dev->recording.playback_mode == GM_RECORDING_PLAYBACK_REALTIME;
+        if (!realtime && !recording_wait_for_consumer(dev))
+            break;
+
         int n_frames = dev->recording.max_frame >= 0 ?
             std::min(dev->recording.max_frame + 1, n_recorded_frames) :
             n_recorded_frames;
@@ -1240,40 +2447,28 @@ recording_io_thread_cb(void *userdata)
             /* Enter paused state if looping has been disabled... */
             while (dev->running && dev->recording.loop == false &&
                    dev->recording.ignore_loop == false) {
-                struct gm_buffer *depth_buffer = NULL;
-                struct gm_buffer *video_buffer = NULL;
-
-                /* We don't just keep 'swapping' in the same buffer since that
-                 * will likely confuse downstream logic. For example with
-                 * our bread crumb debugging for tracking the lifecycle of
-                 * of frames and buffers we don't expect very long lived buffers
-                 * with a never-ending debug trail to track.
+                /* When not playing in realtime we reached the end of the
+                 * stream so there's nothing more to emit
                  */
-                if (dev->recording.last_depth_buf) {
-                    depth_buffer = copy_device_buffer(dev,
-                                                      (struct gm_device_buffer *)
-                                                      dev->recording.last_depth_buf);
-                }
-
-                if (dev->recording.last_video_buf) {
-                    video_buffer = copy_device_buffer(dev,
-                                                      (struct gm_device_buffer *)
-                                                      dev->recording.last_video_buf);
+                if (dev->recording.playback_mode !=
+                    GM_RECORDING_PLAYBACK_REALTIME)
+                {
+                    usleep(16000);
+                    continue;
                 }
 
+                /* Buffers are immutable once handed out so we can just
+                 * re-emit the last ones by reference. (Their breadcrumb
+                 * trails are bounded by device_buffer_add_breadcrumb())
+                 */
                 monotonic_clock += 16000000;
                 loop_start += 16000000;
 
                 swap_recorded_frame(dev,
                                     monotonic_clock,
                                     dev->recording.last_camera_rotation,
-                                    depth_buffer,
-                                    video_buffer);
-
-                if (depth_buffer)
-                    gm_buffer_unref(depth_buffer);
-                if (video_buffer)
-                    gm_buffer_unref(video_buffer);
+                                    dev->recording.last_depth_buf,
+                                    dev->recording.last_video_buf);
 
                 usleep(16000);
             }
@@ -1301,26 +2496,28 @@ recording_io_thread_cb(void *userdata)
         uint64_t time = get_time();
         uint64_t real_progress = time - loop_start;
 
-        JSON_Object *frame = json_array_get_object(frames, dev->recording.frame);
-        uint64_t frame_timestamp = (uint64_t)
-            json_object_get_number(frame, "timestamp");
+        uint64_t frame_timestamp = frames[dev->recording.frame].timestamp;
         uint64_t recording_progress = frame_timestamp - frame0_timestamp;
 
         /* XXX: Skip frames if we're > 33ms behind */
-        if (recording_progress < (real_progress - 33333333)) {
+        if (realtime && recording_progress < (real_progress - 33333333)) {
             gm_warn(dev->log, "slow playback, skipping recorded frames");
 
-            int last_depth = -1;
-            int i;
-            for (i = dev->recording.frame + 1;
-                 i < n_frames && (recording_progress < real_progress);
-                 i++)
-            {
-                frame = json_array_get_object(frames, i);
-                frame_timestamp = (uint64_t)
-                    json_object_get_number(frame, "timestamp");
-                recording_progress = frame_timestamp - frame0_timestamp;
+            /* Skip to the first frame that's caught up with the wall clock */
+            int i = recording_find_frame(dev,
+                                         frame0_timestamp + real_progress,
+                                         dev->recording.frame + 1,
+                                         n_frames);
 
+            if (i >= n_frames) {
+                /* If we've skipped to the end of the recording at least keep
+                 * the last frame without immediately looping so we don't have
+                 * more than one place to handle looping and don't have to
+                 * consider a special case that can continue; before hitting
+                 * the swap_buffers below.
+                 */
+                i = n_frames - 1;
+            } else if (dev->frame_request_buffers_mask & GM_REQUEST_FRAME_DEPTH) {
                 /* If we're skipping frames that's likely due to the size of
                  * video buffers we're loading.
                  *
@@ -1329,31 +2526,15 @@ recording_io_thread_cb(void *userdata)
                  * requirement for tracking and there will be fewer depth
                  * frames than video frames typically so we would likely keep
                  * skipping over them unable to do any tracking.
-                 */
-                if (dev->frame_request_buffers_mask & GM_REQUEST_FRAME_DEPTH &&
-                    json_object_get_string(frame, "depth_file"))
-                {
-                    last_depth = i;
-                }
+                 */
+                int last_depth = frames[i].last_depth_frame;
+                if (last_depth > dev->recording.frame)
+                    i = last_depth;
             }
 
-            if (i >= n_frames) {
-                /* If we've skipped to the end of the recording at least keep
-                 * the last frame without immediately looping so we don't have
-                 * more than one place to handle looping and don't have to
-                 * consider a special case that can continue; before hitting
-                 * the swap_buffers below.
-                 */
-                dev->recording.frame = n_frames - 1;
-            } else if (last_depth > 0 && last_depth != i) {
-                /* jump back if we need to prioritize an earlier depth frame */
-                dev->recording.frame = last_depth;
-                frame = json_array_get_object(frames, last_depth);
-                frame_timestamp = (uint64_t)
-                    json_object_get_number(frame, "timestamp");
-                recording_progress = frame_timestamp - frame0_timestamp;
-            } else
-                dev->recording.frame = i;
+            dev->recording.frame = i;
+            frame_timestamp = frames[i].timestamp;
+            recording_progress = frame_timestamp - frame0_timestamp;
         }
 
         gm_debug(dev->log, "replaying frame %d", dev->recording.frame);
@@ -1369,25 +2550,21 @@ recording_io_thread_cb(void *userdata)
         loop_prev_frame_timestamp = frame_timestamp;
 
         /* Throttle playback according to the timestamps in the recorded frames */
-        while (recording_progress > real_progress) {
+        while (realtime && recording_progress > real_progress) {
             uint64_t delay_us = (recording_progress - real_progress) / 1000;
             usleep(delay_us);
             time = get_time();
             real_progress = time - loop_start;
         }
 
-        struct gm_buffer *depth_buffer = read_frame_buffer(dev,
-                                                           frame,
-                                                           "depth_file",
-                                                           "depth_len",
-                                                           dev->depth_buf_pool);
-        struct gm_buffer *video_buffer = read_frame_buffer(dev,
-                                                           frame,
-                                                           "video_file",
-                                                           "video_len",
-                                                           dev->video_buf_pool);
-        enum gm_rotation rotation = (enum gm_rotation)
-            json_object_get_number(frame, "camera_rotation");
+        ProfilePushSection(ReplayFrame);
+
+        struct gm_buffer *depth_buffer = NULL;
+        struct gm_buffer *video_buffer = NULL;
+        recording_fetch_frame(dev, dev->recording.frame,
+                              &depth_buffer, &video_buffer);
+
+        enum gm_rotation rotation = frames[dev->recording.frame].camera_rotation;
 
         swap_recorded_frame(dev,
                             monotonic_clock,
@@ -1399,8 +2576,12 @@ recording_io_thread_cb(void *userdata)
             gm_buffer_unref(depth_buffer);
         if (video_buffer)
             gm_buffer_unref(video_buffer);
+
+        ProfilePopSection();
     }
 
+    ProfileFinishThread();
+
     return NULL;
 }
 
@@ -1408,6 +2589,9 @@ static void
 recording_start(struct gm_device *dev)
 {
     dev->recording.frame = 0;
+    dev->recording.prefetch_cursor = 0;
+    dev->recording.n_prefetch_hits = 0;
+    dev->recording.n_prefetch_misses = 0;
 
     /* Set running before starting thread, otherwise it would exit immediately */
     dev->running = true;
@@ -1416,6 +2600,14 @@ recording_start(struct gm_device *dev)
                    recording_io_thread_cb,
                    dev);
     pthread_setname_np(dev->recording.io_thread, "Recording IO");
+
+    if (dev->recording.n_prefetch) {
+        pthread_create(&dev->recording.prefetch_thread,
+                       NULL,
+                       recording_prefetch_thread_cb,
+                       dev);
+        pthread_setname_np(dev->recording.prefetch_thread, "Recording Prefetch");
+    }
 }
 
 static void
@@ -1425,7 +2617,34 @@ recording_stop(struct gm_device *dev)
 
     /* After setting running = false we expect the thread to exit within a
      * finite amount of time */
+    pthread_mutex_lock(&dev->recording.prefetch_lock);
     dev->running = false;
+    pthread_cond_broadcast(&dev->recording.prefetch_cond);
+    pthread_mutex_unlock(&dev->recording.prefetch_lock);
+
+    pthread_mutex_lock(&dev->request_buffers_mask_lock);
+    pthread_cond_broadcast(&dev->recording.consumer_cond);
+    pthread_mutex_unlock(&dev->request_buffers_mask_lock);
+
+    if (dev->recording.n_prefetch) {
+        pthread_join(dev->recording.prefetch_thread, NULL);
+
+        for (int i = 0; i < dev->recording.n_prefetch; i++) {
+            struct recording_prefetch_slot *slot = &dev->recording.prefetch[i];
+            if (slot->depth)
+                gm_buffer_unref(slot->depth);
+            if (slot->video)
+                gm_buffer_unref(slot->video);
+            slot->depth = NULL;
+            slot->video = NULL;
+            slot->frame = -1;
+        }
+
+        gm_debug(dev->log, "Recording prefetch: %" PRIu64 " hits, %" PRIu64
+                 " misses",
+                 dev->recording.n_prefetch_hits,
+                 dev->recording.n_prefetch_misses);
+    }
 
     int ret = pthread_join(dev->recording.io_thread, &retval);
     if (ret < 0) {
@@ -1440,6 +2659,611 @@ recording_stop(struct gm_device *dev)
     }
 }
 
+/* Reads the joint positions for one training image, rotating them 180
+ * degrees around the X axis from the rendering camera's convention (+Y up,
+ * looking along -Z) to the depth camera's (+Y down, +Z away from the camera).
+ */
+static bool
+synthetic_read_joints(struct gm_device *dev,
+                      const char *filename,
+                      float *joints,
+                      char **err)
+{
+    FILE *fp = fopen(filename, "rb");
+    if (!fp) {
+        gm_throw(dev->log, err, "Failed to open joints %s: %s",
+                 filename, strerror(errno));
+        return false;
+    }
+
+    size_t n_floats = dev->synthetic.n_joints * 3;
+    bool status = fread(joints, sizeof(float), n_floats, fp) == n_floats &&
+        fgetc(fp) == EOF;
+    fclose(fp);
+
+    if (!status) {
+        gm_throw(dev->log, err, "Expected %d joints in %s",
+                 dev->synthetic.n_joints, filename);
+        return false;
+    }
+
+    for (int j = 0; j < dev->synthetic.n_joints; j++) {
+        joints[j * 3 + 1] = -joints[j * 3 + 1];
+        joints[j * 3 + 2] = -joints[j * 3 + 2];
+    }
+
+    return true;
+}
+
+/* Accumulates the difference between each joint's depth and the depth of the
+ * training image pixel it projects onto, ignoring joints that land on the
+ * background or outside the image.
+ */
+static void
+synthetic_measure_joint_depths(struct gm_device *dev,
+                               int image,
+                               double *total_diff,
+                               int *n_measured)
+{
+    struct gm_intrinsics *in = &dev->synthetic.image_intrinsics;
+    int width = in->width;
+    int height = in->height;
+    size_t image_size = (size_t)width * height;
+    const half *depth = &dev->synthetic.depth_images[image * image_size];
+    const float *joints =
+        &dev->synthetic.joints[image * dev->synthetic.n_joints * 3];
+
+    for (int j = 0; j < dev->synthetic.n_joints; j++) {
+        float z = joints[j * 3 + 2];
+        if (!(z > 0))
+            continue;
+
+        int x = (int)floorf(joints[j * 3 + 0] * in->fx / z + in->cx);
+        int y = (int)floorf(joints[j * 3 + 1] * in->fy / z + in->cy);
+        if (x < 0 || x >= width || y < 0 || y >= height)
+            continue;
+
+        float surface = depth[y * width + x];
+        if (!(surface > 0 && surface < SYNTHETIC_MAX_IMAGE_DEPTH_M))
+            continue;
+
+        *total_diff += fabsf(z - surface);
+        (*n_measured)++;
+    }
+}
+
+static bool
+synthetic_load_images(struct gm_device *dev,
+                      struct gm_device_config *config,
+                      char **err)
+{
+    const char *data_dir = config->synthetic.path;
+    const char *index_name = config->synthetic.index_name ?
+        config->synthetic.index_name : "full";
+    int max_images = config->synthetic.max_images > 0 ?
+        config->synthetic.max_images : SYNTHETIC_DEFAULT_MAX_IMAGES;
+    struct gm_intrinsics *intrinsics = &dev->synthetic.image_intrinsics;
+
+    char *filename = NULL;
+    xasprintf(&filename, "%s/meta.json", data_dir);
+    JSON_Value *meta = json_parse_file(filename);
+    if (!meta) {
+        gm_throw(dev->log, err, "Failed to parse %s", filename);
+        xfree(filename);
+        return false;
+    }
+    xfree(filename);
+
+    JSON_Object *camera = json_object_get_object(json_object(meta), "camera");
+    int width = json_object_get_number(camera, "width");
+    int height = json_object_get_number(camera, "height");
+    float vfov = json_object_get_number(camera, "vertical_fov");
+    json_value_free(meta);
+
+    if (width <= 0 || height <= 0 || vfov <= 0) {
+        gm_throw(dev->log, err, "Missing camera description in %s/meta.json",
+                 data_dir);
+        return false;
+    }
+
+    /* Training images are rendered with square pixels */
+    memset(intrinsics, 0, sizeof(*intrinsics));
+    intrinsics->width = width;
+    intrinsics->height = height;
+    intrinsics->fy = (height / 2.0) / tan(vfov * M_PI / 360.0);
+    intrinsics->fx = intrinsics->fy;
+    intrinsics->cx = width / 2.0;
+    intrinsics->cy = height / 2.0;
+    intrinsics->distortion_model = GM_DISTORTION_NONE;
+
+    xasprintf(&filename, "%s/index.%s", data_dir, index_name);
+    FILE *index = fopen(filename, "r");
+    if (!index) {
+        gm_throw(dev->log, err, "Failed to open index %s", filename);
+        xfree(filename);
+        return false;
+    }
+    xfree(filename);
+
+    std::vector<std::string> names;
+    char *line = NULL;
+    size_t line_buf_len = 0;
+    ssize_t line_len;
+    while ((int)names.size() < max_images &&
+           (line_len = getline(&line, &line_buf_len, index)) != -1)
+    {
+        if (line_len <= 1)
+            continue;
+        /* remove the trailing newline from the line */
+        line[line_len - 1] = '\0';
+        names.push_back(line);
+    }
+    free(line);
+    fclose(index);
+
+    if (names.empty()) {
+        gm_throw(dev->log, err, "No images in %s/index.%s",
+                 data_dir, index_name);
+        return false;
+    }
+
+    /* The number of joints is determined by the size of the first joint
+     * file, and all the others must match
+     */
+    xasprintf(&filename, "%s/labels/%s.jnt", data_dir, names[0].c_str());
+    struct stat sb;
+    if (stat(filename, &sb) < 0 || sb.st_size == 0 ||
+        sb.st_size % (sizeof(float) * 3))
+    {
+        gm_throw(dev->log, err, "Missing or malformed joints %s", filename);
+        xfree(filename);
+        return false;
+    }
+    xfree(filename);
+    dev->synthetic.n_joints = sb.st_size / (sizeof(float) * 3);
+
+    int n_images = names.size();
+    size_t image_size = (size_t)width * height;
+    dev->synthetic.depth_images =
+        (half *)xmalloc(n_images * image_size * sizeof(half));
+    dev->synthetic.joints = (float *)
+        xmalloc(n_images * dev->synthetic.n_joints * 3 * sizeof(float));
+
+    double total_depth_diff = 0;
+    int n_depths_measured = 0;
+
+    for (int i = 0; i < n_images; i++) {
+        IUImageSpec spec = { width, height, IU_FORMAT_HALF };
+        void *output = &dev->synthetic.depth_images[i * image_size];
+
+        xasprintf(&filename, "%s/depth/%s.exr", data_dir, names[i].c_str());
+        if (iu_read_exr_from_file(filename, &spec, &output) != SUCCESS) {
+            gm_throw(dev->log, err, "Failed to read depth image %s", filename);
+            xfree(filename);
+            return false;
+        }
+        xfree(filename);
+
+        xasprintf(&filename, "%s/labels/%s.jnt", data_dir, names[i].c_str());
+        float *joints =
+            &dev->synthetic.joints[i * dev->synthetic.n_joints * 3];
+        bool status = synthetic_read_joints(dev, filename, joints, err);
+        xfree(filename);
+        if (!status)
+            return false;
+
+        /* Only count fully loaded images, for synthetic_close() */
+        dev->synthetic.n_images = i + 1;
+
+        synthetic_measure_joint_depths(dev, i, &total_depth_diff,
+                                       &n_depths_measured);
+    }
+
+    /* Sanity check that the ground truth joints are in the same space as
+     * the depth that gets composited, since that's what they'll be compared
+     * against
+     */
+    if (n_depths_measured == 0 ||
+        total_depth_diff / n_depths_measured >
+        SYNTHETIC_JOINT_DEPTH_TOLERANCE_M)
+    {
+        gm_throw(dev->log, err,
+                 "Joints in %s/labels don't line up with the depth images "
+                 "(%d joints on the body, %.2fm mean depth difference)",
+                 data_dir, n_depths_measured,
+                 n_depths_measured ? total_depth_diff / n_depths_measured : 0);
+        return false;
+    }
+
+    gm_info(dev->log, "Loaded %d %dx%d training images with %d joints from %s",
+            n_images, width, height, dev->synthetic.n_joints, data_dir);
+
+    return true;
+}
+
+static bool
+synthetic_open(struct gm_device *dev,
+               struct gm_device_config *config, char **err)
+{
+    pthread_cond_init(&dev->synthetic.consumer_cond, NULL);
+    pthread_mutex_init(&dev->synthetic.ground_truth_lock, NULL);
+
+    if (!config->synthetic.path) {
+        gm_throw(dev->log, err, "No training data path given");
+        return false;
+    }
+
+    dev->synthetic.n_people = config->synthetic.n_people ?
+        config->synthetic.n_people : 1;
+    if (dev->synthetic.n_people < 1 ||
+        dev->synthetic.n_people > SYNTHETIC_MAX_PEOPLE)
+    {
+        gm_throw(dev->log, err, "Synthetic people count must be from 1 to %d",
+                 SYNTHETIC_MAX_PEOPLE);
+        return false;
+    }
+
+    if (!synthetic_load_images(dev, config, err))
+        return false;
+
+    for (int i = 0; i < SYNTHETIC_GROUND_TRUTH_FRAMES; i++) {
+        dev->synthetic.ground_truth[i].joints = (float *)
+            xcalloc(SYNTHETIC_MAX_PEOPLE * dev->synthetic.n_joints * 3,
+                    sizeof(float));
+    }
+
+    /* The synthesized frames are seen through a camera with the same
+     * vertical field of view as the training camera
+     */
+    struct gm_intrinsics *image_intrinsics = &dev->synthetic.image_intrinsics;
+    int width = config->synthetic.width > 0 ?
+        config->synthetic.width : image_intrinsics->width;
+    int height = config->synthetic.height > 0 ?
+        config->synthetic.height : image_intrinsics->height;
+    double scale = height / (double)image_intrinsics->height;
+
+    memset(&dev->depth_camera_intrinsics, 0,
+           sizeof(dev->depth_camera_intrinsics));
+    dev->depth_camera_intrinsics.width = width;
+    dev->depth_camera_intrinsics.height = height;
+    dev->depth_camera_intrinsics.fx = image_intrinsics->fx * scale;
+    dev->depth_camera_intrinsics.fy = image_intrinsics->fy * scale;
+    dev->depth_camera_intrinsics.cx = width / 2.0;
+    dev->depth_camera_intrinsics.cy = height / 2.0;
+    dev->depth_camera_intrinsics.distortion_model = GM_DISTORTION_NONE;
+    dev->depth_format = GM_FORMAT_Z_F32_M;
+
+    /* The video is just a greyscale visualisation of the depth */
+    dev->video_format = GM_FORMAT_LUMINANCE_U8;
+    dev->video_camera_intrinsics = dev->depth_camera_intrinsics;
+    memset(&dev->depth_to_video_extrinsics, 0,
+           sizeof(dev->depth_to_video_extrinsics));
+    dev->depth_to_video_extrinsics.rotation[0] = 1.f;
+    dev->depth_to_video_extrinsics.rotation[4] = 1.f;
+    dev->depth_to_video_extrinsics.rotation[8] = 1.f;
+
+    dev->synthetic.background_depth = config->synthetic.background_depth;
+
+    struct gm_ui_property prop;
+
+    dev->synthetic.frame = 0;
+    prop = gm_ui_property();
+    prop.object = dev;
+    prop.name = "frame";
+    prop.desc = "Number of frames synthesized";
+    prop.type = GM_PROPERTY_INT;
+    prop.int_state.ptr = &dev->synthetic.frame;
+    prop.int_state.min = 0;
+    prop.int_state.max = INT_MAX;
+    prop.read_only = true;
+    dev->properties.push_back(prop);
+
+    dev->synthetic.fps = config->synthetic.fps;
+    prop = gm_ui_property();
+    prop.object = dev;
+    prop.name = "fps";
+    prop.desc = "Frames synthesized per second (0 = as fast as requested)";
+    prop.type = GM_PROPERTY_FLOAT;
+    prop.float_state.ptr = &dev->synthetic.fps;
+    prop.float_state.min = 0;
+    prop.float_state.max = 240;
+    dev->properties.push_back(prop);
+
+    prop = gm_ui_property();
+    prop.object = dev;
+    prop.name = "people";
+    prop.desc = "Number of people composited into each frame";
+    prop.type = GM_PROPERTY_INT;
+    prop.int_state.ptr = &dev->synthetic.n_people;
+    prop.int_state.min = 1;
+    prop.int_state.max = SYNTHETIC_MAX_PEOPLE;
+    dev->properties.push_back(prop);
+
+    return true;
+}
+
+static void
+synthetic_close(struct gm_device *dev)
+{
+    if (dev->synthetic.depth_images) {
+        xfree(dev->synthetic.depth_images);
+        dev->synthetic.depth_images = nullptr;
+    }
+    if (dev->synthetic.joints) {
+        xfree(dev->synthetic.joints);
+        dev->synthetic.joints = nullptr;
+    }
+    dev->synthetic.n_images = 0;
+
+    for (int i = 0; i < SYNTHETIC_GROUND_TRUTH_FRAMES; i++) {
+        if (dev->synthetic.ground_truth[i].joints) {
+            xfree(dev->synthetic.ground_truth[i].joints);
+            dev->synthetic.ground_truth[i].joints = nullptr;
+        }
+    }
+
+    pthread_mutex_destroy(&dev->synthetic.ground_truth_lock);
+    pthread_cond_destroy(&dev->synthetic.consumer_cond);
+}
+
+/* Reprojects a training image into the synthetic camera, offset by
+ * (offset_x, 0, offset_z) meters, keeping the nearest depth per pixel.
+ *
+ * Each point is splatted over a square footprint that approximates its
+ * projected size so that scaling up doesn't leave holes.
+ */
+static void
+synthetic_composite_image(struct gm_device *dev,
+                          int image,
+                          float offset_x,
+                          float offset_z,
+                          float *depth_out)
+{
+    struct gm_intrinsics *in = &dev->synthetic.image_intrinsics;
+    struct gm_intrinsics *out = &dev->depth_camera_intrinsics;
+    int in_width = in->width;
+    int in_height = in->height;
+    int out_width = out->width;
+    int out_height = out->height;
+    const half *depth_in =
+        &dev->synthetic.depth_images[(size_t)image * in_width * in_height];
+
+    float in_inv_fx = 1.0f / in->fx;
+    float in_inv_fy = 1.0f / in->fy;
+    float scale = out->fx / in->fx;
+
+    for (int y = 0; y < in_height; y++) {
+        for (int x = 0; x < in_width; x++) {
+            float depth = depth_in[y * in_width + x];
+            if (!(depth > 0 && depth < SYNTHETIC_MAX_IMAGE_DEPTH_M))
+                continue;
+
+            float px = (x + 0.5f - in->cx) * depth * in_inv_fx + offset_x;
+            float py = (y + 0.5f - in->cy) * depth * in_inv_fy;
+            float pz = depth + offset_z;
+
+            float footprint = scale * depth / pz;
+            int size = std::max(1, (int)ceilf(footprint));
+            int u0 = (int)floorf(px * out->fx / pz + out->cx - size * 0.5f);
+            int v0 = (int)floorf(py * out->fy / pz + out->cy - size * 0.5f);
+
+            for (int v = std::max(v0, 0);
+                 v < std::min(v0 + size, out_height); v++)
+            {
+                for (int u = std::max(u0, 0);
+                     u < std::min(u0 + size, out_width); u++)
+                {
+                    float *dst = &depth_out[v * out_width + u];
+                    if (*dst == 0 || pz < *dst)
+                        *dst = pz;
+                }
+            }
+        }
+    }
+}
+
+/* Composites the people for the given frame number into a depth buffer and
+ * records their ground truth joints.
+ */
+static void
+synthetic_render_frame(struct gm_device *dev,
+                       uint64_t timestamp,
+                       int frame_no,
+                       float *depth_out)
+{
+    int width = dev->depth_camera_intrinsics.width;
+    int height = dev->depth_camera_intrinsics.height;
+    int n_images = dev->synthetic.n_images;
+    int n_joints = dev->synthetic.n_joints;
+    int n_people = std::min(std::max(dev->synthetic.n_people, 1),
+                            SYNTHETIC_MAX_PEOPLE);
+
+    float background = dev->synthetic.background_depth;
+    for (int i = 0; i < width * height; i++)
+        depth_out[i] = background;
+
+    pthread_mutex_lock(&dev->synthetic.ground_truth_lock);
+
+    struct synthetic_ground_truth *truth =
+        &dev->synthetic.ground_truth[dev->synthetic.ground_truth_pos];
+    dev->synthetic.ground_truth_pos =
+        (dev->synthetic.ground_truth_pos + 1) % SYNTHETIC_GROUND_TRUTH_FRAMES;
+    truth->timestamp = timestamp;
+    truth->n_people = n_people;
+
+    for (int p = 0; p < n_people; p++) {
+        /* Each person plays through the training images (which are
+         * typically in mocap sequence order) at a different phase
+         */
+        int image = (frame_no + p * (n_images / n_people)) % n_images;
+        float offset_x = (p - (n_people - 1) / 2.0f) *
+            SYNTHETIC_PERSON_SPACING_M;
+        float offset_z = (p % 2) * SYNTHETIC_PERSON_STAGGER_M;
+
+        synthetic_composite_image(dev, image, offset_x, offset_z, depth_out);
+
+        const float *joints = &dev->synthetic.joints[image * n_joints * 3];
+        float *truth_joints = &truth->joints[p * n_joints * 3];
+        for (int j = 0; j < n_joints; j++) {
+            truth_joints[j * 3 + 0] = joints[j * 3 + 0] + offset_x;
+            truth_joints[j * 3 + 1] = joints[j * 3 + 1];
+            truth_joints[j * 3 + 2] = joints[j * 3 + 2] + offset_z;
+        }
+    }
+
+    pthread_mutex_unlock(&dev->synthetic.ground_truth_lock);
+}
+
+static void
+synthetic_render_video(struct gm_device *dev,
+                       const float *depth,
+                       uint8_t *video_out)
+{
+    int n_pixels = dev->depth_camera_intrinsics.width *
+        dev->depth_camera_intrinsics.height;
+
+    /* Nearer is brighter, fading out by 8 meters */
+    for (int i = 0; i < n_pixels; i++) {
+        float val = depth[i] > 0 ? 255.f - depth[i] * (255.f / 8.f) : 0;
+        video_out[i] = (uint8_t)std::min(std::max(val, 0.f), 255.f);
+    }
+}
+
+/* When not paced by a frame rate, blocks until the consumer has requested a
+ * frame.
+ *
+ * Returns false if the device is being stopped.
+ */
+static bool
+synthetic_wait_for_consumer(struct gm_device *dev)
+{
+    pthread_mutex_lock(&dev->request_buffers_mask_lock);
+    while (dev->running &&
+           dev->synthetic.fps <= 0 &&
+           dev->frame_request_buffers_mask == 0)
+    {
+        pthread_cond_wait(&dev->synthetic.consumer_cond,
+                          &dev->request_buffers_mask_lock);
+    }
+    pthread_mutex_unlock(&dev->request_buffers_mask_lock);
+
+    return dev->running;
+}
+
+static void *
+synthetic_io_thread_cb(void *userdata)
+{
+    struct gm_device *dev = (struct gm_device *)userdata;
+    int width = dev->depth_camera_intrinsics.width;
+    int height = dev->depth_camera_intrinsics.height;
+    uint64_t next_frame_time = get_time();
+
+    ProfileSetThreadName("Synthetic IO");
+
+    while (dev->running) {
+        if (!synthetic_wait_for_consumer(dev))
+            break;
+
+        /* Like a real camera, when paced by a frame rate we keep
+         * counting frames even if nothing has been requested
+         */
+        float fps = dev->synthetic.fps;
+        if (fps > 0) {
+            uint64_t now = get_time();
+            if (now < next_frame_time) {
+                usleep((next_frame_time - now) / 1000);
+                continue;
+            }
+            next_frame_time = std::max(next_frame_time + (uint64_t)(1e9 / fps),
+                                       now);
+        }
+
+        uint64_t timestamp = get_time();
+        int frame_no = dev->synthetic.frame++;
+
+        pthread_mutex_lock(&dev->request_buffers_mask_lock);
+        uint64_t buffers_mask = dev->frame_request_buffers_mask;
+        pthread_mutex_unlock(&dev->request_buffers_mask_lock);
+        if (!buffers_mask)
+            continue;
+
+        ProfilePushSection(RenderSyntheticFrame);
+        struct gm_device_buffer *depth_buf =
+            mem_pool_acquire_buffer(dev->depth_buf_pool, "synthetic depth");
+        depth_buf->base.len = width * height * sizeof(float);
+        synthetic_render_frame(dev, timestamp, frame_no,
+                               (float *)depth_buf->base.data);
+
+        struct gm_device_buffer *video_buf = NULL;
+        if (buffers_mask & GM_REQUEST_FRAME_VIDEO) {
+            video_buf = mem_pool_acquire_buffer(dev->video_buf_pool,
+                                                "synthetic video");
+            video_buf->base.len = width * height;
+            synthetic_render_video(dev, (float *)depth_buf->base.data,
+                                   (uint8_t *)video_buf->base.data);
+        }
+        ProfilePopSection();
+
+        pthread_mutex_lock(&dev->swap_buffers_lock);
+
+        dev->frame_time = timestamp;
+
+        if (buffers_mask & GM_REQUEST_FRAME_DEPTH) {
+            std::swap(dev->depth_buf_ready, depth_buf);
+            dev->frame_ready_buffers_mask |= GM_REQUEST_FRAME_DEPTH;
+        }
+        if (video_buf) {
+            std::swap(dev->video_buf_ready, video_buf);
+            dev->frame_ready_buffers_mask |= GM_REQUEST_FRAME_VIDEO;
+        }
+
+        pthread_mutex_unlock(&dev->swap_buffers_lock);
+
+        /* Release whatever was replaced (or not wanted) */
+        if (depth_buf)
+            gm_buffer_unref(&depth_buf->base);
+        if (video_buf)
+            gm_buffer_unref(&video_buf->base);
+
+        pthread_mutex_lock(&dev->request_buffers_mask_lock);
+        maybe_notify_frame_locked(dev);
+        pthread_mutex_unlock(&dev->request_buffers_mask_lock);
+    }
+
+    ProfileFinishThread();
+
+    return NULL;
+}
+
+static void
+synthetic_start(struct gm_device *dev)
+{
+    dev->synthetic.frame = 0;
+
+    /* Set running before starting thread, otherwise it would exit immediately */
+    dev->running = true;
+    pthread_create(&dev->synthetic.io_thread,
+                   NULL,
+                   synthetic_io_thread_cb,
+                   dev);
+    pthread_setname_np(dev->synthetic.io_thread, "Synthetic IO");
+}
+
+static void
+synthetic_stop(struct gm_device *dev)
+{
+    pthread_mutex_lock(&dev->request_buffers_mask_lock);
+    dev->running = false;
+    pthread_cond_broadcast(&dev->synthetic.consumer_cond);
+    pthread_mutex_unlock(&dev->request_buffers_mask_lock);
+
+    int ret = pthread_join(dev->synthetic.io_thread, NULL);
+    if (ret != 0) {
+        gm_error(dev->log, "Failed to wait for synthetic IO thread to exit: %s",
+                 strerror(ret));
+    }
+}
+
 static void
 notify_device_ready(struct gm_device *dev)
 {
@@ -2117,28 +3941,34 @@ gm_device_open(struct gm_logger *log,
     dev->log = log;
     dev->type = config->type;
 
-    dev->video_buf_pool = mem_pool_alloc(
+    dev->video_buf_pool = mem_pool_alloc_lockless(
                      log,
                      "video",
                      INT_MAX, // max size
                      device_video_buf_alloc,
                      device_buffer_free,
+                     device_buffer_get_pool_link,
                      dev); // user data
-    dev->depth_buf_pool = mem_pool_alloc(
+    dev->depth_buf_pool = mem_pool_alloc_lockless(
                      log,
                      "depth",
                      INT_MAX, // max size
                      device_depth_buf_alloc,
                      device_buffer_free,
+                     device_buffer_get_pool_link,
                      dev); // user data
-    dev->frame_pool = mem_pool_alloc(
+    dev->frame_pool = mem_pool_alloc_lockless(
                      log,
                      "frame",
                      INT_MAX, // max size
                      device_frame_alloc,
                      device_frame_free,
+                     device_frame_get_pool_link,
                      dev); // user data
 
+    mem_pool_set_byte_budget(dev->video_buf_pool, config->video_buffer_budget);
+    mem_pool_set_byte_budget(dev->depth_buf_pool, config->depth_buffer_budget);
+
     switch (config->type) {
     case GM_DEVICE_KINECT:
         gm_debug(log, "Opening Kinect device");
@@ -2152,6 +3982,10 @@ gm_device_open(struct gm_logger *log,
         gm_debug(log, "Opening Glimpse Viewer recording playback device");
         status = recording_open(dev, config, err);
         break;
+    case GM_DEVICE_SYNTHETIC:
+        gm_debug(log, "Opening synthetic training data device");
+        status = synthetic_open(dev, config, err);
+        break;
     case GM_DEVICE_TANGO:
         gm_debug(log, "Opening Tango device");
 #ifdef USE_TANGO
@@ -2218,6 +4052,19 @@ gm_device_commit_config(struct gm_device *dev, char **err)
 #endif
         break;
     default:
+        /* The camera intrinsics are known at this point so we can allocate
+         * some frames up front instead of paying for that while handling
+         * the first frames.
+         */
+        {
+            int n_buffers = DEVICE_PREALLOC_FRAMES;
+            if (dev->type == GM_DEVICE_RECORDING)
+                n_buffers += dev->recording.n_prefetch;
+            mem_pool_prealloc(dev->video_buf_pool, n_buffers);
+            mem_pool_prealloc(dev->depth_buf_pool, n_buffers);
+        }
+        mem_pool_prealloc(dev->frame_pool, DEVICE_PREALLOC_FRAMES);
+
         dev->configured = true;
         notify_device_ready(dev);
         status = true;
@@ -2310,6 +4157,10 @@ gm_device_close(struct gm_device *dev)
         gm_debug(dev->log, "recording_close");
         recording_close(dev);
         break;
+    case GM_DEVICE_SYNTHETIC:
+        gm_debug(dev->log, "synthetic_close");
+        synthetic_close(dev);
+        break;
     case GM_DEVICE_TANGO:
 #ifdef USE_TANGO
         gm_debug(dev->log, "tango_close");
@@ -2390,6 +4241,9 @@ gm_device_start(struct gm_device *dev)
     case GM_DEVICE_RECORDING:
         recording_start(dev);
         break;
+    case GM_DEVICE_SYNTHETIC:
+        synthetic_start(dev);
+        break;
     case GM_DEVICE_TANGO:
 #ifdef USE_TANGO
         tango_start(dev);
@@ -2418,6 +4272,10 @@ gm_device_stop(struct gm_device *dev)
         gm_debug(dev->log, "recording_stop");
         recording_stop(dev);
         break;
+    case GM_DEVICE_SYNTHETIC:
+        gm_debug(dev->log, "synthetic_stop");
+        synthetic_stop(dev);
+        break;
     case GM_DEVICE_TANGO:
 #ifdef USE_TANGO
         gm_debug(dev->log, "tango_stop");
@@ -2468,6 +4326,10 @@ gm_device_request_frame(struct gm_device *dev, uint64_t buffers_mask)
     pthread_mutex_lock(&dev->request_buffers_mask_lock);
     dev->frame_request_buffers_mask |= buffers_mask;
     maybe_notify_frame_locked(dev);
+    if (dev->type == GM_DEVICE_RECORDING)
+        pthread_cond_broadcast(&dev->recording.consumer_cond);
+    else if (dev->type == GM_DEVICE_SYNTHETIC)
+        pthread_cond_broadcast(&dev->synthetic.consumer_cond);
     pthread_mutex_unlock(&dev->request_buffers_mask_lock);
 }
 
@@ -2539,6 +4401,13 @@ gm_device_get_latest_frame(struct gm_device *dev)
 
     pthread_mutex_unlock(&dev->swap_buffers_lock);
 
+    /* Lockstep playback waits for frames to be collected */
+    if (dev->type == GM_DEVICE_RECORDING) {
+        pthread_mutex_lock(&dev->request_buffers_mask_lock);
+        pthread_cond_broadcast(&dev->recording.consumer_cond);
+        pthread_mutex_unlock(&dev->request_buffers_mask_lock);
+    }
+
     /* We should have one ref for dev->last_frame and return a _ref() to the
      * caller so there's no race between the caller claiming a reference and us
      * possibly dropping our own ref.
@@ -2572,6 +4441,38 @@ gm_device_combine_frames(struct gm_device *dev, uint64_t timestamp,
     return &frame->base;
 }
 
+int
+gm_device_get_ground_truth_n_joints(struct gm_device *dev)
+{
+    return dev->type == GM_DEVICE_SYNTHETIC ? dev->synthetic.n_joints : 0;
+}
+
+int
+gm_device_get_ground_truth_joints(struct gm_device *dev,
+                                  uint64_t timestamp,
+                                  float *joints,
+                                  int max_people)
+{
+    if (dev->type != GM_DEVICE_SYNTHETIC || timestamp == 0)
+        return -1;
+
+    int n_people = -1;
+    int n_floats = dev->synthetic.n_joints * 3;
+
+    pthread_mutex_lock(&dev->synthetic.ground_truth_lock);
+    for (int i = 0; i < SYNTHETIC_GROUND_TRUTH_FRAMES; i++) {
+        struct synthetic_ground_truth *truth = &dev->synthetic.ground_truth[i];
+        if (truth->timestamp == timestamp) {
+            n_people = std::min(truth->n_people, max_people);
+            memcpy(joints, truth->joints, n_people * n_floats * sizeof(float));
+            break;
+        }
+    }
+    pthread_mutex_unlock(&dev->synthetic.ground_truth_lock);
+
+    return n_people;
+}
+
 struct gm_ui_properties *
 gm_device_get_ui_properties(struct gm_device *dev)
 {
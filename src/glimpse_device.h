@@ -59,6 +59,23 @@ enum gm_device_type {
     GM_DEVICE_KINECT,
     GM_DEVICE_RECORDING,
     GM_DEVICE_TANGO,
+    GM_DEVICE_SYNTHETIC,
+};
+
+enum gm_recording_playback_mode {
+    /* Paced according to the recorded timestamps, skipping frames if
+     * playback falls behind
+     */
+    GM_RECORDING_PLAYBACK_REALTIME,
+
+    /* The next frame is emitted as soon as the consumer requests one */
+    GM_RECORDING_PLAYBACK_MAX_RATE,
+
+    /* Like _MAX_RATE but also waits for each frame to be collected (via
+     * gm_device_get_latest_frame()) before emitting the next, so frames are
+     * never replaced before being seen.
+     */
+    GM_RECORDING_PLAYBACK_LOCKSTEP,
 };
 
 struct gm_device_config {
@@ -66,11 +83,75 @@ struct gm_device_config {
     union {
         struct {
             int device_number;
+
+            /* GM_FORMAT_Z_U16_MM (the default if left as _UNKNOWN) or
+             * GM_FORMAT_Z_F32_M
+             */
+            enum gm_format depth_format;
+
+            /* Skip registering depth to the video camera. This saves a
+             * little work if only depth is needed, but depth and video will
+             * then no longer be aligned.
+             */
+            bool unregistered_depth;
         } kinect;
         struct {
             const char *path;
+
+            /* How many frames to read ahead of playback on a separate
+             * thread (0 = default, < 0 = read each frame synchronously).
+             *
+             * NB: the prefetched buffers count towards any buffer budgets
+             * below, and fewer frames are prefetched if a budget couldn't
+             * otherwise leave room for the frames being played.
+             */
+            int prefetch_frames;
+
+            /* Frame timestamps follow the recording in every mode, so
+             * non-realtime playback can be used for reproducible offline
+             * evaluation
+             */
+            enum gm_recording_playback_mode playback_mode;
         } recording;
+        struct {
+            /* Directory of rendered training data (with a meta.json,
+             * index.<name> file and depth/ + labels/ subdirectories as
+             * read by train_rdt)
+             */
+            const char *path;
+            const char *index_name; // NULL = "full"
+
+            /* Limit on how many training images to load (0 = default) */
+            int max_images;
+
+            /* Size of the synthesized depth frames (0 = same as the
+             * training data). The training camera's vertical field of view
+             * is kept either way.
+             */
+            int width;
+            int height;
+
+            /* Frames per second (<= 0 = a new frame as soon as one is
+             * requested)
+             */
+            float fps;
+
+            /* Number of people composited side by side into each frame */
+            int n_people;
+
+            /* Depth of a back wall in meters (0 = no wall, leaving
+             * background pixels empty)
+             */
+            float background_depth;
+        } synthetic;
     };
+
+    /* Optional limits on the memory used for video and depth buffers, in
+     * bytes (0 = no limit). Once reached, acquiring a new buffer blocks until
+     * an old one is released, which in turn throttles frame capture.
+     */
+    size_t video_buffer_budget;
+    size_t depth_buffer_budget;
 };
 
 #ifdef __cplusplus
@@ -138,6 +219,29 @@ struct gm_frame *
 gm_device_combine_frames(struct gm_device *dev, uint64_t timestamp,
                          struct gm_frame *depth, struct gm_frame *video);
 
+/* Synthetic devices only: the number of joints per person in the ground
+ * truth (0 for other devices).
+ */
+int
+gm_device_get_ground_truth_n_joints(struct gm_device *dev);
+
+/* Synthetic devices only: looks up the ground-truth joint positions of the
+ * people composited into the frame with the given timestamp, in the depth
+ * camera's space (meters, +Y down, +Z away from the camera, the same as
+ * tracked skeletons).
+ *
+ * @joints needs room for @max_people * n_joints * 3 floats.
+ *
+ * Only the most recent frames are remembered so this should be queried
+ * soon after the frame is tracked. Returns the number of people written or
+ * -1 if the frame is unknown.
+ */
+int
+gm_device_get_ground_truth_joints(struct gm_device *dev,
+                                  uint64_t timestamp,
+                                  float *joints,
+                                  int max_people);
+
 #ifdef __ANDROID__
 void
 gm_device_attach_jvm(struct gm_device *dev, JavaVM *jvm);
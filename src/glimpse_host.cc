@@ -0,0 +1,445 @@
+/*
+ * Copyright (C) 2018 Glimp IP Ltd
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <inttypes.h>
+#include <pthread.h>
+
+#include <vector>
+#include <algorithm>
+
+#include <profiler.h>
+
+#include "xalloc.h"
+
+#include "glimpse_log.h"
+#include "glimpse_host.h"
+
+#undef GM_LOG_CONTEXT
+#define GM_LOG_CONTEXT "host"
+
+struct gm_host_camera
+{
+    char *name;
+    uint64_t deadline_ns;
+
+    void (*run_job)(struct gm_host_camera *camera, void *job, void *user_data);
+    void (*drop_job)(struct gm_host_camera *camera, void *job, void *user_data);
+    void *user_data;
+
+    /* At most one job may be pending and at most one may be running */
+    void *pending_job;
+    uint64_t pending_submit_time;
+    bool busy;
+    bool removing;
+
+    /* Value of host->service_counter when a job for this camera last
+     * completed, used to break deadline ties fairly
+     */
+    uint64_t last_serviced;
+
+    uint64_t n_submitted;
+    uint64_t n_completed;
+    uint64_t n_dropped;
+    uint64_t n_late;
+    uint64_t latency_total_ns;
+    uint64_t latency_max_ns;
+    uint64_t run_total_ns;
+};
+
+struct gm_host
+{
+    struct gm_logger *log;
+
+    pthread_mutex_t lock;
+
+    /* Signaled when a new job is submitted or the host is stopping */
+    pthread_cond_t job_cond;
+
+    /* Signaled whenever a worker finishes a job */
+    pthread_cond_t idle_cond;
+
+    bool stopping;
+
+    std::vector<pthread_t> workers;
+    std::vector<struct gm_host_camera *> cameras;
+
+    uint64_t service_counter;
+
+    uint64_t start_time;
+    uint64_t n_completed;
+    uint64_t n_dropped;
+};
+
+static uint64_t
+get_time(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ((uint64_t)ts.tv_sec) * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+/* XXX: host->lock must be held */
+static struct gm_host_camera *
+pick_next_camera_locked(struct gm_host *host)
+{
+    struct gm_host_camera *best = NULL;
+    uint64_t best_deadline = 0;
+
+    for (unsigned i = 0; i < host->cameras.size(); i++) {
+        struct gm_host_camera *camera = host->cameras[i];
+
+        if (!camera->pending_job || camera->busy || camera->removing)
+            continue;
+
+        uint64_t deadline = camera->pending_submit_time + camera->deadline_ns;
+        if (!best ||
+            deadline < best_deadline ||
+            (deadline == best_deadline &&
+             camera->last_serviced < best->last_serviced))
+        {
+            best = camera;
+            best_deadline = deadline;
+        }
+    }
+
+    return best;
+}
+
+static void *
+worker_thread_cb(void *data)
+{
+    struct gm_host *host = (struct gm_host *)data;
+
+    ProfileSetThreadName("Glimpse Host");
+
+    pthread_mutex_lock(&host->lock);
+
+    while (!host->stopping) {
+        struct gm_host_camera *camera = pick_next_camera_locked(host);
+        if (!camera) {
+            pthread_cond_wait(&host->job_cond, &host->lock);
+            continue;
+        }
+
+        void *job = camera->pending_job;
+        uint64_t submit_time = camera->pending_submit_time;
+        camera->pending_job = NULL;
+        camera->busy = true;
+
+        pthread_mutex_unlock(&host->lock);
+
+        uint64_t start = get_time();
+        camera->run_job(camera, job, camera->user_data);
+        uint64_t end = get_time();
+
+        pthread_mutex_lock(&host->lock);
+
+        uint64_t latency = end - submit_time;
+        camera->n_completed++;
+        camera->latency_total_ns += latency;
+        camera->latency_max_ns = std::max(camera->latency_max_ns, latency);
+        camera->run_total_ns += end - start;
+        if (latency > camera->deadline_ns)
+            camera->n_late++;
+
+        camera->busy = false;
+        camera->last_serviced = ++host->service_counter;
+        host->n_completed++;
+
+        pthread_cond_broadcast(&host->idle_cond);
+    }
+
+    pthread_mutex_unlock(&host->lock);
+
+    ProfileFinishThread();
+
+    return NULL;
+}
+
+struct gm_host *
+gm_host_new(struct gm_logger *log, int n_workers, char **err)
+{
+    struct gm_host *host = new gm_host();
+
+    host->log = log;
+    host->start_time = get_time();
+
+    pthread_mutex_init(&host->lock, NULL);
+    pthread_cond_init(&host->job_cond, NULL);
+    pthread_cond_init(&host->idle_cond, NULL);
+
+    if (n_workers <= 0) {
+        n_workers = (int)sysconf(_SC_NPROCESSORS_ONLN);
+        if (n_workers <= 0)
+            n_workers = 1;
+    }
+
+    for (int i = 0; i < n_workers; i++) {
+        pthread_t thread;
+        int ret = pthread_create(&thread,
+                                 NULL, /* default attributes */
+                                 worker_thread_cb,
+                                 host);
+        if (ret != 0) {
+            gm_throw(log, err, "Failed to start host worker thread: %s",
+                     strerror(ret));
+            gm_host_destroy(host);
+            return NULL;
+        }
+
+        char name[16];
+        snprintf(name, sizeof(name), "Glimpse Host %d", i);
+        pthread_setname_np(thread, name);
+
+        host->workers.push_back(thread);
+    }
+
+    gm_debug(log, "Started host with %d workers", n_workers);
+
+    return host;
+}
+
+void
+gm_host_destroy(struct gm_host *host)
+{
+    pthread_mutex_lock(&host->lock);
+
+    gm_assert(host->log, host->cameras.size() == 0,
+              "Host destroyed with %d cameras still registered",
+              (int)host->cameras.size());
+
+    host->stopping = true;
+    pthread_cond_broadcast(&host->job_cond);
+    pthread_mutex_unlock(&host->lock);
+
+    for (unsigned i = 0; i < host->workers.size(); i++) {
+        int ret = pthread_join(host->workers[i], NULL);
+        if (ret != 0) {
+            gm_error(host->log, "Failed waiting for host worker to exit: %s",
+                     strerror(ret));
+        }
+    }
+
+    pthread_cond_destroy(&host->idle_cond);
+    pthread_cond_destroy(&host->job_cond);
+    pthread_mutex_destroy(&host->lock);
+
+    delete host;
+}
+
+struct gm_host_camera *
+gm_host_add_camera(struct gm_host *host,
+                   const char *name,
+                   uint64_t deadline_ns,
+                   void (*run_job)(struct gm_host_camera *camera,
+                                   void *job,
+                                   void *user_data),
+                   void (*drop_job)(struct gm_host_camera *camera,
+                                    void *job,
+                                    void *user_data),
+                   void *user_data)
+{
+    struct gm_host_camera *camera =
+        (struct gm_host_camera *)xcalloc(1, sizeof(*camera));
+
+    camera->name = strdup(name);
+    camera->deadline_ns = deadline_ns;
+    camera->run_job = run_job;
+    camera->drop_job = drop_job;
+    camera->user_data = user_data;
+
+    pthread_mutex_lock(&host->lock);
+
+    /* Treat a new camera as the least recently serviced so it gets a chance
+     * to run promptly
+     */
+    camera->last_serviced = 0;
+    host->cameras.push_back(camera);
+
+    pthread_mutex_unlock(&host->lock);
+
+    gm_debug(host->log, "Added camera \"%s\" (deadline = %.3fms)",
+             name, deadline_ns / 1e6);
+
+    return camera;
+}
+
+void
+gm_host_remove_camera(struct gm_host *host, struct gm_host_camera *camera)
+{
+    pthread_mutex_lock(&host->lock);
+
+    camera->removing = true;
+
+    void *dropped = camera->pending_job;
+    camera->pending_job = NULL;
+    if (dropped) {
+        camera->n_dropped++;
+        host->n_dropped++;
+    }
+
+    while (camera->busy)
+        pthread_cond_wait(&host->idle_cond, &host->lock);
+
+    host->cameras.erase(std::remove(host->cameras.begin(),
+                                    host->cameras.end(),
+                                    camera),
+                        host->cameras.end());
+
+    pthread_mutex_unlock(&host->lock);
+
+    if (dropped)
+        camera->drop_job(camera, dropped, camera->user_data);
+
+    gm_debug(host->log, "Removed camera \"%s\"", camera->name);
+
+    free(camera->name);
+    xfree(camera);
+}
+
+void
+gm_host_submit_job(struct gm_host *host,
+                   struct gm_host_camera *camera,
+                   void *job)
+{
+    pthread_mutex_lock(&host->lock);
+
+    gm_assert(host->log, !camera->removing,
+              "Spurious job submitted for camera being removed");
+
+    void *dropped = camera->pending_job;
+    if (dropped) {
+        camera->n_dropped++;
+        host->n_dropped++;
+    }
+
+    camera->pending_job = job;
+    camera->pending_submit_time = get_time();
+    camera->n_submitted++;
+
+    pthread_cond_signal(&host->job_cond);
+    pthread_mutex_unlock(&host->lock);
+
+    /* Drop outside of the lock since it may recycle resources back to
+     * other pools
+     */
+    if (dropped)
+        camera->drop_job(camera, dropped, camera->user_data);
+}
+
+void
+gm_host_get_stats(struct gm_host *host, struct gm_host_stats *stats)
+{
+    pthread_mutex_lock(&host->lock);
+
+    stats->n_workers = (int)host->workers.size();
+    stats->n_cameras = (int)host->cameras.size();
+    stats->elapsed_ns = get_time() - host->start_time;
+    stats->n_completed = host->n_completed;
+    stats->n_dropped = host->n_dropped;
+    stats->throughput = stats->elapsed_ns ?
+        (float)((double)host->n_completed * 1e9 / stats->elapsed_ns) : 0;
+
+    pthread_mutex_unlock(&host->lock);
+}
+
+/* XXX: host->lock must be held */
+static void
+get_camera_stats_locked(struct gm_host_camera *camera,
+                        struct gm_host_camera_stats *stats)
+{
+    stats->name = camera->name;
+    stats->n_submitted = camera->n_submitted;
+    stats->n_completed = camera->n_completed;
+    stats->n_dropped = camera->n_dropped;
+    stats->n_late = camera->n_late;
+    stats->latency_max_ns = camera->latency_max_ns;
+    if (camera->n_completed) {
+        stats->latency_mean_ns = camera->latency_total_ns / camera->n_completed;
+        stats->run_mean_ns = camera->run_total_ns / camera->n_completed;
+    } else {
+        stats->latency_mean_ns = 0;
+        stats->run_mean_ns = 0;
+    }
+}
+
+void
+gm_host_get_camera_stats(struct gm_host *host,
+                         struct gm_host_camera *camera,
+                         struct gm_host_camera_stats *stats)
+{
+    pthread_mutex_lock(&host->lock);
+    get_camera_stats_locked(camera, stats);
+    pthread_mutex_unlock(&host->lock);
+}
+
+void
+gm_host_log_stats(struct gm_host *host)
+{
+    struct gm_host_stats stats;
+
+    gm_host_get_stats(host, &stats);
+
+    gm_info(host->log,
+            "Host: %d workers, %d cameras, %" PRIu64 " jobs completed, "
+            "%" PRIu64 " dropped, %.2f jobs/s",
+            stats.n_workers, stats.n_cameras,
+            stats.n_completed, stats.n_dropped,
+            stats.throughput);
+
+    /* Snapshot the stats under the lock since a camera may be removed
+     * (and freed) as soon as it's dropped. The names are copied for the
+     * same reason.
+     */
+    pthread_mutex_lock(&host->lock);
+    std::vector<struct gm_host_camera_stats> camera_stats(host->cameras.size());
+    for (unsigned i = 0; i < host->cameras.size(); i++) {
+        get_camera_stats_locked(host->cameras[i], &camera_stats[i]);
+        camera_stats[i].name = strdup(camera_stats[i].name);
+    }
+    pthread_mutex_unlock(&host->lock);
+
+    for (unsigned i = 0; i < camera_stats.size(); i++) {
+        struct gm_host_camera_stats &cstats = camera_stats[i];
+
+        gm_info(host->log,
+                "  %s: submitted=%" PRIu64 " completed=%" PRIu64
+                " dropped=%" PRIu64 " late=%" PRIu64
+                " latency mean=%.3fms max=%.3fms run mean=%.3fms",
+                cstats.name,
+                cstats.n_submitted, cstats.n_completed,
+                cstats.n_dropped, cstats.n_late,
+                cstats.latency_mean_ns / 1e6,
+                cstats.latency_max_ns / 1e6,
+                cstats.run_mean_ns / 1e6);
+
+        free((char *)cstats.name);
+    }
+}
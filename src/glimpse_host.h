@@ -0,0 +1,143 @@
+/*
+ * Copyright (C) 2018 Glimp IP Ltd
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * A host owns a fixed pool of worker threads that can be shared between
+ * multiple cameras (i.e. multiple gm_device + gm_context pairs) so that they
+ * don't each spin up their own tracking thread and fight over cores.
+ *
+ * Each camera has at most one job in flight and at most one job pending.
+ * Submitting a new job while one is still pending replaces (drops) the older
+ * job, since for real-time tracking we only ever care about the most recent
+ * frame.
+ *
+ * Workers pick the pending job with the earliest deadline, and between jobs
+ * with the same deadline they pick the camera that was least recently
+ * serviced so that no camera can starve the others.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "glimpse_log.h"
+
+struct gm_host;
+struct gm_host_camera;
+
+struct gm_host_camera_stats {
+    const char *name;
+
+    uint64_t n_submitted;
+    uint64_t n_completed;
+
+    /* Jobs replaced by a newer submission before a worker could start them */
+    uint64_t n_dropped;
+
+    /* Jobs that completed after their deadline */
+    uint64_t n_late;
+
+    /* Time from submission until completion */
+    uint64_t latency_mean_ns;
+    uint64_t latency_max_ns;
+
+    /* Time spent running on a worker */
+    uint64_t run_mean_ns;
+};
+
+struct gm_host_stats {
+    int n_workers;
+    int n_cameras;
+
+    uint64_t elapsed_ns;
+    uint64_t n_completed;
+    uint64_t n_dropped;
+
+    /* Aggregate number of completed jobs per second since the host was
+     * created
+     */
+    float throughput;
+};
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* If @n_workers <= 0 then one worker per online CPU is created */
+struct gm_host *
+gm_host_new(struct gm_logger *log, int n_workers, char **err);
+
+/* All cameras must have been removed before destroying the host */
+void
+gm_host_destroy(struct gm_host *host);
+
+/* @deadline_ns is relative to when each job is submitted.
+ *
+ * @run_job is called on a worker thread with no host locks held.
+ *
+ * @drop_job is called for jobs that will never be run (either superseded
+ * by a newer submission or pending while the camera is removed) and may be
+ * called on any thread.
+ */
+struct gm_host_camera *
+gm_host_add_camera(struct gm_host *host,
+                   const char *name,
+                   uint64_t deadline_ns,
+                   void (*run_job)(struct gm_host_camera *camera,
+                                   void *job,
+                                   void *user_data),
+                   void (*drop_job)(struct gm_host_camera *camera,
+                                    void *job,
+                                    void *user_data),
+                   void *user_data);
+
+/* Drops any pending job and waits for any in-flight job to finish before
+ * returning.
+ *
+ * Must not be called from within @run_job for the same camera.
+ */
+void
+gm_host_remove_camera(struct gm_host *host, struct gm_host_camera *camera);
+
+void
+gm_host_submit_job(struct gm_host *host,
+                   struct gm_host_camera *camera,
+                   void *job);
+
+void
+gm_host_get_stats(struct gm_host *host, struct gm_host_stats *stats);
+
+void
+gm_host_get_camera_stats(struct gm_host *host,
+                         struct gm_host_camera *camera,
+                         struct gm_host_camera_stats *stats);
+
+/* Logs the aggregate and per-camera statistics at info level */
+void
+gm_host_log_stats(struct gm_host *host);
+
+#ifdef __cplusplus
+}
+#endif
@@ -23,14 +23,30 @@
  */
 
 #include <stdlib.h>
+#include <stdint.h>
+#include <stddef.h>
 #include <string.h>
 #include <pthread.h>
 
 #include <vector>
+#include <algorithm>
 
 #include "glimpse_log.h"
 #include "glimpse_mem_pool.h"
 
+/* For lock-free pools each resource's link is registered in a two level
+ * table so that the free stack can refer to links by a 32bit index, leaving
+ * the upper 32bits of the stack head for a tag that's incremented on every
+ * update to avoid ABA problems.
+ */
+#define LINK_NONE           0xffffffffU
+#define LINK_CHUNK_SHIFT    8
+#define LINK_CHUNK_SIZE     (1U<<LINK_CHUNK_SHIFT)
+#define LINK_MAX_CHUNKS     4096
+
+#define HEAD_INDEX(HEAD)    ((uint32_t)((HEAD) & 0xffffffffULL))
+#define HEAD_TAG(HEAD)      ((uint32_t)((HEAD) >> 32))
+#define HEAD_PACK(TAG, IDX) (((uint64_t)(TAG) << 32) | (uint64_t)(IDX))
 
 struct gm_mem_pool {
     struct gm_logger *log;
@@ -43,11 +59,38 @@ struct gm_mem_pool {
     std::vector<void *> available;
     std::vector<void *> busy;
 
+    /* Approximate size of each resource and an optional limit on the total
+     * size of all resources allocated by the pool (0 = no limit). Accessed
+     * atomically since the size is typically reported by alloc_mem.
+     */
+    size_t resource_size;
+    size_t byte_budget;
+
+    unsigned high_watermark; // Accessed atomically
+    unsigned n_throttled;    // Accessed atomically
+
     void *(*alloc_mem)(struct gm_mem_pool *pool, void *user_data);
     void (*free_mem)(struct gm_mem_pool *pool, void *mem, void *user_data);
     void *user_data;
+
+    /* Lock-free pool state (see mem_pool_alloc_lockless()) */
+    bool lockless;
+    struct gm_mem_pool_link *(*get_link)(void *resource);
+    ptrdiff_t link_offset;
+
+    uint64_t free_head; // Accessed atomically
+    unsigned n_busy;    // Accessed atomically
+    unsigned n_waiters; // Accessed atomically
+
+    /* Only grows, and only while holding the lock */
+    unsigned n_links;
+    void **link_chunks[LINK_MAX_CHUNKS];
 };
 
+/* So we can introspect all pools via mem_pool_foreach_pool() */
+static pthread_mutex_t pool_registry_lock = PTHREAD_MUTEX_INITIALIZER;
+static std::vector<struct gm_mem_pool *> pool_registry;
+
 struct gm_mem_pool *
 mem_pool_alloc(struct gm_logger *log,
                const char *name,
@@ -69,17 +112,113 @@ mem_pool_alloc(struct gm_logger *log,
     pthread_mutex_init(&pool->lock, NULL);
     pthread_cond_init(&pool->available_cond, NULL);
 
+    pthread_mutex_lock(&pool_registry_lock);
+    pool_registry.push_back(pool);
+    pthread_mutex_unlock(&pool_registry_lock);
+
+    return pool;
+}
+
+struct gm_mem_pool *
+mem_pool_alloc_lockless(struct gm_logger *log,
+                        const char *name,
+                        unsigned max_size,
+                        void *(*alloc_mem)(struct gm_mem_pool *pool,
+                                           void *user_data),
+                        void (*free_mem)(struct gm_mem_pool *pool, void *mem,
+                                         void *user_data),
+                        struct gm_mem_pool_link *(*get_link)(void *resource),
+                        void *user_data)
+{
+    struct gm_mem_pool *pool = mem_pool_alloc(log, name, max_size,
+                                              alloc_mem, free_mem,
+                                              user_data);
+    pool->lockless = true;
+    pool->get_link = get_link;
+    pool->link_offset = -1;
+    pool->free_head = HEAD_PACK(0, LINK_NONE);
+
     return pool;
 }
 
 void
 mem_pool_free(struct gm_mem_pool *pool)
 {
+    pthread_mutex_lock(&pool_registry_lock);
+    pool_registry.erase(std::remove(pool_registry.begin(),
+                                    pool_registry.end(),
+                                    pool),
+                        pool_registry.end());
+    pthread_mutex_unlock(&pool_registry_lock);
+
+    struct gm_mem_pool_stats stats;
+    mem_pool_get_stats(pool, &stats);
+    gm_debug(pool->log,
+             "Freeing \"%s\" pool: %u allocated (%zu bytes), high watermark = %u, "
+             "throttled %u times",
+             pool->name,
+             stats.n_allocated,
+             stats.n_allocated * stats.resource_size,
+             stats.high_watermark,
+             stats.n_throttled);
+
     mem_pool_free_resources(pool);
     free(pool->name);
     delete pool;
 }
 
+/* XXX: pool->lock must be held */
+static bool
+pool_at_limit_locked(struct gm_mem_pool *pool, unsigned n_allocated)
+{
+    if (n_allocated > pool->max_size)
+        return true;
+
+    size_t resource_size = __atomic_load_n(&pool->resource_size,
+                                           __ATOMIC_RELAXED);
+    size_t byte_budget = __atomic_load_n(&pool->byte_budget, __ATOMIC_RELAXED);
+
+    /* NB: we always let a pool allocate at least one resource, otherwise a
+     * budget smaller than a single resource would deadlock
+     */
+    if (byte_budget && resource_size && n_allocated &&
+        (n_allocated + 1) * resource_size > byte_budget)
+    {
+        return true;
+    }
+
+    return false;
+}
+
+static void
+pool_update_high_watermark(struct gm_mem_pool *pool, unsigned n_busy)
+{
+    unsigned high = __atomic_load_n(&pool->high_watermark, __ATOMIC_RELAXED);
+    while (n_busy > high &&
+           !__atomic_compare_exchange_n(&pool->high_watermark, &high, n_busy,
+                                        true, /* weak */
+                                        __ATOMIC_RELAXED,
+                                        __ATOMIC_RELAXED))
+        ;
+}
+
+/* XXX: pool->lock must be held */
+static void
+pool_note_throttled_locked(struct gm_mem_pool *pool)
+{
+    unsigned n = __atomic_add_fetch(&pool->n_throttled, 1, __ATOMIC_RELAXED);
+
+    /* Only warn the first time to avoid spamming the log under sustained
+     * backpressure
+     */
+    if (n == 1) {
+        gm_warn(pool->log,
+                "\"%s\" pool reached its size limit, throttling acquisition "
+                "until resources are recycled",
+                pool->name);
+    }
+}
+
 static void __attribute__((unused))
 debug_print_busy_and_available_lists(struct gm_mem_pool *pool)
 {
@@ -96,34 +235,244 @@ debug_print_busy_and_available_lists(struct gm_mem_pool *pool)
     }
 }
 
+static inline struct gm_mem_pool_link *
+lockless_link_for_resource(struct gm_mem_pool *pool, void *resource)
+{
+    return (struct gm_mem_pool_link *)((uint8_t *)resource + pool->link_offset);
+}
+
+static inline void *
+lockless_resource_for_link(struct gm_mem_pool *pool,
+                           struct gm_mem_pool_link *link)
+{
+    return (void *)((uint8_t *)link - pool->link_offset);
+}
+
+static inline void *
+lockless_resource_for_index(struct gm_mem_pool *pool, uint32_t index)
+{
+    void **chunk = __atomic_load_n(&pool->link_chunks[index >> LINK_CHUNK_SHIFT],
+                                   __ATOMIC_ACQUIRE);
+    return chunk[index & (LINK_CHUNK_SIZE - 1)];
+}
+
+static void
+lockless_push(struct gm_mem_pool *pool, struct gm_mem_pool_link *link)
+{
+    uint64_t head = __atomic_load_n(&pool->free_head, __ATOMIC_RELAXED);
+    uint64_t new_head;
+
+    do {
+        __atomic_store_n(&link->next, HEAD_INDEX(head), __ATOMIC_RELAXED);
+        new_head = HEAD_PACK(HEAD_TAG(head) + 1, link->index);
+    } while (!__atomic_compare_exchange_n(&pool->free_head, &head, new_head,
+                                          true, /* weak */
+                                          __ATOMIC_SEQ_CST,
+                                          __ATOMIC_RELAXED));
+}
+
+static struct gm_mem_pool_link *
+lockless_pop(struct gm_mem_pool *pool)
+{
+    uint64_t head = __atomic_load_n(&pool->free_head, __ATOMIC_ACQUIRE);
+    struct gm_mem_pool_link *link;
+    uint64_t new_head;
+
+    do {
+        uint32_t index = HEAD_INDEX(head);
+        if (index == LINK_NONE)
+            return NULL;
+
+        /* NB: links are never freed while the pool is in use so it's safe to
+         * read link->next even if the link is concurrently popped, in which
+         * case the tag will have changed and the exchange will fail.
+         */
+        link = lockless_link_for_resource(pool,
+                                          lockless_resource_for_index(pool,
+                                                                      index));
+        uint32_t next = __atomic_load_n(&link->next, __ATOMIC_RELAXED);
+        new_head = HEAD_PACK(HEAD_TAG(head) + 1, next);
+    } while (!__atomic_compare_exchange_n(&pool->free_head, &head, new_head,
+                                          true, /* weak */
+                                          __ATOMIC_SEQ_CST,
+                                          __ATOMIC_ACQUIRE));
+
+    return link;
+}
+
+static void *
+lockless_mark_busy(struct gm_mem_pool *pool, struct gm_mem_pool_link *link)
+{
+    __atomic_store_n(&link->busy, 1, __ATOMIC_RELAXED);
+    unsigned n_busy = __atomic_add_fetch(&pool->n_busy, 1, __ATOMIC_RELAXED);
+    pool_update_high_watermark(pool, n_busy);
+
+    return lockless_resource_for_link(pool, link);
+}
+
+/* XXX: pool->lock must be held */
+static struct gm_mem_pool_link *
+lockless_alloc_locked(struct gm_mem_pool *pool)
+{
+    void *resource = pool->alloc_mem(pool, pool->user_data);
+    struct gm_mem_pool_link *link = pool->get_link(resource);
+    ptrdiff_t offset = (uint8_t *)link - (uint8_t *)resource;
+
+    if (pool->link_offset < 0)
+        pool->link_offset = offset;
+    gm_assert(pool->log, offset == pool->link_offset,
+              "Inconsistent link offset for resources in %s pool",
+              pool->name);
+
+    unsigned index = pool->n_links;
+    unsigned chunk = index >> LINK_CHUNK_SHIFT;
+    gm_assert(pool->log, chunk < LINK_MAX_CHUNKS,
+              "'%s' memory pool growing out of control (%u allocations)",
+              pool->name, index);
+
+    if (!pool->link_chunks[chunk]) {
+        void **links = (void **)calloc(LINK_CHUNK_SIZE, sizeof(void *));
+        __atomic_store_n(&pool->link_chunks[chunk], links, __ATOMIC_RELEASE);
+    }
+    pool->link_chunks[chunk][index & (LINK_CHUNK_SIZE - 1)] = resource;
+    pool->n_links++;
+
+    link->index = index;
+    link->next = LINK_NONE;
+    link->busy = 0;
+
+    return link;
+}
+
+static void *
+lockless_acquire_resource(struct gm_mem_pool *pool)
+{
+    struct gm_mem_pool_link *link = lockless_pop(pool);
+    if (link)
+        return lockless_mark_busy(pool, link);
+
+    /* Slow path: we need to either allocate a new resource or wait for one
+     * to be recycled...
+     */
+    void *resource;
+
+    pthread_mutex_lock(&pool->lock);
+
+    if (pool_at_limit_locked(pool, pool->n_links)) {
+        pool_note_throttled_locked(pool);
+        gm_debug(pool->log,
+                 "Throttling \"%s\" pool acquisition, waiting for old %s object to be released\n",
+                 pool->name, pool->name);
+
+        /* NB: n_waiters must be visible before we check the stack so that a
+         * concurrent recycle either sees a waiter (and will take the lock
+         * to wake us) or we see its push.
+         */
+        __atomic_add_fetch(&pool->n_waiters, 1, __ATOMIC_SEQ_CST);
+        while (!(link = lockless_pop(pool)))
+            pthread_cond_wait(&pool->available_cond, &pool->lock);
+        __atomic_sub_fetch(&pool->n_waiters, 1, __ATOMIC_SEQ_CST);
+
+        resource = lockless_mark_busy(pool, link);
+    } else {
+        resource = lockless_mark_busy(pool, lockless_alloc_locked(pool));
+    }
+
+    pthread_mutex_unlock(&pool->lock);
+
+    return resource;
+}
+
+static void *
+lockless_try_acquire_resource(struct gm_mem_pool *pool)
+{
+    struct gm_mem_pool_link *link = lockless_pop(pool);
+    if (link)
+        return lockless_mark_busy(pool, link);
+
+    void *resource = NULL;
+
+    pthread_mutex_lock(&pool->lock);
+
+    /* A resource may have been recycled while we waited for the lock */
+    if ((link = lockless_pop(pool)))
+        resource = lockless_mark_busy(pool, link);
+    else if (!pool_at_limit_locked(pool, pool->n_links))
+        resource = lockless_mark_busy(pool, lockless_alloc_locked(pool));
+
+    pthread_mutex_unlock(&pool->lock);
+
+    return resource;
+}
+
+static void
+lockless_recycle_resource(struct gm_mem_pool *pool, void *resource)
+{
+    struct gm_mem_pool_link *link = lockless_link_for_resource(pool, resource);
+
+    int was_busy = __atomic_exchange_n(&link->busy, 0, __ATOMIC_RELAXED);
+    gm_assert(pool->log, was_busy,
+              "Recycled resource %p wasn't acquired from %s pool",
+              resource,
+              pool->name);
+    __atomic_sub_fetch(&pool->n_busy, 1, __ATOMIC_RELAXED);
+
+    lockless_push(pool, link);
+
+    if (__atomic_load_n(&pool->n_waiters, __ATOMIC_SEQ_CST)) {
+        pthread_mutex_lock(&pool->lock);
+        pthread_cond_broadcast(&pool->available_cond);
+        pthread_mutex_unlock(&pool->lock);
+    }
+}
+
+static void
+lockless_free_resources(struct gm_mem_pool *pool)
+{
+    gm_assert(pool->log,
+              __atomic_load_n(&pool->n_busy, __ATOMIC_RELAXED) == 0,
+              "Shouldn't be freeing a pool (%s) with resources still in use",
+              pool->name);
+
+    for (unsigned i = 0; i < pool->n_links; i++)
+        pool->free_mem(pool, lockless_resource_for_index(pool, i),
+                       pool->user_data);
+
+    for (unsigned i = 0; i < LINK_MAX_CHUNKS; i++) {
+        free(pool->link_chunks[i]);
+        pool->link_chunks[i] = NULL;
+    }
+
+    pool->n_links = 0;
+    pool->free_head = HEAD_PACK(0, LINK_NONE);
+}
+
 void *
 mem_pool_acquire_resource(struct gm_mem_pool *pool)
 {
     void *resource;
 
+    if (pool->lockless)
+        return lockless_acquire_resource(pool);
+
     pthread_mutex_lock(&pool->lock);
 
     //gm_error(pool->log, "mem_pool_acquire_resource: lists before");
     //debug_print_busy_and_available_lists(pool);
 
-    /* Sanity check with arbitrary upper limit for the number of allocations */
-    /* XXX Had to remove this assertion for recording mode, where we keep
-     *     frame recordings around for an indefinite amount of time. In the
-     *     situation we see memory unexpectedly growing out of control, we
-     *     likely want to re-enable this.
+    /* NB: Rather than asserting some arbitrary upper limit for the number of
+     * allocations (which doesn't work for recording mode, where we keep frame
+     * recordings around for an indefinite amount of time) growth is bounded
+     * by max_size and the pool's byte budget, and acquisition blocks once
+     * those limits are reached (see mem_pool_set_byte_budget())
      */
-#if 0
-    gm_assert(pool->log,
-              (pool->busy.size() + pool->available.size()) < 100,
-              "'%s' memory pool growing out of control (%u allocations)",
-              pool->name,
-              (pool->busy.size() + pool->available.size()));
-#endif
 
     if (pool->available.size()) {
         resource = pool->available.back();
         pool->available.pop_back();
-    } else if (pool->busy.size() + pool->available.size() > pool->max_size) {
+    } else if (pool_at_limit_locked(pool,
+                                    pool->busy.size() + pool->available.size())) {
+        pool_note_throttled_locked(pool);
 
         gm_debug(pool->log,
                  "Throttling \"%s\" pool acquisition, waiting for old %s object to be released\n",
@@ -139,6 +488,7 @@ mem_pool_acquire_resource(struct gm_mem_pool *pool)
     }
 
     pool->busy.push_back(resource);
+    pool_update_high_watermark(pool, pool->busy.size());
 
     //gm_debug(pool->log, "mem_pool_acquire_resource %p: lists after", resource);
     //debug_print_busy_and_available_lists(pool);
@@ -148,9 +498,41 @@ mem_pool_acquire_resource(struct gm_mem_pool *pool)
     return resource;
 }
 
+void *
+mem_pool_try_acquire_resource(struct gm_mem_pool *pool)
+{
+    void *resource = NULL;
+
+    if (pool->lockless)
+        return lockless_try_acquire_resource(pool);
+
+    pthread_mutex_lock(&pool->lock);
+
+    if (pool->available.size()) {
+        resource = pool->available.back();
+        pool->available.pop_back();
+    } else if (!pool_at_limit_locked(pool, pool->busy.size())) {
+        resource = pool->alloc_mem(pool, pool->user_data);
+    }
+
+    if (resource) {
+        pool->busy.push_back(resource);
+        pool_update_high_watermark(pool, pool->busy.size());
+    }
+
+    pthread_mutex_unlock(&pool->lock);
+
+    return resource;
+}
+
 void
 mem_pool_recycle_resource(struct gm_mem_pool *pool, void *resource)
 {
+    if (pool->lockless) {
+        lockless_recycle_resource(pool, resource);
+        return;
+    }
+
     pthread_mutex_lock(&pool->lock);
 
     //gm_error(pool->log, "mem_pool_recycle_resource %p: lists before", resource);
@@ -183,6 +565,11 @@ mem_pool_recycle_resource(struct gm_mem_pool *pool, void *resource)
 void
 mem_pool_free_resources(struct gm_mem_pool *pool)
 {
+    if (pool->lockless) {
+        lockless_free_resources(pool);
+        return;
+    }
+
     gm_assert(pool->log,
               pool->busy.size() == 0,
               "Shouldn't be freeing a pool (%s) with resources still in use",
@@ -212,6 +599,18 @@ mem_pool_foreach(struct gm_mem_pool *pool,
 
     //debug_print_busy_and_available_lists(pool);
 
+    if (pool->lockless) {
+        for (unsigned i = 0; i < pool->n_links; i++) {
+            void *resource = lockless_resource_for_index(pool, i);
+            struct gm_mem_pool_link *link =
+                lockless_link_for_resource(pool, resource);
+            if (__atomic_load_n(&link->busy, __ATOMIC_RELAXED))
+                callback(pool, resource, user_data);
+        }
+        pthread_mutex_unlock(&pool->lock);
+        return;
+    }
+
     unsigned size = pool->busy.size();
     for (unsigned i = 0; i < size; i++) {
         callback(pool, pool->busy[i], user_data);
@@ -219,3 +618,83 @@ mem_pool_foreach(struct gm_mem_pool *pool,
 
     pthread_mutex_unlock(&pool->lock);
 }
+
+void
+mem_pool_set_resource_size(struct gm_mem_pool *pool, size_t size)
+{
+    __atomic_store_n(&pool->resource_size, size, __ATOMIC_RELAXED);
+}
+
+void
+mem_pool_set_byte_budget(struct gm_mem_pool *pool, size_t budget)
+{
+    __atomic_store_n(&pool->byte_budget, budget, __ATOMIC_RELAXED);
+}
+
+unsigned
+mem_pool_prealloc(struct gm_mem_pool *pool, unsigned n_resources)
+{
+    unsigned n_allocated = 0;
+
+    pthread_mutex_lock(&pool->lock);
+
+    while (true) {
+        unsigned size = pool->lockless ? pool->n_links :
+            (pool->busy.size() + pool->available.size());
+
+        if (size >= n_resources || pool_at_limit_locked(pool, size))
+            break;
+
+        if (pool->lockless)
+            lockless_push(pool, lockless_alloc_locked(pool));
+        else
+            pool->available.push_back(pool->alloc_mem(pool, pool->user_data));
+
+        n_allocated++;
+    }
+
+    pthread_mutex_unlock(&pool->lock);
+
+    if (n_allocated) {
+        gm_debug(pool->log, "Pre-allocated %u resources for \"%s\" pool",
+                 n_allocated, pool->name);
+    }
+
+    return n_allocated;
+}
+
+void
+mem_pool_get_stats(struct gm_mem_pool *pool, struct gm_mem_pool_stats *stats)
+{
+    pthread_mutex_lock(&pool->lock);
+
+    stats->name = pool->name;
+    if (pool->lockless) {
+        stats->n_allocated = pool->n_links;
+        stats->n_busy = __atomic_load_n(&pool->n_busy, __ATOMIC_RELAXED);
+    } else {
+        stats->n_allocated = pool->busy.size() + pool->available.size();
+        stats->n_busy = pool->busy.size();
+    }
+    stats->high_watermark = __atomic_load_n(&pool->high_watermark,
+                                            __ATOMIC_RELAXED);
+    stats->n_throttled = __atomic_load_n(&pool->n_throttled, __ATOMIC_RELAXED);
+    stats->resource_size = __atomic_load_n(&pool->resource_size,
+                                           __ATOMIC_RELAXED);
+    stats->byte_budget = __atomic_load_n(&pool->byte_budget, __ATOMIC_RELAXED);
+
+    pthread_mutex_unlock(&pool->lock);
+}
+
+void
+mem_pool_foreach_pool(void (*callback)(struct gm_mem_pool *pool,
+                                       void *user_data),
+                      void *user_data)
+{
+    pthread_mutex_lock(&pool_registry_lock);
+
+    for (unsigned i = 0; i < pool_registry.size(); i++)
+        callback(pool_registry[i], user_data);
+
+    pthread_mutex_unlock(&pool_registry_lock);
+}
@@ -24,10 +24,44 @@
 
 #pragma once
 
+#include <stddef.h>
+#include <stdint.h>
 #include <pthread.h>
 
 struct gm_mem_pool;
 
+/* Resources managed by a pool created with mem_pool_alloc_lockless() must
+ * embed one of these so that acquiring and recycling them is O(1) and
+ * doesn't require taking a lock. The contents are private to the pool.
+ */
+struct gm_mem_pool_link {
+    uint32_t index;
+    uint32_t next;
+    int busy;
+};
+
+struct gm_mem_pool_stats {
+    const char *name;
+
+    /* The current size of the pool, including busy and available resources */
+    unsigned n_allocated;
+    unsigned n_busy;
+
+    /* The largest number of resources that have been busy at once */
+    unsigned high_watermark;
+
+    /* The number of acquisitions that had to wait for a resource to be
+     * recycled due to the pool's max_size or byte budget
+     */
+    unsigned n_throttled;
+
+    /* As given via mem_pool_set_resource_size() and
+     * mem_pool_set_byte_budget()
+     */
+    size_t resource_size;
+    size_t byte_budget;
+};
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -41,12 +75,38 @@ mem_pool_alloc(struct gm_logger *log,
                                 void *user_data),
                void *user_data);
 
+/* A variant of mem_pool_alloc() where resources are kept on a lock-free
+ * stack. @get_link should return the gm_mem_pool_link embedded in the given
+ * resource.
+ *
+ * Acquiring an available resource and recycling a resource never take the
+ * pool's lock, nor wake any waiters unless an acquisition is currently being
+ * throttled by @max_size. Allocating a new resource is a slow path that does
+ * take the lock.
+ */
+struct gm_mem_pool *
+mem_pool_alloc_lockless(struct gm_logger *log,
+                        const char *name,
+                        unsigned max_size,
+                        void *(*alloc_mem)(struct gm_mem_pool *pool,
+                                           void *user_data),
+                        void (*free_mem)(struct gm_mem_pool *pool, void *mem,
+                                         void *user_data),
+                        struct gm_mem_pool_link *(*get_link)(void *resource),
+                        void *user_data);
+
 void
 mem_pool_free(struct gm_mem_pool *pool);
 
 void *
 mem_pool_acquire_resource(struct gm_mem_pool *pool);
 
+/* Like mem_pool_acquire_resource() except that it returns NULL instead of
+ * blocking when the pool has reached its max_size or byte budget
+ */
+void *
+mem_pool_try_acquire_resource(struct gm_mem_pool *pool);
+
 void
 mem_pool_recycle_resource(struct gm_mem_pool *pool, void *resource);
 
@@ -56,6 +116,35 @@ mem_pool_free_resources(struct gm_mem_pool *pool);
 const char *
 mem_pool_get_name(struct gm_mem_pool *pool);
 
+/* Report the approximate size of each resource in bytes, for statistics and
+ * to apply a byte budget. This may be called from within alloc_mem.
+ */
+void
+mem_pool_set_resource_size(struct gm_mem_pool *pool, size_t size);
+
+/* Once the pool's resources would exceed @budget bytes then acquisition
+ * blocks until a resource is recycled, the same as when max_size is
+ * reached. A @budget of 0 means no limit.
+ */
+void
+mem_pool_set_byte_budget(struct gm_mem_pool *pool, size_t budget);
+
+/* Allocate resources up front (within the pool's limits) so the first
+ * acquisitions don't pay for alloc_mem. Returns the number of new
+ * resources allocated so that the pool has @n_resources in total.
+ */
+unsigned
+mem_pool_prealloc(struct gm_mem_pool *pool, unsigned n_resources);
+
+void
+mem_pool_get_stats(struct gm_mem_pool *pool, struct gm_mem_pool_stats *stats);
+
+/* Iterate all existing pools, e.g. for reporting mem_pool_get_stats() */
+void
+mem_pool_foreach_pool(void (*callback)(struct gm_mem_pool *pool,
+                                       void *user_data),
+                      void *user_data);
+
 void
 mem_pool_foreach(struct gm_mem_pool *pool,
                  void (*callback)(struct gm_mem_pool *pool,
@@ -0,0 +1,653 @@
+/*
+ * Copyright (C) 2017 Glimp IP Ltd
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <sys/types.h>
+
+/*
+ * Runs skeletal tracking for several recordings at once, sharing a single
+ * gm_host worker pool between all of the contexts, and reports aggregate
+ * throughput and per-camera latency when done.
+ *
+ * This is intended to simulate an installation with multiple depth cameras
+ * on one machine.
+ *
+ * With --synthetic the arguments are instead training data directories that
+ * are composited into synthetic depth frames, and the tracked skeletons are
+ * also compared against the known ground truth.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <pthread.h>
+
+#include <vector>
+#include <algorithm>
+#include <cmath>
+
+#include "xalloc.h"
+
+#include "glimpse_log.h"
+#include "glimpse_assets.h"
+#include "glimpse_device.h"
+#include "glimpse_context.h"
+#include "glimpse_host.h"
+#include "glimpse_mem_pool.h"
+#include "profiler.h"
+
+enum event_type
+{
+  EVENT_DEVICE,
+  EVENT_CONTEXT
+};
+
+struct camera;
+
+struct event
+{
+  enum event_type type;
+  struct camera *camera;
+  union
+    {
+      struct gm_event *context_event;
+      struct gm_device_event *device_event;
+    };
+};
+
+struct camera
+{
+  char *name;
+
+  struct gm_device *device;
+  struct gm_context *ctx;
+
+  uint64_t pending_frame_buffers_mask;
+  uint64_t n_frames;
+  uint64_t n_tracked;
+
+  /* Only for synthetic devices */
+  uint64_t n_compared;
+  double total_joint_error;
+  uint64_t total_latency;
+};
+
+/* The most synthetic people we compare tracked skeletons against */
+#define MAX_SYNTHETIC_PEOPLE 8
+
+/* Raised to GM_LOG_INFO before reporting the host statistics */
+static enum gm_log_level min_log_level = GM_LOG_WARN;
+
+static pthread_mutex_t event_queue_lock = PTHREAD_MUTEX_INITIALIZER;
+static std::vector<struct event> events_back;
+static std::vector<struct event> events_front;
+
+static uint64_t
+get_time(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return ((uint64_t)ts.tv_sec) * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static void
+logger_cb(struct gm_logger *logger,
+          enum gm_log_level level,
+          const char *context,
+          struct gm_backtrace *backtrace,
+          const char *format,
+          va_list ap,
+          void *user_data)
+{
+  if (level < min_log_level)
+    return;
+
+  switch (level)
+    {
+    case GM_LOG_ERROR:
+      fprintf(stderr, "%s: ERROR: ", context);
+      break;
+    case GM_LOG_WARN:
+      fprintf(stderr, "%s: WARN: ", context);
+      break;
+    default:
+      fprintf(stderr, "%s: ", context);
+    }
+
+  vfprintf(stderr, format, ap);
+  fprintf(stderr, "\n");
+}
+
+static void
+logger_abort_cb(struct gm_logger *logger,
+                void *user_data)
+{
+  fprintf(stderr, "ABORT\n");
+  fflush(stderr);
+  abort();
+}
+
+/* NB: it's undefined what thread these are called on so we queue events to
+ * be processed by the mainloop.
+ */
+static void
+on_event_cb(struct gm_context *ctx,
+            struct gm_event *context_event, void *user_data)
+{
+  struct event event = {};
+  event.type = EVENT_CONTEXT;
+  event.camera = (struct camera *)user_data;
+  event.context_event = context_event;
+
+  pthread_mutex_lock(&event_queue_lock);
+  events_back.push_back(event);
+  pthread_mutex_unlock(&event_queue_lock);
+}
+
+static void
+on_device_event_cb(struct gm_device_event *device_event,
+                   void *user_data)
+{
+  struct event event = {};
+  event.type = EVENT_DEVICE;
+  event.camera = (struct camera *)user_data;
+  event.device_event = device_event;
+
+  pthread_mutex_lock(&event_queue_lock);
+  events_back.push_back(event);
+  pthread_mutex_unlock(&event_queue_lock);
+}
+
+static void
+request_device_frame(struct camera *camera, uint64_t buffers_mask)
+{
+  uint64_t new_buffers_mask = camera->pending_frame_buffers_mask | buffers_mask;
+
+  if (camera->pending_frame_buffers_mask != new_buffers_mask)
+    {
+      gm_device_request_frame(camera->device, new_buffers_mask);
+      camera->pending_frame_buffers_mask = new_buffers_mask;
+    }
+}
+
+static void
+handle_device_ready(struct camera *camera)
+{
+  gm_context_set_depth_camera_intrinsics(camera->ctx,
+      gm_device_get_depth_intrinsics(camera->device));
+  gm_context_set_video_camera_intrinsics(camera->ctx,
+      gm_device_get_video_intrinsics(camera->device));
+
+  uint64_t old_reqs = camera->pending_frame_buffers_mask;
+  camera->pending_frame_buffers_mask = 0;
+  gm_device_start(camera->device);
+  gm_context_enable(camera->ctx);
+  if (old_reqs)
+    request_device_frame(camera, old_reqs);
+}
+
+static void
+handle_device_frame_ready(struct camera *camera, uint64_t buffers_mask)
+{
+  if (!(buffers_mask & camera->pending_frame_buffers_mask))
+    return;
+
+  /* NB: gm_device_get_latest_frame will give us a _ref() */
+  struct gm_frame *frame = gm_device_get_latest_frame(camera->device);
+  if (!frame)
+    return;
+
+  if (frame->depth)
+    camera->pending_frame_buffers_mask &= ~GM_REQUEST_FRAME_DEPTH;
+  if (frame->video)
+    camera->pending_frame_buffers_mask &= ~GM_REQUEST_FRAME_VIDEO;
+  camera->n_frames++;
+
+  if (!gm_context_notify_frame(camera->ctx, frame))
+    {
+      /* The context rejected an incomplete frame so ask again */
+      request_device_frame(camera, (GM_REQUEST_FRAME_DEPTH |
+                                    GM_REQUEST_FRAME_VIDEO));
+    }
+
+  gm_frame_unref(frame);
+}
+
+/* Compares the latest tracked skeleton with the ground truth for the frame
+ * it was tracked from, accumulating the mean joint error against the
+ * closest matching person.
+ */
+static void
+check_ground_truth(struct camera *camera)
+{
+  int n_joints = gm_device_get_ground_truth_n_joints(camera->device);
+  if (!n_joints)
+    return;
+
+  struct gm_tracking *tracking = gm_context_get_latest_tracking(camera->ctx);
+  if (!tracking)
+    return;
+
+  uint64_t timestamp = gm_tracking_get_timestamp(tracking);
+  const struct gm_skeleton *skeleton = gm_tracking_get_skeleton(tracking);
+
+  std::vector<float> truth(MAX_SYNTHETIC_PEOPLE * n_joints * 3);
+  int n_people = gm_device_get_ground_truth_joints(camera->device,
+                                                   timestamp,
+                                                   truth.data(),
+                                                   MAX_SYNTHETIC_PEOPLE);
+
+  if (skeleton && n_people > 0 &&
+      gm_skeleton_get_n_joints(skeleton) == n_joints)
+    {
+      double best_error = HUGE_VAL;
+      for (int p = 0; p < n_people; p++)
+        {
+          const float *person = &truth[p * n_joints * 3];
+          double error = 0;
+          for (int j = 0; j < n_joints; j++)
+            {
+              const struct gm_joint *joint = gm_skeleton_get_joint(skeleton, j);
+              float dx = joint->x - person[j * 3 + 0];
+              float dy = joint->y - person[j * 3 + 1];
+              float dz = joint->z - person[j * 3 + 2];
+              error += sqrtf(dx * dx + dy * dy + dz * dz);
+            }
+          best_error = std::min(best_error, error / n_joints);
+        }
+
+      camera->total_joint_error += best_error;
+      camera->total_latency += get_time() - timestamp;
+      camera->n_compared++;
+    }
+
+  gm_tracking_unref(tracking);
+}
+
+static void
+handle_event(struct event *event)
+{
+  struct camera *camera = event->camera;
+
+  switch (event->type)
+    {
+    case EVENT_DEVICE:
+      switch (event->device_event->type)
+        {
+        case GM_DEV_EVENT_READY:
+          handle_device_ready(camera);
+          break;
+        case GM_DEV_EVENT_FRAME_READY:
+          handle_device_frame_ready(camera,
+              event->device_event->frame_ready.buffers_mask);
+          break;
+        }
+      gm_device_event_free(event->device_event);
+      break;
+    case EVENT_CONTEXT:
+      switch (event->context_event->type)
+        {
+        case GM_EVENT_REQUEST_FRAME:
+          request_device_frame(camera, (GM_REQUEST_FRAME_DEPTH |
+                                        GM_REQUEST_FRAME_VIDEO));
+          break;
+        case GM_EVENT_TRACKING_READY:
+          camera->n_tracked++;
+          check_ground_truth(camera);
+          break;
+        }
+      gm_context_event_free(event->context_event);
+      break;
+    }
+}
+
+static void
+print_pool_stats_cb(struct gm_mem_pool *pool, void *user_data)
+{
+  struct gm_mem_pool_stats stats;
+  mem_pool_get_stats(pool, &stats);
+
+  printf("  %-28s %5u %5u %5u %9u %9.1f",
+         stats.name,
+         stats.n_allocated,
+         stats.n_busy,
+         stats.high_watermark,
+         stats.n_throttled,
+         (stats.n_allocated * stats.resource_size) / (1024.0 * 1024.0));
+  if (stats.byte_budget)
+    printf(" / %.1f", stats.byte_budget / (1024.0 * 1024.0));
+  printf("\n");
+}
+
+static void
+print_usage(FILE* stream)
+{
+  fprintf(stream,
+"Usage: glimpse_multi_track [OPTIONS] <recording> [recording] ...\n"
+"       glimpse_multi_track [OPTIONS] --synthetic <data_dir> [data_dir] ...\n"
+"Track several recordings concurrently using one shared worker pool.\n"
+"\n"
+"  -w, --workers=N          Number of shared worker threads (default = number\n"
+"                           of online CPUs)\n"
+"  -t, --time=SECONDS       How long to run for (default = 10)\n"
+"  -d, --deadline=MS        Per-frame tracking deadline (default = 33)\n"
+"  -p, --playback=MODE      Recording playback mode: realtime, max-rate or\n"
+"                           lockstep (default = realtime)\n"
+"\n"
+"  -s, --synthetic          Synthesize frames from training data directories\n"
+"                           instead of playing back recordings\n"
+"  -i, --index=NAME         Training data index to use (default = full)\n"
+"  -n, --people=N           Number of synthetic people per frame (default = 1)\n"
+"  -r, --fps=N              Synthetic frame rate (default = 30, 0 = as fast as\n"
+"                           requested)\n"
+"  -W, --width=N            Synthetic frame width (default = training width)\n"
+"  -H, --height=N           Synthetic frame height (default = training height)\n"
+"\n"
+"  -V, --video-budget=MB    Limit each device's video buffers to MB megabytes\n"
+"                           (default = unlimited)\n"
+"  -D, --depth-budget=MB    Limit each device's depth buffers to MB megabytes\n"
+"                           (default = unlimited)\n"
+"\n"
+"  -T, --trace=FILE         Write a Chrome trace-event JSON profile of all\n"
+"                           tracking, worker and device threads to FILE\n"
+"\n"
+"  -v, --verbose            Print all log messages\n"
+"\n"
+"  -h, --help               Display this help\n\n");
+}
+
+int
+main(int argc, char **argv)
+{
+  int n_workers = 0;
+  float run_time = 10;
+  float deadline_ms = 33;
+  enum gm_recording_playback_mode playback_mode =
+    GM_RECORDING_PLAYBACK_REALTIME;
+  bool synthetic = false;
+  const char *index_name = NULL;
+  int n_people = 1;
+  float fps = 30;
+  int width = 0;
+  int height = 0;
+  float video_budget_mb = 0;
+  float depth_budget_mb = 0;
+  const char *trace_filename = NULL;
+  int opt;
+
+  /* N.B. The initial '+' means that getopt will stop looking for options
+   * after the first non-option argument...
+   */
+  const char *short_options="+hw:t:d:p:si:n:r:W:H:V:D:T:v";
+  const struct option long_options[] = {
+      {"help",            no_argument,        0, 'h'},
+      {"workers",         required_argument,  0, 'w'},
+      {"time",            required_argument,  0, 't'},
+      {"deadline",        required_argument,  0, 'd'},
+      {"playback",        required_argument,  0, 'p'},
+      {"synthetic",       no_argument,        0, 's'},
+      {"index",           required_argument,  0, 'i'},
+      {"people",          required_argument,  0, 'n'},
+      {"fps",             required_argument,  0, 'r'},
+      {"width",           required_argument,  0, 'W'},
+      {"height",          required_argument,  0, 'H'},
+      {"video-budget",    required_argument,  0, 'V'},
+      {"depth-budget",    required_argument,  0, 'D'},
+      {"trace",           required_argument,  0, 'T'},
+      {"verbose",         no_argument,        0, 'v'},
+      {0, 0, 0, 0}
+  };
+
+  while ((opt = getopt_long(argc, argv, short_options, long_options, NULL))
+         != -1)
+    {
+      switch (opt) {
+          case 'h':
+              print_usage(stdout);
+              return 0;
+          case 'w':
+              n_workers = atoi(optarg);
+              break;
+          case 't':
+              run_time = strtof(optarg, NULL);
+              break;
+          case 'd':
+              deadline_ms = strtof(optarg, NULL);
+              break;
+          case 'p':
+              if (strcmp(optarg, "realtime") == 0)
+                playback_mode = GM_RECORDING_PLAYBACK_REALTIME;
+              else if (strcmp(optarg, "max-rate") == 0)
+                playback_mode = GM_RECORDING_PLAYBACK_MAX_RATE;
+              else if (strcmp(optarg, "lockstep") == 0)
+                playback_mode = GM_RECORDING_PLAYBACK_LOCKSTEP;
+              else
+                {
+                  fprintf(stderr, "Unknown playback mode '%s'\n", optarg);
+                  print_usage(stderr);
+                  return 1;
+                }
+              break;
+          case 's':
+              synthetic = true;
+              break;
+          case 'i':
+              index_name = optarg;
+              break;
+          case 'n':
+              n_people = atoi(optarg);
+              break;
+          case 'r':
+              fps = strtof(optarg, NULL);
+              break;
+          case 'W':
+              width = atoi(optarg);
+              break;
+          case 'H':
+              height = atoi(optarg);
+              break;
+          case 'V':
+              video_budget_mb = strtof(optarg, NULL);
+              break;
+          case 'D':
+              depth_budget_mb = strtof(optarg, NULL);
+              break;
+          case 'T':
+              trace_filename = optarg;
+              break;
+          case 'v':
+              min_log_level = GM_LOG_DEBUG;
+              break;
+         default:
+              print_usage(stderr);
+              return 1;
+      }
+  }
+
+  if ((argc - optind) < 1)
+    {
+      print_usage(stderr);
+      return 1;
+    }
+
+  struct gm_logger *log = gm_logger_new(logger_cb, NULL);
+  gm_logger_set_abort_callback(log, logger_abort_cb, NULL);
+
+  gm_set_assets_root(log, getenv("GLIMPSE_ASSETS_ROOT"));
+
+  char *err = NULL;
+  struct gm_host *host = gm_host_new(log, n_workers, &err);
+  if (!host)
+    {
+      fprintf(stderr, "Failed to create host: %s\n", err);
+      return 1;
+    }
+
+  int n_cameras = argc - optind;
+  std::vector<struct camera> cameras(n_cameras);
+
+  for (int i = 0; i < n_cameras; i++)
+    {
+      struct camera *camera = &cameras[i];
+      const char *path = argv[optind + i];
+
+      xasprintf(&camera->name, "cam%d", i);
+
+      camera->ctx = gm_context_new(log, &err);
+      if (!camera->ctx)
+        {
+          fprintf(stderr, "Failed to create tracking context: %s\n", err);
+          return 1;
+        }
+      gm_context_set_event_callback(camera->ctx, on_event_cb, camera);
+
+      if (!gm_context_set_host(camera->ctx, host, camera->name,
+                               (uint64_t)(deadline_ms * 1000000.0f), &err))
+        {
+          fprintf(stderr, "Failed to associate context with host: %s\n", err);
+          return 1;
+        }
+
+      struct gm_device_config config = {};
+      if (synthetic)
+        {
+          config.type = GM_DEVICE_SYNTHETIC;
+          config.synthetic.path = path;
+          config.synthetic.index_name = index_name;
+          config.synthetic.n_people = n_people;
+          config.synthetic.fps = fps;
+          config.synthetic.width = width;
+          config.synthetic.height = height;
+        }
+      else
+        {
+          config.type = GM_DEVICE_RECORDING;
+          config.recording.path = path;
+          config.recording.playback_mode = playback_mode;
+        }
+      config.video_buffer_budget = (size_t)(video_budget_mb * 1024 * 1024);
+      config.depth_buffer_budget = (size_t)(depth_budget_mb * 1024 * 1024);
+
+      camera->device = gm_device_open(log, &config, &err);
+      if (!camera->device)
+        {
+          fprintf(stderr, "Failed to open %s %s: %s\n",
+                  synthetic ? "training data" : "recording", path, err);
+          return 1;
+        }
+      gm_device_set_event_callback(camera->device, on_device_event_cb, camera);
+      gm_device_commit_config(camera->device, NULL);
+    }
+
+  if (trace_filename)
+    ProfileStartTrace();
+
+  printf("Tracking %d %s for %.1f seconds...\n", n_cameras,
+         synthetic ? "synthetic cameras" : "recordings", run_time);
+
+  uint64_t end_time = get_time() + (uint64_t)(run_time * 1e9);
+  while (get_time() < end_time)
+    {
+      pthread_mutex_lock(&event_queue_lock);
+      std::swap(events_front, events_back);
+      pthread_mutex_unlock(&event_queue_lock);
+
+      for (unsigned i = 0; i < events_front.size(); i++)
+        handle_event(&events_front[i]);
+      events_front.clear();
+
+      usleep(1000);
+    }
+
+  if (min_log_level > GM_LOG_INFO)
+    min_log_level = GM_LOG_INFO;
+  gm_host_log_stats(host);
+
+  /* NB: Make sure there can be no asynchronous calls into the contexts
+   * before destroying them, the same as the viewer does...
+   */
+  for (int i = 0; i < n_cameras; i++)
+    gm_device_stop(cameras[i].device);
+
+  printf("Memory pools:\n");
+  printf("  %-28s %5s %5s %5s %9s %9s\n",
+         "name", "size", "busy", "peak", "throttled", "MB");
+  mem_pool_foreach_pool(print_pool_stats_cb, NULL);
+
+  if (trace_filename)
+    {
+      if (ProfileStopTrace(trace_filename))
+        printf("Wrote trace to %s\n", trace_filename);
+      else
+        fprintf(stderr, "Failed to write trace to %s\n", trace_filename);
+    }
+
+  pthread_mutex_lock(&event_queue_lock);
+  for (unsigned i = 0; i < events_back.size(); i++)
+    {
+      struct event *event = &events_back[i];
+      switch (event->type)
+        {
+        case EVENT_DEVICE:
+          gm_device_event_free(event->device_event);
+          break;
+        case EVENT_CONTEXT:
+          gm_context_event_free(event->context_event);
+          break;
+        }
+    }
+  events_back.clear();
+  pthread_mutex_unlock(&event_queue_lock);
+
+  for (int i = 0; i < n_cameras; i++)
+    {
+      struct camera *camera = &cameras[i];
+
+      printf("  %s: %" PRIu64 " frames, %" PRIu64 " tracking updates\n",
+             camera->name, camera->n_frames, camera->n_tracked);
+      if (camera->n_compared)
+        {
+          printf("    %" PRIu64 " skeletons compared to ground truth: "
+                 "mean joint error = %.3fm, mean latency = %.2fms\n",
+                 camera->n_compared,
+                 camera->total_joint_error / camera->n_compared,
+                 (camera->total_latency / camera->n_compared) / 1e6);
+        }
+
+      /* Destroying the context removes it from the host */
+      gm_context_destroy(camera->ctx);
+      gm_device_close(camera->device);
+      free(camera->name);
+    }
+
+  gm_host_destroy(host);
+  gm_logger_destroy(log);
+
+  return 0;
+}
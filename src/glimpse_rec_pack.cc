@@ -0,0 +1,567 @@
+/*
+ * Copyright (C) 2018 Glimp IP Ltd
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#ifdef USE_SNAPPY
+#include <snappy-c.h>
+#endif
+
+#include "glimpse_rec_pack.h"
+#include "xalloc.h"
+
+struct gm_rec_pack {
+    struct gm_logger *log;
+
+    int fd;
+    uint8_t *map;
+    size_t map_len;
+
+    const struct gm_rec_pack_header *header;
+    const struct gm_rec_pack_frame *frames;
+
+    /* Copied so that it can be nul terminated */
+    char *metadata;
+};
+
+struct gm_rec_pack_writer {
+    struct gm_logger *log;
+
+    char *filename;
+    FILE *fp;
+    uint64_t offset;
+
+    int n_frames;
+    int n_frames_allocated;
+    struct gm_rec_pack_frame *frames;
+};
+
+static bool
+range_is_valid(struct gm_rec_pack *pack, uint64_t offset, uint64_t len)
+{
+    return offset <= pack->map_len && len <= pack->map_len - offset;
+}
+
+struct gm_rec_pack *
+rec_pack_open(struct gm_logger *log, const char *filename, char **err)
+{
+    struct gm_rec_pack *pack =
+        (struct gm_rec_pack *)xcalloc(1, sizeof(struct gm_rec_pack));
+    pack->log = log;
+
+    pack->fd = open(filename, O_RDONLY|O_CLOEXEC);
+    if (pack->fd < 0) {
+        gm_throw(log, err, "Failed to open %s: %s", filename, strerror(errno));
+        xfree(pack);
+        return NULL;
+    }
+
+    struct stat sb;
+    if (fstat(pack->fd, &sb) < 0) {
+        gm_throw(log, err, "Failed to stat %s: %s", filename, strerror(errno));
+        rec_pack_close(pack);
+        return NULL;
+    }
+    if ((size_t)sb.st_size < sizeof(struct gm_rec_pack_header)) {
+        gm_throw(log, err, "%s is too small to be a recording", filename);
+        rec_pack_close(pack);
+        return NULL;
+    }
+
+    pack->map_len = sb.st_size;
+    void *map = mmap(NULL, pack->map_len, PROT_READ, MAP_SHARED, pack->fd, 0);
+    if (map == MAP_FAILED) {
+        gm_throw(log, err, "Failed to map %s: %s", filename, strerror(errno));
+        pack->map_len = 0;
+        rec_pack_close(pack);
+        return NULL;
+    }
+    pack->map = (uint8_t *)map;
+
+    pack->header = (const struct gm_rec_pack_header *)pack->map;
+    if (memcmp(pack->header->magic, GM_REC_PACK_MAGIC, 4) != 0) {
+        gm_throw(log, err, "%s is not a complete Glimpse recording", filename);
+        rec_pack_close(pack);
+        return NULL;
+    }
+    if (pack->header->version != GM_REC_PACK_VERSION) {
+        gm_throw(log, err, "Unsupported recording version %u in %s",
+                 pack->header->version, filename);
+        rec_pack_close(pack);
+        return NULL;
+    }
+
+    uint64_t n_frames = pack->header->n_frames;
+    if (!range_is_valid(pack, pack->header->metadata_offset,
+                        pack->header->metadata_len) ||
+        !range_is_valid(pack, pack->header->index_offset,
+                        n_frames * sizeof(struct gm_rec_pack_frame)) ||
+        pack->header->index_offset % GM_REC_PACK_ALIGNMENT)
+    {
+        gm_throw(log, err, "Corrupt recording header in %s", filename);
+        rec_pack_close(pack);
+        return NULL;
+    }
+
+    pack->frames = (const struct gm_rec_pack_frame *)
+        (pack->map + pack->header->index_offset);
+
+    for (uint64_t i = 0; i < n_frames; i++) {
+        const struct gm_rec_pack_frame *frame = &pack->frames[i];
+        if (!range_is_valid(pack, frame->depth_offset, frame->depth_len) ||
+            !range_is_valid(pack, frame->video_offset, frame->video_len))
+        {
+            gm_throw(log, err, "Corrupt index entry for frame %d in %s",
+                     (int)i, filename);
+            rec_pack_close(pack);
+            return NULL;
+        }
+    }
+
+    size_t metadata_len = pack->header->metadata_len;
+    pack->metadata = (char *)xmalloc(metadata_len + 1);
+    memcpy(pack->metadata, pack->map + pack->header->metadata_offset,
+           metadata_len);
+    pack->metadata[metadata_len] = '\0';
+
+    return pack;
+}
+
+void
+rec_pack_close(struct gm_rec_pack *pack)
+{
+    if (pack->map)
+        munmap(pack->map, pack->map_len);
+    if (pack->fd >= 0)
+        close(pack->fd);
+    xfree(pack->metadata);
+    xfree(pack);
+}
+
+const char *
+rec_pack_get_metadata(struct gm_rec_pack *pack)
+{
+    return pack->metadata;
+}
+
+int
+rec_pack_get_n_frames(struct gm_rec_pack *pack)
+{
+    return pack->header->n_frames;
+}
+
+const struct gm_rec_pack_frame *
+rec_pack_get_frame(struct gm_rec_pack *pack, int frame)
+{
+    gm_assert(pack->log, frame >= 0 && frame < (int)pack->header->n_frames,
+              "Out of bounds recording frame %d", frame);
+    return &pack->frames[frame];
+}
+
+const void *
+rec_pack_get_depth(struct gm_rec_pack *pack, int frame, size_t *len)
+{
+    const struct gm_rec_pack_frame *entry = rec_pack_get_frame(pack, frame);
+    *len = entry->depth_len;
+    return entry->depth_len ? pack->map + entry->depth_offset : NULL;
+}
+
+const void *
+rec_pack_get_video(struct gm_rec_pack *pack, int frame, size_t *len)
+{
+    const struct gm_rec_pack_frame *entry = rec_pack_get_frame(pack, frame);
+    *len = entry->video_len;
+    return entry->video_len ? pack->map + entry->video_offset : NULL;
+}
+
+static void
+advise_range(struct gm_rec_pack *pack, uint64_t offset, uint64_t len)
+{
+    if (!len)
+        return;
+
+    long page_size = sysconf(_SC_PAGESIZE);
+    uint64_t start = offset & ~(uint64_t)(page_size - 1);
+    madvise(pack->map + start, len + (offset - start), MADV_WILLNEED);
+}
+
+void
+rec_pack_will_need(struct gm_rec_pack *pack, int frame)
+{
+    const struct gm_rec_pack_frame *entry = rec_pack_get_frame(pack, frame);
+
+    advise_range(pack, entry->depth_offset, entry->depth_len);
+    advise_range(pack, entry->video_offset, entry->video_len);
+}
+
+struct gm_rec_pack_writer *
+rec_pack_writer_open(struct gm_logger *log, const char *filename, char **err)
+{
+    FILE *fp = fopen(filename, "wb");
+    if (!fp) {
+        gm_throw(log, err, "Failed to open %s: %s", filename, strerror(errno));
+        return NULL;
+    }
+
+    /* The real header is written when the recording is closed */
+    struct gm_rec_pack_header header = {};
+    if (fwrite(&header, sizeof(header), 1, fp) != 1) {
+        gm_throw(log, err, "Failed to write %s: %s", filename, strerror(errno));
+        fclose(fp);
+        return NULL;
+    }
+
+    struct gm_rec_pack_writer *writer = (struct gm_rec_pack_writer *)
+        xcalloc(1, sizeof(struct gm_rec_pack_writer));
+    writer->log = log;
+    writer->filename = strdup(filename);
+    writer->fp = fp;
+    writer->offset = sizeof(header);
+
+    return writer;
+}
+
+static bool
+write_aligned(struct gm_rec_pack_writer *writer,
+              const void *data,
+              size_t len,
+              uint64_t *offset_out,
+              char **err)
+{
+    static const uint8_t padding[GM_REC_PACK_ALIGNMENT] = {};
+    size_t pad = (GM_REC_PACK_ALIGNMENT -
+                  (writer->offset % GM_REC_PACK_ALIGNMENT)) %
+        GM_REC_PACK_ALIGNMENT;
+
+    if ((pad && fwrite(padding, 1, pad, writer->fp) != pad) ||
+        (len && fwrite(data, 1, len, writer->fp) != len))
+    {
+        gm_throw(writer->log, err, "Failed to write %s: %s",
+                 writer->filename, strerror(errno));
+        return false;
+    }
+
+    *offset_out = writer->offset + pad;
+    writer->offset += pad + len;
+
+    return true;
+}
+
+bool
+rec_pack_writer_add_frame(struct gm_rec_pack_writer *writer,
+                          uint64_t timestamp,
+                          int camera_rotation,
+                          const void *depth,
+                          size_t depth_len,
+                          const void *video,
+                          size_t video_len,
+                          char **err)
+{
+    if (depth_len > UINT32_MAX || video_len > UINT32_MAX) {
+        gm_throw(writer->log, err, "Recording buffer too large");
+        return false;
+    }
+
+    struct gm_rec_pack_frame entry = {};
+    entry.timestamp = timestamp;
+    entry.camera_rotation = camera_rotation;
+
+    if (depth && depth_len) {
+        if (!write_aligned(writer, depth, depth_len, &entry.depth_offset, err))
+            return false;
+        entry.depth_len = depth_len;
+    }
+    if (video && video_len) {
+        if (!write_aligned(writer, video, video_len, &entry.video_offset, err))
+            return false;
+        entry.video_len = video_len;
+    }
+
+    if (writer->n_frames == writer->n_frames_allocated) {
+        writer->n_frames_allocated =
+            writer->n_frames_allocated ? writer->n_frames_allocated * 2 : 256;
+        writer->frames = (struct gm_rec_pack_frame *)
+            xrealloc(writer->frames,
+                     writer->n_frames_allocated *
+                     sizeof(struct gm_rec_pack_frame));
+    }
+    writer->frames[writer->n_frames++] = entry;
+
+    return true;
+}
+
+static void
+rec_pack_writer_free(struct gm_rec_pack_writer *writer)
+{
+    free(writer->filename);
+    xfree(writer->frames);
+    xfree(writer);
+}
+
+bool
+rec_pack_writer_close(struct gm_rec_pack_writer *writer,
+                      const char *metadata,
+                      char **err)
+{
+    struct gm_rec_pack_header header = {};
+    memcpy(header.magic, GM_REC_PACK_MAGIC, 4);
+    header.version = GM_REC_PACK_VERSION;
+    header.n_frames = writer->n_frames;
+    header.metadata_len = strlen(metadata);
+
+    bool status =
+        write_aligned(writer, metadata, header.metadata_len,
+                      &header.metadata_offset, err) &&
+        write_aligned(writer, writer->frames,
+                      writer->n_frames * sizeof(struct gm_rec_pack_frame),
+                      &header.index_offset, err);
+
+    if (status) {
+        if (fseek(writer->fp, 0, SEEK_SET) != 0 ||
+            fwrite(&header, sizeof(header), 1, writer->fp) != 1)
+        {
+            gm_throw(writer->log, err, "Failed to write header to %s: %s",
+                     writer->filename, strerror(errno));
+            status = false;
+        }
+    }
+
+    if (fclose(writer->fp) != 0 && status) {
+        gm_throw(writer->log, err, "Failed to close %s: %s",
+                 writer->filename, strerror(errno));
+        status = false;
+    }
+
+    rec_pack_writer_free(writer);
+
+    return status;
+}
+
+const char *
+rec_compression_name(enum gm_rec_compression compression)
+{
+    switch (compression) {
+    case GM_REC_COMPRESSION_NONE:
+        return NULL;
+    case GM_REC_COMPRESSION_DELTA_SNAPPY:
+        return "delta-snappy";
+    }
+
+    return NULL;
+}
+
+bool
+rec_compression_from_name(const char *name,
+                          enum gm_rec_compression *compression)
+{
+    if (!name || strcmp(name, "none") == 0) {
+        *compression = GM_REC_COMPRESSION_NONE;
+        return true;
+    } else if (strcmp(name, "delta-snappy") == 0) {
+        *compression = GM_REC_COMPRESSION_DELTA_SNAPPY;
+        return true;
+    }
+
+    return false;
+}
+
+bool
+rec_compression_supported(enum gm_rec_compression compression)
+{
+    switch (compression) {
+    case GM_REC_COMPRESSION_NONE:
+        return true;
+    case GM_REC_COMPRESSION_DELTA_SNAPPY:
+#ifdef USE_SNAPPY
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    return false;
+}
+
+size_t
+rec_depth_max_compressed_len(enum gm_rec_compression compression, size_t len)
+{
+    switch (compression) {
+    case GM_REC_COMPRESSION_NONE:
+        return len;
+    case GM_REC_COMPRESSION_DELTA_SNAPPY:
+#ifdef USE_SNAPPY
+        return snappy_max_compressed_length(len);
+#else
+        return 0;
+#endif
+    }
+
+    return 0;
+}
+
+template<typename WordT>
+static void
+delta_encode(const void *src, void *dst, size_t len)
+{
+    const WordT *in = (const WordT *)src;
+    WordT *out = (WordT *)dst;
+    size_t n_words = len / sizeof(WordT);
+
+    WordT prev = 0;
+    for (size_t i = 0; i < n_words; i++) {
+        WordT word = in[i];
+        out[i] = word - prev;
+        prev = word;
+    }
+}
+
+template<typename WordT>
+static void
+delta_decode(void *buf, size_t len)
+{
+    WordT *words = (WordT *)buf;
+    size_t n_words = len / sizeof(WordT);
+
+    WordT prev = 0;
+    for (size_t i = 0; i < n_words; i++) {
+        prev += words[i];
+        words[i] = prev;
+    }
+}
+
+bool
+rec_depth_compress(struct gm_logger *log,
+                   enum gm_rec_compression compression,
+                   int word_size,
+                   const void *src,
+                   size_t len,
+                   void *dst,
+                   size_t *dst_len,
+                   char **err)
+{
+    if (compression == GM_REC_COMPRESSION_NONE) {
+        memcpy(dst, src, len);
+        *dst_len = len;
+        return true;
+    }
+
+    if (!rec_compression_supported(compression)) {
+        gm_throw(log, err, "Unsupported depth compression");
+        return false;
+    }
+    if ((word_size != 2 && word_size != 4) || len % word_size) {
+        gm_throw(log, err, "Can't delta encode %d byte words", word_size);
+        return false;
+    }
+
+#ifdef USE_SNAPPY
+    void *delta = xmalloc(len);
+    if (word_size == 2)
+        delta_encode<uint16_t>(src, delta, len);
+    else
+        delta_encode<uint32_t>(src, delta, len);
+
+    size_t compressed_len = *dst_len;
+    snappy_status status = snappy_compress((const char *)delta, len,
+                                           (char *)dst, &compressed_len);
+    xfree(delta);
+
+    if (status != SNAPPY_OK) {
+        gm_throw(log, err, "Failed to compress depth buffer");
+        return false;
+    }
+
+    *dst_len = compressed_len;
+    return true;
+#else
+    return false;
+#endif
+}
+
+bool
+rec_depth_decompress(struct gm_logger *log,
+                     enum gm_rec_compression compression,
+                     int word_size,
+                     const void *src,
+                     size_t len,
+                     void *dst,
+                     size_t dst_max_len,
+                     size_t *dst_len,
+                     char **err)
+{
+    if (compression == GM_REC_COMPRESSION_NONE) {
+        if (len > dst_max_len) {
+            gm_throw(log, err, "Depth buffer too large");
+            return false;
+        }
+        memcpy(dst, src, len);
+        *dst_len = len;
+        return true;
+    }
+
+    if (!rec_compression_supported(compression)) {
+        gm_throw(log, err, "Unsupported depth compression");
+        return false;
+    }
+    if (word_size != 2 && word_size != 4) {
+        gm_throw(log, err, "Can't delta decode %d byte words", word_size);
+        return false;
+    }
+
+#ifdef USE_SNAPPY
+    size_t uncompressed_len = 0;
+    if (snappy_uncompressed_length((const char *)src, len,
+                                   &uncompressed_len) != SNAPPY_OK ||
+        uncompressed_len > dst_max_len)
+    {
+        gm_throw(log, err, "Corrupt or oversized compressed depth buffer");
+        return false;
+    }
+
+    if (snappy_uncompress((const char *)src, len,
+                          (char *)dst, &uncompressed_len) != SNAPPY_OK)
+    {
+        gm_throw(log, err, "Failed to decompress depth buffer");
+        return false;
+    }
+
+    if (word_size == 2)
+        delta_decode<uint16_t>(dst, uncompressed_len);
+    else
+        delta_decode<uint32_t>(dst, uncompressed_len);
+
+    *dst_len = uncompressed_len;
+    return true;
+#else
+    return false;
+#endif
+}
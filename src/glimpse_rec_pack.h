@@ -0,0 +1,201 @@
+/*
+ * Copyright (C) 2018 Glimp IP Ltd
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+/*
+ * A single-file container for Glimpse recordings, as an alternative to the
+ * original layout of a glimpse_recording.json file plus one .bin file per
+ * depth or video buffer.
+ *
+ * The buffer data is written first, followed by the recording metadata
+ * (the same JSON as glimpse_recording.json but without a "frames" array)
+ * and finally a fixed-size index entry for each frame. The header at the
+ * start of the file is only filled in once the recording is closed,
+ * so an incomplete recording is detected as invalid.
+ *
+ * Readers mmap the whole file so looking up a frame is just an index into
+ * the frame table and no per-frame files need to be opened.
+ *
+ * All values are little endian.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "glimpse_log.h"
+
+#define GM_REC_PACK_NAME "glimpse_recording.rec"
+
+#define GM_REC_PACK_MAGIC "GmRc"
+#define GM_REC_PACK_VERSION 1
+
+/* Buffer data is aligned so that it can be accessed in-place */
+#define GM_REC_PACK_ALIGNMENT 16
+
+struct gm_rec_pack_header {
+    char magic[4];
+    uint32_t version;
+
+    uint32_t n_frames;
+    uint32_t metadata_len;
+    uint64_t metadata_offset;
+    uint64_t index_offset;
+
+    uint8_t reserved[32];
+};
+
+struct gm_rec_pack_frame {
+    uint64_t timestamp;
+
+    /* A length of zero means the frame has no buffer of that type */
+    uint64_t depth_offset;
+    uint64_t video_offset;
+    uint32_t depth_len;
+    uint32_t video_len;
+
+    uint32_t camera_rotation; // enum gm_rotation
+    uint32_t reserved;
+};
+
+/* Optional compression of depth buffers, which applies to both the pack
+ * and directory layouts. The compression used is named by a
+ * "depth_compression" string in the recording metadata, and the recorded
+ * depth lengths are then the compressed lengths.
+ */
+enum gm_rec_compression {
+    GM_REC_COMPRESSION_NONE,
+
+    /* Each word is replaced with the (wrapping) difference from the previous
+     * word, which turns smooth depth into lots of small repeated values,
+     * and the result is compressed with Snappy
+     */
+    GM_REC_COMPRESSION_DELTA_SNAPPY,
+};
+
+struct gm_rec_pack;
+struct gm_rec_pack_writer;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct gm_rec_pack *
+rec_pack_open(struct gm_logger *log, const char *filename, char **err);
+
+void
+rec_pack_close(struct gm_rec_pack *pack);
+
+/* Returns a nul terminated JSON string */
+const char *
+rec_pack_get_metadata(struct gm_rec_pack *pack);
+
+int
+rec_pack_get_n_frames(struct gm_rec_pack *pack);
+
+const struct gm_rec_pack_frame *
+rec_pack_get_frame(struct gm_rec_pack *pack, int frame);
+
+/* Returns a pointer into the mapped file (valid until the pack is closed),
+ * or NULL if the frame has no depth buffer
+ */
+const void *
+rec_pack_get_depth(struct gm_rec_pack *pack, int frame, size_t *len);
+
+const void *
+rec_pack_get_video(struct gm_rec_pack *pack, int frame, size_t *len);
+
+/* Lets the kernel know we're about to read the given frame */
+void
+rec_pack_will_need(struct gm_rec_pack *pack, int frame);
+
+
+struct gm_rec_pack_writer *
+rec_pack_writer_open(struct gm_logger *log, const char *filename, char **err);
+
+/* Either buffer may be NULL */
+bool
+rec_pack_writer_add_frame(struct gm_rec_pack_writer *writer,
+                          uint64_t timestamp,
+                          int camera_rotation,
+                          const void *depth,
+                          size_t depth_len,
+                          const void *video,
+                          size_t video_len,
+                          char **err);
+
+/* Writes the metadata, frame index and header and closes the file.
+ *
+ * The writer is freed, even on failure.
+ */
+bool
+rec_pack_writer_close(struct gm_rec_pack_writer *writer,
+                      const char *metadata,
+                      char **err);
+
+/* Returns NULL for GM_REC_COMPRESSION_NONE (i.e. no metadata needed) */
+const char *
+rec_compression_name(enum gm_rec_compression compression);
+
+bool
+rec_compression_from_name(const char *name,
+                          enum gm_rec_compression *compression);
+
+/* Not all compression methods are available in every build */
+bool
+rec_compression_supported(enum gm_rec_compression compression);
+
+size_t
+rec_depth_max_compressed_len(enum gm_rec_compression compression,
+                             size_t len);
+
+/* @word_size should be the size of a depth value (2 or 4 bytes) and @len
+ * must be a multiple of it.
+ */
+bool
+rec_depth_compress(struct gm_logger *log,
+                   enum gm_rec_compression compression,
+                   int word_size,
+                   const void *src,
+                   size_t len,
+                   void *dst,
+                   size_t *dst_len,
+                   char **err);
+
+bool
+rec_depth_decompress(struct gm_logger *log,
+                     enum gm_rec_compression compression,
+                     int word_size,
+                     const void *src,
+                     size_t len,
+                     void *dst,
+                     size_t dst_max_len,
+                     size_t *dst_len,
+                     char **err);
+
+#ifdef __cplusplus
+}
+#endif
@@ -30,10 +30,13 @@
 #include <string.h>
 #include <alloca.h>
 #include <time.h>
+#include <pthread.h>
 #include <list>
 
 #include "glimpse_record.h"
+#include "glimpse_rec_pack.h"
 #include "image_utils.h"
+#include "xalloc.h"
 
 #include "parson.h"
 
@@ -42,6 +45,11 @@
 #define DEPTH_SUFFIX "-depth.bin"
 #define VIDEO_SUFFIX "-video.bin"
 
+/* Up to about a second of frames can be buffered while waiting for the
+ * disk before we start dropping frames
+ */
+#define RECORDING_QUEUE_LEN 30
+
 struct gm_recording {
     struct gm_logger *log;
     JSON_Value *json;
@@ -50,6 +58,29 @@ struct gm_recording {
     enum gm_format depth_format;
     enum gm_format video_format;
     char *path;
+
+    enum gm_recording_format format;
+    struct gm_rec_pack_writer *pack;
+
+    enum gm_rec_compression depth_compression;
+    void *depth_scratch;
+    size_t depth_scratch_len;
+
+    /* Frames are queued by gm_recording_save_frame() and written by a
+     * separate thread so that capturing isn't stalled by disk IO.
+     *
+     * Everything above is only accessed by the writer thread once
+     * frames have been queued.
+     */
+    pthread_t writer_thread;
+    pthread_mutex_t queue_lock;
+    pthread_cond_t queue_cond;
+    struct gm_frame *queue[RECORDING_QUEUE_LEN];
+    int queue_head;
+    int queue_len;
+    bool stopping;
+    int n_written;
+    int n_dropped;
 };
 
 static JSON_Value *
@@ -139,6 +170,65 @@ delete_files(struct gm_logger *log, const char *path, const char *suffix)
     }
 }
 
+/* Removes any files belonging to a previous recording that wouldn't be
+ * overwritten by a new recording in the given format
+ *
+ * Returns false if the path is too long to name the stale files
+ */
+static bool
+delete_stale_recording(struct gm_logger *log,
+                       const char *path,
+                       enum gm_recording_format format)
+{
+    char stale_path[512];
+    struct stat sb;
+
+    if (format == GM_RECORDING_FORMAT_DIRECTORY) {
+        if (snprintf(stale_path, sizeof(stale_path), "%s/%s",
+                     path, GM_REC_PACK_NAME) >= (int)sizeof(stale_path))
+        {
+            gm_error(log, "Unable to format stale recording path");
+            return false;
+        }
+        if (remove(stale_path) != 0 && errno != ENOENT) {
+            gm_warn(log, "Error removing file %s: %s",
+                    stale_path, strerror(errno));
+        }
+        return true;
+    }
+
+    if (snprintf(stale_path, sizeof(stale_path), "%s/glimpse_recording.json",
+                 path) >= (int)sizeof(stale_path))
+    {
+        gm_error(log, "Unable to format stale recording path");
+        return false;
+    }
+    if (remove(stale_path) != 0 && errno != ENOENT) {
+        gm_warn(log, "Error removing file %s: %s",
+                stale_path, strerror(errno));
+    }
+
+    if (snprintf(stale_path, sizeof(stale_path), "%s%s",
+                 path, DEPTH_PATH) >= (int)sizeof(stale_path))
+    {
+        gm_error(log, "Unable to format stale recording path");
+        return false;
+    }
+    if (stat(stale_path, &sb) == 0 && S_ISDIR(sb.st_mode))
+        delete_files(log, stale_path, DEPTH_SUFFIX);
+
+    if (snprintf(stale_path, sizeof(stale_path), "%s%s",
+                 path, VIDEO_PATH) >= (int)sizeof(stale_path))
+    {
+        gm_error(log, "Unable to format stale recording path");
+        return false;
+    }
+    if (stat(stale_path, &sb) == 0 && S_ISDIR(sb.st_mode))
+        delete_files(log, stale_path, VIDEO_SUFFIX);
+
+    return true;
+}
+
 static void
 gm_record_write_bin(struct gm_logger *log, const char *path,
                     void *data, size_t len)
@@ -158,12 +248,16 @@ gm_record_write_bin(struct gm_logger *log, const char *path,
     }
 }
 
+static void *
+recording_writer_thread_cb(void *userdata);
+
 struct gm_recording *
 gm_recording_init(struct gm_logger *log,
                   struct gm_device *device,
                   const char *recordings_path,
                   const char *rel_path,
-                  bool overwrite)
+                  bool overwrite,
+                  enum gm_recording_format format)
 {
     char full_path[512];
 
@@ -205,39 +299,61 @@ gm_recording_init(struct gm_logger *log,
         }
     }
 
-    int full_path_len = strlen(full_path);
-
-    // Create depth images directory
-    const char *depth_path_suffix = "/depth";
-    size_t depth_path_len = full_path_len + strlen(depth_path_suffix);
-    char *depth_path = (char *)alloca(depth_path_len + 1);
-    snprintf(depth_path, depth_path_len + 1, "%s%s", full_path, depth_path_suffix);
+    if (overwrite && !delete_stale_recording(log, full_path, format))
+        return NULL;
 
-    ret = mkdir(depth_path, 0777);
-    if (ret < 0 && errno != EEXIST) {
-        gm_error(log, "Unable to create directory '%s': %s",
-                 depth_path, strerror(errno));
-        return nullptr;
-    }
+    struct gm_rec_pack_writer *pack = NULL;
+    if (format == GM_RECORDING_FORMAT_PACK) {
+        char pack_path[512];
+        if (snprintf(pack_path, sizeof(pack_path), "%s/%s",
+                     full_path, GM_REC_PACK_NAME) >= (int)sizeof(pack_path))
+        {
+            gm_error(log, "Unable to format recording path");
+            return NULL;
+        }
 
-    // Create video images directory
-    const char *video_path_suffix = "/video";
-    size_t video_path_len = full_path_len + strlen(video_path_suffix);
-    char *video_path = (char *)alloca(video_path_len + 1);
-    snprintf(video_path, video_path_len+1, "%s%s", full_path, video_path_suffix);
+        char *pack_err = NULL;
+        pack = rec_pack_writer_open(log, pack_path, &pack_err);
+        if (!pack) {
+            gm_error(log, "%s", pack_err);
+            free(pack_err);
+            return NULL;
+        }
+    } else {
+        int full_path_len = strlen(full_path);
+
+        // Create depth images directory
+        const char *depth_path_suffix = "/depth";
+        size_t depth_path_len = full_path_len + strlen(depth_path_suffix);
+        char *depth_path = (char *)alloca(depth_path_len + 1);
+        snprintf(depth_path, depth_path_len + 1, "%s%s", full_path, depth_path_suffix);
+
+        ret = mkdir(depth_path, 0777);
+        if (ret < 0 && errno != EEXIST) {
+            gm_error(log, "Unable to create directory '%s': %s",
+                     depth_path, strerror(errno));
+            return nullptr;
+        }
 
-    ret = mkdir(video_path, 0777);
-    if (ret < 0 && errno != EEXIST) {
-        gm_error(log, "Unable to create directory '%s': %s",
-                 video_path, strerror(errno));
-        return nullptr;
-    }
+        // Create video images directory
+        const char *video_path_suffix = "/video";
+        size_t video_path_len = full_path_len + strlen(video_path_suffix);
+        char *video_path = (char *)alloca(video_path_len + 1);
+        snprintf(video_path, video_path_len+1, "%s%s", full_path, video_path_suffix);
+
+        ret = mkdir(video_path, 0777);
+        if (ret < 0 && errno != EEXIST) {
+            gm_error(log, "Unable to create directory '%s': %s",
+                     video_path, strerror(errno));
+            return nullptr;
+        }
 
-    if (overwrite) {
-        // Delete any existing files in the depth/video images directory to avoid
-        // accumulating untracked files
-        delete_files(log, depth_path, DEPTH_SUFFIX);
-        delete_files(log, video_path, VIDEO_SUFFIX);
+        if (overwrite) {
+            // Delete any existing files in the depth/video images directory to avoid
+            // accumulating untracked files
+            delete_files(log, depth_path, DEPTH_SUFFIX);
+            delete_files(log, video_path, VIDEO_SUFFIX);
+        }
     }
 
     // Create JSON metadata structure
@@ -286,9 +402,12 @@ gm_recording_init(struct gm_logger *log,
     json_object_set_number(json_object(json), "video_format",
                            (double)GM_FORMAT_UNKNOWN);
 
-    // Create an array for frames
-    JSON_Value *frames = json_value_init_array();
-    json_object_set_value(json_object(json), "frames", frames);
+    // Create an array for frames (the pack format has its own index)
+    JSON_Value *frames = NULL;
+    if (format == GM_RECORDING_FORMAT_DIRECTORY) {
+        frames = json_value_init_array();
+        json_object_set_value(json_object(json), "frames", frames);
+    }
 
     // Initialise recording structure and return
     struct gm_recording *r = (struct gm_recording *)
@@ -299,15 +418,116 @@ gm_recording_init(struct gm_logger *log,
     r->depth_format = depth_format;
     r->video_format = video_format;
     r->path = strdup(full_path);
+    r->format = format;
+    r->pack = pack;
+
+    pthread_mutex_init(&r->queue_lock, NULL);
+    pthread_cond_init(&r->queue_cond, NULL);
+    pthread_create(&r->writer_thread, NULL, recording_writer_thread_cb, r);
+    pthread_setname_np(r->writer_thread, "Recording Writer");
 
     return r;
 }
 
-void
-gm_recording_save_frame(struct gm_recording *r, struct gm_frame *frame)
+static bool
+update_depth_format(struct gm_recording *r, struct gm_frame *frame)
 {
-    if (!frame->video && !frame->depth) {
-        gm_warn(r->log, "Not saving frame with no depth or video buffer");
+    if (r->depth_format == GM_FORMAT_UNKNOWN) {
+        r->depth_format = frame->depth_format;
+        json_object_set_number(json_object(r->json), "depth_format",
+                               (double)r->depth_format);
+    } else if (frame->depth_format != r->depth_format) {
+        gm_error(r->log, "Depth frame with unexpected format");
+        return false;
+    }
+
+    return true;
+}
+
+static bool
+update_video_format(struct gm_recording *r, struct gm_frame *frame)
+{
+    if (r->video_format == GM_FORMAT_UNKNOWN) {
+        r->video_format = frame->video_format;
+        json_object_set_number(json_object(r->json), "video_format",
+                               (double)r->video_format);
+    } else if (frame->video_format != r->video_format) {
+        gm_error(r->log, "Video frame with unexpected format");
+        return false;
+    }
+
+    return true;
+}
+
+/* Returns the depth data to write, which is compressed into a scratch
+ * buffer if requested
+ */
+static const void *
+get_depth_data(struct gm_recording *r, struct gm_frame *frame, size_t *len)
+{
+    if (r->depth_compression == GM_REC_COMPRESSION_NONE) {
+        *len = frame->depth->len;
+        return frame->depth->data;
+    }
+
+    size_t max_len = rec_depth_max_compressed_len(r->depth_compression,
+                                                  frame->depth->len);
+    if (max_len > r->depth_scratch_len) {
+        r->depth_scratch = xrealloc(r->depth_scratch, max_len);
+        r->depth_scratch_len = max_len;
+    }
+
+    int word_size = (frame->depth_format == GM_FORMAT_Z_U16_MM ||
+                     frame->depth_format == GM_FORMAT_Z_F16_M) ? 2 : 4;
+
+    char *err = NULL;
+    *len = r->depth_scratch_len;
+    if (!rec_depth_compress(r->log,
+                            r->depth_compression,
+                            word_size,
+                            frame->depth->data,
+                            frame->depth->len,
+                            r->depth_scratch,
+                            len,
+                            &err))
+    {
+        gm_error(r->log, "Failed to compress depth: %s", err);
+        free(err);
+        return NULL;
+    }
+
+    return r->depth_scratch;
+}
+
+static void
+write_frame(struct gm_recording *r, struct gm_frame *frame)
+{
+    bool save_depth = frame->depth && update_depth_format(r, frame);
+    bool save_video = frame->video && update_video_format(r, frame);
+
+    size_t depth_len = 0;
+    const void *depth_data = NULL;
+    if (save_depth) {
+        depth_data = get_depth_data(r, frame, &depth_len);
+        save_depth = depth_data != NULL;
+    }
+
+    if (r->format == GM_RECORDING_FORMAT_PACK) {
+        char *err = NULL;
+        if (!rec_pack_writer_add_frame(r->pack,
+                                       frame->timestamp,
+                                       frame->camera_rotation,
+                                       depth_data,
+                                       depth_len,
+                                       save_video ? frame->video->data : NULL,
+                                       save_video ? frame->video->len : 0,
+                                       &err))
+        {
+            gm_error(r->log, "Failed to save frame: %s", err);
+            free(err);
+            return;
+        }
+        ++r->n_frames;
         return;
     }
 
@@ -317,67 +537,40 @@ gm_recording_save_frame(struct gm_recording *r, struct gm_frame *frame)
 
     size_t path_len = strlen(r->path);
 
-    if (frame->depth) {
-        // Update depth format
-        bool save = true;
-        if (r->depth_format == GM_FORMAT_UNKNOWN) {
-            r->depth_format = frame->depth_format;
-            json_object_set_number(json_object(r->json), "depth_format",
-                                   (double)r->depth_format);
-        } else if (frame->depth_format != r->depth_format) {
-            gm_error(r->log, "Depth frame with unexpected format");
-            save = false;
-        }
-
-        if (save) {
-            // Save out depth frame
-            // 6 characters: 1 = '/', '4' = %04d, '1' = '\0'
-            size_t bin_path_size =
-                path_len + strlen(DEPTH_PATH) + strlen(DEPTH_SUFFIX) + 6;
-            char *bin_path = (char *)malloc(bin_path_size);
-            snprintf(bin_path, bin_path_size, "%s%s/%04d%s",
-                     r->path, DEPTH_PATH, r->n_frames, DEPTH_SUFFIX);
-
-            gm_record_write_bin(r->log, bin_path, frame->depth->data,
-                                frame->depth->len);
-
-            json_object_set_string(json_object(frame_meta), "depth_file",
-                                   bin_path + path_len);
-            json_object_set_number(json_object(frame_meta), "depth_len",
-                                   (double)frame->depth->len);
-            free(bin_path);
-        }
+    if (save_depth) {
+        // Save out depth frame
+        // 6 characters: 1 = '/', '4' = %04d, '1' = '\0'
+        size_t bin_path_size =
+            path_len + strlen(DEPTH_PATH) + strlen(DEPTH_SUFFIX) + 6;
+        char *bin_path = (char *)malloc(bin_path_size);
+        snprintf(bin_path, bin_path_size, "%s%s/%04d%s",
+                 r->path, DEPTH_PATH, r->n_frames, DEPTH_SUFFIX);
+
+        gm_record_write_bin(r->log, bin_path, (void *)depth_data, depth_len);
+
+        json_object_set_string(json_object(frame_meta), "depth_file",
+                               bin_path + path_len);
+        json_object_set_number(json_object(frame_meta), "depth_len",
+                               (double)depth_len);
+        free(bin_path);
     }
 
-    if (frame->video) {
-        // Update video format
-        bool save = true;
-        if (r->video_format == GM_FORMAT_UNKNOWN) {
-            r->video_format = frame->video_format;
-            json_object_set_number(json_object(r->json), "video_format",
-                                   (double)r->video_format);
-        } else if (frame->video_format != r->video_format) {
-            gm_error(r->log, "Video frame with unexpected format");
-            save = false;
-        }
-
-        if (save) {
-            // Save out video frame
-            size_t bin_path_size =
-                path_len + strlen(VIDEO_PATH) + strlen(VIDEO_SUFFIX) + 6;
-            char *bin_path = (char *)malloc(bin_path_size);
-            snprintf(bin_path, bin_path_size, "%s%s/%04d%s",
-                     r->path, VIDEO_PATH, r->n_frames, VIDEO_SUFFIX);
-
-            gm_record_write_bin(r->log, bin_path, frame->video->data,
-                                frame->video->len);
-
-            json_object_set_string(json_object(frame_meta), "video_file",
-                                   bin_path + path_len);
-            json_object_set_number(json_object(frame_meta), "video_len",
-                                   (double)frame->video->len);
-            free(bin_path);
-        }
+    if (save_video) {
+        // Save out video frame
+        size_t bin_path_size =
+            path_len + strlen(VIDEO_PATH) + strlen(VIDEO_SUFFIX) + 6;
+        char *bin_path = (char *)malloc(bin_path_size);
+        snprintf(bin_path, bin_path_size, "%s%s/%04d%s",
+                 r->path, VIDEO_PATH, r->n_frames, VIDEO_SUFFIX);
+
+        gm_record_write_bin(r->log, bin_path, frame->video->data,
+                            frame->video->len);
+
+        json_object_set_string(json_object(frame_meta), "video_file",
+                               bin_path + path_len);
+        json_object_set_number(json_object(frame_meta), "video_len",
+                               (double)frame->video->len);
+        free(bin_path);
     }
 
     // Save out camera rotation
@@ -388,9 +581,146 @@ gm_recording_save_frame(struct gm_recording *r, struct gm_frame *frame)
     ++r->n_frames;
 }
 
+static void *
+recording_writer_thread_cb(void *userdata)
+{
+    struct gm_recording *r = (struct gm_recording *)userdata;
+
+    pthread_mutex_lock(&r->queue_lock);
+    while (true) {
+        while (!r->queue_len && !r->stopping)
+            pthread_cond_wait(&r->queue_cond, &r->queue_lock);
+
+        /* Only finish once everything queued has been written */
+        if (!r->queue_len)
+            break;
+
+        struct gm_frame *frame = r->queue[r->queue_head];
+        r->queue_head = (r->queue_head + 1) % RECORDING_QUEUE_LEN;
+        r->queue_len--;
+
+        pthread_mutex_unlock(&r->queue_lock);
+
+        write_frame(r, frame);
+        gm_frame_unref(frame);
+
+        pthread_mutex_lock(&r->queue_lock);
+        r->n_written++;
+    }
+    pthread_mutex_unlock(&r->queue_lock);
+
+    return NULL;
+}
+
+bool
+gm_recording_set_depth_compression(struct gm_recording *r,
+                                   enum gm_rec_compression compression,
+                                   char **err)
+{
+    if (!rec_compression_supported(compression)) {
+        gm_throw(r->log, err, "Depth compression '%s' not supported by this build",
+                 rec_compression_name(compression));
+        return false;
+    }
+
+    pthread_mutex_lock(&r->queue_lock);
+    bool started = r->n_written || r->queue_len;
+    pthread_mutex_unlock(&r->queue_lock);
+    if (started) {
+        gm_throw(r->log, err, "Can't change compression after saving frames");
+        return false;
+    }
+
+    r->depth_compression = compression;
+
+    const char *name = rec_compression_name(compression);
+    if (name)
+        json_object_set_string(json_object(r->json), "depth_compression", name);
+    else
+        json_object_remove(json_object(r->json), "depth_compression");
+
+    return true;
+}
+
+void
+gm_recording_save_frame(struct gm_recording *r, struct gm_frame *frame)
+{
+    if (!frame->video && !frame->depth) {
+        gm_warn(r->log, "Not saving frame with no depth or video buffer");
+        return;
+    }
+
+    pthread_mutex_lock(&r->queue_lock);
+
+    if (r->queue_len == RECORDING_QUEUE_LEN) {
+        int n_dropped = ++r->n_dropped;
+        pthread_mutex_unlock(&r->queue_lock);
+
+        /* Avoid flooding the log if the disk is consistently too slow */
+        if ((n_dropped & (n_dropped - 1)) == 0) {
+            gm_warn(r->log, "Recording can't keep up, dropped %d frames so far",
+                    n_dropped);
+        }
+        return;
+    }
+
+    int tail = (r->queue_head + r->queue_len) % RECORDING_QUEUE_LEN;
+    r->queue[tail] = gm_frame_ref(frame);
+    r->queue_len++;
+
+    pthread_cond_signal(&r->queue_cond);
+    pthread_mutex_unlock(&r->queue_lock);
+}
+
+void
+gm_recording_get_stats(struct gm_recording *r,
+                       struct gm_recording_stats *stats)
+{
+    pthread_mutex_lock(&r->queue_lock);
+    stats->n_queued = r->queue_len;
+    stats->n_written = r->n_written;
+    stats->n_dropped = r->n_dropped;
+    pthread_mutex_unlock(&r->queue_lock);
+}
+
+static void
+recording_free(struct gm_recording *r)
+{
+    pthread_cond_destroy(&r->queue_cond);
+    pthread_mutex_destroy(&r->queue_lock);
+
+    json_value_free(r->json);
+    xfree(r->depth_scratch);
+    free(r->path);
+    free(r);
+}
+
 void
 gm_recording_close(struct gm_recording *r)
 {
+    pthread_mutex_lock(&r->queue_lock);
+    r->stopping = true;
+    pthread_cond_signal(&r->queue_cond);
+    pthread_mutex_unlock(&r->queue_lock);
+
+    pthread_join(r->writer_thread, NULL);
+
+    gm_info(r->log, "Recorded %d frames (%d dropped)",
+            r->n_written, r->n_dropped);
+
+    if (r->format == GM_RECORDING_FORMAT_PACK) {
+        char *metadata = json_serialize_to_string(r->json);
+        char *err = NULL;
+        if (!rec_pack_writer_close(r->pack, metadata, &err)) {
+            gm_error(r->log, "Failed to finish recording: %s", err);
+            free(err);
+        }
+        json_free_serialized_string(metadata);
+
+        recording_free(r);
+        return;
+    }
+
     const char *json_name = "glimpse_recording.json";
     size_t json_path_size = strlen(r->path) + strlen(json_name) + 2;
     char *json_path = (char *)alloca(json_path_size);
@@ -398,7 +728,5 @@ gm_recording_close(struct gm_recording *r)
 
     json_serialize_to_file_pretty(r->json, json_path);
 
-    json_value_free(r->json);
-    free(r->path);
-    free(r);
+    recording_free(r);
 }
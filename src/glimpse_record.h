@@ -29,17 +29,51 @@
 #include "glimpse_log.h"
 #include "glimpse_context.h"
 #include "glimpse_device.h"
+#include "glimpse_rec_pack.h"
 
 struct gm_recording;
 
+struct gm_recording_stats {
+    /* Frames waiting to be written by the background writer thread */
+    int n_queued;
+
+    int n_written;
+
+    /* Frames discarded because the queue was full (i.e. the disk couldn't
+     * keep up with the capture rate)
+     */
+    int n_dropped;
+};
+
+enum gm_recording_format {
+    /* A glimpse_recording.json file plus one .bin file per buffer */
+    GM_RECORDING_FORMAT_DIRECTORY,
+
+    /* A single indexed file (see glimpse_rec_pack.h) */
+    GM_RECORDING_FORMAT_PACK,
+};
+
 struct gm_recording *
 gm_recording_init(struct gm_logger *log,
                   struct gm_device *device,
                   const char *recordings_path,
                   const char *rel_path,
-                  bool overwrite);
+                  bool overwrite,
+                  enum gm_recording_format format);
+
+/* Must be called before saving any frames */
+bool gm_recording_set_depth_compression(struct gm_recording *recording,
+                                        enum gm_rec_compression compression,
+                                        char **err);
 
+/* Takes a reference on the frame and queues it to be written on a separate
+ * thread. If the queue is full the frame is dropped.
+ */
 void gm_recording_save_frame(struct gm_recording *recording,
                              struct gm_frame *frame);
 
+void gm_recording_get_stats(struct gm_recording *recording,
+                            struct gm_recording_stats *stats);
+
+/* Waits for all queued frames to be written before closing */
 void gm_recording_close(struct gm_recording *recording);
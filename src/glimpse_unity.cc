@@ -36,6 +36,7 @@
 #include <epoxy/gl.h>
 
 #include <vector>
+#include <atomic>
 
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
@@ -84,6 +85,25 @@ struct event
     };
 };
 
+/* Lock-free hand-off of the latest video frame to Unity's render thread.
+ *
+ * The producer (the thread running gm_unity_process_events()) owns the
+ * back slot and the render thread owns the front slot, while the middle
+ * slot is swapped atomically by either side. All frame references are
+ * taken and dropped by the producer (gm_frame refcounts aren't atomic)
+ * so the render thread never takes a lock or calls into gm_device.
+ */
+#define TRIPLE_BUFFER_INDEX_MASK 0x3
+#define TRIPLE_BUFFER_DIRTY 0x4
+
+struct frame_triple_buffer
+{
+    struct gm_frame *slots[3];
+    int back;
+    int front;
+    std::atomic<int> middle;
+};
+
 struct glimpse_data
 {
     JSON_Value *config_val;
@@ -110,17 +130,16 @@ struct glimpse_data
     /* Once we've been notified that there's a device frame ready for us then
      * we store the latest frames from gm_device_get_latest_frame() here...
      *
-     * We have the lock considering that unity's rendering happens in a separate
-     * thread and also needs to access these pointers.
+     * NB: these are only accessed by the thread processing events, unity's
+     * render thread gets video frames via render_frames instead.
      */
-    pthread_mutex_t swap_frames_lock;
     struct gm_frame *last_depth_frame;
     struct gm_frame *last_video_frame;
 
-    /* When we come to render the background we take a reference on the latest
-     * gm_frame before uploading to a texture for display.
+    /* Each new video frame is published here for the render thread to
+     * upload to a texture for display.
      */
-    struct gm_frame *visible_frame;
+    struct frame_triple_buffer render_frames;
     GLuint gl_vid_tex;
 
     /* Set when gm_context sends a _REQUEST_FRAME event */
@@ -297,6 +316,66 @@ on_graphics_device_event_cb(UnityGfxDeviceEventType type)
     }
 }
 
+static void
+frame_triple_buffer_init(struct frame_triple_buffer *buf)
+{
+    for (int i = 0; i < 3; i++)
+        buf->slots[i] = NULL;
+    buf->back = 0;
+    buf->middle.store(1, std::memory_order_relaxed);
+    buf->front = 2;
+}
+
+/* Called by the producer thread only */
+static void
+frame_triple_buffer_publish(struct frame_triple_buffer *buf,
+                            struct gm_frame *frame)
+{
+    struct gm_frame *old = buf->slots[buf->back];
+    if (old) {
+        gm_frame_add_breadcrumb(old, "unity: render thread discard");
+        gm_frame_unref(old);
+    }
+
+    buf->slots[buf->back] = gm_frame_ref(frame);
+    gm_frame_add_breadcrumb(frame, "unity: publish to render thread");
+
+    int prev = buf->middle.exchange(buf->back | TRIPLE_BUFFER_DIRTY,
+                                    std::memory_order_acq_rel);
+    buf->back = prev & TRIPLE_BUFFER_INDEX_MASK;
+}
+
+/* Called by the render thread only. Returns the latest published frame
+ * (possibly NULL) and sets *changed if it differs from the last call.
+ *
+ * The frame stays valid until the next call.
+ */
+static struct gm_frame *
+frame_triple_buffer_acquire(struct frame_triple_buffer *buf, bool *changed)
+{
+    *changed = false;
+
+    if (buf->middle.load(std::memory_order_relaxed) & TRIPLE_BUFFER_DIRTY) {
+        int prev = buf->middle.exchange(buf->front, std::memory_order_acq_rel);
+        buf->front = prev & TRIPLE_BUFFER_INDEX_MASK;
+        *changed = true;
+    }
+
+    return buf->slots[buf->front];
+}
+
+/* Only safe once the render thread can no longer call _acquire() */
+static void
+frame_triple_buffer_clear(struct frame_triple_buffer *buf)
+{
+    for (int i = 0; i < 3; i++) {
+        if (buf->slots[i]) {
+            gm_frame_unref(buf->slots[i]);
+            buf->slots[i] = NULL;
+        }
+    }
+}
+
 /* If we've already requested gm_device for a frame then this won't submit
  * a request that downgrades the buffers_mask
  */
@@ -347,12 +426,6 @@ handle_device_frame_updates(struct glimpse_data *data)
          */
         device_frame->timestamp = get_time();
 
-        /* XXX: we have to consider that the rendering is in another thread
-         * and we don't want to unref (and potentially free) the last frame
-         * while the render thread might reference the same pointer...
-         */
-        pthread_mutex_lock(&data->swap_frames_lock);
-
         if (device_frame->depth) {
             if (data->last_depth_frame) {
                 gm_frame_add_breadcrumb(data->last_depth_frame, "unity: discard old depth frame");
@@ -374,9 +447,9 @@ handle_device_frame_updates(struct glimpse_data *data)
             data->pending_frame_buffers_mask &= ~GM_REQUEST_FRAME_VIDEO;
             gm_frame_add_breadcrumb(device_frame, "unity: latest video frame");
             //upload = true;
-        }
 
-        pthread_mutex_unlock(&data->swap_frames_lock);
+            frame_triple_buffer_publish(&data->render_frames, device_frame);
+        }
 
         gm_frame_unref(device_frame);
     }
@@ -393,35 +466,20 @@ handle_device_frame_updates(struct glimpse_data *data)
                                          data->last_depth_frame,
                                          data->last_video_frame);
 
-            /* XXX: we have to consider that the rendering is in another thread
-             * and we don't want to unref (and potentially free) the last frame
-             * while the render thread might reference the same pointer...
-             *
-             * XXX: be careful making changes here to not end up holding this
-             * lock for too long and blocking the rendering thread. E.g.
-             * we avoid having the scope of the lock include the call into
-             * gm_context_notify_frame().
-             */
-            pthread_mutex_lock(&data->swap_frames_lock);
-
             // We don't need the individual frames any more
             gm_frame_unref(data->last_depth_frame);
             gm_frame_unref(data->last_video_frame);
 
             data->last_depth_frame = full_frame;
             data->last_video_frame = gm_frame_ref(full_frame);
-
-            pthread_mutex_unlock(&data->swap_frames_lock);
         }
 
         data->context_needs_frame =
             !gm_context_notify_frame(data->ctx, data->last_depth_frame);
 
         // We don't want to send duplicate frames to tracking, so discard now
-        pthread_mutex_lock(&data->swap_frames_lock);
         gm_frame_unref(data->last_depth_frame);
         data->last_depth_frame = NULL;
-        pthread_mutex_unlock(&data->swap_frames_lock);
     }
 
     data->device_frame_ready = false;
@@ -734,30 +792,19 @@ render_ar_video_background(struct glimpse_data *data)
 {
     gm_assert(data->log, !!data->ctx, "render_ar_video_background, NULL ctx");
 
+    bool new_frame = false;
+    struct gm_frame *visible_frame =
+        frame_triple_buffer_acquire(&data->render_frames, &new_frame);
 
     if (data->device_type != GM_DEVICE_TANGO) {
         /* Upload latest video frame if it's changed...
         */
-        if (data->last_video_frame != data->visible_frame) {
+        if (new_frame && visible_frame) {
             const struct gm_intrinsics *video_intrinsics =
                 gm_device_get_video_intrinsics(data->device);
             int video_width = video_intrinsics->width;
             int video_height = video_intrinsics->height;
 
-            pthread_mutex_lock(&data->swap_frames_lock);
-
-            struct gm_frame *new_frame = gm_frame_ref(data->last_video_frame);
-
-            gm_frame_add_breadcrumb(new_frame, "render thread visible");
-
-            if (data->visible_frame) {
-                gm_frame_add_breadcrumb(data->visible_frame, "render thread discard");
-                gm_frame_unref(data->visible_frame);
-            }
-            data->visible_frame = new_frame;
-
-            pthread_mutex_unlock(&data->swap_frames_lock);
-
             /*
              * Update video from camera
              */
@@ -770,8 +817,8 @@ render_ar_video_background(struct glimpse_data *data)
             glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
             glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
 
-            void *video_front = new_frame->video->data;
-            enum gm_format video_format = new_frame->video_format;
+            void *video_front = visible_frame->video->data;
+            enum gm_format video_format = visible_frame->video_format;
 
             if (data->gl_vid_tex == 0) {
                 glGenTextures(1, &data->gl_vid_tex);
@@ -840,7 +887,7 @@ render_ar_video_background(struct glimpse_data *data)
         }
     }
 
-    if (data->gl_vid_tex != 0 && data->last_video_frame != NULL) {
+    if (data->gl_vid_tex != 0 && visible_frame != NULL) {
 
 #ifdef USE_TANGO
         if (data->device_type == GM_DEVICE_TANGO &&
@@ -852,7 +899,7 @@ render_ar_video_background(struct glimpse_data *data)
         }
 #endif
 
-        enum gm_rotation rotation = data->last_video_frame->camera_rotation;
+        enum gm_rotation rotation = visible_frame->camera_rotation;
 
         struct {
             float x, y, s, t;
@@ -1079,15 +1126,11 @@ gm_unity_terminate(void)
         gm_context_destroy(data->ctx);
 
 
-    /* locking redundant here, but help serve as a reminder that
-     * this state should only be touched with this lock held...
+    /* NB: terminating is set so the render thread can no longer be
+     * accessing render_frames...
      */
-    pthread_mutex_lock(&data->swap_frames_lock);
+    frame_triple_buffer_clear(&data->render_frames);
 
-    if (data->visible_frame) {
-        gm_frame_unref(data->visible_frame);
-        data->visible_frame = NULL;
-    }
     if (data->last_depth_frame) {
         gm_frame_unref(data->last_depth_frame);
         data->last_depth_frame = NULL;
@@ -1097,8 +1140,6 @@ gm_unity_terminate(void)
         data->last_video_frame = NULL;
     }
 
-    pthread_mutex_unlock(&data->swap_frames_lock);
-
     if (data->device)
         gm_device_close(data->device);
 
@@ -1200,7 +1241,7 @@ gm_unity_init(char *config_json)
     data->events_front = new std::vector<struct event>();
     data->events_back = new std::vector<struct event>();
 
-    pthread_mutex_init(&data->swap_frames_lock, NULL);
+    frame_triple_buffer_init(&data->render_frames);
 
     char *ctx_err = NULL;
     data->ctx = gm_context_new(data->log, &ctx_err);
@@ -71,8 +71,10 @@
 #include "glimpse_context.h"
 #include "glimpse_device.h"
 #include "glimpse_record.h"
+#include "glimpse_rec_pack.h"
 #include "glimpse_assets.h"
 #include "glimpse_gl.h"
+#include "glimpse_mem_pool.h"
 
 
 #define ARRAY_LEN(X) (sizeof(X)/sizeof(X[0]))
@@ -172,6 +174,14 @@ typedef struct _Data
     struct gm_frame *last_depth_frame;
     struct gm_frame *last_video_frame;
 
+    /* So we only upload video when it has actually changed, e.g. not while
+     * playback is paused and the same buffer is repeatedly delivered.
+     *
+     * NB: we keep a reference on the uploaded buffer so that its address
+     * can't be recycled for a new buffer from the device's pool.
+     */
+    struct gm_buffer *uploaded_video_buf;
+
     /* Set when gm_context sends a _REQUEST_FRAME event */
     bool context_needs_frame;
     /* Set when gm_context sends a _TRACKING_READY event */
@@ -187,6 +197,8 @@ typedef struct _Data
      * frames as we add them.
      */
     bool overwrite_recording;
+    bool pack_recording;
+    bool compress_recorded_depth;
     struct gm_recording *recording;
     struct gm_device *recording_device;
     std::vector<char *> recordings;
@@ -194,6 +206,12 @@ typedef struct _Data
 
     struct gm_device *playback_device;
 
+    /* Optional limits for device video and depth buffers, in bytes, as set
+     * via GLIMPSE_VIDEO_BUFFER_BUDGET_MB and GLIMPSE_DEPTH_BUFFER_BUDGET_MB
+     */
+    size_t video_buffer_budget;
+    size_t depth_buffer_budget;
+
     struct gm_device *active_device;
 
     /* Events from the gm_context and gm_device apis may be delivered via any
@@ -233,6 +251,20 @@ static uint32_t joint_palette[] = {
 
 char *glimpse_recordings_path;
 
+/* Textures that are updated every frame are streamed via a pair of pixel
+ * unpack buffers into texture storage that's only reallocated if the size or
+ * format changes.
+ */
+struct texture_stream
+{
+    GLuint pbos[2];
+    int next_pbo;
+
+    int width;
+    int height;
+    GLenum format;
+};
+
 static GLuint gl_labels_tex;
 static GLuint gl_depth_rgb_tex;
 static GLuint gl_normals_rgb_tex;
@@ -263,6 +295,14 @@ static GLuint gl_cloud_fbo;
 static GLuint gl_cloud_depth_bo;
 static GLuint gl_cloud_tex;
 
+static struct texture_stream labels_stream;
+static struct texture_stream depth_rgb_stream;
+static struct texture_stream normals_rgb_stream;
+static struct texture_stream nclusters_rgb_stream;
+static struct texture_stream cclusters_rgb_stream;
+static struct texture_stream vid_stream;
+static struct texture_stream db_vid_stream;
+
 static const char *views[] = {
     "Controls", "Video Buffer", "Depth Buffer",
     "Normals", "Normal clusters", "Candidate clusters", "Labels", "Cloud" };
@@ -295,6 +335,10 @@ unref_device_frames(Data *data)
         gm_frame_unref(data->last_depth_frame);
         data->last_depth_frame = NULL;
     }
+    if (data->uploaded_video_buf) {
+        gm_buffer_unref(data->uploaded_video_buf);
+        data->uploaded_video_buf = NULL;
+    }
 }
 
 static void
@@ -332,6 +376,7 @@ index_recordings_recursive(Data *data,
     struct stat st;
     DIR *dir;
     bool ret = true;
+    bool is_recording = false;
 
     char full_path[512];
     xsnprintf(full_path, sizeof(full_path), "%s/%s", recordings_path, rel_path);
@@ -361,13 +406,18 @@ index_recordings_recursive(Data *data,
                 break;
             }
         } else if (strlen(rel_path) &&
-                   strcmp(entry->d_name, "glimpse_recording.json") == 0) {
-            files.push_back(strdup(rel_path));
+                   (strcmp(entry->d_name, "glimpse_recording.json") == 0 ||
+                    strcmp(entry->d_name, GM_REC_PACK_NAME) == 0)) {
+            /* A recording may have both a json description and a pack */
+            is_recording = true;
         }
     }
 
     closedir(dir);
 
+    if (ret && is_recording)
+        files.push_back(strdup(rel_path));
+
     return ret;
 }
 
@@ -499,6 +549,26 @@ adjust_aspect(ImVec2 &input, int width, int height)
     input = output;
 }
 
+static void
+draw_pool_stats_cb(struct gm_mem_pool *pool, void *user_data)
+{
+    struct gm_mem_pool_stats stats;
+    mem_pool_get_stats(pool, &stats);
+
+    float mb = (stats.n_allocated * stats.resource_size) / (1024.f * 1024.f);
+    if (stats.byte_budget) {
+        ImGui::Text("%s: %u/%u busy (peak %u), %.1f/%.1fMB, %u throttled",
+                    stats.name, stats.n_busy, stats.n_allocated,
+                    stats.high_watermark,
+                    mb, stats.byte_budget / (1024.f * 1024.f),
+                    stats.n_throttled);
+    } else {
+        ImGui::Text("%s: %u/%u busy (peak %u), %.1fMB, %u throttled",
+                    stats.name, stats.n_busy, stats.n_allocated,
+                    stats.high_watermark, mb, stats.n_throttled);
+    }
+}
+
 static bool
 draw_controls(Data *data, int x, int y, int width, int height, bool disabled)
 {
@@ -521,6 +591,11 @@ draw_controls(Data *data, int x, int y, int width, int height, bool disabled)
     ImGui::Spacing();
 
     ImGui::Checkbox("Overwrite recording", &data->overwrite_recording);
+    ImGui::Checkbox("Single-file recording", &data->pack_recording);
+    if (rec_compression_supported(GM_REC_COMPRESSION_DELTA_SNAPPY)) {
+        ImGui::Checkbox("Compress recorded depth",
+                        &data->compress_recorded_depth);
+    }
 
     ImGui::Spacing();
     ImGui::Separator();
@@ -541,6 +616,14 @@ draw_controls(Data *data, int x, int y, int width, int height, bool disabled)
     props = gm_context_get_ui_properties(data->ctx);
     draw_properties(props);
 
+    ImGui::Spacing();
+    ImGui::Separator();
+    ImGui::TextDisabled("Memory pools...");
+    ImGui::Separator();
+    ImGui::Spacing();
+
+    mem_pool_foreach_pool(draw_pool_stats_cb, NULL);
+
     ImGui::Spacing();
     ImGui::Separator();
 
@@ -573,6 +656,23 @@ draw_controls(Data *data, int x, int y, int width, int height, bool disabled)
         free(json);
     }
 
+    ImGui::SameLine();
+    if (ImGui::Button("Save trace")) {
+        const char *assets_root = gm_get_assets_root();
+        char filename[512];
+
+        if (snprintf(filename, sizeof(filename), "%s/%s",
+                     assets_root, "glimpse-trace.json") <
+            (int)sizeof(filename))
+        {
+            if (ProfileExportTrace(filename)) {
+                gm_debug(data->log, "Wrote %s", filename);
+            } else {
+                gm_error(data->log, "Error saving trace: %s", strerror(errno));
+            }
+        }
+    }
+
     if (disabled) {
         ImGui::PopItemFlag();
     }
@@ -632,7 +732,21 @@ draw_playback_controls(Data *data, const ImVec4 &bounds)
                                                 data->recording_device,
                                                 glimpse_recordings_path,
                                                 rel_path,
-                                                overwrite);
+                                                overwrite,
+                                                data->pack_recording ?
+                                                GM_RECORDING_FORMAT_PACK :
+                                                GM_RECORDING_FORMAT_DIRECTORY);
+            if (data->recording && data->compress_recorded_depth) {
+                char *compression_err = NULL;
+                if (!gm_recording_set_depth_compression(
+                        data->recording,
+                        GM_REC_COMPRESSION_DELTA_SNAPPY,
+                        &compression_err))
+                {
+                    gm_warn(data->log, "%s", compression_err);
+                    free(compression_err);
+                }
+            }
         }
     }
     ImGui::SameLine();
@@ -665,6 +779,8 @@ draw_playback_controls(Data *data, const ImVec4 &bounds)
             xsnprintf(full_path, sizeof(full_path), "%s/%s",
                       glimpse_recordings_path, rel_path);
             config.recording.path = full_path;
+            config.video_buffer_budget = data->video_buffer_budget;
+            config.depth_buffer_budget = data->depth_buffer_budget;
 
             char *open_err = NULL;
             data->playback_device = gm_device_open(data->log, &config, &open_err);
@@ -687,6 +803,14 @@ draw_playback_controls(Data *data, const ImVec4 &bounds)
 
     ImGui::Spacing();
 
+    if (data->recording) {
+        struct gm_recording_stats stats;
+        gm_recording_get_stats(data->recording, &stats);
+        ImGui::Text("Written: %d, queued: %d, dropped: %d",
+                    stats.n_written, stats.n_queued, stats.n_dropped);
+        ImGui::Spacing();
+    }
+
     if (data->recordings.size()) {
         ImGui::Combo("Recording Path",
                      &data->selected_playback_recording,
@@ -1237,11 +1361,85 @@ request_device_frame(Data *data, uint64_t buffers_mask)
     }
 }
 
+static void
+texture_stream_init(struct texture_stream *stream)
+{
+    glGenBuffers(ARRAY_LEN(stream->pbos), stream->pbos);
+    stream->next_pbo = 0;
+    stream->width = 0;
+    stream->height = 0;
+    stream->format = GL_NONE;
+}
+
+static void
+texture_stream_upload(struct texture_stream *stream,
+                      GLuint tex,
+                      int width,
+                      int height,
+                      GLenum format,
+                      int bytes_per_pixel,
+                      const void *pixels)
+{
+    glBindTexture(GL_TEXTURE_2D, tex);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+
+    if (width != stream->width ||
+        height != stream->height ||
+        format != stream->format)
+    {
+        /* NB: gles2 only allows npot textures with clamp to edge
+         * coordinate wrapping
+         */
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexImage2D(GL_TEXTURE_2D, 0, format,
+                     width, height,
+                     0, format, GL_UNSIGNED_BYTE, NULL);
+
+        stream->width = width;
+        stream->height = height;
+        stream->format = format;
+    }
+
+    /* E.g. debug state that wasn't retained with the tracking */
+    size_t size = (size_t)width * height * bytes_per_pixel;
+    if (!pixels || !size)
+        return;
+
+    /* Alternate PBOs so we don't have to wait for the driver to finish
+     * reading the previous frame before writing the next. Re-specifying the
+     * buffer data also lets the driver orphan storage that's still in use.
+     */
+    GLuint pbo = stream->pbos[stream->next_pbo];
+    stream->next_pbo = (stream->next_pbo + 1) % ARRAY_LEN(stream->pbos);
+
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo);
+    glBufferData(GL_PIXEL_UNPACK_BUFFER, size, NULL, GL_STREAM_DRAW);
+    void *dst = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size,
+                                 GL_MAP_WRITE_BIT |
+                                 GL_MAP_INVALIDATE_BUFFER_BIT);
+    if (dst) {
+        memcpy(dst, pixels, size);
+        if (glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER)) {
+            glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height,
+                            format, GL_UNSIGNED_BYTE, 0);
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+            return;
+        }
+    }
+
+    /* Fall back to a synchronous upload if the buffer couldn't be mapped
+     * (or its contents were lost while mapped)
+     */
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height,
+                    format, GL_UNSIGNED_BYTE, pixels);
+}
+
 static void
 handle_device_frame_updates(Data *data)
 {
     ProfileScopedSection(UpdatingDeviceFrame);
-    bool upload = false;
 
     if (!data->device_frame_ready)
         return;
@@ -1253,7 +1451,6 @@ handle_device_frame_updates(Data *data)
         if (!device_frame) {
             return;
         }
-        upload = true;
 
         if (device_frame->depth) {
             if (data->last_depth_frame) {
@@ -1330,7 +1527,9 @@ handle_device_frame_updates(Data *data)
                              GM_REQUEST_FRAME_VIDEO);
     }
 
-    if (upload && data->last_video_frame) {
+    if (data->last_video_frame &&
+        data->last_video_frame->video != data->uploaded_video_buf)
+    {
         const struct gm_intrinsics *video_intrinsics =
             gm_device_get_video_intrinsics(data->active_device);
         int video_width = video_intrinsics->width;
@@ -1341,36 +1540,27 @@ handle_device_frame_updates(Data *data)
         /*
          * Update video from camera
          */
-        glBindTexture(GL_TEXTURE_2D, gl_vid_tex);
-
-        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
-        /* NB: gles2 only allows npot textures with clamp to edge
-         * coordinate wrapping
-         */
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-
         void *video_front = data->last_video_frame->video->data;
         enum gm_format video_format = data->last_video_frame->video_format;
 
         switch (video_format) {
         case GM_FORMAT_LUMINANCE_U8:
-            glTexImage2D(GL_TEXTURE_2D, 0, GL_LUMINANCE,
-                         video_width, video_height,
-                         0, GL_LUMINANCE, GL_UNSIGNED_BYTE, video_front);
+            texture_stream_upload(&vid_stream, gl_vid_tex,
+                                  video_width, video_height,
+                                  GL_LUMINANCE, 1, video_front);
             break;
 
         case GM_FORMAT_RGB_U8:
-            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB,
-                         video_width, video_height,
-                         0, GL_RGB, GL_UNSIGNED_BYTE, video_front);
+            texture_stream_upload(&vid_stream, gl_vid_tex,
+                                  video_width, video_height,
+                                  GL_RGB, 3, video_front);
             break;
 
         case GM_FORMAT_RGBX_U8:
         case GM_FORMAT_RGBA_U8:
-            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA,
-                         video_width, video_height,
-                         0, GL_RGBA, GL_UNSIGNED_BYTE, video_front);
+            texture_stream_upload(&vid_stream, gl_vid_tex,
+                                  video_width, video_height,
+                                  GL_RGBA, 4, video_front);
             break;
 
         case GM_FORMAT_UNKNOWN:
@@ -1381,6 +1571,11 @@ handle_device_frame_updates(Data *data)
             gm_assert(data->log, 0, "Unexpected format for video buffer");
             break;
         }
+
+        if (data->uploaded_video_buf)
+            gm_buffer_unref(data->uploaded_video_buf);
+        data->uploaded_video_buf =
+            gm_buffer_ref(data->last_video_frame->video);
     }
 }
 
@@ -1392,23 +1587,14 @@ upload_tracking_textures(Data *data)
     /*
      * Update the RGB visualization of the depth buffer
      */
-    glBindTexture(GL_TEXTURE_2D, gl_depth_rgb_tex);
-
-    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
-    /* NB: gles2 only allows npot textures with clamp to edge
-     * coordinate wrapping
-     */
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-
     uint8_t *depth_rgb = NULL;
     gm_tracking_create_rgb_depth(data->latest_tracking,
                                  &data->depth_rgb_width,
                                  &data->depth_rgb_height,
                                  &depth_rgb);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB,
-                 data->depth_rgb_width, data->depth_rgb_height,
-                 0, GL_RGB, GL_UNSIGNED_BYTE, depth_rgb);
+    texture_stream_upload(&depth_rgb_stream, gl_depth_rgb_tex,
+                          data->depth_rgb_width, data->depth_rgb_height,
+                          GL_RGB, 3, depth_rgb);
     free(depth_rgb);
 
     /* Update depth buffer and colour buffer */
@@ -1419,89 +1605,60 @@ upload_tracking_textures(Data *data)
                  depth, GL_DYNAMIC_DRAW);
     glBindBuffer(GL_ARRAY_BUFFER, 0);
 
-    glBindTexture(GL_TEXTURE_2D, gl_db_vid_tex);
-    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-
     uint8_t *video_rgb = NULL;
     gm_tracking_create_rgb_video(data->latest_tracking,
                                  &data->video_rgb_width,
                                  &data->video_rgb_height,
                                  &video_rgb);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB,
-                 data->video_rgb_width, data->video_rgb_height,
-                 0, GL_RGB, GL_UNSIGNED_BYTE, video_rgb);
+    texture_stream_upload(&db_vid_stream, gl_db_vid_tex,
+                          data->video_rgb_width, data->video_rgb_height,
+                          GL_RGB, 3, video_rgb);
     free(video_rgb);
 
     /* Update normals buffer */
-    glBindTexture(GL_TEXTURE_2D, gl_normals_rgb_tex);
-    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-
     uint8_t *normals_rgb = NULL;
     gm_tracking_create_rgb_normals(data->latest_tracking,
                                    &data->normals_rgb_width,
                                    &data->normals_rgb_height,
                                    &normals_rgb);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB,
-                 data->normals_rgb_width, data->normals_rgb_height,
-                 0, GL_RGB, GL_UNSIGNED_BYTE, normals_rgb);
+    texture_stream_upload(&normals_rgb_stream, gl_normals_rgb_tex,
+                          data->normals_rgb_width, data->normals_rgb_height,
+                          GL_RGB, 3, normals_rgb);
     free(normals_rgb);
 
     /* Update normal clusters buffer */
-    glBindTexture(GL_TEXTURE_2D, gl_nclusters_rgb_tex);
-    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-
     uint8_t *nclusters_rgb = NULL;
     gm_tracking_create_rgb_normal_clusters(data->latest_tracking,
                                            &data->nclusters_rgb_width,
                                            &data->nclusters_rgb_height,
                                            &nclusters_rgb);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB,
-                 data->nclusters_rgb_width, data->nclusters_rgb_height,
-                 0, GL_RGB, GL_UNSIGNED_BYTE, nclusters_rgb);
+    texture_stream_upload(&nclusters_rgb_stream, gl_nclusters_rgb_tex,
+                          data->nclusters_rgb_width, data->nclusters_rgb_height,
+                          GL_RGB, 3, nclusters_rgb);
     free(nclusters_rgb);
 
     /* Update candidate clusters buffer */
-    glBindTexture(GL_TEXTURE_2D, gl_cclusters_rgb_tex);
-    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-
     uint8_t *cclusters_rgb = NULL;
     gm_tracking_create_rgb_candidate_clusters(data->latest_tracking,
                                               &data->cclusters_rgb_width,
                                               &data->cclusters_rgb_height,
                                               &cclusters_rgb);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB,
-                 data->cclusters_rgb_width, data->cclusters_rgb_height,
-                 0, GL_RGB, GL_UNSIGNED_BYTE, cclusters_rgb);
+    texture_stream_upload(&cclusters_rgb_stream, gl_cclusters_rgb_tex,
+                          data->cclusters_rgb_width, data->cclusters_rgb_height,
+                          GL_RGB, 3, cclusters_rgb);
     free(cclusters_rgb);
 
     /*
      * Update inferred label map
      */
-    glBindTexture(GL_TEXTURE_2D, gl_labels_tex);
-
-    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
-    /* NB: gles2 only allows npot textures with clamp to edge
-     * coordinate wrapping
-     */
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-
     uint8_t *labels_rgb = NULL;
     gm_tracking_create_rgb_label_map(data->latest_tracking,
                                      &data->labels_rgb_width,
                                      &data->labels_rgb_height,
                                      &labels_rgb);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB,
-                 data->labels_rgb_width, data->labels_rgb_height,
-                 0, GL_RGB, GL_UNSIGNED_BYTE, labels_rgb);
+    texture_stream_upload(&labels_stream, gl_labels_tex,
+                          data->labels_rgb_width, data->labels_rgb_height,
+                          GL_RGB, 3, labels_rgb);
     free(labels_rgb);
 }
 
@@ -2081,6 +2238,14 @@ init_viewer_opengl(Data *data)
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 
+    texture_stream_init(&depth_rgb_stream);
+    texture_stream_init(&vid_stream);
+    texture_stream_init(&normals_rgb_stream);
+    texture_stream_init(&nclusters_rgb_stream);
+    texture_stream_init(&cclusters_rgb_stream);
+    texture_stream_init(&labels_stream);
+    texture_stream_init(&db_vid_stream);
+
     glGenTextures(1, &gl_cloud_tex);
     glBindTexture(GL_TEXTURE_2D, gl_cloud_tex);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
@@ -2326,6 +2491,17 @@ viewer_init(Data *data)
         data->requested_recording_len = strtoull(n_frames_env, NULL, 10);
     }
 
+    const char *video_budget_env = getenv("GLIMPSE_VIDEO_BUFFER_BUDGET_MB");
+    if (video_budget_env) {
+        data->video_buffer_budget =
+            (size_t)(strtod(video_budget_env, NULL) * 1024 * 1024);
+    }
+    const char *depth_budget_env = getenv("GLIMPSE_DEPTH_BUFFER_BUDGET_MB");
+    if (depth_budget_env) {
+        data->depth_buffer_budget =
+            (size_t)(strtod(depth_budget_env, NULL) * 1024 * 1024);
+    }
+
     // TODO: Might be nice to be able to retrieve this information via the API
     //       rather than reading it separately here.
     struct gm_asset *joint_map_asset = gm_asset_open(data->log,
@@ -2357,6 +2533,12 @@ viewer_init(Data *data)
 
     gm_context_set_event_callback(data->ctx, on_event_cb, data);
 
+    /* We visualize all of the intermediate tracking state */
+    gm_context_set_debug_retention(data->ctx,
+                                   GM_TRACKING_RETAIN_LABEL_PROBS |
+                                   GM_TRACKING_RETAIN_NORMALS |
+                                   GM_TRACKING_RETAIN_CLUSTERS);
+
     struct gm_asset *config_asset =
         gm_asset_open(data->log,
                       "glimpse-config.json", GM_ASSET_MODE_BUFFER, &open_err);
@@ -2375,6 +2557,8 @@ viewer_init(Data *data)
 #else
     config.type = GM_DEVICE_KINECT;
 #endif
+    config.video_buffer_budget = data->video_buffer_budget;
+    config.depth_buffer_budget = data->depth_buffer_budget;
     data->recording_device = gm_device_open(data->log, &config, NULL);
     data->active_device = data->recording_device;
     gm_device_set_event_callback(data->recording_device, on_device_event_cb, data);
@@ -2383,6 +2567,8 @@ viewer_init(Data *data)
 #endif
     gm_device_commit_config(data->recording_device, NULL);
 
+    data->pack_recording = true;
+
     data->initialized = true;
 }
 
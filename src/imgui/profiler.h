@@ -1,5 +1,9 @@
 #pragma once
 
+#include <atomic>
+#include <mutex>
+#include <vector>
+
 #include "timer.h"
 
 #define ProfileInitialize(isPaused, commandHandler) ImGuiControl::globalInstance.Initialize(isPaused, commandHandler)
@@ -10,6 +14,19 @@
 #define ProfileInitThread()     ImGuiControl::globalInstance.InitThreadInternal()
 #define ProfileFinishThread()   ImGuiControl::globalInstance.FinishThreadInternal()
 
+// Threads are registered automatically when they first push a section and
+// are named after their pthread name unless named explicitly
+#define ProfileSetThreadName(name)  ImGuiControl::globalInstance.SetThreadNameInternal(name)
+
+// Captures every section (not just the most recent MaxSections per thread)
+// until the trace is stopped and written as Chrome trace-event JSON, which
+// can be loaded into Perfetto or chrome://tracing
+#define ProfileStartTrace()         ImGuiControl::globalInstance.StartTraceInternal()
+#define ProfileStopTrace(filename)  ImGuiControl::globalInstance.StopTraceInternal(filename)
+
+// Writes the currently buffered sections as Chrome trace-event JSON
+#define ProfileExportTrace(filename) ImGuiControl::globalInstance.ExportTraceInternal(filename)
+
 #define ProfilePushSection_1(x)     ImGuiControl::globalInstance.PushSectionInternal( #x, 0x00000000, __FILE__, __LINE__ )
 #define ProfilePushSection_2(x,y)   ImGuiControl::globalInstance.PushSectionInternal( #x, y, __FILE__, __LINE__ )
 #define ProfilePushSection_X(x,y,z,...) z
@@ -19,7 +36,7 @@
 #define ProfilePushSection_MACRO_CHOOSER(...) ProfilePushSection_CHOOSE_FROM_ARG_COUNT(__VA_ARGS__ ())
 #define ProfilePushSection(...) ProfilePushSection_MACRO_CHOOSER(__VA_ARGS__)(__VA_ARGS__)
 
-#define ProfilePopSection() gProf.PopSectionInternal()
+#define ProfilePopSection() ImGuiControl::globalInstance.PopSectionInternal()
 
 #define ProfileScopedSection_1(x)   ImGuiControl::ProfileScope S##x__LINE__( #x, 0x00000000, __FILE__, __LINE__ )
 #define ProfileScopedSection_2(x,y) ImGuiControl::ProfileScope S##x__LINE__( #x, y, __FILE__, __LINE__ )
@@ -39,7 +56,6 @@ namespace ImGuiControl
     class Profiler
     {
     public:
-        static const int MaxThreads   = 4;
         static const int MaxFrames    = 600;
         static const int MaxSections  = 2000;
 
@@ -53,14 +69,21 @@ namespace ImGuiControl
             Dark        = 0xFF222222,
         };
 
+        ~Profiler();
+
         void Initialize(bool* isPaused, void (*setPause)(bool));
         void Shutdown();
         void NewFrame();
         void InitThreadInternal();
         void FinishThreadInternal();
+        void SetThreadNameInternal(const char* name);
         void PushSectionInternal(const char* sectionName, unsigned int color, const char* fileName, int line);
         void PopSectionInternal();
 
+        void StartTraceInternal();
+        bool StopTraceInternal(const char* filename);
+        bool ExportTraceInternal(const char* filename);
+
         void DrawUI();
         inline void LockCriticalSection2() {}
         inline void UnLockCriticalSection2() {}
@@ -87,22 +110,51 @@ namespace ImGuiControl
             double      endTime;
         };
 
+        struct TraceEvent
+        {
+            const char*     name;
+            int             threadId;
+            double          startTime;
+            double          endTime;
+        };
+
         struct Thread
         {
             bool        initialized;
+            int         id;
+            char        name[32];
             int         callStackDepth;
             int         sectionsCount;
             int         sectionIndex;
             Section     sections[MaxSections];
             int         activeSectionIndex;
+
+            // Completed sections while tracing, guarded by traceLock since
+            // they're written out from another thread
+            std::mutex              traceLock;
+            std::vector<TraceEvent> trace;
+        };
+
+        struct ThreadName
+        {
+            int         id;
+            char        name[32];
         };
 
         Timer       m_timer;
         Frame       m_frames[MaxFrames];
         int         m_frameCount;
         int         m_frameIndex;
-        Thread      m_threads[MaxThreads];
-        int         m_threadIndex;
+
+        // Thread slots are allocated on demand and reused once a thread
+        // finishes. They're never freed so the UI can safely walk a
+        // snapshot of the list without holding m_threadsLock.
+        std::mutex              m_threadsLock;
+        std::vector<Thread*>    m_threads;
+        std::vector<ThreadName> m_threadNames;
+        int                     m_nextThreadId;
+        std::atomic<bool>       m_tracing;
+
         bool*       m_isPausedPtr;
         void        (*m_setPause)(bool);
 
@@ -115,7 +167,11 @@ namespace ImGuiControl
         int         m_frameSelectionEnd;
         double      m_sectionAreaDurationWhenZoomStarted;
 
+        std::vector<Thread*> GetThreads();
+
     private:
+        Thread* GetThread();
+        bool WriteTrace(const char* filename, const std::vector<TraceEvent>& events);
         void RefreshFrameSelection(double recordsMaxTime);
     };
 
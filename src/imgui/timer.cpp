@@ -35,11 +35,11 @@ double Timer::GetTime() const
     return counter;
 }
 
-float Timer::GetMilliseconds() const
+double Timer::GetMilliseconds() const
 {
     double counter;
     QueryPerformanceCounter((LARGE_INTEGER*)&counter);
-	float ms = (float)(1000.0f * (counter - m_start) / s_frequency);
+	double ms = 1000.0 * (counter - m_start) / s_frequency;
     return ms;
 }
 
@@ -61,7 +61,7 @@ void Timer::Reset()
     m_start = ((uint64_t)ts.tv_sec) * 1000000000ULL + (uint64_t)ts.tv_nsec;
 }
 
-float Timer::GetMilliseconds() const
+double Timer::GetMilliseconds() const
 {
     struct timespec ts;
     clock_gettime(CLOCK_MONOTONIC, &ts);
@@ -69,7 +69,7 @@ float Timer::GetMilliseconds() const
     uint64_t end = ((uint64_t)ts.tv_sec) * 1000000000ULL + (uint64_t)ts.tv_nsec;
     uint64_t duration = end - m_start;
 
-    return duration / 1000000.0f;
+    return duration / 1000000.0;
 }
 
 #elif defined (__APPLE__)
@@ -89,11 +89,11 @@ void Timer::Reset()
     m_start_usec = t.tv_usec;
 }
 
-float Timer::GetMilliseconds() const
+double Timer::GetMilliseconds() const
 {
     timeval t;
     gettimeofday(&t, 0);
-    return 1000.0f * (t.tv_sec - m_start_sec) + 0.001f * (t.tv_usec - m_start_usec);
+    return 1000.0 * (t.tv_sec - m_start_sec) + 0.001 * (t.tv_usec - m_start_usec);
 }
 
 #else
@@ -106,9 +106,9 @@ void Timer::Reset()
 {
 }
 
-float Timer::GetMilliseconds() const
+double Timer::GetMilliseconds() const
 {
-	return 0.0f;
+	return 0.0;
 }
 
 #endif
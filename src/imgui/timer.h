@@ -12,7 +12,7 @@ namespace ImGuiControl
         Timer();
         void Reset();
         double GetTime() const;
-        float GetMilliseconds() const;
+        double GetMilliseconds() const;
 
     private:
 #if defined(_WIN32)
@@ -61,7 +61,8 @@ typedef struct {
 template<typename FloatT>
 float*
 infer_labels(RDTree** forest, uint8_t n_trees, FloatT* depth_image,
-             uint32_t width, uint32_t height, float* out_labels)
+             uint32_t width, uint32_t height, float* out_labels,
+             uint32_t stride)
 {
   uint8_t n_labels = forest[0]->header.n_labels;
 
@@ -70,10 +71,13 @@ infer_labels(RDTree** forest, uint8_t n_trees, FloatT* depth_image,
   float* output_pr = out_labels ? out_labels : (float*)xmalloc(output_size);
   memset(output_pr, 0, output_size);
 
+  if (stride < 1)
+    stride = 1;
+
   // Accumulate probability map
-  for (uint32_t y = 0; y < height; y++)
+  for (uint32_t y = 0; y < height; y += stride)
     {
-      for (uint32_t x = 0; x < width; x++)
+      for (uint32_t x = 0; x < width; x += stride)
         {
           float* out_pr_table = &output_pr[(y * width * n_labels) +
                                            (x * n_labels)];
@@ -128,13 +132,42 @@ infer_labels(RDTree** forest, uint8_t n_trees, FloatT* depth_image,
         }
     }
 
+  // Share the sampled probabilities with the skipped neighbouring pixels
+  if (stride > 1)
+    {
+      for (uint32_t y = 0; y < height; y++)
+        {
+          for (uint32_t x = 0; x < width; x++)
+            {
+              uint32_t sx = x - (x % stride);
+              uint32_t sy = y - (y % stride);
+              if (sx == x && sy == y)
+                continue;
+
+              float* out_pr_table = &output_pr[(y * width * n_labels) +
+                                               (x * n_labels)];
+              if ((float)depth_image[y * width + x] >= HUGE_DEPTH)
+                {
+                  out_pr_table[forest[0]->header.bg_label] = 1.0f;
+                  continue;
+                }
+
+              memcpy(out_pr_table,
+                     &output_pr[(sy * width * n_labels) + (sx * n_labels)],
+                     n_labels * sizeof(float));
+            }
+        }
+    }
+
   return output_pr;
 }
 
 template float*
-infer_labels<half>(RDTree**, uint8_t, half*, uint32_t, uint32_t, float*);
+infer_labels<half>(RDTree**, uint8_t, half*, uint32_t, uint32_t, float*,
+                   uint32_t);
 template float*
-infer_labels<float>(RDTree**, uint8_t, float*, uint32_t, uint32_t, float*);
+infer_labels<float>(RDTree**, uint8_t, float*, uint32_t, uint32_t, float*,
+                    uint32_t);
 
 /* We don't want to be making lots of function calls or dereferencing
  * lots of pointers while accessing the joint map within inner loops
@@ -44,13 +44,18 @@ typedef struct {
   LList** joints;
 } InferredJoints;
 
+/* With a stride > 1 the forest is only evaluated for every stride'th pixel
+ * in each direction and the result is shared with the neighbouring pixels
+ * (background pixels are still labelled individually).
+ */
 template<typename FloatT>
 float* infer_labels(RDTree** forest,
                     uint8_t n_trees,
                     FloatT* depth_image,
                     uint32_t width,
                     uint32_t height,
-                    float* out_labels = NULL);
+                    float* out_labels = NULL,
+                    uint32_t stride = 1);
 
 template<typename FloatT>
 float* calc_pixel_weights(FloatT* depth_image,
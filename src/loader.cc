@@ -88,27 +88,99 @@ save_tree_close:
   return success;
 }
 
-static JSON_Value*
-recursive_build_tree(RDTree* tree, Node* node, int depth, int id)
+/* NB: The JSON trees are written and parsed incrementally, without building
+ * a document tree with parson, since a complete tree of depth 20 would need
+ * millions of JSON values and many gigabytes of memory.
+ */
+
+static void
+write_json_indent(FILE* fp, bool pretty, int level)
 {
-  JSON_Value* json_node_val = json_value_init_object();
-  JSON_Object* json_node = json_object(json_node_val);
+  if (pretty)
+    {
+      fputc('\n', fp);
+      for (int i = 0; i < level; i++)
+        {
+          fputs("    ", fp);
+        }
+    }
+}
 
-  if (node->label_pr_idx == 0)
+static void
+write_json_key(FILE* fp, bool pretty, int level, const char* key)
+{
+  write_json_indent(fp, pretty, level);
+  fprintf(fp, pretty ? "\"%s\": " : "\"%s\":", key);
+}
+
+/* NB: Nine significant digits are enough to round-trip any float. JSON has
+ * no representation for nan or inf so those are rejected.
+ */
+static bool
+write_json_float(FILE* fp, float value)
+{
+  if (!std::isfinite(value))
     {
-      json_object_set_number(json_node, "t", node->t);
+      return false;
+    }
+  fprintf(fp, "%.9g", value);
+  return true;
+}
 
-      JSON_Value* u_val = json_value_init_array();
-      JSON_Array* u = json_array(u_val);
-      json_array_append_number(u, node->uv[0]);
-      json_array_append_number(u, node->uv[1]);
-      json_object_set_value(json_node, "u", u_val);
+static bool
+write_json_floats(FILE* fp, bool pretty, int level, float* values, int n)
+{
+  fputc('[', fp);
+  for (int i = 0; i < n; i++)
+    {
+      if (i)
+        {
+          fputc(',', fp);
+        }
+      write_json_indent(fp, pretty, level + 1);
+      if (!write_json_float(fp, values[i]))
+        {
+          return false;
+        }
+    }
+  write_json_indent(fp, pretty, level);
+  fputc(']', fp);
+  return true;
+}
 
-      JSON_Value* v_val = json_value_init_array();
-      JSON_Array* v = json_array(v_val);
-      json_array_append_number(v, node->uv[2]);
-      json_array_append_number(v, node->uv[3]);
-      json_object_set_value(json_node, "v", v_val);
+static bool
+write_json_node(FILE* fp, bool pretty, RDTree* tree, int depth, int id)
+{
+  Node* node = &tree->nodes[id];
+  int level = depth + 1;
+
+  fputc('{', fp);
+
+  if (node->label_pr_idx == 0)
+    {
+      float u[2] = { node->uv[0], node->uv[1] };
+      float v[2] = { node->uv[2], node->uv[3] };
+
+      write_json_key(fp, pretty, level + 1, "t");
+      if (!write_json_float(fp, node->t))
+        {
+          fprintf(stderr, "Node %d has a non-finite threshold\n", id);
+          return false;
+        }
+      fputc(',', fp);
+      write_json_key(fp, pretty, level + 1, "u");
+      if (!write_json_floats(fp, pretty, level + 1, u, 2))
+        {
+          fprintf(stderr, "Node %d has a non-finite u offset\n", id);
+          return false;
+        }
+      fputc(',', fp);
+      write_json_key(fp, pretty, level + 1, "v");
+      if (!write_json_floats(fp, pretty, level + 1, v, 2))
+        {
+          fprintf(stderr, "Node %d has a non-finite v offset\n", id);
+          return false;
+        }
 
       if (depth < (tree->header.depth - 1))
         {
@@ -120,116 +192,454 @@ recursive_build_tree(RDTree* tree, Node* node, int depth, int id)
            * ('id' here) then 2 * id + 1 is the index for the left child and
            * 2 * id + 2 is the index for the right child...
            */
-          int left_id = id * 2 + 1;
-          Node* left_node = tree->nodes + left_id;
-          int right_id = id * 2 + 2;
-          Node* right_node = tree->nodes + right_id;
-
-          JSON_Value* left_json = recursive_build_tree(tree, left_node,
-                                                       depth + 1, left_id);
-          json_object_set_value(json_node, "l", left_json);
-          JSON_Value* right_json = recursive_build_tree(tree, right_node,
-                                                        depth + 1, right_id);
-          json_object_set_value(json_node, "r", right_json);
+          fputc(',', fp);
+          write_json_key(fp, pretty, level + 1, "l");
+          if (!write_json_node(fp, pretty, tree, depth + 1, id * 2 + 1))
+            {
+              return false;
+            }
+          fputc(',', fp);
+          write_json_key(fp, pretty, level + 1, "r");
+          if (!write_json_node(fp, pretty, tree, depth + 1, id * 2 + 2))
+            {
+              return false;
+            }
         }
     }
   else
     {
-      JSON_Value* probs_val = json_value_init_array();
-      JSON_Array* probs = json_array(probs_val);
-
       /* NB: node->label_pr_idx is a base-one index since index zero is
        * reserved to indicate that the node is not a leaf node
        */
       float* pr_table = &tree->label_pr_tables[(node->label_pr_idx - 1) *
                                                tree->header.n_labels];
 
-      for (int i = 0; i < tree->header.n_labels; i++)
+      write_json_key(fp, pretty, level + 1, "p");
+      if (!write_json_floats(fp, pretty, level + 1, pr_table,
+                             tree->header.n_labels))
         {
-          json_array_append_number(probs, pr_table[i]);
+          fprintf(stderr, "Leaf node %d has a non-finite probability\n", id);
+          return false;
         }
-
-      json_object_set_value(json_node, "p", probs_val);
     }
 
-  return json_node_val;
+  write_json_indent(fp, pretty, level);
+  fputc('}', fp);
+  return true;
 }
 
 bool
 save_tree_json(RDTree* tree, const char* filename, bool pretty)
 {
-  JSON_Value *root = json_value_init_object();
+  FILE* output;
+  if (!(output = fopen(filename, "w")))
+    {
+      fprintf(stderr, "Failed to open output file '%s'\n", filename);
+      return false;
+    }
+
+  bool success = true;
+
+  fputc('{', output);
+  write_json_key(output, pretty, 1, "_rdt_version_was");
+  fprintf(output, "%u,", (uint32_t)tree->header.version);
+  write_json_key(output, pretty, 1, "depth");
+  fprintf(output, "%u,", (uint32_t)tree->header.depth);
+  write_json_key(output, pretty, 1, "vertical_fov");
+  if (!write_json_float(output, tree->header.fov))
+    {
+      fprintf(stderr, "Tree has a non-finite field of view\n");
+      success = false;
+    }
+  else
+    {
+      fputc(',', output);
+      write_json_key(output, pretty, 1, "n_labels");
+      fprintf(output, "%u,", (uint32_t)tree->header.n_labels);
+      write_json_key(output, pretty, 1, "bg_label");
+      fprintf(output, "%u,", (uint32_t)tree->header.bg_label);
+      write_json_key(output, pretty, 1, "root");
+      success = write_json_node(output, pretty, tree, 0, 0);
+      write_json_indent(output, pretty, 0);
+      fputc('}', output);
+    }
+
+  if (ferror(output))
+    {
+      fprintf(stderr, "Failed to serialize output to JSON\n");
+      success = false;
+    }
+  if (fclose(output) != 0)
+    {
+      fprintf(stderr, "Error closing output file\n");
+      success = false;
+    }
+
+  // Don't leave a truncated or invalid tree behind
+  if (!success)
+    {
+      fprintf(stderr, "Failed to save tree to '%s'\n", filename);
+      unlink(filename);
+    }
+
+  return success;
+}
+
+typedef struct {
+  const char* start;
+  const char* pos;
+  const char* end;
+} JSONReader;
+
+static bool
+json_reader_error(JSONReader* reader, const char* message)
+{
+  fprintf(stderr, "Failed to parse JSON tree at offset %ld: %s\n",
+          (long)(reader->pos - reader->start), message);
+  return false;
+}
 
-  json_object_set_number(json_object(root), "_rdt_version_was", tree->header.version);
-  json_object_set_number(json_object(root), "depth", tree->header.depth);
-  json_object_set_number(json_object(root), "vertical_fov", tree->header.fov);
-  json_object_set_number(json_object(root), "n_labels", tree->header.n_labels);
-  json_object_set_number(json_object(root), "bg_label", tree->header.bg_label);
+static void
+json_skip_space(JSONReader* reader)
+{
+  while (reader->pos < reader->end &&
+         (*reader->pos == ' ' || *reader->pos == '\t' ||
+          *reader->pos == '\n' || *reader->pos == '\r'))
+    {
+      reader->pos++;
+    }
+}
 
-  JSON_Value *nodes = recursive_build_tree(tree, tree->nodes, 0, 0);
+/* Returns the next non-whitespace character without consuming it, or '\0'
+ * at the end of the buffer.
+ */
+static char
+json_peek(JSONReader* reader)
+{
+  json_skip_space(reader);
+  return (reader->pos < reader->end) ? *reader->pos : '\0';
+}
 
-  json_object_set_value(json_object(root), "root", nodes);
+static bool
+json_expect(JSONReader* reader, char c)
+{
+  if (json_peek(reader) != c)
+    {
+      char message[32];
+      snprintf(message, sizeof(message), "Expected '%c'", c);
+      return json_reader_error(reader, message);
+    }
+  reader->pos++;
+  return true;
+}
 
-  JSON_Status status = pretty ?
-    json_serialize_to_file_pretty(root, filename) :
-    json_serialize_to_file(root, filename);
+/* Reads a string into 'out', truncating it if necessary. Escape sequences
+ * are kept as-is since the keys of the tree format never need them.
+ */
+static bool
+json_read_string(JSONReader* reader, char* out, size_t out_len)
+{
+  if (!json_expect(reader, '"'))
+    {
+      return false;
+    }
 
-  if (status != JSONSuccess)
+  size_t len = 0;
+  while (reader->pos < reader->end && *reader->pos != '"')
+    {
+      if (*reader->pos == '\\' && reader->pos + 1 < reader->end)
+        {
+          reader->pos++;
+        }
+      if (len < out_len - 1)
+        {
+          out[len++] = *reader->pos;
+        }
+      reader->pos++;
+    }
+  out[len] = '\0';
+
+  return json_expect(reader, '"');
+}
+
+static bool
+json_read_number(JSONReader* reader, double* out)
+{
+  char number[64];
+  size_t len = 0;
+
+  json_skip_space(reader);
+  while (reader->pos < reader->end && len < sizeof(number) - 1 &&
+         strchr("+-.0123456789eE", *reader->pos))
+    {
+      number[len++] = *reader->pos++;
+    }
+  number[len] = '\0';
+
+  char* end;
+  *out = strtod(number, &end);
+  if (len == 0 || *end != '\0')
+    {
+      return json_reader_error(reader, "Expected a number");
+    }
+
+  return true;
+}
+
+static bool
+json_read_floats(JSONReader* reader, float* out, int n)
+{
+  if (!json_expect(reader, '['))
     {
-      fprintf(stderr, "Failed to serialize output to JSON\n");
       return false;
     }
 
+  for (int i = 0; i < n; i++)
+    {
+      double value;
+      if ((i && !json_expect(reader, ',')) ||
+          !json_read_number(reader, &value))
+        {
+          return false;
+        }
+      out[i] = (float)value;
+    }
+
+  return json_expect(reader, ']');
+}
+
+/* Skips over any value, keeping track of nesting without recursion */
+static bool
+json_skip_value(JSONReader* reader)
+{
+  int nesting = 0;
+
+  json_skip_space(reader);
+  do
+    {
+      if (reader->pos >= reader->end)
+        {
+          return json_reader_error(reader, "Unexpected end of data");
+        }
+
+      switch (*reader->pos)
+        {
+        case '{':
+        case '[':
+          nesting++;
+          reader->pos++;
+          break;
+        case '}':
+        case ']':
+          if (--nesting < 0)
+            {
+              return json_reader_error(reader, "Unexpected end of value");
+            }
+          reader->pos++;
+          break;
+        case '"':
+          {
+            char ignored[2];
+            if (!json_read_string(reader, ignored, sizeof(ignored)))
+              {
+                return false;
+              }
+            break;
+          }
+        default:
+          // Numbers, literals or separators between nested values
+          reader->pos++;
+          while (reader->pos < reader->end &&
+                 !strchr(",:{}[]\" \t\n\r", *reader->pos))
+            {
+              reader->pos++;
+            }
+          break;
+        }
+      json_skip_space(reader);
+    }
+  while (nesting > 0);
+
   return true;
 }
 
-static int
-count_pr_tables(JSON_Object* node)
+/* Calls 'member_cb' for each member of an object, with the reader positioned
+ * at the member's value, which the callback must consume.
+ */
+static bool
+json_read_object(JSONReader* reader,
+                 bool (*member_cb)(JSONReader* reader, const char* key,
+                                   void* user_data),
+                 void* user_data)
 {
-  if (json_object_has_value(node, "p"))
+  if (!json_expect(reader, '{'))
     {
-      return 1;
+      return false;
+    }
+  if (json_peek(reader) == '}')
+    {
+      reader->pos++;
+      return true;
+    }
+
+  for (;;)
+    {
+      char key[32];
+      if (!json_read_string(reader, key, sizeof(key)) ||
+          !json_expect(reader, ':') ||
+          !member_cb(reader, key, user_data))
+        {
+          return false;
+        }
+
+      if (json_peek(reader) != ',')
+        {
+          break;
+        }
+      reader->pos++;
     }
 
-  return count_pr_tables(json_object_get_object(node, "l")) +
-    count_pr_tables(json_object_get_object(node, "r"));
+  return json_expect(reader, '}');
 }
 
-static void
-unpack_json_tree(JSON_Object* jnode, Node* nodes, uint32_t node_index,
-                 float* pr_tables, uint32_t* table_index, uint8_t n_labels)
+typedef struct {
+  RDTree* tree;
+  uint32_t n_nodes;
+  uint32_t max_pr_tables;
+  int version;
+  const char* root;
+} JSONTreeState;
+
+typedef struct {
+  JSONTreeState* state;
+  uint32_t id;
+  bool has_children[2];
+} JSONNodeState;
+
+static bool
+json_tree_member_cb(JSONReader* reader, const char* key, void* user_data)
 {
-  Node* node = &nodes[node_index];
+  JSONTreeState* state = (JSONTreeState*)user_data;
+  RDTHeader* header = &state->tree->header;
+  double value;
 
-  if (json_object_has_value(jnode, "p"))
+  if (strcmp(key, "root") == 0)
     {
-      float* pr_table = &pr_tables[(*table_index) * n_labels];
+      // The root is parsed once all the header values are known
+      json_skip_space(reader);
+      state->root = reader->pos;
+      return json_skip_value(reader);
+    }
+
+  if (strcmp(key, "_rdt_version_was") != 0 &&
+      strcmp(key, "depth") != 0 &&
+      strcmp(key, "n_labels") != 0 &&
+      strcmp(key, "bg_label") != 0 &&
+      strcmp(key, "vertical_fov") != 0)
+    {
+      return json_skip_value(reader);
+    }
+
+  if (!json_read_number(reader, &value))
+    {
+      return false;
+    }
+
+  if (strcmp(key, "_rdt_version_was") == 0)
+    state->version = (int)value;
+  else if (strcmp(key, "depth") == 0)
+    header->depth = (uint8_t)value;
+  else if (strcmp(key, "n_labels") == 0)
+    header->n_labels = (uint8_t)value;
+  else if (strcmp(key, "bg_label") == 0)
+    header->bg_label = (uint8_t)value;
+  else
+    header->fov = (float)value;
+
+  return true;
+}
+
+static bool
+json_node_member_cb(JSONReader* reader, const char* key, void* user_data)
+{
+  JSONNodeState* node_state = (JSONNodeState*)user_data;
+  JSONTreeState* state = node_state->state;
+  RDTree* tree = state->tree;
+  Node* node = &tree->nodes[node_state->id];
 
-      JSON_Array* p = json_object_get_array(jnode, "p");
-      for (uint8_t i = 0; i < n_labels; i++)
+  if (strcmp(key, "t") == 0)
+    {
+      double t;
+      if (!json_read_number(reader, &t))
+        {
+          return false;
+        }
+      node->t = (float)t;
+      return true;
+    }
+  else if (strcmp(key, "u") == 0 || strcmp(key, "v") == 0)
+    {
+      float uv[2];
+      if (!json_read_floats(reader, uv, 2))
         {
-          pr_table[i] = (float)json_array_get_number(p, i);
+          return false;
+        }
+      int offset = (key[0] == 'u') ? 0 : 2;
+      node->uv[offset] = uv[0];
+      node->uv[offset + 1] = uv[1];
+      return true;
+    }
+  else if (strcmp(key, "p") == 0)
+    {
+      uint8_t n_labels = tree->header.n_labels;
+      if (tree->n_pr_tables == state->max_pr_tables)
+        {
+          state->max_pr_tables *= 2;
+          tree->label_pr_tables = (float*)
+            xrealloc(tree->label_pr_tables,
+                     state->max_pr_tables * n_labels * sizeof(float));
         }
 
-      // Write out probability table
-      node->label_pr_idx = ++(*table_index);
-      return;
+      float* pr_table = &tree->label_pr_tables[tree->n_pr_tables * n_labels];
+      if (!json_read_floats(reader, pr_table, n_labels))
+        {
+          return false;
+        }
+      node->label_pr_idx = ++tree->n_pr_tables;
+      return true;
     }
+  else if (strcmp(key, "l") == 0 || strcmp(key, "r") == 0)
+    {
+      int side = (key[0] == 'l') ? 0 : 1;
+      JSONNodeState child_state = {
+        state, node_state->id * 2 + 1 + side, { false, false }
+      };
+      if (child_state.id >= state->n_nodes)
+        {
+          return json_reader_error(reader, "Tree is deeper than its depth");
+        }
 
-  JSON_Array* u = json_object_get_array(jnode, "u");
-  JSON_Array* v = json_object_get_array(jnode, "v");
+      if (!json_read_object(reader, json_node_member_cb, &child_state))
+        {
+          return false;
+        }
+      Node* child = &tree->nodes[child_state.id];
+      if (child->label_pr_idx == UINT32_MAX)
+        {
+          if (!child_state.has_children[0] || !child_state.has_children[1])
+            {
+              return json_reader_error(reader,
+                                       "Node has neither children nor "
+                                       "label probabilities");
+            }
+          child->label_pr_idx = 0;
+        }
 
-  node->uv[0] = (float)json_array_get_number(u, 0);
-  node->uv[1] = (float)json_array_get_number(u, 1);
-  node->uv[2] = (float)json_array_get_number(v, 0);
-  node->uv[3] = (float)json_array_get_number(v, 1);
-  node->t = (float)json_object_get_number(jnode, "t");
-  node->label_pr_idx = 0;
+      node_state->has_children[side] = true;
+      return true;
+    }
 
-  unpack_json_tree(json_object_get_object(jnode, "l"), nodes,
-                   node_index * 2 + 1, pr_tables, table_index, n_labels);
-  unpack_json_tree(json_object_get_object(jnode, "r"), nodes,
-                   node_index * 2 + 2, pr_tables, table_index, n_labels);
+  return json_skip_value(reader);
 }
 
 RDTree*
@@ -237,64 +647,78 @@ load_json_tree(uint8_t* json_tree_buf, uint32_t len)
 {
   assert_rdt_abi();
 
-  JSON_Value* json_tree_value = json_parse_string((const char *)json_tree_buf);
-  if (!json_tree_value)
-    {
-      fprintf(stderr, "Failed to parse JSON string\n");
-      return NULL;
-    }
+  RDTree* tree = (RDTree*)xcalloc(1, sizeof(RDTree));
+  tree->header.tag[0] = 'R';
+  tree->header.tag[1] = 'D';
+  tree->header.tag[2] = 'T';
+  tree->header.version = RDT_VERSION;
+
+  JSONTreeState state = { tree, 0, 0, -1, NULL };
+  JSONReader reader = {
+    (const char*)json_tree_buf,
+    (const char*)json_tree_buf,
+    (const char*)json_tree_buf + len
+  };
 
-  JSON_Object* json_tree = json_value_get_object(json_tree_value);
-  if (!json_tree)
+  // Find the header values, skipping over the nodes
+  if (!json_read_object(&reader, json_tree_member_cb, &state))
     {
-      fprintf(stderr, "Failed to find top-level tree object\n");
-      json_value_free(json_tree_value);
+      free_tree(tree);
       return NULL;
     }
 
-  if ((int)json_object_get_number(json_tree, "_rdt_version_was") != RDT_VERSION)
+  if (state.version != RDT_VERSION)
     {
       fprintf(stderr, "Unexpected RDT version (expected %d)\n", RDT_VERSION);
-      json_value_free(json_tree_value);
+      free_tree(tree);
       return NULL;
     }
 
-  JSON_Object* root = json_object_get_object(json_tree, "root");
-  if (!root)
+  if (!state.root)
     {
       fprintf(stderr, "Failed to find tree root node\n");
-      json_value_free(json_tree_value);
+      free_tree(tree);
       return NULL;
     }
 
-  RDTree* tree = (RDTree*)xcalloc(1, sizeof(RDTree));
-  tree->header.tag[0] = 'R';
-  tree->header.tag[1] = 'D';
-  tree->header.tag[2] = 'T';
-  tree->header.version = RDT_VERSION;
-
-  tree->header.depth = (uint8_t)json_object_get_number(json_tree, "depth");
-  tree->header.n_labels = (uint8_t)json_object_get_number(json_tree, "n_labels");
-  tree->header.bg_label = (uint8_t)json_object_get_number(json_tree, "bg_label");
-  tree->header.fov = (float)json_object_get_number(json_tree, "vertical_fov");
+  if (tree->header.depth == 0 || tree->header.depth > 31 ||
+      tree->header.n_labels == 0)
+    {
+      fprintf(stderr, "Invalid tree depth or number of labels\n");
+      free_tree(tree);
+      return NULL;
+    }
 
-  // Count probability arrays
-  int n_pr_tables = count_pr_tables(root);
-  tree->n_pr_tables = n_pr_tables;
+  // Allocate tree structure, marking nodes below leaves as unused
+  state.n_nodes = (uint32_t)roundf(powf(2.f, tree->header.depth)) - 1;
+  tree->nodes = (Node*)xcalloc(state.n_nodes, sizeof(Node));
+  for (uint32_t i = 0; i < state.n_nodes; i++)
+    {
+      tree->nodes[i].label_pr_idx = UINT32_MAX;
+    }
 
-  // Allocate tree structure
-  uint32_t n_nodes = (uint32_t)roundf(powf(2.f, tree->header.depth)) - 1;
-  tree->nodes = (Node*)xmalloc(n_nodes * sizeof(Node));
+  state.max_pr_tables = 1024;
   tree->label_pr_tables = (float*)
-    xmalloc(n_pr_tables * tree->header.n_labels * sizeof(float));
+    xmalloc(state.max_pr_tables * tree->header.n_labels * sizeof(float));
 
   // Copy over nodes and probability tables
-  uint32_t table_index = 0;
-  unpack_json_tree(root, tree->nodes, 0, tree->label_pr_tables, &table_index,
-                   tree->header.n_labels);
-
-  // Free data and return tree
-  json_value_free(json_tree_value);
+  JSONNodeState root_state = { &state, 0, { false, false } };
+  reader.pos = state.root;
+  if (!json_read_object(&reader, json_node_member_cb, &root_state))
+    {
+      free_tree(tree);
+      return NULL;
+    }
+  if (tree->nodes[0].label_pr_idx == UINT32_MAX)
+    {
+      if (!root_state.has_children[0] || !root_state.has_children[1])
+        {
+          fprintf(stderr, "Tree root has no children or probabilities\n");
+          free_tree(tree);
+          return NULL;
+        }
+      tree->nodes[0].label_pr_idx = 0;
+    }
 
   return tree;
 }
@@ -0,0 +1,375 @@
+/*
+ * Copyright (C) 2018 Glimp IP Ltd
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+/*
+ * Converts a recording from the original layout (glimpse_recording.json plus
+ * a .bin file per depth or video buffer) to a single indexed file that the
+ * recording device can mmap (see glimpse_rec_pack.h)
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <getopt.h>
+
+#include <vector>
+
+#include "parson.h"
+#include "xalloc.h"
+
+#include "glimpse_log.h"
+#include "glimpse_context.h"
+#include "glimpse_rec_pack.h"
+
+static enum gm_log_level min_log_level = GM_LOG_INFO;
+
+static void
+logger_cb(struct gm_logger *logger,
+          enum gm_log_level level,
+          const char *context,
+          struct gm_backtrace *backtrace,
+          const char *format,
+          va_list ap,
+          void *user_data)
+{
+  if (level < min_log_level)
+    return;
+
+  switch (level)
+    {
+    case GM_LOG_ERROR:
+      fprintf(stderr, "%s: ERROR: ", context);
+      break;
+    case GM_LOG_WARN:
+      fprintf(stderr, "%s: WARN: ", context);
+      break;
+    default:
+      fprintf(stderr, "%s: ", context);
+    }
+
+  vfprintf(stderr, format, ap);
+  fprintf(stderr, "\n");
+}
+
+static void
+logger_abort_cb(struct gm_logger *logger,
+                void *user_data)
+{
+  fprintf(stderr, "ABORT\n");
+  fflush(stderr);
+  abort();
+}
+
+static bool
+read_bin(struct gm_logger *log,
+         const char *recording_dir,
+         JSON_Object *frame,
+         const char *filename_prop,
+         const char *len_prop,
+         std::vector<uint8_t> &buf)
+{
+  buf.clear();
+
+  const char *filename = json_object_get_string(frame, filename_prop);
+  if (!filename)
+    return true;
+
+  char path[1024];
+  snprintf(path, sizeof(path), "%s/%s", recording_dir, filename);
+
+  size_t len = (size_t)json_object_get_number(frame, len_prop);
+  buf.resize(len);
+
+  FILE *fp = fopen(path, "rb");
+  if (!fp)
+    {
+      gm_error(log, "Failed to open %s: %s", path, strerror(errno));
+      return false;
+    }
+
+  bool status = true;
+  if (fread(buf.data(), 1, len, fp) != len)
+    {
+      gm_error(log, "Failed to read %s", path);
+      status = false;
+    }
+
+  fclose(fp);
+
+  return status;
+}
+
+static void
+remove_old_files(struct gm_logger *log,
+                 const char *recording_dir,
+                 JSON_Array *frames,
+                 const char *json_path)
+{
+  static const char *file_props[] = { "depth_file", "video_file" };
+  char path[1024];
+
+  for (int i = 0; i < (int)json_array_get_count(frames); i++)
+    {
+      JSON_Object *frame = json_array_get_object(frames, i);
+
+      for (int j = 0; j < 2; j++)
+        {
+          const char *filename = json_object_get_string(frame, file_props[j]);
+          if (!filename)
+            continue;
+
+          snprintf(path, sizeof(path), "%s/%s", recording_dir, filename);
+          if (remove(path) != 0)
+            gm_warn(log, "Failed to remove %s: %s", path, strerror(errno));
+        }
+    }
+
+  if (remove(json_path) != 0)
+    gm_warn(log, "Failed to remove %s: %s", json_path, strerror(errno));
+}
+
+static void
+print_usage(FILE* stream)
+{
+  fprintf(stream,
+"Usage: pack-recording [OPTIONS] <recording directory>\n"
+"Convert a recording to a single indexed " GM_REC_PACK_NAME " file.\n"
+"\n"
+"  -o, --output=DIR         Directory to write to (default = the recording\n"
+"                           directory)\n"
+"  -r, --remove-old         Remove the original metadata and buffer files\n"
+"                           after a successful conversion\n"
+"  -c, --compress-depth     Delta encode and Snappy compress depth buffers\n"
+"  -v, --verbose            Print all log messages\n"
+"\n"
+"  -h, --help               Display this help\n\n");
+}
+
+int
+main(int argc, char **argv)
+{
+  const char *output_dir = NULL;
+  bool remove_old = false;
+  bool compress_depth = false;
+  int opt;
+
+  /* N.B. The initial '+' means that getopt will stop looking for options
+   * after the first non-option argument...
+   */
+  const char *short_options="+ho:rcv";
+  const struct option long_options[] = {
+      {"help",            no_argument,        0, 'h'},
+      {"output",          required_argument,  0, 'o'},
+      {"remove-old",      no_argument,        0, 'r'},
+      {"compress-depth",  no_argument,        0, 'c'},
+      {"verbose",         no_argument,        0, 'v'},
+      {0, 0, 0, 0}
+  };
+
+  while ((opt = getopt_long(argc, argv, short_options, long_options, NULL))
+         != -1)
+    {
+      switch (opt) {
+          case 'h':
+              print_usage(stdout);
+              return 0;
+          case 'o':
+              output_dir = optarg;
+              break;
+          case 'r':
+              remove_old = true;
+              break;
+          case 'c':
+              compress_depth = true;
+              break;
+          case 'v':
+              min_log_level = GM_LOG_DEBUG;
+              break;
+          default:
+              print_usage(stderr);
+              return 1;
+      }
+  }
+
+  if ((argc - optind) != 1)
+    {
+      print_usage(stderr);
+      return 1;
+    }
+
+  const char *recording_dir = argv[optind];
+  if (!output_dir)
+    output_dir = recording_dir;
+
+  struct gm_logger *log = gm_logger_new(logger_cb, NULL);
+  gm_logger_set_abort_callback(log, logger_abort_cb, NULL);
+
+  char json_path[1024];
+  snprintf(json_path, sizeof(json_path), "%s/glimpse_recording.json",
+           recording_dir);
+  JSON_Value *json = json_parse_file(json_path);
+  if (!json)
+    {
+      fprintf(stderr, "Failed to parse %s\n", json_path);
+      return 1;
+    }
+
+  JSON_Array *frames = json_object_get_array(json_object(json), "frames");
+  int n_frames = json_array_get_count(frames);
+
+  /* Already compressed depth is copied as-is */
+  JSON_Object *meta = json_object(json);
+  enum gm_rec_compression compression = GM_REC_COMPRESSION_NONE;
+  if (!rec_compression_from_name(json_object_get_string(meta,
+                                                        "depth_compression"),
+                                 &compression))
+    {
+      fprintf(stderr, "Unknown depth compression in %s\n", json_path);
+      return 1;
+    }
+  bool recompress = (compress_depth &&
+                     compression == GM_REC_COMPRESSION_NONE);
+  if (recompress)
+    {
+      compression = GM_REC_COMPRESSION_DELTA_SNAPPY;
+      if (!rec_compression_supported(compression))
+        {
+          fprintf(stderr, "Depth compression not supported by this build\n");
+          return 1;
+        }
+    }
+
+  int depth_format = json_object_get_number(meta, "depth_format");
+  int word_size = (depth_format == GM_FORMAT_Z_U16_MM ||
+                   depth_format == GM_FORMAT_Z_F16_M) ? 2 : 4;
+
+  char pack_path[1024];
+  snprintf(pack_path, sizeof(pack_path), "%s/%s",
+           output_dir, GM_REC_PACK_NAME);
+
+  char *err = NULL;
+  struct gm_rec_pack_writer *writer = rec_pack_writer_open(log, pack_path,
+                                                           &err);
+  if (!writer)
+    {
+      fprintf(stderr, "%s\n", err);
+      return 1;
+    }
+
+  std::vector<uint8_t> depth;
+  std::vector<uint8_t> compressed_depth;
+  std::vector<uint8_t> video;
+  bool status = true;
+
+  for (int i = 0; i < n_frames && status; i++)
+    {
+      JSON_Object *frame = json_array_get_object(frames, i);
+
+      if (!read_bin(log, recording_dir, frame, "depth_file", "depth_len",
+                    depth) ||
+          !read_bin(log, recording_dir, frame, "video_file", "video_len",
+                    video))
+        {
+          status = false;
+          break;
+        }
+
+      if (recompress && depth.size())
+        {
+          size_t len = rec_depth_max_compressed_len(compression, depth.size());
+          compressed_depth.resize(len);
+          if (!rec_depth_compress(log, compression, word_size,
+                                  depth.data(), depth.size(),
+                                  compressed_depth.data(), &len, &err))
+            {
+              fprintf(stderr, "%s\n", err);
+              free(err);
+              status = false;
+              break;
+            }
+          compressed_depth.resize(len);
+          depth.swap(compressed_depth);
+        }
+
+      status = rec_pack_writer_add_frame(writer,
+                                         (uint64_t)json_object_get_number(
+                                             frame, "timestamp"),
+                                         (int)json_object_get_number(
+                                             frame, "camera_rotation"),
+                                         depth.size() ? depth.data() : NULL,
+                                         depth.size(),
+                                         video.size() ? video.data() : NULL,
+                                         video.size(),
+                                         &err);
+      if (!status)
+        {
+          fprintf(stderr, "%s\n", err);
+          free(err);
+          err = NULL;
+        }
+    }
+
+  /* The frames are described by the pack's own index */
+  JSON_Value *metadata_json = json_value_deep_copy(json);
+  json_object_remove(json_object(metadata_json), "frames");
+  if (recompress)
+    {
+      json_object_set_string(json_object(metadata_json), "depth_compression",
+                             rec_compression_name(compression));
+    }
+  char *metadata = json_serialize_to_string(metadata_json);
+
+  if (!rec_pack_writer_close(writer, metadata, &err))
+    {
+      fprintf(stderr, "%s\n", err);
+      free(err);
+      status = false;
+    }
+
+  json_free_serialized_string(metadata);
+  json_value_free(metadata_json);
+
+  if (!status)
+    {
+      fprintf(stderr, "Failed to convert %s\n", recording_dir);
+      remove(pack_path);
+      json_value_free(json);
+      gm_logger_destroy(log);
+      return 1;
+    }
+
+  printf("Wrote %d frames to %s\n", n_frames, pack_path);
+
+  if (remove_old)
+    remove_old_files(log, recording_dir, frames, json_path);
+
+  json_value_free(json);
+  gm_logger_destroy(log);
+
+  return 0;
+}
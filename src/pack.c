@@ -60,16 +60,22 @@ get_property(LList *properties, const char *name, char **err)
     return prop;
 }
 
-static void
+/* Returns the new head of the list, in case that was the removed node */
+static LList *
 remove_property(LList *properties, const char *name)
 {
     for (LList *l = properties; l; l = l->next) {
         struct property *prop = (struct property *)l->data;
         if (strcmp(prop->name, name) == 0) {
+            if (l == properties)
+                properties = l->next;
             llist_free(llist_remove(l), NULL, NULL);
             free(prop);
+            break;
         }
     }
+
+    return properties;
 }
 
 static LList *
@@ -77,7 +83,7 @@ _set_i64(LList *properties, const char *name, int64_t val)
 {
     struct int64_property *prop;
 
-    remove_property(properties, name);
+    properties = remove_property(properties, name);
 
     uint32_t byte_len = sizeof(*prop);
     prop = (struct int64_property *)xcalloc(1, byte_len);
@@ -109,7 +115,7 @@ _set_double(LList *properties, const char *name, double val)
 {
     struct double_property *prop;
 
-    remove_property(properties, name);
+    properties = remove_property(properties, name);
 
     uint32_t byte_len = sizeof(*prop);
     prop = (struct double_property *)xcalloc(1, byte_len);
@@ -146,7 +152,7 @@ _set_blob(LList *properties,
 
     assert(strlen(name) < sizeof(prop->name));
 
-    remove_property(properties, name);
+    properties = remove_property(properties, name);
 
     uint32_t byte_len = sizeof(*prop) + len;
     prop = (struct blob_property *)xcalloc(1, byte_len);
@@ -186,7 +192,7 @@ _set_string(LList *properties,
 
     assert(strlen(name) < sizeof(prop->name));
 
-    remove_property(properties, name);
+    properties = remove_property(properties, name);
 
     uint32_t len = strlen(string) + 1;
 
@@ -763,8 +769,11 @@ pack_frame_free(struct pack_frame *frame)
         free(l->data);
     llist_free(frame->properties, NULL, NULL);
 
-    for (int i = 0; i < frame->pack->n_sections; i++)
+    for (int i = 0; i < frame->pack->n_sections; i++) {
         free(frame->sections[i].compressed_data);
+        if (frame->read)
+            free(frame->sections[i].uncompressed_data);
+    }
 
     free(frame->compressed_header);
 
@@ -833,6 +842,7 @@ pack_read_frame(struct pack_file *pack, int n, char **err)
     frame = (struct pack_frame *)xcalloc(1, sizeof(*frame) +
                                          pack->n_sections * sizeof(frame->sections[0]));
     frame->pack = pack;
+    frame->read = true;
 
     if (fread(&compressed_header_size, 4, 1, pack->fp) != 1) {
         xasprintf(err, "Failed to read size of header");
@@ -864,20 +874,20 @@ pack_read_frame(struct pack_file *pack, int n, char **err)
     while ((uint8_t *)prop < (header + header_size)) {
         switch (prop->type) {
         case PROP_INT64:
-            pack_set_i64(pack, prop->name, ((struct int64_property *)prop)->i64_val);
+            pack_frame_set_i64(frame, prop->name, ((struct int64_property *)prop)->i64_val);
             break;
         case PROP_DOUBLE:
-            pack_set_double(pack, prop->name, ((struct double_property *)prop)->double_val);
+            pack_frame_set_double(frame, prop->name, ((struct double_property *)prop)->double_val);
             break;
         case PROP_STRING:
-            pack_set_string(pack, prop->name, (char *)((struct string_property *)prop)->string);
+            pack_frame_set_string(frame, prop->name, (char *)((struct string_property *)prop)->string);
             break;
         case PROP_BLOB:
             {
                 unsigned blob_len =
                     prop->byte_len - offsetof(struct blob_property, blob);
 
-                pack_set_blob(pack, prop->name, ((struct blob_property *)prop)->blob, blob_len);
+                pack_frame_set_blob(frame, prop->name, ((struct blob_property *)prop)->blob, blob_len);
                 break;
             }
         };
@@ -899,6 +909,9 @@ pack_read_frame(struct pack_file *pack, int n, char **err)
         }
     }
 
+    free(compressed_header);
+    free(header);
+
     fseek(pack->fp, pos + frame_len, SEEK_SET);
     pack->frame_cursor = n + 1;
     return frame;
@@ -929,11 +942,16 @@ pack_frame_get_section(struct pack_frame *frame,
         if (strcmp(frame->pack->section_names[i], section) != 0)
             continue;
 
-        if (frame->sections[i].compressed_data) {
+        if (!frame->read) {
             xasprintf(err, "Frame needs to be read via pack_read_frame() first");
             return NULL;
         }
 
+        if (frame->sections[i].uncompressed_data) {
+            *len = frame->sections[i].uncompressed_size;
+            return frame->sections[i].uncompressed_data;
+        }
+
         if (snappy_uncompressed_length((char *)frame->sections[i].compressed_data,
                                        frame->sections[i].compressed_size,
                                        &section_len)
@@ -226,6 +226,9 @@ struct pack_frame {
 
     uint32_t total_length;// set when compressed
 
+    bool read;            // set by pack_read_frame(), sections are then
+                          // decompressed on demand and owned by the frame
+
     uint32_t compressed_header_size;
     uint8_t *compressed_header;
 
@@ -36,11 +36,12 @@
 #include <dirent.h>
 #include <stdint.h>
 #include <libgen.h>
+#include <limits.h>
 #include <getopt.h>
 
-#include "tinyexr.h"
-
-#include "half.hpp"
+#include "image_utils.h"
+#include "batch_convert.h"
+#include "xalloc.h"
 
 #ifdef DEBUG
 #define debug(ARGS...) printf(ARGS)
@@ -48,19 +49,8 @@
 #define debug(ARGS...) do {} while(0)
 #endif
 
-using half_float::half;
-
 static bool write_half_float = false;
 
-static void *
-xmalloc(size_t size)
-{
-    void *ret = malloc(size);
-    if (ret == NULL)
-        exit(1);
-    return ret;
-}
-
 enum image_format {
     IMAGE_FORMAT_X8,
     IMAGE_FORMAT_XFLOAT,
@@ -77,7 +67,6 @@ struct image
     union {
         uint8_t *data_u8;
         float *data_float;
-        half *data_half;
     };
 };
 
@@ -196,53 +185,63 @@ error_mmap:
 }
 
 static bool
-write_exr(const char *filename,
-          struct image *image,
-          enum image_format format)
+convert_file(const char *in_filename, const char *out_filename)
 {
-    EXRHeader header;
-    InitEXRHeader(&header);
-
-    EXRImage exr_image;
-    InitEXRImage(&exr_image);
-
-    exr_image.num_channels = 1;
-    exr_image.width = image->width;
-    exr_image.height = image->height;
-
-    unsigned char *image_ptr = (unsigned char *)image->data_u8;
-    exr_image.images = &image_ptr;
-
-    header.num_channels = 1;
-    EXRChannelInfo channel_info;
-    header.channels = &channel_info;
-    strcpy(channel_info.name, "Y");
-
-    int input_format = (image->format == IMAGE_FORMAT_XFLOAT ?
-                        TINYEXR_PIXELTYPE_FLOAT : TINYEXR_PIXELTYPE_HALF);
-    int final_format = (format == IMAGE_FORMAT_XFLOAT ?
-                        TINYEXR_PIXELTYPE_FLOAT : TINYEXR_PIXELTYPE_HALF);
-    header.pixel_types = &input_format;
-    header.requested_pixel_types = &final_format;
-
-    const char *err = NULL;
-    if (SaveEXRImageToFile(&exr_image, &header, filename, &err) != TINYEXR_SUCCESS) {
-        fprintf(stderr, "Failed to save EXR: %s\n", err);
+    struct stat st;
+    if (stat(in_filename, &st) < 0) {
+        fprintf(stderr, "Failed to stat %s: %m\n", in_filename);
+        return false;
+    }
+
+    /* NB: The decoded image is the same size as the file, give or take
+     * the header
+     */
+    batch_budget_reserve(st.st_size);
+
+    struct image *img = load_pfm(in_filename);
+    if (!img) {
+        batch_budget_release(st.st_size);
         return false;
-    } else
-        return true;
+    }
+
+    IUImageSpec spec = { img->width, img->height, IU_FORMAT_FLOAT };
+    IUReturnCode ret = iu_write_exr_to_file(out_filename, &spec,
+                                            img->data_float,
+                                            write_half_float ?
+                                            IU_FORMAT_HALF : IU_FORMAT_FLOAT);
+    if (ret != SUCCESS) {
+        fprintf(stderr, "Failed to write %s: %s\n", out_filename,
+                iu_code_to_string(ret));
+    }
+
+    xfree(img);
+    batch_budget_release(st.st_size);
+
+    return ret == SUCCESS;
 }
 
 static void
 usage(void)
 {
     printf("Usage pfm-to-exr [options] <in_pfm_file> <out_exr_file>\n"
+           "      pfm-to-exr [options] --batch <in_dir> <out_dir>\n"
            "\n"
            "    --half              Write a half-float channel (otherwise\n"
            "                        writes full-float)\n"
+           "    -b,--batch          Convert all .pfm files under <in_dir> to\n"
+           "                        .exr files with the same relative paths\n"
+           "                        under <out_dir>\n"
+           "    -i,--index=<file>   Only convert the files listed in a\n"
+           "                        training data index (implies --batch)\n"
+           "    -j,--threads=<n>    Number of worker threads (default: number\n"
+           "                        of CPUs)\n"
+           "    -m,--max-memory=<MB>\n"
+           "                        Limit on the memory used by files being\n"
+           "                        converted (default: %zuMB)\n"
            "\n"
            "    -h,--help           Display this help\n\n"
-           "\n");
+           "\n",
+           batch_get_budget() / (1024 * 1024));
     exit(1);
 }
 
@@ -250,16 +249,23 @@ int
 main(int argc, char **argv)
 {
     int opt;
+    bool batch = false;
+    const char *index_filename = NULL;
+    int n_threads = sysconf(_SC_NPROCESSORS_ONLN);
 
 #define HALF_OPT    (CHAR_MAX + 1) // no short opt
 
     /* N.B. The initial '+' means that getopt will stop looking for options
      * after the first non-option argument...
      */
-    const char *short_options="+h";
+    const char *short_options="+hbi:j:m:";
     const struct option long_options[] = {
         {"help",            no_argument,        0, 'h'},
         {"half",            no_argument,        0, HALF_OPT},
+        {"batch",           no_argument,        0, 'b'},
+        {"index",           required_argument,  0, 'i'},
+        {"threads",         required_argument,  0, 'j'},
+        {"max-memory",      required_argument,  0, 'm'},
         {0, 0, 0, 0}
     };
 
@@ -273,17 +279,31 @@ main(int argc, char **argv)
             case HALF_OPT:
                 write_half_float = true;
                 break;
+            case 'b':
+                batch = true;
+                break;
+            case 'i':
+                index_filename = optarg;
+                batch = true;
+                break;
+            case 'j':
+                n_threads = atoi(optarg);
+                break;
+            case 'm':
+                batch_set_budget((size_t)strtoul(optarg, NULL, 10) * 1024 * 1024);
+                break;
         }
     }
 
     if (optind != argc - 2)
         usage();
 
-    struct image *img = load_pfm(argv[optind]);
+    if (!batch)
+        return convert_file(argv[optind], argv[optind + 1]) ? 0 : 1;
+
+    unsigned n_failed = batch_convert(argv[optind], argv[optind + 1],
+                                      index_filename, ".pfm", ".exr",
+                                      n_threads, convert_file);
 
-    if (write_half_float)
-        write_exr(argv[optind + 1], img, IMAGE_FORMAT_XHALF);
-    else
-        write_exr(argv[optind + 1], img, IMAGE_FORMAT_XFLOAT);
-    return 0;
+    return n_failed ? 1 : 0;
 }
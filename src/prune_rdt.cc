@@ -0,0 +1,526 @@
+/*
+ * Copyright (C) 2017 Glimp IP Ltd
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+/* Collapses the subtrees of a trained decision tree that don't
+ * meaningfully change the inferred label distribution, to reduce the size
+ * of the tree and the number of nodes traversed for each pixel.
+ *
+ * Pruning is done bottom-up: a split node whose children are both leaves
+ * is replaced by a single leaf if the children's distributions are close
+ * (by L1 distance or by their KL divergence from the merged distribution)
+ * or if too few training pixels reached it. Sample counts are only known
+ * if training data is given, in which case it's also used to measure the
+ * change in accuracy.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <getopt.h>
+
+#include <algorithm>
+
+#include "half.hpp"
+
+#include "xalloc.h"
+#include "utils.h"
+#include "train_utils.h"
+#include "loader.h"
+#include "infer.h"
+
+using half_float::half;
+
+typedef struct {
+  float    l1_tolerance;  // Collapse splits with children closer than this
+  float    kl_tolerance;  // Collapse splits with less information than this
+  uint32_t min_samples;   // Collapse splits reached by fewer pixels than this
+
+  RDTree*  tree;          // Tree being pruned
+  uint32_t n_nodes;       // Number of nodes in the tree's node array
+  float*   pr_tables;     // Original and merged probability tables
+  uint32_t n_pr_tables;   // Number of tables in pr_tables
+  uint64_t* counts;       // Number of sampled pixels reaching each node
+
+  uint32_t n_images;      // Number of evaluation images
+  int32_t  width;         // Width of evaluation images
+  int32_t  height;        // Height of evaluation images
+  half*    depth_images;  // Depth images (row-major)
+  uint8_t* label_images;  // Label images (row-major)
+} PruneContext;
+
+typedef struct {
+  uint32_t n_nodes;       // Number of reachable nodes
+  uint32_t n_leaves;      // Number of reachable leaf nodes
+  uint8_t  depth;         // Depth of the deepest leaf, plus one
+  float    mean_depth;    // Mean traversal depth
+  float    accuracy;      // Accuracy over foreground pixels
+} TreeStats;
+
+static inline float*
+node_pr_table(PruneContext* ctx, Node* node)
+{
+  return &ctx->pr_tables[(node->label_pr_idx - 1) * ctx->tree->header.n_labels];
+}
+
+/* Runs every foreground pixel of the evaluation images through the tree,
+ * accumulating the pixel accuracy and traversal depth, and optionally the
+ * number of pixels that reach each node.
+ */
+static void
+evaluate_tree(PruneContext* ctx, uint64_t* counts, TreeStats* stats)
+{
+  RDTree* tree = ctx->tree;
+  uint8_t n_labels = tree->header.n_labels;
+  uint32_t n_pixels = ctx->width * ctx->height;
+  uint64_t n_sampled = 0;
+  uint64_t n_correct = 0;
+  uint64_t total_depth = 0;
+
+  for (uint32_t i = 0; i < ctx->n_images; i++)
+    {
+      half* depth_image = &ctx->depth_images[i * n_pixels];
+      uint8_t* label_image = &ctx->label_images[i * n_pixels];
+
+      for (int32_t y = 0; y < ctx->height; y++)
+        {
+          for (int32_t x = 0; x < ctx->width; x++)
+            {
+              float depth_value = depth_image[y * ctx->width + x];
+              if (depth_value >= HUGE_DEPTH)
+                {
+                  continue;
+                }
+
+              Int2D pixel = { x, y };
+              Node* node = tree->nodes;
+              uint32_t id = 0;
+              uint32_t depth = 0;
+              while (node->label_pr_idx == 0)
+                {
+                  if (counts)
+                    {
+                      counts[id]++;
+                    }
+
+                  float value = sample_uv<half>(depth_image,
+                                                ctx->width, ctx->height,
+                                                pixel, depth_value, node->uv);
+                  id = (value < node->t) ? 2 * id + 1 : 2 * id + 2;
+                  node = &tree->nodes[id];
+                  depth++;
+                }
+              if (counts)
+                {
+                  counts[id]++;
+                }
+
+              float* pr_table = node_pr_table(ctx, node);
+              uint8_t best_label = 0;
+              for (uint8_t l = 1; l < n_labels; l++)
+                {
+                  if (pr_table[l] > pr_table[best_label])
+                    {
+                      best_label = l;
+                    }
+                }
+
+              n_sampled++;
+              total_depth += depth;
+              if (best_label == label_image[y * ctx->width + x])
+                {
+                  n_correct++;
+                }
+            }
+        }
+    }
+
+  stats->mean_depth = n_sampled ? total_depth / (double)n_sampled : 0.f;
+  stats->accuracy = n_sampled ? n_correct / (double)n_sampled : 0.f;
+}
+
+/* Counts the reachable nodes and, without evaluation data, estimates the
+ * mean traversal depth by assuming that every split is even.
+ */
+static void
+count_nodes(PruneContext* ctx, uint32_t id, uint8_t depth, TreeStats* stats)
+{
+  Node* node = &ctx->tree->nodes[id];
+
+  stats->n_nodes++;
+  if (node->label_pr_idx != 0)
+    {
+      stats->n_leaves++;
+      stats->depth = std::max(stats->depth, (uint8_t)(depth + 1));
+      stats->mean_depth += depth * powf(0.5f, depth);
+      return;
+    }
+
+  count_nodes(ctx, id * 2 + 1, depth + 1, stats);
+  count_nodes(ctx, id * 2 + 2, depth + 1, stats);
+}
+
+static void
+get_tree_stats(PruneContext* ctx, TreeStats* stats)
+{
+  memset(stats, 0, sizeof(TreeStats));
+  count_nodes(ctx, 0, 0, stats);
+  if (ctx->n_images)
+    {
+      evaluate_tree(ctx, NULL, stats);
+    }
+}
+
+/* Returns true if the node at the given index is a leaf after pruning */
+static bool
+prune_node(PruneContext* ctx, uint32_t id)
+{
+  Node* node = &ctx->tree->nodes[id];
+  if (node->label_pr_idx != 0)
+    {
+      return true;
+    }
+
+  uint32_t left_id = id * 2 + 1;
+  uint32_t right_id = id * 2 + 2;
+  bool left_leaf = prune_node(ctx, left_id);
+  bool right_leaf = prune_node(ctx, right_id);
+  if (!left_leaf || !right_leaf)
+    {
+      return false;
+    }
+
+  uint8_t n_labels = ctx->tree->header.n_labels;
+  float* left_pr = node_pr_table(ctx, &ctx->tree->nodes[left_id]);
+  float* right_pr = node_pr_table(ctx, &ctx->tree->nodes[right_id]);
+
+  /* Without sample counts, assume the split was even */
+  float left_weight = 0.5f;
+  uint64_t n_samples = 0;
+  if (ctx->counts)
+    {
+      n_samples = ctx->counts[id];
+      if (n_samples)
+        {
+          left_weight = ctx->counts[left_id] / (float)n_samples;
+        }
+    }
+  float right_weight = 1.f - left_weight;
+
+  float* merged_pr = &ctx->pr_tables[ctx->n_pr_tables * n_labels];
+  float l1 = 0.f;
+  float kl = 0.f;
+  for (uint8_t l = 0; l < n_labels; l++)
+    {
+      merged_pr[l] = left_weight * left_pr[l] + right_weight * right_pr[l];
+      l1 += fabsf(left_pr[l] - right_pr[l]);
+
+      /* NB: This is the information gain of the split that training
+       * maximised, measured with the leaves' distributions.
+       */
+      if (left_pr[l] > 0.f)
+        {
+          kl += left_weight * left_pr[l] * log2f(left_pr[l] / merged_pr[l]);
+        }
+      if (right_pr[l] > 0.f)
+        {
+          kl += right_weight * right_pr[l] * log2f(right_pr[l] / merged_pr[l]);
+        }
+    }
+
+  if (l1 < ctx->l1_tolerance ||
+      kl < ctx->kl_tolerance ||
+      (ctx->counts && n_samples < ctx->min_samples))
+    {
+      node->label_pr_idx = ++ctx->n_pr_tables;
+      ctx->tree->nodes[left_id].label_pr_idx = UINT32_MAX;
+      ctx->tree->nodes[right_id].label_pr_idx = UINT32_MAX;
+      return true;
+    }
+
+  return false;
+}
+
+/* Marks all nodes that aren't reachable from the root as unused, the same
+ * as train_rdt does for the nodes below its leaves.
+ */
+static void
+mark_reachable(RDTree* tree, uint32_t id, bool* reachable)
+{
+  reachable[id] = true;
+  if (tree->nodes[id].label_pr_idx == 0)
+    {
+      mark_reachable(tree, id * 2 + 1, reachable);
+      mark_reachable(tree, id * 2 + 2, reachable);
+    }
+}
+
+/* Rebuilds the tree's probability tables from the pruned nodes, numbering
+ * the leaves in breadth-first order like train_rdt, and truncates the node
+ * array to the depth of the deepest remaining leaf.
+ */
+static void
+compact_tree(PruneContext* ctx, uint8_t depth)
+{
+  RDTree* tree = ctx->tree;
+  uint8_t n_labels = tree->header.n_labels;
+  bool* reachable = (bool*)xcalloc(ctx->n_nodes, sizeof(bool));
+  mark_reachable(tree, 0, reachable);
+
+  uint32_t n_nodes = (uint32_t)roundf(powf(2.f, depth)) - 1;
+  uint32_t n_leaves = 0;
+  for (uint32_t id = 0; id < n_nodes; id++)
+    {
+      if (tree->nodes[id].label_pr_idx != 0 && reachable[id])
+        {
+          n_leaves++;
+        }
+    }
+
+  float* pr_tables = (float*)xmalloc(n_leaves * n_labels * sizeof(float));
+  uint32_t n_pr_tables = 0;
+  for (uint32_t id = 0; id < n_nodes; id++)
+    {
+      Node* node = &tree->nodes[id];
+      if (!reachable[id])
+        {
+          node->label_pr_idx = UINT32_MAX;
+        }
+      else if (node->label_pr_idx != 0)
+        {
+          memcpy(&pr_tables[n_pr_tables * n_labels], node_pr_table(ctx, node),
+                 n_labels * sizeof(float));
+          node->label_pr_idx = ++n_pr_tables;
+        }
+    }
+
+  xfree(reachable);
+  xfree(tree->label_pr_tables);
+  tree->label_pr_tables = pr_tables;
+  tree->n_pr_tables = n_pr_tables;
+  tree->header.depth = depth;
+
+  ctx->pr_tables = pr_tables;
+  ctx->n_pr_tables = n_pr_tables;
+  ctx->n_nodes = n_nodes;
+}
+
+static void
+print_stats(const char* name, PruneContext* ctx, TreeStats* stats)
+{
+  printf("%-7s %9u nodes, %9u leaves, depth %2u, mean traversal depth %.2f",
+         name, stats->n_nodes, stats->n_leaves, (unsigned)stats->depth,
+         stats->mean_depth);
+  if (ctx->n_images)
+    {
+      printf(", accuracy %.3f%%", stats->accuracy * 100.f);
+    }
+  printf("\n");
+}
+
+static void
+print_usage(FILE* stream)
+{
+  fprintf(stream,
+"Usage: prune_rdt [OPTIONS] <in tree> <out tree>\n"
+"Collapse the subtrees of a decision tree that have little effect on the\n"
+"inferred labels. Trees are read and written as JSON if their filename ends\n"
+"in .json, or as RDT otherwise.\n"
+"\n"
+"  -1, --l1=NUMBER             Collapse splits where the L1 distance between\n"
+"                              the children's distributions is less than this\n"
+"  -k, --kl=NUMBER             Collapse splits where the KL divergence of the\n"
+"                              children from their merged distribution (the\n"
+"                              split's information gain, in bits) is less\n"
+"                              than this\n"
+"  -n, --min-samples=NUMBER    Collapse splits reached by fewer than this many\n"
+"                              pixels of the given data (requires --data)\n"
+"  -d, --data=DIR              Training data directory used to count samples\n"
+"                              and measure accuracy\n"
+"  -i, --index=NAME            Index of the training data (default: train)\n"
+"  -l, --limit=NUMBER[,NUMBER] Limit the data to this many images.\n"
+"                              Optionally, skip the first N images.\n"
+"  -h, --help                  Display this message\n");
+}
+
+int
+main(int argc, char **argv)
+{
+  PruneContext ctx = {};
+  const char* data_dir = NULL;
+  const char* index_name = "train";
+  uint32_t limit = UINT32_MAX;
+  uint32_t skip = 0;
+  int opt;
+
+  const char *short_options="+h1:k:n:d:i:l:";
+  const struct option long_options[] = {
+      {"help",            no_argument,        0, 'h'},
+      {"l1",              required_argument,  0, '1'},
+      {"kl",              required_argument,  0, 'k'},
+      {"min-samples",     required_argument,  0, 'n'},
+      {"data",            required_argument,  0, 'd'},
+      {"index",           required_argument,  0, 'i'},
+      {"limit",           required_argument,  0, 'l'},
+      {0, 0, 0, 0}
+  };
+
+  while ((opt = getopt_long(argc, argv, short_options, long_options, NULL))
+         != -1)
+    {
+      char* end;
+
+      switch (opt) {
+          case 'h':
+              print_usage(stdout);
+              return 0;
+          case '1':
+              ctx.l1_tolerance = strtof(optarg, NULL);
+              break;
+          case 'k':
+              ctx.kl_tolerance = strtof(optarg, NULL);
+              break;
+          case 'n':
+              ctx.min_samples = (uint32_t)strtol(optarg, NULL, 10);
+              break;
+          case 'd':
+              data_dir = optarg;
+              break;
+          case 'i':
+              index_name = optarg;
+              break;
+          case 'l':
+              limit = (uint32_t)strtol(optarg, &end, 10);
+              if (end[0] == ',')
+                {
+                  skip = (uint32_t)strtol(end + 1, NULL, 10);
+                }
+              break;
+         default:
+              print_usage(stderr);
+              return 1;
+      }
+  }
+
+  if ((argc - optind) != 2)
+    {
+      print_usage(stderr);
+      return 1;
+    }
+
+  if (ctx.min_samples && !data_dir)
+    {
+      fprintf(stderr, "--min-samples requires --data to count samples\n");
+      return 1;
+    }
+
+  const char* in_filename = argv[optind];
+  const char* out_filename = argv[optind + 1];
+
+  const char* ext = strrchr(in_filename, '.');
+  RDTree* tree = (ext && strcmp(ext, ".json") == 0) ?
+    read_json_tree(in_filename) : read_tree(in_filename);
+  if (!tree)
+    {
+      fprintf(stderr, "Failed to read tree %s\n", in_filename);
+      return 1;
+    }
+
+  uint8_t n_labels = tree->header.n_labels;
+  ctx.tree = tree;
+  ctx.n_nodes = (uint32_t)roundf(powf(2.f, tree->header.depth)) - 1;
+
+  /* Merging can create at most one table less than the number of leaves,
+   * so allocate space for twice as many tables up front.
+   */
+  ctx.pr_tables = (float*)
+    xmalloc(tree->n_pr_tables * 2 * n_labels * sizeof(float));
+  memcpy(ctx.pr_tables, tree->label_pr_tables,
+         tree->n_pr_tables * n_labels * sizeof(float));
+  ctx.n_pr_tables = tree->n_pr_tables;
+
+  if (data_dir)
+    {
+      uint8_t data_n_labels;
+      gather_train_data(data_dir, index_name, NULL, limit, skip, false,
+                        &ctx.n_images, NULL, &ctx.width, &ctx.height,
+                        &ctx.depth_images, &ctx.label_images, NULL,
+                        &data_n_labels, NULL);
+      if (data_n_labels != n_labels)
+        {
+          fprintf(stderr, "Data has %u labels but the tree has %u\n",
+                  (unsigned)data_n_labels, (unsigned)n_labels);
+          return 1;
+        }
+    }
+
+  TreeStats before;
+  memset(&before, 0, sizeof(TreeStats));
+  count_nodes(&ctx, 0, 0, &before);
+  if (ctx.n_images)
+    {
+      ctx.counts = (uint64_t*)xcalloc(ctx.n_nodes, sizeof(uint64_t));
+      evaluate_tree(&ctx, ctx.counts, &before);
+    }
+
+  prune_node(&ctx, 0);
+
+  TreeStats after;
+  memset(&after, 0, sizeof(TreeStats));
+  count_nodes(&ctx, 0, 0, &after);
+
+  // Keep using the unpruned probability tables until they're compacted
+  float* original_pr_tables = tree->label_pr_tables;
+  tree->label_pr_tables = ctx.pr_tables;
+  compact_tree(&ctx, after.depth);
+  xfree(original_pr_tables);
+
+  get_tree_stats(&ctx, &after);
+
+  print_stats("Before:", &ctx, &before);
+  print_stats("After:", &ctx, &after);
+  if (ctx.n_images)
+    {
+      printf("Accuracy delta: %+.3f%%\n",
+             (after.accuracy - before.accuracy) * 100.f);
+    }
+
+  ext = strrchr(out_filename, '.');
+  bool saved = (ext && strcmp(ext, ".json") == 0) ?
+    save_tree_json(tree, out_filename, false) :
+    save_tree(tree, out_filename);
+  if (!saved)
+    {
+      return 1;
+    }
+
+  xfree(ctx.counts);
+  xfree(ctx.depth_images);
+  xfree(ctx.label_images);
+  free_tree(tree);
+
+  return 0;
+}
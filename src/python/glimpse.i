@@ -5,11 +5,48 @@
 #include "glimpse_python.h"
 %}
 
+%include "stdint.i"
 %include "numpy.i"
 %init %{
 import_array();
 %}
 
+%numpy_typemaps(half_float::half, NPY_HALF, int)
+
+/* Inference doesn't touch any Python state, so let other Python threads
+ * run meanwhile. The input arrays are kept alive by the caller's
+ * references for the duration of the call.
+ */
+%define %release_gil(function)
+%exception function {
+  Py_BEGIN_ALLOW_THREADS
+  $action
+  Py_END_ALLOW_THREADS
+}
+%enddef
+
+%release_gil(Glimpse::DepthImage::asPointCloud)
+%release_gil(Glimpse::Forest::inferLabels)
+%release_gil(Glimpse::Forest::inferLabelsBatch)
+%release_gil(Glimpse::JointMap::inferJoints)
+
+/* DepthImages created from arrays are views, so the proxy keeps a reference
+ * on the array. Arrays that can't be viewed directly (e.g. float64 or
+ * non-contiguous) are first converted to a contiguous float32 copy.
+ */
+%pythonprepend Glimpse::DepthImage::DepthImage %{
+    if len(args) == 1 and not isinstance(args[0], str):
+        import numpy
+        depth = numpy.asarray(args[0])
+        if depth.dtype not in (numpy.float16, numpy.float32, numpy.uint16):
+            depth = depth.astype(numpy.float32)
+        depth = numpy.ascontiguousarray(depth)
+        if not depth.dtype.isnative:
+            depth = depth.astype(depth.dtype.newbyteorder('='))
+        self._depth_array = depth
+        args = (depth,)
+%}
+
 %typemap(in) (char** IN_ARRAY1, int DIM1) {
   /* Check if is a list */
   if (PyList_Check($input))
@@ -43,11 +80,17 @@ import_array();
 }
 
 %apply (char** IN_ARRAY1, int DIM1) {(const char** aFiles, unsigned int aNFiles)};
-%apply (float* IN_ARRAY2, int DIM1, int DIM2) {(float* aDepthImage, int aHeight, int aWidth)};
+%apply (float* INPLACE_ARRAY2, int DIM1, int DIM2) {(float* aDepthImage, int aHeight, int aWidth)};
+%apply (half_float::half* INPLACE_ARRAY2, int DIM1, int DIM2) {(half_float::half* aDepthImage, int aHeight, int aWidth)};
+%apply (unsigned short* INPLACE_ARRAY2, int DIM1, int DIM2) {(uint16_t* aDepthImage, int aHeight, int aWidth)};
+%apply (float* INPLACE_ARRAY3, int DIM1, int DIM2, int DIM3) {(float* aDepthImages, int aNImages, int aHeight, int aWidth)};
+%apply (half_float::half* INPLACE_ARRAY3, int DIM1, int DIM2, int DIM3) {(half_float::half* aDepthImages, int aNImages, int aHeight, int aWidth)};
+%apply (unsigned short* INPLACE_ARRAY3, int DIM1, int DIM2, int DIM3) {(uint16_t* aDepthImages, int aNImages, int aHeight, int aWidth)};
 %apply (float* IN_ARRAY2, int DIM1, int DIM2) {(float* aPointCloud, int aNPoints, int aNDims)};
 %apply (float** ARGOUTVIEWM_ARRAY2, int* DIM1, int* DIM2) {(float** aDepth, int* aOutHeight, int* aOutWidth)};
 %apply (float** ARGOUTVIEWM_ARRAY2, int* DIM1, int* DIM2) {(float** aCloud, int* aOutNPoints, int* aOutNDims)};
 %apply (float** ARGOUTVIEWM_ARRAY2, int* DIM1, int* DIM2) {(float** aJoints, int* aOutNJoints, int* aOutNDims)};
 %apply (float** ARGOUTVIEWM_ARRAY3, int* DIM1, int* DIM2, int* DIM3) {(float** aLabelPr, int* aOutHeight, int* aOutWidth, int* aNLabels)};
+%apply (float** ARGOUTVIEWM_ARRAY4, int* DIM1, int* DIM2, int* DIM3, int* DIM4) {(float** aLabelPr, int* aOutNImages, int* aOutHeight, int* aOutWidth, int* aNLabels)};
 
 %include "glimpse_python.h"
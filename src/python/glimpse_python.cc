@@ -22,6 +22,12 @@
  * SOFTWARE.
  */
 
+#include <pthread.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <atomic>
+
 #include "glimpse_python.h"
 #include "xalloc.h"
 
@@ -29,17 +35,34 @@ namespace Glimpse {
 
 using half_float::half;
 
-DepthImage::DepthImage(half* aDepthImage, uint32_t aWidth, uint32_t aHeight)
+/* Zero millimetres means there was no depth reading, which the inference
+ * code expects to see as background.
+ */
+static void
+u16_mm_to_m(const uint16_t* aDepthMM, float* aDepthM, size_t aNPixels)
+{
+  for (size_t i = 0; i < aNPixels; i++)
+    {
+      aDepthM[i] = aDepthMM[i] ? aDepthMM[i] * 0.001f : HUGE_DEPTH;
+    }
+}
+
+DepthImage::DepthImage(Adopt, half* aDepthImage,
+                       uint32_t aWidth, uint32_t aHeight)
 {
   mDepthImage = aDepthImage;
+  mFormat = DEPTH_HALF;
   mWidth = aWidth;
   mHeight = aHeight;
+  mOwned = true;
   mValid = true;
 }
 
 DepthImage::DepthImage(const char* aFileName)
 {
   mValid = false;
+  mOwned = true;
+  mFormat = DEPTH_HALF;
 
   mDepthImage = NULL;
   IUImageSpec spec = { 0, 0, IU_FORMAT_HALF };
@@ -54,42 +77,110 @@ DepthImage::DepthImage(const char* aFileName)
 DepthImage::DepthImage(float* aDepthImage, int aHeight, int aWidth)
 {
   mValid = true;
+  mOwned = false;
+  mFormat = DEPTH_FLOAT;
   mWidth = aWidth;
   mHeight = aHeight;
-  mDepthImage = (half*)xmalloc(aWidth * aHeight * sizeof(half));
-  for (int i = 0; i < aWidth * aHeight; i++)
-    {
-      mDepthImage[i] = (half)aDepthImage[i];
-    }
+  mDepthImage = aDepthImage;
+}
+
+DepthImage::DepthImage(half* aDepthImage, int aHeight, int aWidth)
+{
+  mValid = true;
+  mOwned = false;
+  mFormat = DEPTH_HALF;
+  mWidth = aWidth;
+  mHeight = aHeight;
+  mDepthImage = aDepthImage;
+}
+
+DepthImage::DepthImage(uint16_t* aDepthImage, int aHeight, int aWidth)
+{
+  mValid = true;
+  mOwned = false;
+  mFormat = DEPTH_U16_MM;
+  mWidth = aWidth;
+  mHeight = aHeight;
+  mDepthImage = aDepthImage;
 }
 
 DepthImage::~DepthImage()
 {
   if (mValid)
     {
-      xfree(mDepthImage);
+      if (mOwned)
+        {
+          xfree(mDepthImage);
+        }
       mValid = false;
     }
 }
 
+/* Returns the depth as half or float data in metres, as accepted by the
+ * infer.h functions. Only u16 images need converting, into *aOutTemp which
+ * the caller should free.
+ */
+void*
+DepthImage::inferrableDepth(bool* aOutIsHalf, float** aOutTemp)
+{
+  *aOutTemp = NULL;
+
+  switch (mFormat)
+    {
+    case DEPTH_HALF:
+      *aOutIsHalf = true;
+      return mDepthImage;
+    case DEPTH_FLOAT:
+      *aOutIsHalf = false;
+      return mDepthImage;
+    case DEPTH_U16_MM:
+      break;
+    }
+
+  *aOutIsHalf = false;
+  *aOutTemp = (float*)xmalloc(mWidth * mHeight * sizeof(float));
+  u16_mm_to_m((uint16_t*)mDepthImage, *aOutTemp, mWidth * mHeight);
+  return *aOutTemp;
+}
+
 void
 DepthImage::writeEXR(const char* aFileName)
 {
-  IUImageSpec spec = { (int)mWidth, (int)mHeight, IU_FORMAT_HALF };
-  if (iu_write_exr_to_file(aFileName, &spec, (void*)mDepthImage,
+  bool is_half;
+  float* temp;
+  void* depth = inferrableDepth(&is_half, &temp);
+
+  IUImageSpec spec = { (int)mWidth, (int)mHeight,
+                       is_half ? IU_FORMAT_HALF : IU_FORMAT_FLOAT };
+  if (iu_write_exr_to_file(aFileName, &spec, depth,
                            IU_FORMAT_HALF) != SUCCESS)
     {
       fprintf(stderr, "Error writing EXR file '%s'\n", aFileName);
     }
+
+  xfree(temp);
 }
 
 void
 DepthImage::asArray(float** aDepth, int* aOutHeight, int* aOutWidth)
 {
-  *aDepth = (float*)xmalloc(mWidth * mHeight * sizeof(float));
-  for (uint32_t i = 0; i < mWidth * mHeight; i++)
+  uint32_t n_pixels = mWidth * mHeight;
+
+  *aDepth = (float*)xmalloc(n_pixels * sizeof(float));
+  switch (mFormat)
     {
-      (*aDepth)[i] = (float)mDepthImage[i];
+    case DEPTH_HALF:
+      for (uint32_t i = 0; i < n_pixels; i++)
+        {
+          (*aDepth)[i] = (float)((half*)mDepthImage)[i];
+        }
+      break;
+    case DEPTH_FLOAT:
+      memcpy(*aDepth, mDepthImage, n_pixels * sizeof(float));
+      break;
+    case DEPTH_U16_MM:
+      u16_mm_to_m((uint16_t*)mDepthImage, *aDepth, n_pixels);
+      break;
     }
   *aOutWidth = mWidth;
   *aOutHeight = mHeight;
@@ -99,12 +190,26 @@ void
 DepthImage::asPointCloud(float aVFOV, float aThreshold, float** aCloud,
                          int* aOutNPoints, int* aOutNDims)
 {
+  bool is_half;
+  float* temp;
+  void* depth = inferrableDepth(&is_half, &temp);
+
   uint32_t n_points = 0;
-  *aCloud = reproject(mDepthImage, mWidth, mHeight, aVFOV,
-                      aThreshold, &n_points);
+  if (is_half)
+    {
+      *aCloud = reproject((half*)depth, mWidth, mHeight, aVFOV,
+                          aThreshold, &n_points);
+    }
+  else
+    {
+      *aCloud = reproject((float*)depth, mWidth, mHeight, aVFOV,
+                          aThreshold, &n_points);
+    }
   *aOutNPoints = (int)n_points;
   *aOutNDims = 3;
 
+  xfree(temp);
+
   if (n_points == 0)
     {
       *aCloud = (float*)xmalloc(sizeof(float));
@@ -121,9 +226,10 @@ DepthImageFromPointCloud(float* aPointCloud, int aNPoints, int aNDims,
       return NULL;
     }
 
-  half* depth_image = project(aPointCloud, aNPoints, aWidth, aHeight, aVFOV,
-                              aBackground);
-  return new DepthImage(depth_image, aWidth, aHeight);
+  half* depth_image = project<half>(aPointCloud, aNPoints, aWidth, aHeight,
+                                    aVFOV, aBackground);
+  return new DepthImage(DepthImage::Adopt(), depth_image,
+                        (uint32_t)aWidth, (uint32_t)aHeight);
 }
 
 Forest::Forest(const char** aFiles, unsigned int aNFiles)
@@ -151,11 +257,186 @@ Forest::inferLabels(DepthImage* aDepthImage, float** aLabelPr,
       return;
     }
 
-  *aLabelPr = infer_labels(mForest, mNTrees, aDepthImage->mDepthImage,
-                           aDepthImage->mWidth, aDepthImage->mHeight);
+  bool is_half;
+  float* temp;
+  void* depth = aDepthImage->inferrableDepth(&is_half, &temp);
+
+  if (is_half)
+    {
+      *aLabelPr = infer_labels(mForest, mNTrees, (half*)depth,
+                               aDepthImage->mWidth, aDepthImage->mHeight);
+    }
+  else
+    {
+      *aLabelPr = infer_labels(mForest, mNTrees, (float*)depth,
+                               aDepthImage->mWidth, aDepthImage->mHeight);
+    }
   *aOutWidth = aDepthImage->mWidth;
   *aOutHeight = aDepthImage->mHeight;
   *aNLabels = mForest[0]->header.n_labels;
+
+  xfree(temp);
+}
+
+struct BatchState {
+  RDTree**          forest;
+  uint8_t           n_trees;
+  uint8_t           n_labels;
+
+  void*             depth_images;
+  DepthFormat       format;
+  int               n_images;
+  uint32_t          width;
+  uint32_t          height;
+
+  float*            label_pr;
+
+  std::atomic<int>  next_image;
+};
+
+static void*
+infer_batch_thread(void* aData)
+{
+  BatchState* state = (BatchState*)aData;
+  size_t n_pixels = (size_t)state->width * state->height;
+
+  float* temp = NULL;
+  if (state->format == DEPTH_U16_MM)
+    {
+      temp = (float*)xmalloc(n_pixels * sizeof(float));
+    }
+
+  int i;
+  while ((i = state->next_image++) < state->n_images)
+    {
+      float* out_pr = state->label_pr + i * n_pixels * state->n_labels;
+
+      switch (state->format)
+        {
+        case DEPTH_HALF:
+          infer_labels(state->forest, state->n_trees,
+                       (half*)state->depth_images + i * n_pixels,
+                       state->width, state->height, out_pr);
+          break;
+        case DEPTH_FLOAT:
+          infer_labels(state->forest, state->n_trees,
+                       (float*)state->depth_images + i * n_pixels,
+                       state->width, state->height, out_pr);
+          break;
+        case DEPTH_U16_MM:
+          u16_mm_to_m((uint16_t*)state->depth_images + i * n_pixels,
+                      temp, n_pixels);
+          infer_labels(state->forest, state->n_trees, temp,
+                       state->width, state->height, out_pr);
+          break;
+        }
+    }
+
+  xfree(temp);
+
+  return NULL;
+}
+
+void
+Forest::inferBatch(void* aDepthImages, DepthFormat aFormat, int aNImages,
+                   int aHeight, int aWidth, float** aLabelPr,
+                   int* aOutNImages, int* aOutHeight, int* aOutWidth,
+                   int* aNLabels, int aNThreads)
+{
+  if (!mForest)
+    {
+      return;
+    }
+
+  uint8_t n_labels = mForest[0]->header.n_labels;
+  size_t n_pixels = (size_t)aWidth * aHeight;
+
+  *aOutNImages = aNImages;
+  *aOutHeight = aHeight;
+  *aOutWidth = aWidth;
+  *aNLabels = n_labels;
+
+  if (aNImages < 1 || n_pixels == 0)
+    {
+      *aLabelPr = (float*)xmalloc(sizeof(float));
+      return;
+    }
+
+  *aLabelPr = (float*)xmalloc(aNImages * n_pixels * n_labels * sizeof(float));
+
+  BatchState state;
+  state.forest = mForest;
+  state.n_trees = mNTrees;
+  state.n_labels = n_labels;
+  state.depth_images = aDepthImages;
+  state.format = aFormat;
+  state.n_images = aNImages;
+  state.width = aWidth;
+  state.height = aHeight;
+  state.label_pr = *aLabelPr;
+  state.next_image = 0;
+
+  int n_threads = aNThreads;
+  if (n_threads < 1)
+    {
+      n_threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    }
+  if (n_threads > aNImages)
+    {
+      n_threads = aNImages;
+    }
+
+  /* The calling thread does its share of the work too */
+  pthread_t* threads = (pthread_t*)xcalloc(n_threads, sizeof(pthread_t));
+  int n_started = 0;
+  for (int i = 1; i < n_threads; i++)
+    {
+      if (pthread_create(&threads[n_started], NULL, infer_batch_thread,
+                         &state) != 0)
+        {
+          fprintf(stderr, "Error creating inference thread\n");
+          break;
+        }
+      n_started++;
+    }
+
+  infer_batch_thread(&state);
+
+  for (int i = 0; i < n_started; i++)
+    {
+      pthread_join(threads[i], NULL);
+    }
+  xfree(threads);
+}
+
+void
+Forest::inferLabelsBatch(float* aDepthImages, int aNImages,
+                         int aHeight, int aWidth, float** aLabelPr,
+                         int* aOutNImages, int* aOutHeight, int* aOutWidth,
+                         int* aNLabels, int aNThreads)
+{
+  inferBatch(aDepthImages, DEPTH_FLOAT, aNImages, aHeight, aWidth, aLabelPr,
+             aOutNImages, aOutHeight, aOutWidth, aNLabels, aNThreads);
+}
+
+void
+Forest::inferLabelsBatch(half* aDepthImages, int aNImages,
+                         int aHeight, int aWidth, float** aLabelPr,
+                         int* aOutNImages, int* aOutHeight, int* aOutWidth,
+                         int* aNLabels, int aNThreads)
+{
+  inferBatch(aDepthImages, DEPTH_HALF, aNImages, aHeight, aWidth, aLabelPr,
+             aOutNImages, aOutHeight, aOutWidth, aNLabels, aNThreads);
+}
+
+void
+Forest::inferLabelsBatch(uint16_t* aDepthImages, int aNImages,
+                         int aHeight, int aWidth, float** aLabelPr,
+                         int* aOutNImages, int* aOutHeight, int* aOutWidth,
+                         int* aNLabels, int aNThreads)
+{
+  inferBatch(aDepthImages, DEPTH_U16_MM, aNImages, aHeight, aWidth, aLabelPr,
+             aOutNImages, aOutHeight, aOutWidth, aNLabels, aNThreads);
 }
 
 JointMap::JointMap(char* aJointMap, char* aJointInferenceParams)
@@ -200,24 +481,42 @@ JointMap::inferJoints(Forest* aForest, DepthImage* aDepthImage,
       return;
     }
 
-  float* pr_table;
-  int width, height, n_labels;
-  aForest->inferLabels(aDepthImage, &pr_table, &width, &height, &n_labels);
+  bool is_half;
+  float* temp;
+  void* depth = aDepthImage->inferrableDepth(&is_half, &temp);
 
-  float* weights = calc_pixel_weights(aDepthImage->mDepthImage,
-                                      pr_table, width, height, n_labels,
-                                      mJointMap);
+  RDTree** forest = aForest->mForest;
+  uint8_t n_labels = forest[0]->header.n_labels;
+  int width = aDepthImage->mWidth;
+  int height = aDepthImage->mHeight;
 
-  InferredJoints* result =
-    infer_joints(aDepthImage->mDepthImage, pr_table, weights,
-                 aDepthImage->mWidth, aDepthImage->mHeight,
-                 aForest->mForest[0]->header.n_labels,
-                 mJointMap,
-                 aForest->mForest[0]->header.fov,
-                 mParams->joint_params);
+  InferredJoints* result;
+  if (is_half)
+    {
+      float* pr_table = infer_labels(forest, aForest->mNTrees, (half*)depth,
+                                     width, height);
+      float* weights = calc_pixel_weights((half*)depth, pr_table,
+                                          width, height, n_labels, mJointMap);
+      result = infer_joints((half*)depth, pr_table, weights, width, height,
+                            n_labels, mJointMap, forest[0]->header.fov,
+                            mParams->joint_params);
+      xfree(weights);
+      xfree(pr_table);
+    }
+  else
+    {
+      float* pr_table = infer_labels(forest, aForest->mNTrees, (float*)depth,
+                                     width, height);
+      float* weights = calc_pixel_weights((float*)depth, pr_table,
+                                          width, height, n_labels, mJointMap);
+      result = infer_joints((float*)depth, pr_table, weights, width, height,
+                            n_labels, mJointMap, forest[0]->header.fov,
+                            mParams->joint_params);
+      xfree(weights);
+      xfree(pr_table);
+    }
 
-  xfree(weights);
-  xfree(pr_table);
+  xfree(temp);
 
   // TODO: Create an object equivalent of InferredJoints for bindings
   *aJoints = (float*)xcalloc(result->n_joints, sizeof(float) * 3);
@@ -26,6 +26,15 @@
 
 namespace Glimpse
 {
+  /* The element type of a DepthImage. Half and float images are in metres,
+   * u16 images are in millimetres with zero meaning no depth.
+   */
+  enum DepthFormat {
+    DEPTH_HALF,
+    DEPTH_FLOAT,
+    DEPTH_U16_MM
+  };
+
   class DepthImage {
     friend class Forest;
     friend class JointMap;
@@ -39,19 +48,40 @@ namespace Glimpse
 
     private:
       bool              mValid;
-      half_float::half* mDepthImage;
+      bool              mOwned;
+      DepthFormat       mFormat;
+      void*             mDepthImage;
       uint32_t          mWidth;
       uint32_t          mHeight;
 
-      DepthImage(half_float::half* aDepthImage,
+      /* Takes ownership of an xmalloc()ed image. The tag keeps this
+       * distinct from the public (non-owning) array constructors, which
+       * take their dimensions in the opposite order.
+       */
+      struct Adopt {};
+      DepthImage(Adopt,
+                 half_float::half* aDepthImage,
                  uint32_t          aWidth,
                  uint32_t          aHeight);
 
+      void* inferrableDepth(bool* aOutIsHalf, float** aOutTemp);
+
     public:
       DepthImage(const char* aFileName);
-      DepthImage(float*      aDepthImage,
-                 int         aHeight,
-                 int         aWidth);
+
+      /* These wrap the given numpy array in place, without copying or
+       * converting it. The Python proxy keeps a reference on the array for
+       * as long as the DepthImage exists.
+       */
+      DepthImage(float*            aDepthImage,
+                 int               aHeight,
+                 int               aWidth);
+      DepthImage(half_float::half* aDepthImage,
+                 int               aHeight,
+                 int               aWidth);
+      DepthImage(uint16_t*         aDepthImage,
+                 int               aHeight,
+                 int               aWidth);
       ~DepthImage();
 
       void writeEXR(const char* aFileName);
@@ -75,6 +105,18 @@ namespace Glimpse
       RDTree**     mForest;
       unsigned int mNTrees;
 
+      void inferBatch(void*       aDepthImages,
+                      DepthFormat aFormat,
+                      int         aNImages,
+                      int         aHeight,
+                      int         aWidth,
+                      float**     aLabelPr,
+                      int*        aOutNImages,
+                      int*        aOutHeight,
+                      int*        aOutWidth,
+                      int*        aNLabels,
+                      int         aNThreads);
+
     public:
       Forest(const char** aFiles,
              unsigned int aNFiles);
@@ -85,6 +127,41 @@ namespace Glimpse
                        int*        aOutHeight,
                        int*        aOutWidth,
                        int*        aNLabels);
+
+      /* Infers labels for a stack of images (of shape [n, height, width])
+       * across aNThreads threads (0 = number of online CPUs), returning
+       * probabilities of shape [n, height, width, n_labels].
+       */
+      void inferLabelsBatch(float*            aDepthImages,
+                            int               aNImages,
+                            int               aHeight,
+                            int               aWidth,
+                            float**           aLabelPr,
+                            int*              aOutNImages,
+                            int*              aOutHeight,
+                            int*              aOutWidth,
+                            int*              aNLabels,
+                            int               aNThreads = 0);
+      void inferLabelsBatch(half_float::half* aDepthImages,
+                            int               aNImages,
+                            int               aHeight,
+                            int               aWidth,
+                            float**           aLabelPr,
+                            int*              aOutNImages,
+                            int*              aOutHeight,
+                            int*              aOutWidth,
+                            int*              aNLabels,
+                            int               aNThreads = 0);
+      void inferLabelsBatch(uint16_t*         aDepthImages,
+                            int               aNImages,
+                            int               aHeight,
+                            int               aWidth,
+                            float**           aLabelPr,
+                            int*              aOutNImages,
+                            int*              aOutHeight,
+                            int*              aOutWidth,
+                            int*              aNLabels,
+                            int               aNThreads = 0);
   };
 
   class JointMap {
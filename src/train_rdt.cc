@@ -70,6 +70,10 @@ typedef struct {
   uint32_t n_pixels;      // Number of pixels to sample
   UVPair*  uvs;           // A list of uv pairs to test
   float*   ts;            // A list of thresholds to test
+
+  float    balance;       // Strength of the bias towards sampling rare labels
+  float*   label_weights; // Relative sampling probability of each label
+  float*   image_weights; // Mean label weight of each image's pixels
 } TrainContext;
 
 typedef struct {
@@ -93,6 +97,108 @@ typedef struct {
   pthread_barrier_t* finished_barrier;   // Barrier to wait on when finished
 } TrainThreadData;
 
+/* Calculates how much more likely pixels of each label should be to be
+ * sampled than with uniform sampling, from the frequency of each label over
+ * all of the training images. With a balance of 1 then each label is sampled
+ * equally often.
+ */
+static void
+calculate_label_weights(TrainContext* ctx)
+{
+  uint64_t counts[ctx->n_labels];
+  uint64_t n_pixels = (uint64_t)ctx->n_images * ctx->width * ctx->height;
+
+  memset(counts, 0, sizeof(counts));
+  for (uint64_t p = 0; p < n_pixels; p++)
+    {
+      uint8_t label = ctx->label_images[p];
+      if (label >= ctx->n_labels)
+        {
+          fprintf(stderr, "Label '%u' is bigger than expected (max %u)\n",
+                  (uint32_t)label, (uint32_t)ctx->n_labels - 1);
+          exit(1);
+        }
+      ++counts[label];
+    }
+
+  ctx->label_weights = (float*)xmalloc(ctx->n_labels * sizeof(float));
+  for (int i = 0; i < ctx->n_labels; i++)
+    {
+      ctx->label_weights[i] = counts[i] ?
+        powf(counts[i] / (float)n_pixels, -ctx->balance) : 0.f;
+
+      if (verbose)
+        {
+          printf("  Label %02d - frequency %f, weight %f\n", i,
+                 counts[i] / (float)n_pixels, ctx->label_weights[i]);
+        }
+    }
+
+  ctx->image_weights = (float*)xmalloc(ctx->n_images * sizeof(float));
+}
+
+/* Samples pixels of each image with a probability proportional to the weight
+ * of their label, by picking a label and then a random pixel with that label.
+ * The mean weight of each image's pixels is recorded so that histograms can
+ * weight samples by the inverse of their relative sampling probability.
+ */
+static void
+sample_balanced_pixels(TrainContext* ctx, Int3D* pixels, std::mt19937& rng)
+{
+  uint32_t n_image_pixels = ctx->width * ctx->height;
+  uint32_t* label_pixels = (uint32_t*)
+    xmalloc(n_image_pixels * sizeof(uint32_t));
+  uint32_t counts[ctx->n_labels];
+  uint32_t offsets[ctx->n_labels];
+  double masses[ctx->n_labels];
+
+  for (uint32_t i = 0, idx = 0; i < ctx->n_images; i++)
+    {
+      uint8_t* label_image = &ctx->label_images[i * n_image_pixels];
+
+      // Group the pixel indices of the image by label
+      memset(counts, 0, sizeof(counts));
+      for (uint32_t p = 0; p < n_image_pixels; p++)
+        {
+          ++counts[label_image[p]];
+        }
+      double total_mass = 0.0;
+      for (int l = 0, offset = 0; l < ctx->n_labels; l++)
+        {
+          offsets[l] = offset;
+          offset += counts[l];
+          masses[l] = counts[l] * (double)ctx->label_weights[l];
+          total_mass += masses[l];
+        }
+      for (uint32_t p = 0; p < n_image_pixels; p++)
+        {
+          label_pixels[offsets[label_image[p]]++] = p;
+        }
+      for (int l = 0; l < ctx->n_labels; l++)
+        {
+          offsets[l] -= counts[l];
+        }
+
+      ctx->image_weights[i] = total_mass / n_image_pixels;
+
+      std::discrete_distribution<int> rand_label(masses,
+                                                 masses + ctx->n_labels);
+      for (uint32_t j = 0; j < ctx->n_pixels; j++, idx++)
+        {
+          int label = rand_label(rng);
+          std::uniform_int_distribution<uint32_t> rand_pixel(0,
+                                                             counts[label] - 1);
+          uint32_t p = label_pixels[offsets[label] + rand_pixel(rng)];
+
+          pixels[idx].xy[0] = p % ctx->width;
+          pixels[idx].xy[1] = p / ctx->width;
+          pixels[idx].i = i;
+        }
+    }
+
+  xfree(label_pixels);
+}
+
 static NodeTrainData*
 create_node_train_data(TrainContext* ctx, uint32_t id, uint32_t depth,
                        uint32_t n_pixels, Int3D* pixels)
@@ -115,6 +221,12 @@ create_node_train_data(TrainContext* ctx, uint32_t id, uint32_t depth,
 
       //std::random_device rd;
       std::mt19937 rng(seed);
+      if (ctx->label_weights)
+        {
+          sample_balanced_pixels(ctx, data->pixels, rng);
+          return data;
+        }
+
       std::uniform_int_distribution<int> rand_x(0, ctx->width - 1);
       std::uniform_int_distribution<int> rand_y(0, ctx->height - 1);
       for (uint32_t i = 0, idx = 0; i < ctx->n_images; i++)
@@ -138,25 +250,30 @@ destroy_node_train_data(NodeTrainData* data)
   xfree(data);
 }
 
-static inline Int2D
-normalize_histogram(uint32_t* histogram, uint8_t n_labels, float* normalized)
+/* NB: Histograms hold the sum of the weights of the pixels of each label,
+ * which are whole pixel counts unless sampling is balanced.
+ */
+static inline double
+normalize_histogram(double* histogram, uint8_t n_labels, float* normalized,
+                    int* n_labels_present)
 {
-  Int2D sums = { 0, 0 };
+  double sum = 0.0;
+  int n_present = 0;
 
   for (int i = 0; i < n_labels; i++)
     {
       if (histogram[i] > 0)
         {
-          sums[0] += histogram[i];
-          ++sums[1];
+          sum += histogram[i];
+          ++n_present;
         }
     }
 
-  if (sums[0] > 0)
+  if (sum > 0)
     {
       for (int i = 0; i < n_labels; i++)
         {
-          normalized[i] = histogram[i] / (float)sums[0];
+          normalized[i] = (float)histogram[i] / (float)sum;
         }
     }
   else
@@ -164,7 +281,12 @@ normalize_histogram(uint32_t* histogram, uint8_t n_labels, float* normalized)
       memset(normalized, 0, n_labels * sizeof(float));
     }
 
-  return sums;
+  if (n_labels_present)
+    {
+      *n_labels_present = n_present;
+    }
+
+  return sum;
 }
 
 static inline float
@@ -183,18 +305,18 @@ calculate_shannon_entropy(float* normalized_histogram, uint8_t n_labels)
 }
 
 static inline float
-calculate_gain(float entropy, uint32_t n_pixels,
-               float l_entropy, uint32_t l_n_pixels,
-               float r_entropy, uint32_t r_n_pixels)
+calculate_gain(float entropy, double n_pixels,
+               float l_entropy, double l_n_pixels,
+               float r_entropy, double r_n_pixels)
 {
-  return entropy - ((l_n_pixels / (float)n_pixels * l_entropy) +
-                    (r_n_pixels / (float)n_pixels * r_entropy));
+  return entropy - (((float)l_n_pixels / (float)n_pixels * l_entropy) +
+                    ((float)r_n_pixels / (float)n_pixels * r_entropy));
 }
 
 static void
 accumulate_histograms(TrainContext* ctx, NodeTrainData* data,
                       uint32_t c_start, uint32_t c_end,
-                      uint32_t* root_histogram, uint32_t* lr_histograms)
+                      double* root_histogram, double* lr_histograms)
 {
   for (uint32_t p = 0; p < data->n_pixels && !interrupted; p++)
     {
@@ -216,8 +338,11 @@ accumulate_histograms(TrainContext* ctx, NodeTrainData* data,
           exit(1);
         }
 
+      float weight = ctx->label_weights ?
+        ctx->image_weights[i] / ctx->label_weights[label] : 1.f;
+
       // Accumulate root histogram
-      ++root_histogram[label];
+      root_histogram[label] += weight;
 
       // Don't waste processing time if this is the last depth
       if (data->depth >= (uint32_t)ctx->max_depth - 1)
@@ -246,9 +371,9 @@ accumulate_histograms(TrainContext* ctx, NodeTrainData* data,
               // Accumulate histogram for this particular uvt combination
               // on both theoretical branches
               float threshold = ctx->ts[t];
-              ++lr_histograms[samples[c] < threshold ?
+              lr_histograms[samples[c] < threshold ?
                 lr_histogram_idx + label :
-                lr_histogram_idx + ctx->n_labels + label];
+                lr_histogram_idx + ctx->n_labels + label] += weight;
             }
         }
     }
@@ -260,13 +385,13 @@ thread_body(void* userdata)
   TrainThreadData* data = (TrainThreadData*)userdata;
 
   // Histogram for the node being processed
-  uint32_t* root_histogram = (uint32_t*)
-    malloc(data->ctx->n_labels * sizeof(uint32_t));
+  double* root_histogram = (double*)
+    malloc(data->ctx->n_labels * sizeof(double));
 
   // Histograms for each uvt combination being tested
-  uint32_t* lr_histograms = (uint32_t*)
+  double* lr_histograms = (double*)
     malloc(data->ctx->n_labels * (data->c_end - data->c_start) *
-           data->ctx->n_t * 2 * sizeof(uint32_t));
+           data->ctx->n_t * 2 * sizeof(double));
 
   float* nhistogram = (float*)xmalloc(data->ctx->n_labels * sizeof(float));
   float* root_nhistogram = data->root_nhistogram ? data->root_nhistogram :
@@ -284,10 +409,10 @@ thread_body(void* userdata)
         }
 
       // Clear histogram accumulators
-      memset(root_histogram, 0, data->ctx->n_labels * sizeof(uint32_t));
+      memset(root_histogram, 0, data->ctx->n_labels * sizeof(double));
       memset(lr_histograms, 0, data->ctx->n_labels *
              (data->c_end - data->c_start) * data->ctx->n_t * 2 *
-             sizeof(uint32_t));
+             sizeof(double));
 
       // Accumulate histograms
       accumulate_histograms(data->ctx, *data->data, data->c_start, data->c_end,
@@ -295,15 +420,17 @@ thread_body(void* userdata)
 
       // Calculate the normalised label histogram and get the number of pixels
       // and the number of labels in the root histogram.
-      Int2D root_n_pixels = normalize_histogram(root_histogram,
-                                                data->ctx->n_labels,
-                                                root_nhistogram);
+      int root_n_labels;
+      double root_n_pixels = normalize_histogram(root_histogram,
+                                                 data->ctx->n_labels,
+                                                 root_nhistogram,
+                                                 &root_n_labels);
 
       // Determine the best u,v,t combination
       *data->best_gain = 0.f;
 
       // If there's only 1 label, skip all this, gain is zero
-      if (root_n_pixels[1] > 1 &&
+      if (root_n_labels > 1 &&
           (*data->data)->depth < (uint32_t)data->ctx->max_depth - 1)
         {
           // Calculate the shannon entropy for the normalised label histogram
@@ -319,34 +446,39 @@ thread_body(void* userdata)
                 {
                   float l_entropy, r_entropy, gain;
 
-                  Int2D l_n_pixels =
+                  double l_n_pixels =
                     normalize_histogram(&lr_histograms[lr_histo_base],
-                                        data->ctx->n_labels, nhistogram);
-                  if (l_n_pixels[0] == 0 || l_n_pixels[0] == root_n_pixels[0])
+                                        data->ctx->n_labels, nhistogram, NULL);
+                  if (l_n_pixels == 0 || l_n_pixels == root_n_pixels)
                     {
                       continue;
                     }
                   l_entropy = calculate_shannon_entropy(nhistogram,
                                                         data->ctx->n_labels);
 
-                  Int2D r_n_pixels =
+                  double r_n_pixels =
                     normalize_histogram(
                       &lr_histograms[lr_histo_base + data->ctx->n_labels],
-                      data->ctx->n_labels, nhistogram);
+                      data->ctx->n_labels, nhistogram, NULL);
                   r_entropy = calculate_shannon_entropy(nhistogram,
                                                         data->ctx->n_labels);
 
-                  gain = calculate_gain(entropy, root_n_pixels[0],
-                                        l_entropy, l_n_pixels[0],
-                                        r_entropy, r_n_pixels[0]);
+                  gain = calculate_gain(entropy, root_n_pixels,
+                                        l_entropy, l_n_pixels,
+                                        r_entropy, r_n_pixels);
 
                   if (gain > *data->best_gain)
                     {
                       *data->best_gain = gain;
                       *data->best_uv = i;
                       *data->best_t = j;
-                      data->n_lr_pixels[0] = l_n_pixels[0];
-                      data->n_lr_pixels[1] = r_n_pixels[0];
+
+                      /* NB: Weighted sums aren't pixel counts, and zero
+                       * leaves collect_pixels() to count the pixels itself
+                       */
+                      bool weighted = data->ctx->label_weights;
+                      data->n_lr_pixels[0] = weighted ? 0 : l_n_pixels;
+                      data->n_lr_pixels[1] = weighted ? 0 : r_n_pixels;
                     }
                 }
             }
@@ -450,6 +582,10 @@ print_usage(FILE* stream)
 "                                  (default: 0)\n"
 "  -n, --seed=NUMBER             Seed to use for RNG.\n"
 "                                  (default: 0)\n"
+"  -w, --balance=NUMBER          Bias pixel sampling towards rare labels, from\n"
+"                                0 (uniform) to 1 (each label equally often).\n"
+"                                Samples are weighted to compensate.\n"
+"                                  (default: 0)\n"
 "  -i, --continue                Continue training from an interrupted run.\n"
 "  -v, --verbose                 Verbose output.\n"
 "  -h, --help                    Display this message.\n");
@@ -567,6 +703,10 @@ main(int argc, char **argv)
             {
               param = 'n';
             }
+          else if (strstr(arg, "balance="))
+            {
+              param = 'w';
+            }
           else if (strcmp(arg, "continue") == 0)
             {
               param = 'i';
@@ -658,6 +798,9 @@ main(int argc, char **argv)
         case 'n':
           seed = (uint32_t)atoi(value);
           break;
+        case 'w':
+          ctx.balance = strtof(value, NULL);
+          break;
 
         default:
           print_usage(stderr);
@@ -675,6 +818,12 @@ main(int argc, char **argv)
                     &ctx.n_labels,
                     &ctx.fov);
 
+  if (ctx.balance > 0.f)
+    {
+      printf("Calculating label weights...\n");
+      calculate_label_weights(&ctx);
+    }
+
   // Work out pixels per meter and adjust uv range accordingly
   float ppm = (ctx.height / 2.f) / tanf(ctx.fov / 2.f);
   ctx.uv_range *= ppm;
@@ -1019,6 +1168,11 @@ main(int argc, char **argv)
   xfree(ctx.ts);
   xfree(ctx.label_images);
   xfree(ctx.depth_images);
+  if (ctx.label_weights)
+    {
+      xfree(ctx.label_weights);
+      xfree(ctx.image_weights);
+    }
   xfree(best_gains);
   xfree(best_uvs);
   xfree(best_ts);